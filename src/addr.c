@@ -54,11 +54,13 @@ unsigned int ipv4_mask(unsigned int masklen) {
   for (i=0; i<bytes; i++) {
     mask[i] = 0xff;
   }
-  tmp = 128;
-  mask[i] = 0;
-  for (j=0; j<bits; j++) {
-    mask[i] |= tmp;
-    tmp >>= 1;
+  if (i < sizeof(m)) {   /* a 32-bit mask has no partial byte */
+    tmp = 128;
+    mask[i] = 0;
+    for (j=0; j<bits; j++) {
+      mask[i] |= tmp;
+      tmp >>= 1;
+    }
   }
 
   return m;
@@ -55,11 +55,16 @@
 #include <netinet/in.h>    /* for struct in_addr */
 #include <sys/socket.h>    /* for inet_aton()    */
 #include <arpa/inet.h>     /* for inet_aton()    */
+#include <stdint.h>        /* for uint32_t       */
+#include <pthread.h>       /* for mutexes        */
+#include <sys/time.h>      /* for gettimeofday() */
 #include <openssl/aes.h>
+#include <openssl/evp.h>   /* for AES-NI         */
 #include "err.h"           /* for error codes    */
 #include "anon.h" 
 #include "addr.h"
 #include "radix_trie.h"
+#include "cpu_isa.h"       /* for time_diff()    */
 
 FILE *anon_info;
 
@@ -67,10 +72,16 @@ FILE *anon_info;
 
 struct anon_aes_128_ipv4_key {
   AES_KEY key;
+  unsigned char bytes[MAX_KEY_SIZE];   /* for EVP */
+  unsigned int generation;             /* incremented by key_init() */
 };
 
 struct anon_aes_128_ipv4_key key;
 
+static void anon_cache_clear();
+
+static enum status anon_pp_init();
+
 #define ANON_KEYFILE "pcap2flow.bin"
 
 unsigned int anonymize = 0;
@@ -131,6 +142,12 @@ enum status key_init() {
     } 
   } 
   AES_set_encrypt_key(buf, 128, &key.key);    
+  memcpy(key.bytes, buf, MAX_KEY_SIZE);
+  key.generation++;
+  anon_cache_clear();
+  if (anon_pp_init() != ok) {
+    return failure;
+  }
   anonymize = 1;
 
   return ok; 
@@ -158,39 +175,132 @@ void print_binary(FILE *f, const void *x, unsigned int bytes) {
 
 
 struct subnet {
+  int family;                 /* AF_INET or AF_INET6 */
   struct in_addr addr;
   struct in_addr mask;
+  struct in6_addr addr6;
+  unsigned int masklen;
 };
 
-#define MAX_ANON_SUBNETS 256
+/*
+ * membership in the anonymization set is tested with a radix trie,
+ * so that the cost of a lookup does not depend on the number of
+ * subnets; the subnets themselves are also kept in a growable array,
+ * in the order in which they were added, for anon_print_subnets()
+ *
+ * The set in use is reached through the pointer anon_set, so that a
+ * new set can be built while the old one is in use, and then swapped
+ * in with a single atomic store (see anon_subnets_swap()).
+ */
+struct anon_subnets {
+  radix_trie_t trie;
+  attr_flags flag;
+  struct subnet *subnet;
+  unsigned int num_subnets;
+  unsigned int size;
+};
 
-struct subnet anon_subnet[MAX_ANON_SUBNETS];
+struct anon_subnets *anon_set = NULL;
 
-unsigned int num_subnets = 0;
+static struct anon_subnets *anon_subnets_alloc() {
+  struct anon_subnets *s = calloc(1, sizeof(struct anon_subnets));
 
-enum status anon_subnet_add(struct in_addr a, unsigned int netmasklen) {
-  if (num_subnets >= MAX_ANON_SUBNETS) {
+  if (s == NULL) {
+    return NULL;
+  }
+  s->trie = radix_trie_alloc();
+  if (s->trie == NULL || radix_trie_init(s->trie) != ok) {
+    free(s);
+    return NULL;
+  }
+  s->flag = radix_trie_add_attr_label(s->trie, "anon");
+  if (s->flag == 0) {
+    anon_subnets_free(s);
+    return NULL;
+  }
+  return s;
+}
+
+void anon_subnets_free(struct anon_subnets *s) {
+  if (s == NULL) {
+    return;
+  }
+  radix_trie_free(s->trie);
+  free(s->subnet);
+  free(s);
+}
+
+static enum status anon_subnets_add(struct anon_subnets *s, struct in_addr a, unsigned int netmasklen) {
+
+  if (s->num_subnets >= s->size) {
+    unsigned int size = s->size ? 2 * s->size : 64;
+    struct subnet *tmp = realloc(s->subnet, size * sizeof(struct subnet));
+
+    if (tmp == NULL) {
+      return failure;
+    }
+    s->subnet = tmp;
+    s->size = size;
+  }
+  if (radix_trie_add_subnet(s->trie, a, netmasklen, s->flag) != ok) {
     return failure;
-  } else {
-    // fprintf(output, "adding subnet %u\n", num_subnets);
-    anon_subnet[num_subnets].addr = a;
-    anon_subnet[num_subnets].mask.s_addr = ipv4_mask(netmasklen);
-    // fprintf(anon_info, "addr: %s\t", inet_ntoa(anon_subnet[num_subnets].addr));
-    // print_binary(anon_info, &anon_subnet[num_subnets].addr, 4);
-    // fprintf(anon_info, "\t");
-    // print_binary(anon_info, &anon_subnet[num_subnets].mask.s_addr, 4);
-    // fprintf(anon_info, "\n");
-    num_subnets++;
   }
+  memset(&s->subnet[s->num_subnets], 0, sizeof(struct subnet));
+  s->subnet[s->num_subnets].family = AF_INET;
+  s->subnet[s->num_subnets].addr = a;
+  s->subnet[s->num_subnets].mask.s_addr = ipv4_mask(netmasklen);
+  s->subnet[s->num_subnets].masklen = netmasklen;
+  s->num_subnets++;
+
   return ok;
 }
 
-enum status anon_subnet_add_from_string(char *addr) {
-  int i, masklen = 0;
+static enum status anon_subnets_add6(struct anon_subnets *s, const struct in6_addr *a, unsigned int netmasklen) {
+
+  if (s->num_subnets >= s->size) {
+    unsigned int size = s->size ? 2 * s->size : 64;
+    struct subnet *tmp = realloc(s->subnet, size * sizeof(struct subnet));
+
+    if (tmp == NULL) {
+      return failure;
+    }
+    s->subnet = tmp;
+    s->size = size;
+  }
+  if (radix_trie_add_subnet6(s->trie, a, netmasklen, s->flag) != ok) {
+    return failure;
+  }
+  memset(&s->subnet[s->num_subnets], 0, sizeof(struct subnet));
+  s->subnet[s->num_subnets].family = AF_INET6;
+  s->subnet[s->num_subnets].addr6 = *a;
+  s->subnet[s->num_subnets].masklen = netmasklen;
+  s->num_subnets++;
+
+  return ok;
+}
+
+enum status anon_subnet_add(struct in_addr a, unsigned int netmasklen) {
+
+  if (anon_set == NULL) {
+    anon_set = anon_subnets_alloc();
+    if (anon_set == NULL) {
+      return failure;
+    }
+  }
+  return anon_subnets_add(anon_set, a, netmasklen);
+}
+
+static enum status anon_subnets_add_from_string(struct anon_subnets *s, char *addr) {
+  int i, masklen = 0, maxlen = 32;
   char *mask = NULL;
   struct in_addr a;
+  struct in6_addr a6;
   extern FILE *anon_info;
 
+  if (strchr(addr, ':')) {
+    maxlen = 128;   /* IPv6 subnet */
+  }
+
   //  fprintf(anon_info, "loading anonymizer subnet %s\n", addr);
   for (i=0; i<80; i++) {
     if (addr[i] == '/') {
@@ -213,33 +323,63 @@ enum status anon_subnet_add_from_string(char *addr) {
       }
     }    
     masklen = atoi(mask);
-    if (masklen < 1 || masklen > 32) {
+    if (masklen < 1 || masklen > maxlen) {
       fprintf(anon_info, "error: cannot parse subnet; netmask is %d bits\n", masklen);
       return failure;
     }
     // fprintf(output, "masklen: %d\n", masklen);
+
+    if (maxlen == 128) {
+      if (inet_pton(AF_INET6, addr, &a6) != 1) {
+	fprintf(anon_info, "error: cannot parse IPv6 address %s\n", addr);
+	return failure;
+      }
+      for (i=masklen; i<128; i++) {
+	a6.s6_addr[i/8] &= ~(0x80 >> (i % 8));
+      }
+      return anon_subnets_add6(s, &a6, masklen);
+    }
     
     inet_aton(addr, &a);
     // print_binary(anon_info, &a, sizeof(a));
     a.s_addr = addr_mask(a.s_addr, masklen);
     
-    return anon_subnet_add(a, masklen);
+    return anon_subnets_add(s, a, masklen);
   }			 
   return failure;
 }
 
+enum status anon_subnet_add_from_string(char *addr) {
+
+  if (anon_set == NULL) {
+    anon_set = anon_subnets_alloc();
+    if (anon_set == NULL) {
+      return failure;
+    }
+  }
+  return anon_subnets_add_from_string(anon_set, addr);
+}
+
 unsigned int addr_is_in_set(const struct in_addr *a) {
-  int i;
+  struct anon_subnets *s = __atomic_load_n(&anon_set, __ATOMIC_ACQUIRE);
 
-  for (i=0; i < num_subnets; i++) {
-    if ((a->s_addr & anon_subnet[i].mask.s_addr) == anon_subnet[i].addr.s_addr) {
-      // printf("address %s -", inet_ntoa(*a)); 
-      // fprintf(output, "found match with %s\n", inet_ntoa(anon_subnet[i].addr));  
-      return 1;
-    } 
+  if (s == NULL) {
+    return 0;
   }
-  //  fprintf(output, "no matches in set\n");
-  return 0;
+  return radix_trie_lookup_addr(s->trie, *a) != 0;
+}
+
+static unsigned int addr6_is_in_set(const struct in6_addr *a) {
+  struct anon_subnets *s = __atomic_load_n(&anon_set, __ATOMIC_ACQUIRE);
+
+  if (s == NULL) {
+    return 0;
+  }
+  return radix_trie_lookup_addr6(s->trie, a) != 0;
+}
+
+struct anon_subnets *anon_subnets_swap(struct anon_subnets *s) {
+  return __atomic_exchange_n(&anon_set, s, __ATOMIC_ACQ_REL);
 }
 
 unsigned int bits_in_mask(void *a, unsigned int bytes) {
@@ -263,124 +403,1003 @@ unsigned int bits_in_mask(void *a, unsigned int bytes) {
 }
 
 int anon_print_subnets(FILE *f) {
-  if (num_subnets > MAX_ANON_SUBNETS) {
-    fprintf(f, "error: %u anonymous subnets configured, but maximum is %u\n", 
-	    num_subnets, MAX_ANON_SUBNETS);
-    return failure;
-  } else {
-    unsigned int i;
+  unsigned int i;
 
-    for (i=0; i<num_subnets; i++) {
-      fprintf(f, "anon subnet %u: %s/%d\n", i, 
-	      inet_ntoa(anon_subnet[i].addr),
-	      bits_in_mask(&anon_subnet[i].mask, 4));
+  if (anon_set == NULL) {
+    return ok;
+  }
+  for (i=0; i<anon_set->num_subnets; i++) {
+    char addr_string[INET6_ADDRSTRLEN];
+
+    if (anon_set->subnet[i].family == AF_INET6) {
+      fprintf(f, "anon subnet %u: %s/%u\n", i, 
+	      inet_ntop(AF_INET6, &anon_set->subnet[i].addr6, addr_string, sizeof(addr_string)),
+	      anon_set->subnet[i].masklen);
+      continue;
     }
+    fprintf(f, "anon subnet %u: %s/%d\n", i, 
+	    inet_ntoa(anon_set->subnet[i].addr),
+	    bits_in_mask(&anon_set->subnet[i].mask, 4));
   }
   return ok;
 }
 
 #include <ctype.h>
 
-enum status anon_init(const char *pathname, FILE *logfile) {
-  enum status s;
+struct anon_subnets *anon_subnets_load(const char *pathname) {
+  struct anon_subnets *s;
   FILE *fp;
   size_t len;
   char *line = NULL;
   extern FILE *anon_info;
 
+  fp = fopen(pathname, "r");
+  if (fp == NULL) {
+    return NULL;
+  }
+  s = anon_subnets_alloc();
+  if (s == NULL) {
+    fclose(fp);
+    return NULL;
+  }
+    
+  while (getline(&line, &len, fp) != -1) {
+    char *addr = line;
+    int i, got_input = 0;
+
+    for (i=0; i<80; i++) {
+      if (line[i] == '#') {
+	break;
+      }
+      if (isblank(line[i])) {
+	if (got_input) {
+	  line[i] = 0; /* null terminate */
+	} else {
+	  addr = line + i + 1;
+	}
+      }
+      if (!isprint(line[i])) {
+	break;
+      }
+      if (isxdigit(line[i])) {
+	got_input = 1;
+      }
+    }
+    if (got_input) {
+      if (anon_subnets_add_from_string(s, addr) != ok) {
+	fprintf(anon_info, "error: could not add subnet %s to anon set\n", addr);
+	anon_subnets_free(s);
+	s = NULL;
+	break;
+      }
+    }
+  }
+  free(line);
+  fclose(fp);
+
+  return s;
+}
+
+enum status anon_init(const char *pathname, FILE *logfile) {
+  struct anon_subnets *set;
+  enum status s;
+  extern FILE *anon_info;
+
   if (logfile != NULL) {
     anon_info = logfile;
   } else {
     anon_info = stderr;
   }
 
-  fp = fopen(pathname, "r");
-  if (fp == NULL) {
+  set = anon_subnets_load(pathname);
+  if (set == NULL) {
     return failure;
+  }
+  anon_subnets_free(anon_subnets_swap(set));
+
+  anon_print_subnets(anon_info);
+  fprintf(anon_info, "configured %d subnets for anonymization\n", set->num_subnets);
+
+  s = key_init();
+
+  return s;
+}
+
+/*
+ * The anonymized form of an address is the hexadecimal encoding of
+ * its AES encryption.  Since a small number of internal addresses
+ * account for most flows, the results are kept in a cache, which is
+ * a direct-mapped hash table indexed by address.  The table is
+ * protected by ANON_CACHE_LOCKS mutexes, each of which covers an
+ * interleaved subset of its entries, so that threads seldom contend.
+ *
+ * Addresses that miss in the cache are encrypted with EVP, which uses
+ * AES-NI where it is available, and which pipelines the encryption
+ * of the blocks passed to it in one call; each thread has its own
+ * EVP context.
+ */
+
+#define ANON_CACHE_BITS   12
+#define ANON_CACHE_SIZE   (1 << ANON_CACHE_BITS)
+#define ANON_CACHE_LOCKS  64
+#define ANON_BATCH_SIZE   64
+
+struct anon_cache_entry {
+  uint32_t addr;
+  unsigned int valid;
+  char hexout[ANON_HEXSTRING_LEN];
+};
+
+static struct anon_cache_entry anon_cache[ANON_CACHE_SIZE];
+
+static struct {
+  pthread_mutex_t mutex;
+  unsigned long int hits;
+  unsigned long int misses;
+} anon_cache_lock[ANON_CACHE_LOCKS];
+
+static pthread_once_t anon_cache_once = PTHREAD_ONCE_INIT;
+
+static void anon_cache_init() {
+  unsigned int i;
+
+  for (i=0; i<ANON_CACHE_LOCKS; i++) {
+    pthread_mutex_init(&anon_cache_lock[i].mutex, NULL);
+  }
+}
+
+static void anon_cache_clear() {
+  unsigned int i;
+
+  pthread_once(&anon_cache_once, anon_cache_init);
+  for (i=0; i<ANON_CACHE_SIZE; i++) {
+    anon_cache[i].valid = 0;
+  }
+}
+
+static inline unsigned int anon_cache_index(uint32_t addr) {
+  return (addr * 0x9e3779b1U) >> (32 - ANON_CACHE_BITS);
+}
+
+static unsigned int anon_cache_lookup(uint32_t addr, char *hexout) {
+  unsigned int i = anon_cache_index(addr);
+  unsigned int l = i % ANON_CACHE_LOCKS;
+  unsigned int hit = 0;
+
+  pthread_mutex_lock(&anon_cache_lock[l].mutex);
+  if (anon_cache[i].valid && anon_cache[i].addr == addr) {
+    memcpy(hexout, anon_cache[i].hexout, ANON_HEXSTRING_LEN);
+    anon_cache_lock[l].hits++;
+    hit = 1;
   } else {
-    
-    while (getline(&line, &len, fp) != -1) {
-      char *addr = line;
-      int i, got_input = 0;
+    anon_cache_lock[l].misses++;
+  }
+  pthread_mutex_unlock(&anon_cache_lock[l].mutex);
+  return hit;
+}
 
-      for (i=0; i<80; i++) {
-	if (line[i] == '#') {
-	  break;
-	}
-	if (isblank(line[i])) {
-	  if (got_input) {
-	    line[i] = 0; /* null terminate */
-	  } else {
-	    addr = line + i + 1;
-	  }
-	}
-	if (!isprint(line[i])) {
-	  break;
+static void anon_cache_insert(uint32_t addr, const char *hexout) {
+  unsigned int i = anon_cache_index(addr);
+  unsigned int l = i % ANON_CACHE_LOCKS;
+
+  pthread_mutex_lock(&anon_cache_lock[l].mutex);
+  anon_cache[i].addr = addr;
+  memcpy(anon_cache[i].hexout, hexout, ANON_HEXSTRING_LEN);
+  anon_cache[i].valid = 1;
+  pthread_mutex_unlock(&anon_cache_lock[l].mutex);
+}
+
+void anon_cache_get_stats(unsigned long int *hits, unsigned long int *misses) {
+  unsigned int l;
+
+  *hits = *misses = 0;
+  for (l=0; l<ANON_CACHE_LOCKS; l++) {
+    pthread_mutex_lock(&anon_cache_lock[l].mutex);
+    *hits += anon_cache_lock[l].hits;
+    *misses += anon_cache_lock[l].misses;
+    pthread_mutex_unlock(&anon_cache_lock[l].mutex);
+  }
+}
+
+static __thread EVP_CIPHER_CTX *anon_ctx = NULL;
+static __thread unsigned int anon_ctx_generation = 0;
+static __thread EVP_CIPHER_CTX *anon_pp_ctx = NULL;
+static __thread unsigned int anon_pp_ctx_generation = 0;
+
+/*
+ * anon_ctx_get(ctx, generation, bytes) returns the thread's EVP
+ * context *ctx, creating it if needed and setting its key to bytes if
+ * the key has changed since generation
+ */
+static EVP_CIPHER_CTX *anon_ctx_get(EVP_CIPHER_CTX **ctx, unsigned int *generation, 
+				    const unsigned char *bytes) {
+  if (*ctx == NULL) {
+    *ctx = EVP_CIPHER_CTX_new();
+    if (*ctx == NULL) {
+      return NULL;
+    }
+  }
+  if (*generation != key.generation) {
+    if (EVP_EncryptInit_ex(*ctx, EVP_aes_128_ecb(), NULL, bytes, NULL) != 1) {
+      return NULL;
+    }
+    EVP_CIPHER_CTX_set_padding(*ctx, 0);
+    *generation = key.generation;
+  }
+  return *ctx;
+}
+
+static EVP_CIPHER_CTX *anon_get_ctx() {
+  return anon_ctx_get(&anon_ctx, &anon_ctx_generation, key.bytes);
+}
+
+static inline void anon_hex(char *hexout, const unsigned char *c) {
+  static const char hex[] = "0123456789abcdef";
+  unsigned int i;
+
+  for (i=0; i<16; i++) {
+    hexout[2*i] = hex[c[i] >> 4];
+    hexout[2*i+1] = hex[c[i] & 0x0f];
+  }
+  hexout[32] = 0;
+}
+
+/*
+ * Prefix-preserving anonymization follows Crypto-PAn (Xu, Fan, Ammar
+ * and Moon, ICNP 2002): bit i of the anonymized address is bit i of
+ * the address XORed with f(i), a pseudorandom bit that depends only
+ * on the first i bits of the address, so two addresses that share a
+ * k-bit prefix are mapped to addresses that share a k-bit prefix.
+ * f(i) is the most significant bit of the AES encryption of a block
+ * holding those i bits, followed by the bits of a secret pad.  The
+ * key and the pad are derived from the anonymization key, so that
+ * the two modes do not share an AES key.
+ *
+ * Computed naively, that is 32 AES operations per address, so the
+ * pseudorandom bits are memoized in a tree with one level per byte
+ * of the address.  Each node holds the bits for the prefixes that
+ * end within its byte (indexed like a heap: prefix p of length j is
+ * at (1 << j) | p), the anonymized values of its byte that have been
+ * seen, and for the first three levels, its children.  The root is
+ * computed when the key is set, after which it is only read; each of
+ * its subtrees is protected by its own mutex.  Once the tree uses
+ * ANON_PP_MAX_MEM bytes, the bits for new prefixes are computed
+ * without being memoized.
+ */
+
+#define ANON_PP_MAX_MEM (64 * 1024 * 1024)
+
+struct anon_pp_node {
+  uint8_t out[256];                /* anonymized byte, for each byte value */
+  uint8_t out_known[32];           /* bitmap: out[b] is valid            */
+  uint8_t f[32];                   /* bitmap: pseudorandom bit of prefix  */
+  uint8_t f_known[32];             /* bitmap: f bit is valid              */
+  struct anon_pp_node *child[];    /* 256 children, above the last level  */
+};
+
+static struct {
+  AES_KEY key;
+  unsigned char bytes[16];         /* for EVP */
+  unsigned char pad[16];
+  uint32_t pad32;                  /* first 32 bits of pad, in host order */
+} anon_pp_key;
+
+static struct anon_pp_node *anon_pp_root = NULL;
+
+static pthread_mutex_t anon_pp_lock[256];
+
+static unsigned long int anon_pp_mem = 0;
+
+static pthread_once_t anon_pp_once = PTHREAD_ONCE_INIT;
+
+enum anon_mode anon_mode = anon_mode_aes;
+
+static inline unsigned int bit_get(const uint8_t *bitmap, unsigned int i) {
+  return (bitmap[i >> 3] >> (i & 7)) & 1;
+}
+
+static inline void bit_set(uint8_t *bitmap, unsigned int i, unsigned int value) {
+  bitmap[i >> 3] |= value << (i & 7);
+}
+
+static struct anon_pp_node *anon_pp_node_alloc(unsigned int level) {
+  size_t size = sizeof(struct anon_pp_node);
+  struct anon_pp_node *node;
+
+  if (level < 3) {
+    size += 256 * sizeof(struct anon_pp_node *);
+  }
+  if (anon_pp_mem + size > ANON_PP_MAX_MEM) {
+    return NULL;
+  }
+  node = calloc(1, size);
+  if (node != NULL) {
+    __sync_fetch_and_add(&anon_pp_mem, size);
+  }
+  return node;
+}
+
+static void anon_pp_node_free(struct anon_pp_node *node, unsigned int level) {
+  unsigned int i;
+
+  if (node == NULL) {
+    return;
+  }
+  if (level < 3) {
+    for (i=0; i<256; i++) {
+      anon_pp_node_free(node->child[i], level + 1);
+    }
+  }
+  free(node);
+}
+
+/*
+ * anon_pp_prf(x, n, f) sets f[k] to the pseudorandom bit of the
+ * prefix whose bits, followed by the bits of the pad, form x[k], for
+ * k = 0..n-1; the blocks are encrypted together
+ */
+#define ANON_PP_MAX_BLOCKS 256
+
+static void anon_pp_prf(const uint32_t *x, unsigned int n, unsigned char *f) {
+  unsigned char pt[ANON_PP_MAX_BLOCKS * 16];
+  unsigned char c[ANON_PP_MAX_BLOCKS * 16];
+  EVP_CIPHER_CTX *ctx = anon_ctx_get(&anon_pp_ctx, &anon_pp_ctx_generation, anon_pp_key.bytes);
+  unsigned int k;
+  int len;
+
+  for (k=0; k<n; k++) {
+    uint32_t tmp = htonl(x[k]);
+
+    memcpy(pt + k*16, anon_pp_key.pad, 16);
+    memcpy(pt + k*16, &tmp, sizeof(uint32_t));
+  }
+  if (ctx && EVP_EncryptUpdate(ctx, c, &len, pt, n * 16) == 1 && len == n * 16) {
+    for (k=0; k<n; k++) {
+      f[k] = c[k*16] >> 7;
+    }
+  } else {
+    for (k=0; k<n; k++) {
+      AES_encrypt(pt + k*16, c, &anon_pp_key.key);
+      f[k] = c[0] >> 7;
+    }
+  }
+}
+
+/*
+ * anon_pp_block(a, i) returns the first 32 bits of the block for the
+ * i-bit prefix of the address a (in host order)
+ */
+static inline uint32_t anon_pp_block(uint32_t a, unsigned int i) {
+  uint32_t mask = i ? 0xffffffff << (32 - i) : 0;
+
+  return (a & mask) | (anon_pp_key.pad32 & ~mask);
+}
+
+static void anon_pp_lock_init() {
+  unsigned int i;
+
+  for (i=0; i<256; i++) {
+    pthread_mutex_init(&anon_pp_lock[i], NULL);
+  }
+}
+
+/*
+ * anon_pp_init() derives the prefix-preserving key and pad from the
+ * anonymization key, discards the tree, and computes its root
+ */
+static enum status anon_pp_init() {
+  static const unsigned char pp_key_seed[16] = "prefix-preserve";
+  static const unsigned char pp_pad_seed[16] = "prefix-pad-bits";
+  uint32_t x[255];
+  unsigned char f[255];
+  unsigned int h, b, j;
+
+  pthread_once(&anon_pp_once, anon_pp_lock_init);
+  AES_encrypt(pp_key_seed, anon_pp_key.bytes, &key.key);
+  AES_set_encrypt_key(anon_pp_key.bytes, 128, &anon_pp_key.key);
+  AES_encrypt(pp_pad_seed, anon_pp_key.pad, &anon_pp_key.key);
+  anon_pp_key.pad32 = ((uint32_t)anon_pp_key.pad[0] << 24) | (anon_pp_key.pad[1] << 16) 
+    | (anon_pp_key.pad[2] << 8) | anon_pp_key.pad[3];
+
+  anon_pp_node_free(anon_pp_root, 0);
+  anon_pp_root = NULL;
+  anon_pp_mem = 0;
+  anon_pp_root = anon_pp_node_alloc(0);
+  if (anon_pp_root == NULL) {
+    return failure;
+  }
+  for (h=1; h<256; h++) {
+    for (j=7; (h >> j) == 0; j--)
+      ;
+    x[h-1] = anon_pp_block(j ? (h ^ (1 << j)) << (32 - j) : 0, j);
+  }
+  anon_pp_prf(x, 255, f);
+  for (h=1; h<256; h++) {
+    bit_set(anon_pp_root->f, h, f[h-1]);
+    bit_set(anon_pp_root->f_known, h, 1);
+  }
+  for (b=0; b<256; b++) {
+    unsigned int o = b;
+
+    for (j=0; j<8; j++) {
+      o ^= bit_get(anon_pp_root->f, (1 << j) | (b >> (8 - j))) << (7 - j);
+    }
+    anon_pp_root->out[b] = o;
+    bit_set(anon_pp_root->out_known, b, 1);
+  }
+  return ok;
+}
+
+/*
+ * anon_pp(a) returns the prefix-preserving anonymization of the
+ * address a (in host order)
+ */
+static uint32_t anon_pp(uint32_t a) {
+  struct anon_pp_node *node[4];
+  uint32_t x[32];
+  unsigned char f[32], miss[32];
+  unsigned int level, j, n = 0, num_misses;
+  uint32_t out = 0;
+  pthread_mutex_t *lock = &anon_pp_lock[a >> 24];
+
+  pthread_mutex_lock(lock);
+
+  /* find or create the nodes, and the prefixes whose bits are unknown */
+  node[0] = anon_pp_root;
+  for (level=0; level<4; level++) {
+    unsigned int b = (a >> (24 - 8*level)) & 0xff;
+
+    if (node[level] && bit_get(node[level]->out_known, b)) {
+      ;
+    } else {
+      for (j=0; j<8; j++) {
+	unsigned int h = (1 << j) | (b >> (8 - j));
+
+	if (node[level] && bit_get(node[level]->f_known, h)) {
+	  continue;
 	}
-	if (isxdigit(line[i])) {
-	  got_input = 1;
+	miss[n] = 8*level + j;
+	x[n++] = anon_pp_block(a, 8*level + j);
+      }
+    }
+    if (level < 3) {
+      node[level+1] = NULL;
+      if (node[level]) {
+	if (node[level]->child[b] == NULL) {
+	  node[level]->child[b] = anon_pp_node_alloc(level + 1);
 	}
+	node[level+1] = node[level]->child[b];
       }
-      if (got_input) {
-	if (anon_subnet_add_from_string(addr) != ok) {
-	  fprintf(anon_info, "error: could not add subnet %s to anon set\n", addr);
-	  return failure;
+    }
+  }
+  num_misses = n;
+  if (num_misses) {
+    anon_pp_prf(x, num_misses, f);
+  }
+
+  /* compute each byte, memoizing its bits where there is a node */
+  n = 0;
+  for (level=0; level<4; level++) {
+    unsigned int b = (a >> (24 - 8*level)) & 0xff;
+    unsigned int o = b;
+
+    if (node[level] && bit_get(node[level]->out_known, b)) {
+      o = node[level]->out[b];
+    } else {
+      for (j=0; j<8; j++) {
+	unsigned int h = (1 << j) | (b >> (8 - j));
+	unsigned int bit;
+
+	if (n < num_misses && miss[n] == 8*level + j) {
+	  bit = f[n++];
+	  if (node[level]) {
+	    bit_set(node[level]->f, h, bit);
+	    bit_set(node[level]->f_known, h, 1);
+	  }
+	} else {
+	  bit = bit_get(node[level]->f, h);
 	}
+	o ^= bit << (7 - j);
+      }
+      if (node[level]) {
+	node[level]->out[b] = o;
+	bit_set(node[level]->out_known, b, 1);
       }
     }
+    out = (out << 8) | o;
+  }
 
-    anon_print_subnets(anon_info);
-    fprintf(anon_info, "configured %d subnets for anonymization\n", num_subnets);
-      
-    free(line);
-    
-    fclose(fp);
-  } 
+  pthread_mutex_unlock(lock);
 
-  s = key_init();
+  return out;
+}
 
-  return s;
+/*
+ * anon_dotted_quad(s, a) writes the address a (in host order) into s
+ * in dotted quad notation
+ */
+static void anon_dotted_quad(char *s, uint32_t a) {
+  int i;
+
+  for (i=24; i>=0; i-=8) {
+    unsigned int b = (a >> i) & 0xff;
+
+    if (b >= 100) {
+      *s++ = '0' + b / 100;
+    }
+    if (b >= 10) {
+      *s++ = '0' + (b / 10) % 10;
+    }
+    *s++ = '0' + b % 10;
+    *s++ = '.';
+  }
+  s[-1] = 0;
+}
+
+void anon_set_mode(enum anon_mode mode) {
+  anon_mode = mode;
+  anon_cache_clear();
+}
+
+/*
+ * anon_encrypt(a, hexout, n) writes the anonymized forms of the n
+ * addresses a[0..n-1] into hexout, with n at most ANON_BATCH_SIZE
+ */
+static void anon_encrypt(const uint32_t *a, char (*hexout)[ANON_HEXSTRING_LEN], unsigned int n) {
+  unsigned char pt[ANON_BATCH_SIZE * 16];
+  unsigned char c[ANON_BATCH_SIZE * 16];
+  EVP_CIPHER_CTX *ctx = anon_get_ctx();
+  unsigned int i;
+  int len;
+
+  if (anon_mode == anon_mode_prefix_preserving) {
+    for (i=0; i<n; i++) {
+      anon_dotted_quad(hexout[i], anon_pp(ntohl(a[i])));
+    }
+    return;
+  }
+
+  memset(pt, 0, n * 16);
+  for (i=0; i<n; i++) {
+    memcpy(pt + i*16, &a[i], sizeof(uint32_t));
+  }
+  if (ctx && EVP_EncryptUpdate(ctx, c, &len, pt, n * 16) == 1 && len == n * 16) {
+    for (i=0; i<n; i++) {
+      anon_hex(hexout[i], c + i*16);
+    }
+  } else {
+    for (i=0; i<n; i++) {
+      AES_encrypt(pt + i*16, c, &key.key);
+      anon_hex(hexout[i], c);
+    }
+  }
+}
+
+void addr_get_anon_hexstring_batch(const struct in_addr *a, char (*hexout)[ANON_HEXSTRING_LEN], unsigned int n) {
+  uint32_t miss_addr[ANON_BATCH_SIZE];
+  unsigned int miss_index[ANON_BATCH_SIZE];
+  char miss_hexout[ANON_BATCH_SIZE][ANON_HEXSTRING_LEN];
+  unsigned int i, j, num_misses;
+
+  while (n > 0) {
+    unsigned int batch = n < ANON_BATCH_SIZE ? n : ANON_BATCH_SIZE;
+
+    num_misses = 0;
+    for (i=0; i<batch; i++) {
+      if (!anon_cache_lookup(a[i].s_addr, hexout[i])) {
+	miss_addr[num_misses] = a[i].s_addr;
+	miss_index[num_misses++] = i;
+      }
+    }
+    if (num_misses) {
+      anon_encrypt(miss_addr, miss_hexout, num_misses);
+      for (j=0; j<num_misses; j++) {
+	memcpy(hexout[miss_index[j]], miss_hexout[j], ANON_HEXSTRING_LEN);
+	anon_cache_insert(miss_addr[j], miss_hexout[j]);
+      }
+    }
+    a += batch;
+    hexout += batch;
+    n -= batch;
+  }
+}
+
+char *addr_get_anon_hexstring(const struct in_addr *a, char *hexout) {
+  addr_get_anon_hexstring_batch(a, (char (*)[ANON_HEXSTRING_LEN])hexout, 1);
+  return hexout;
+}
+
+
+unsigned int ipv4_addr_needs_anonymization(const struct in_addr *a) {
+  if (anonymize) {
+    return addr_is_in_set(a);
+  }
+  return 0;
+}
+
+unsigned int ipv6_addr_needs_anonymization(const struct in6_addr *a) {
+  if (anonymize) {
+    return addr6_is_in_set(a);
+  }
+  return 0;
+}
+
+/*
+ * anon_pp6(a, out) writes the prefix-preserving anonymization of the
+ * IPv6 address a into out.  The pseudorandom bit for prefix i is
+ * computed as for IPv4, with the block holding the first i bits of
+ * the address followed by the bits of the pad; the 128 blocks are
+ * encrypted in one call.  IPv6 addresses are not memoized in the
+ * prefix tree, whose levels are sized for IPv4.
+ */
+static void anon_pp6(const struct in6_addr *a, struct in6_addr *out) {
+  unsigned char pt[128 * 16];
+  unsigned char c[128 * 16];
+  EVP_CIPHER_CTX *ctx = anon_ctx_get(&anon_pp_ctx, &anon_pp_ctx_generation, anon_pp_key.bytes);
+  unsigned int i, j;
+  int len;
+
+  for (i=0; i<128; i++) {
+    unsigned char *x = pt + i*16;
+
+    for (j=0; j<16; j++) {
+      unsigned int bits = i > 8*j ? i - 8*j : 0;   /* bits of a in byte j */
+      unsigned char mask = bits >= 8 ? 0xff : (0xff00 >> bits) & 0xff;
+
+      x[j] = (a->s6_addr[j] & mask) | (anon_pp_key.pad[j] & ~mask);
+    }
+  }
+  if (!ctx || EVP_EncryptUpdate(ctx, c, &len, pt, sizeof(pt)) != 1 || len != sizeof(pt)) {
+    for (i=0; i<128; i++) {
+      AES_encrypt(pt + i*16, c + i*16, &anon_pp_key.key);
+    }
+  }
+  *out = *a;
+  for (i=0; i<128; i++) {
+    out->s6_addr[i/8] ^= (c[i*16] >> 7) << (7 - i%8);
+  }
 }
 
-char hexout[33];
+/*
+ * IPv6 addresses are anonymized without the cache, since they are
+ * rarer, and each is encrypted as a whole block (or, in
+ * prefix-preserving mode, mapped to another IPv6 address)
+ */
+char *addr_get_anon_string6(const struct in6_addr *a, char *out) {
+  EVP_CIPHER_CTX *ctx;
+  struct in6_addr tmp;
+  unsigned char c[16];
+  int len;
+
+  if (anon_mode == anon_mode_prefix_preserving) {
+    anon_pp6(a, &tmp);
+    inet_ntop(AF_INET6, &tmp, out, ANON_STRING6_LEN);
+    return out;
+  }
+  ctx = anon_get_ctx();
+  if (!ctx || EVP_EncryptUpdate(ctx, c, &len, a->s6_addr, 16) != 1 || len != 16) {
+    AES_encrypt(a->s6_addr, c, &key.key);
+  }
+  anon_hex(out, c);
+  return out;
+}
 
-char *addr_get_anon_hexstring(const struct in_addr *a) {
+/*
+ * anon_hexstring_ref(a, hexout) is the uncached implementation that
+ * the cache and batch encryption replace
+ */
+static void anon_hexstring_ref(const struct in_addr *a, char *hexout) {
   unsigned char pt[16] = { 0, };
   unsigned char c[16];
 
   memcpy(pt, a, sizeof(struct in_addr));
   AES_encrypt(pt, c, &key.key);
-  snprintf(hexout, 33, "%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x", 
+  snprintf(hexout, ANON_HEXSTRING_LEN, "%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x", 
 	   c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7], 
 	   c[8], c[9], c[10], c[11], c[12], c[13], c[14], c[15]);
- 
-  return hexout;
 }
 
+/*
+ * anon_pp_ref(a) is the naive prefix-preserving anonymization of the
+ * address a (in host order), with one AES operation per bit
+ */
+static uint32_t anon_pp_ref(uint32_t a) {
+  unsigned char pt[16], c[16];
+  uint32_t out = 0;
+  unsigned int i;
 
-unsigned int ipv4_addr_needs_anonymization(const struct in_addr *a) {
-  if (anonymize) {
-    return addr_is_in_set(a);
+  for (i=0; i<32; i++) {
+    uint32_t x = htonl(anon_pp_block(a, i));
+
+    memcpy(pt, anon_pp_key.pad, 16);
+    memcpy(pt, &x, sizeof(uint32_t));
+    AES_encrypt(pt, c, &anon_pp_key.key);
+    out = (out << 1) | (((a >> (31 - i)) & 1) ^ (c[0] >> 7));
   }
-  return 0;
+  return out;
+}
+
+/*
+ * anon_pp6_ref(a, out) is the naive prefix-preserving anonymization
+ * of the IPv6 address a, with one AES operation per bit
+ */
+static void anon_pp6_ref(const struct in6_addr *a, struct in6_addr *out) {
+  unsigned char pt[16], c[16];
+  unsigned int i, j;
+
+  *out = *a;
+  for (i=0; i<128; i++) {
+    memcpy(pt, anon_pp_key.pad, 16);
+    for (j=0; j<i; j++) {
+      pt[j/8] = (pt[j/8] & ~(0x80 >> (j%8))) | (a->s6_addr[j/8] & (0x80 >> (j%8)));
+    }
+    AES_encrypt(pt, c, &anon_pp_key.key);
+    out->s6_addr[i/8] ^= (c[0] >> 7) << (7 - i%8);
+  }
+}
+
+static unsigned int common_prefix_len6(const struct in6_addr *x, const struct in6_addr *y) {
+  unsigned int n = 0;
+
+  while (n < 128 && ((x->s6_addr[n/8] ^ y->s6_addr[n/8]) & (0x80 >> (n%8))) == 0) {
+    n++;
+  }
+  return n;
 }
 
+static unsigned int common_prefix_len(uint32_t x, uint32_t y) {
+  unsigned int n = 0;
+
+  while (n < 32 && ((x ^ y) & (0x80000000 >> n)) == 0) {
+    n++;
+  }
+  return n;
+}
+
+#define ANON_TEST_SUBNETS 1000
+
+#define ANON_TEST_ADDRS 1000
+
 int anon_unit_test() {
-  struct in_addr inp;
+  struct in_addr inp, a[ANON_TEST_ADDRS];
+  char ref[ANON_HEXSTRING_LEN], out[ANON_HEXSTRING_LEN];
+  static char batch_out[ANON_TEST_ADDRS][ANON_HEXSTRING_LEN];
+  unsigned int i, trial, iters = 1000000;
+  unsigned long int hits, misses;
+  struct timeval start;
+  int num_fails = 0;
   extern FILE *anon_info;
 
-  anon_init("internal.net", stderr);
+  if (anon_init("internal.net", stderr) != ok) {
+    fprintf(anon_info, "error: could not initialize anonymization\n");
+    return failure;
+  }
 
-  if (inet_aton("64.104.192.129", &inp) == 0) {
+  if (inet_aton("10.1.2.3", &inp) == 0) {
     fprintf(anon_info, "error: could not convert address\n");
+    return failure;
   }  
   if (ipv4_addr_needs_anonymization(&inp) != 1) {
-    fprintf(anon_info, "error in anon_unit_test\n");
-  } else {
-    fprintf(anon_info, "passed\n");
+    fprintf(anon_info, "error: 10.1.2.3 does not need anonymization\n");
+    num_fails++;
   }
 
-  return ok;
+  /* cached, uncached, and batched results agree */
+  srand(0xa11e);
+  for (i=0; i<ANON_TEST_ADDRS; i++) {
+    a[i].s_addr = (i % 4) ? (uint32_t)rand() : a[i/4].s_addr;
+  }
+  for (trial=0; trial<2; trial++) {
+    for (i=0; i<ANON_TEST_ADDRS; i++) {
+      anon_hexstring_ref(&a[i], ref);
+      if (strcmp(addr_get_anon_hexstring(&a[i], out), ref) != 0) {
+	fprintf(anon_info, "error: anonymized address mismatch\n");
+	num_fails++;
+	break;
+      }
+    }
+    anon_cache_clear();
+    addr_get_anon_hexstring_batch(a, batch_out, ANON_TEST_ADDRS);
+    for (i=0; i<ANON_TEST_ADDRS; i++) {
+      anon_hexstring_ref(&a[i], ref);
+      if (strcmp(batch_out[i], ref) != 0) {
+	fprintf(anon_info, "error: batch anonymized address mismatch\n");
+	num_fails++;
+	break;
+      }
+    }
+  }
+  if (num_fails) {
+    return failure;
+  }
+
+  /* subnet membership agrees with a linear scan, past the old limit of 256 */
+  for (i=0; i<ANON_TEST_SUBNETS; i++) {
+    struct in_addr s;
+    unsigned int len = 12 + rand() % 21;
+
+    s.s_addr = addr_mask((uint32_t)rand(), len);
+    if (anon_subnet_add(s, len) != ok) {
+      fprintf(anon_info, "error: could not add subnet %u\n", i);
+      return failure;
+    }
+  }
+  for (i=0; i<iters / 10; i++) {
+    unsigned int j, in_set = 0;
+
+    inp.s_addr = (i & 1) ? (uint32_t)rand() : (anon_set->subnet[rand() % anon_set->num_subnets].addr.s_addr ^ htonl(rand() & 0xff));
+    for (j=0; j<anon_set->num_subnets; j++) {
+      if ((inp.s_addr & anon_set->subnet[j].mask.s_addr) == anon_set->subnet[j].addr.s_addr) {
+	in_set = 1;
+	break;
+      }
+    }
+    if (addr_is_in_set(&inp) != in_set) {
+      fprintf(anon_info, "error: subnet membership mismatch for %s\n", inet_ntoa(inp));
+      return failure;
+    }
+  }
+  trial = 0;
+  gettimeofday(&start, NULL);
+  for (i=0; i<iters; i++) {
+    trial += addr_is_in_set(&a[i % ANON_TEST_ADDRS]);
+  }
+  printf("subnet membership, %u subnets:            %8.1f ns/addr (%u in set)\n", 
+	 anon_set->num_subnets, time_diff(&start) * 1e9 / iters, trial);
+
+  /* a set loaded in the background replaces the one in use */
+  {
+    struct anon_subnets *set = anon_subnets_load("internal.net");
+
+    if (set == NULL) {
+      fprintf(anon_info, "error: could not reload anonymization subnets\n");
+      return failure;
+    }
+    inp.s_addr = anon_set->subnet[anon_set->num_subnets - 1].addr.s_addr;
+    anon_subnets_free(anon_subnets_swap(set));
+    if (anon_set->num_subnets != 3 || addr_is_in_set(&inp) != ((ntohl(inp.s_addr) >> 24) == 10)) {
+      fprintf(anon_info, "error: reloaded anonymization subnets do not match\n");
+      return failure;
+    }
+  }
+
+  /* throughput, with a few addresses that are seen often */
+  gettimeofday(&start, NULL);
+  for (i=0; i<iters; i++) {
+    anon_hexstring_ref(&a[i % 16], out);
+  }
+  printf("address anonymization, AES_encrypt + snprintf: %8.1f ns/addr\n", 
+	 time_diff(&start) * 1e9 / iters);
+  gettimeofday(&start, NULL);
+  for (i=0; i<iters; i++) {
+    addr_get_anon_hexstring(&a[i % 16], out);
+  }
+  printf("address anonymization, cache hit:              %8.1f ns/addr\n", 
+	 time_diff(&start) * 1e9 / iters);
+  gettimeofday(&start, NULL);
+  for (i=0; i<iters / ANON_TEST_ADDRS; i++) {
+    anon_cache_clear();
+    addr_get_anon_hexstring_batch(a, batch_out, ANON_TEST_ADDRS);
+  }
+  printf("address anonymization, batch of misses:        %8.1f ns/addr\n", 
+	 time_diff(&start) * 1e9 / iters);
+  anon_cache_get_stats(&hits, &misses);
+  printf("address anonymization cache: %lu hits, %lu misses\n", hits, misses);
+
+  /* prefix-preserving mode agrees with the naive version, and preserves prefixes */
+  anon_set_mode(anon_mode_prefix_preserving);
+  for (trial=0; trial<2; trial++) {
+    for (i=0; i<ANON_TEST_ADDRS; i++) {
+      uint32_t x = ntohl(a[i].s_addr), y = x ^ (0x80000000 >> (rand() % 32));
+      struct in_addr tmp;
+
+      tmp.s_addr = htonl(anon_pp_ref(x));
+      strcpy(ref, inet_ntoa(tmp));
+      if (strcmp(addr_get_anon_hexstring(&a[i], out), ref) != 0) {
+	fprintf(anon_info, "error: prefix-preserving address mismatch (%s, %s)\n", out, ref);
+	num_fails++;
+	break;
+      }
+      if (common_prefix_len(anon_pp(x), anon_pp(y)) != common_prefix_len(x, y)) {
+	fprintf(anon_info, "error: prefix not preserved\n");
+	num_fails++;
+	break;
+      }
+    }
+    anon_pp_init();
+  }
+  if (num_fails) {
+    anon_set_mode(anon_mode_aes);
+    return failure;
+  }
+
+  /* throughput, against the opaque mode above */
+  gettimeofday(&start, NULL);
+  for (i=0; i<iters / 32; i++) {
+    anon_pp_ref(ntohl(a[i % ANON_TEST_ADDRS].s_addr));
+  }
+  printf("prefix-preserving anonymization, naive:        %8.1f ns/addr\n", 
+	 time_diff(&start) * 1e9 / (iters / 32));
+  gettimeofday(&start, NULL);
+  for (i=0; i<iters / 32; i++) {
+    if (i % ANON_TEST_ADDRS == 0) {
+      anon_pp_init();
+    }
+    anon_pp(ntohl(a[i % ANON_TEST_ADDRS].s_addr) + i / ANON_TEST_ADDRS);
+  }
+  printf("prefix-preserving anonymization, new prefixes: %8.1f ns/addr\n", 
+	 time_diff(&start) * 1e9 / (iters / 32));
+  gettimeofday(&start, NULL);
+  for (i=0; i<iters; i++) {
+    anon_pp(ntohl(a[i % ANON_TEST_ADDRS].s_addr) ^ (i & 0xff));
+  }
+  printf("prefix-preserving anonymization, tree hit:     %8.1f ns/addr\n", 
+	 time_diff(&start) * 1e9 / iters);
+  gettimeofday(&start, NULL);
+  for (i=0; i<iters; i++) {
+    addr_get_anon_hexstring(&a[i % 16], out);
+  }
+  printf("prefix-preserving anonymization, cache hit:    %8.1f ns/addr\n", 
+	 time_diff(&start) * 1e9 / iters);
+  printf("prefix-preserving anonymization tree: %lu bytes\n", anon_pp_mem);
+
+  /* IPv6 subnets and addresses */
+  {
+    char subnet6[] = "2001:db8:1::/48";
+    char out6[ANON_STRING6_LEN];
+    unsigned char c[16];
+    struct in6_addr x, y, ax, ay;
+
+    if (anon_subnet_add_from_string(subnet6) != ok) {
+      fprintf(anon_info, "error: could not add IPv6 subnet\n");
+      return failure;
+    }
+    inet_pton(AF_INET6, "2001:db8:1:ff::1", &x);
+    inet_pton(AF_INET6, "2001:db8:2::1", &y);
+    if (ipv6_addr_needs_anonymization(&x) != 1 || ipv6_addr_needs_anonymization(&y) != 0) {
+      fprintf(anon_info, "error: IPv6 subnet membership mismatch\n");
+      num_fails++;
+    }
+    for (i=0; i<ANON_TEST_ADDRS / 10 && !num_fails; i++) {
+      unsigned int j, k = rand() % 128;
+
+      for (j=0; j<16; j++) {
+	x.s6_addr[j] = rand();
+      }
+      y = x;
+      y.s6_addr[k/8] ^= 0x80 >> (k%8);
+      anon_pp6_ref(&x, &ax);
+      if (inet_pton(AF_INET6, addr_get_anon_string6(&x, out6), &ay) != 1 || memcmp(&ax, &ay, 16) != 0) {
+	fprintf(anon_info, "error: prefix-preserving IPv6 address mismatch (%s)\n", out6);
+	num_fails++;
+      }
+      anon_pp6(&y, &ay);
+      if (common_prefix_len6(&ax, &ay) != k) {
+	fprintf(anon_info, "error: IPv6 prefix not preserved\n");
+	num_fails++;
+      }
+    }
+    gettimeofday(&start, NULL);
+    for (i=0; i<iters / 32; i++) {
+      x.s6_addr[15] = i;
+      addr_get_anon_string6(&x, out6);
+    }
+    printf("prefix-preserving anonymization, IPv6:         %8.1f ns/addr\n", 
+	   time_diff(&start) * 1e9 / (iters / 32));
+
+    anon_set_mode(anon_mode_aes);
+    AES_encrypt(x.s6_addr, c, &key.key);
+    for (i=0; i<16; i++) {
+      sprintf(ref + 2*i, "%02x", c[i]);
+    }
+    if (strcmp(addr_get_anon_string6(&x, out6), ref) != 0) {
+      fprintf(anon_info, "error: anonymized IPv6 address mismatch\n");
+      num_fails++;
+    }
+  }
+  anon_set_mode(anon_mode_aes);
+
+  return num_fails ? failure : ok;
 }
 
 /* END address anonymization  */
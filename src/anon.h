@@ -65,8 +65,6 @@
 //  struct in_addr mask;
 //};
 
-#define MAX_ANON_SUBNETS 256
-
 /*
  * anon_init(subnetfile, logfile) initializes anonymization using the
  * subnets in the file subnetfile and sets the secondary output to
@@ -76,12 +74,81 @@ enum status anon_init(const char *pathname, FILE *logfile);
 
 enum status anon_subnet_add_from_string(char *addr);
 
+/*
+ * anon_subnets_load(pathname) reads the subnets in the file pathname
+ * into a new anonymization set, without changing the set in use, so
+ * that it can be called from a background thread; it returns NULL on
+ * failure.  anon_subnets_swap(set) atomically makes set the one in
+ * use, and returns the previous set, which the caller frees with
+ * anon_subnets_free() once no thread can still be looking up an
+ * address in it.
+ */
+struct anon_subnets;
+
+struct anon_subnets *anon_subnets_load(const char *pathname);
+
+struct anon_subnets *anon_subnets_swap(struct anon_subnets *set);
+
+void anon_subnets_free(struct anon_subnets *set);
+
 int anon_print_subnets(FILE *f);
 
-char *addr_get_anon_hexstring(const struct in_addr *a);
+/*
+ * addr_get_anon_hexstring(a, hexout) writes the anonymized form of
+ * the address a into hexout, which must have room for
+ * ANON_HEXSTRING_LEN characters, and returns hexout.  Results are
+ * cached, and it can be called from several threads at once, since
+ * the anonymization key and subnets are not changed after
+ * anon_init().
+ */
+#define ANON_HEXSTRING_LEN 33
+
+char *addr_get_anon_hexstring(const struct in_addr *a, char *hexout);
+
+/*
+ * addr_get_anon_hexstring_batch(a, hexout, n) writes the anonymized
+ * forms of the n addresses a[0..n-1] into hexout[0..n-1]; the
+ * addresses that are not in the cache are encrypted together, which
+ * is faster than encrypting them one at a time
+ */
+void addr_get_anon_hexstring_batch(const struct in_addr *a, char (*hexout)[ANON_HEXSTRING_LEN], unsigned int n);
+
+void anon_cache_get_stats(unsigned long int *hits, unsigned long int *misses);
+
+/*
+ * anon_set_mode(mode) selects the form of anonymized addresses: with
+ * anon_mode_aes (the default), an address is replaced by the
+ * hexadecimal encoding of its AES encryption; with
+ * anon_mode_prefix_preserving, it is replaced by another address, in
+ * dotted quad notation, such that addresses that share a prefix are
+ * replaced by addresses that share a prefix of the same length.  It
+ * must be called before addresses are anonymized.
+ */
+enum anon_mode {
+  anon_mode_aes = 0,
+  anon_mode_prefix_preserving = 1
+};
+
+void anon_set_mode(enum anon_mode mode);
 
 unsigned int ipv4_addr_needs_anonymization(const struct in_addr *a);
 
+/*
+ * A subnet file can hold IPv6 subnets as well as IPv4 ones.
+ * addr_get_anon_string6(a, out) writes the anonymized form of the
+ * IPv6 address a into out, which must have room for ANON_STRING6_LEN
+ * characters: with anon_mode_aes, it is the hexadecimal encoding of
+ * the AES encryption of the address, and with
+ * anon_mode_prefix_preserving, it is another IPv6 address.
+ */
+#define ANON_STRING6_LEN 46     /* INET6_ADDRSTRLEN */
+
+unsigned int ipv6_addr_needs_anonymization(const struct in6_addr *a);
+
+char *addr_get_anon_string6(const struct in6_addr *a, char *out);
+
+
+int anon_unit_test();
 
 /* END address anonymization  */
 
@@ -0,0 +1,425 @@
+/*
+ *	
+ * Copyright (c) 2016 Cisco Systems, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * byte_dist.c
+ *
+ * byte distribution of flow payloads
+ */
+
+#include <stdint.h>     /* for uint64_t      */
+#include <stdio.h>      /* for printf()      */
+#include <stdlib.h>     /* for rand()        */
+#include <string.h>     /* for memcpy()      */
+#include <sys/time.h>   /* for gettimeofday  */
+#include <math.h>       /* for sqrt()        */
+#include "byte_dist.h"
+#include "cpu_isa.h"    /* for time_diff()   */
+#include "err.h"
+
+/* a word whose bytes are all equal to its lowest byte */
+#define word_is_uniform(w) ((w) == ((w) & 0xff) * 0x0101010101010101ULL)
+
+void byte_count_update(unsigned int count[256], const void *data, unsigned int len) {
+  const unsigned char *d = data;
+  uint64_t w;
+
+  while (len >= sizeof(w)) {
+    memcpy(&w, d, sizeof(w));
+    if (word_is_uniform(w)) {
+      count[d[0]] += sizeof(w);
+    } else {
+      count[d[0]]++;
+      count[d[1]]++;
+      count[d[2]]++;
+      count[d[3]]++;
+      count[d[4]]++;
+      count[d[5]]++;
+      count[d[6]]++;
+      count[d[7]]++;
+    }
+    d += sizeof(w);
+    len -= sizeof(w);
+  }
+  while (len-- > 0) {
+    count[*d++]++;
+  }
+}
+
+void byte_count_mean_std_dev(const unsigned int count[256], double *mean, double *std_dev) {
+  uint64_t n = 0, sum = 0;
+  double m, delta, sum_sq = 0.0;
+  unsigned int i;
+
+  for (i=0; i<256; i++) {
+    n += count[i];
+    sum += (uint64_t)count[i] * i;
+  }
+  if (n == 0) {
+    *mean = *std_dev = 0.0;
+    return;
+  }
+  m = (double)sum / (double)n;
+
+  /* a second pass, rather than sum of squares less squared sum, to avoid cancellation */
+  for (i=0; i<256; i++) {
+    delta = (double)i - m;
+    sum_sq += count[i] * delta * delta;
+  }
+  *mean = m;
+  *std_dev = n > 1 ? sqrt(sum_sq / (double)(n - 1)) : 0.0;
+}
+
+#define BYTE_DIST_NLOGN_TABLE_LEN 4096
+
+static double byte_dist_nlogn[BYTE_DIST_NLOGN_TABLE_LEN];   /* n * log2(n) */
+
+static unsigned int byte_dist_nlogn_initialized = 0;
+
+static void byte_dist_nlogn_init() {
+  unsigned int n;
+
+  byte_dist_nlogn[0] = 0.0;
+  for (n=1; n<BYTE_DIST_NLOGN_TABLE_LEN; n++) {
+    byte_dist_nlogn[n] = n * log2(n);
+  }
+  byte_dist_nlogn_initialized = 1;
+}
+
+/*
+ * byte_dist_log2(x) approximates log2(x), for x >= 1: with x = m * 2^e
+ * and m in [sqrt(1/2), sqrt(2)), log2(m) is the series 2/ln(2) * (t +
+ * t^3/3 + ... + t^9/9), with t = (m - 1)/(m + 1); since |t| < 0.172,
+ * the first omitted term, and the error, is below 1.1e-9
+ */
+static inline double byte_dist_log2(double x) {
+  union {
+    double d;
+    uint64_t u;
+  } v;
+  double t, t2;
+  int e;
+
+  v.d = x;
+  e = (int)(v.u >> 52) - 1023;
+  v.u = (v.u & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;   /* m in [1, 2) */
+  if (v.d > 1.4142135623730951) {
+    v.d *= 0.5;
+    e++;
+  }
+  t = (v.d - 1.0) / (v.d + 1.0);
+  t2 = t * t;
+  return e + t * (2.8853900817779268 + t2 * (0.9617966939259756 + t2 * (0.5770780163555854 
+	     + t2 * (0.4121985831111324 + t2 * 0.3205988979753252))));
+}
+
+double byte_count_entropy(const unsigned int count[256], unsigned int num_bytes, float dist[256]) {
+  double sum = 0.0;
+  unsigned int i, n;
+
+  if (!byte_dist_nlogn_initialized) {
+    byte_dist_nlogn_init();
+  }
+  for (i=0; i<256; i++) {
+    n = count[i];
+    if (n < BYTE_DIST_NLOGN_TABLE_LEN) {
+      sum += byte_dist_nlogn[n];
+    } else {
+      sum += n * byte_dist_log2(n);
+    }
+    dist[i] = (float) n / (float) num_bytes;
+  }
+  return log2(num_bytes) - sum / num_bytes;
+}
+
+static void byte_count_update_ref(unsigned int count[256], const void *data, unsigned int len) {
+  const unsigned char *d = data;
+  unsigned int i;
+
+  for (i=0; i<len; i++) {
+    count[d[i]]++;
+  }
+}
+
+#define BYTE_DIST_TEST_BUF_LEN 65536
+#define BYTE_DIST_TEST_BYTES   (1 << 25)
+
+enum byte_dist_test_payload {
+  payload_random = 0,     /* encrypted or compressed  */
+  payload_text   = 1,     /* HTTP headers             */
+  payload_zeros  = 2,     /* padding                  */
+  payload_mixed  = 3      /* text and runs of padding */
+};
+
+static void byte_dist_test_fill(unsigned char *buf, unsigned int len, enum byte_dist_test_payload type) {
+  const char *text = "GET /index.html HTTP/1.1\r\nHost: www.example.com\r\nAccept: */*\r\n\r\n";
+  unsigned int i, text_len = strlen(text);
+
+  for (i=0; i<len; i++) {
+    switch (type) {
+    case payload_random:
+      buf[i] = rand();
+      break;
+    case payload_text:
+      buf[i] = text[i % text_len];
+      break;
+    case payload_zeros:
+      buf[i] = 0;
+      break;
+    case payload_mixed:
+      buf[i] = (i & 0x100) ? 0 : text[i % text_len];
+      break;
+    }
+  }
+}
+
+/*
+ * byte_mean_std_dev_ref() computes the mean and standard deviation
+ * of len bytes one byte at a time, with Welford's method
+ */
+static void byte_mean_std_dev_ref(const unsigned char *d, unsigned int len, double *mean, double *std_dev) {
+  double delta, m = 0.0, m2 = 0.0;
+  unsigned int i;
+
+  for (i=0; i<len; i++) {
+    delta = (double)d[i] - m;
+    m += delta / (double)(i + 1);
+    m2 += delta * ((double)d[i] - m);
+  }
+  *mean = m;
+  *std_dev = len > 1 ? sqrt(m2 / (len - 1)) : 0.0;
+}
+
+/*
+ * byte_count_entropy_ref() computes the entropy of a byte
+ * distribution with a call to log2() for each count
+ */
+static double byte_count_entropy_ref(const unsigned int count[256], unsigned int num_bytes) {
+  double p, sum = 0.0;
+  unsigned int i;
+
+  for (i=0; i<256; i++) {
+    if (count[i] != 0) {
+      p = (double) count[i] / (double) num_bytes;
+      sum -= p * log2(p);
+    }
+  }
+  return sum;
+}
+
+#define BYTE_DIST_ENTROPY_MAX_ERROR 1e-8
+
+/*
+ * byte_count_entropy_test() checks byte_dist_log2() against log2()
+ * over the range of counts for which it is used, and
+ * byte_count_entropy() against byte_count_entropy_ref() for
+ * distributions of small and large counts, and times both
+ */
+static int byte_count_entropy_test() {
+  unsigned int count[256];
+  float dist[256];
+  double x, err, max_err = 0.0, t, t_ref, sum = 0.0;
+  unsigned int i, j, num_bytes, iterations = 100000;
+  struct timeval start;
+  int test_failed = 0;
+
+  for (x = BYTE_DIST_NLOGN_TABLE_LEN; x < 4294967296.0; x *= 1.0001) {
+    err = fabs(byte_dist_log2(floor(x)) - log2(floor(x)));
+    if (err > max_err) {
+      max_err = err;
+    }
+  }
+  if (max_err > BYTE_DIST_ENTROPY_MAX_ERROR) {
+    printf("error: log2 approximation error %g exceeds %g\n", max_err, BYTE_DIST_ENTROPY_MAX_ERROR);
+    test_failed = 1;
+  }
+  printf("log2 approximation: largest error %.3g\n", max_err);
+
+  for (j=0; j<64; j++) {
+    num_bytes = 0;
+    for (i=0; i<256; i++) {
+      switch (j % 4) {
+      case 0:
+	count[i] = rand() % 16;                            /* short flows      */
+	break;
+      case 1:
+	count[i] = (i < 16) ? rand() % 100000 : 0;         /* text             */
+	break;
+      case 2:
+	count[i] = 3000 + rand() % 3000;                   /* around the table */
+	break;
+      default:
+	count[i] = (i == 0) ? 10000000 : rand() % 65536;   /* padding          */
+	break;
+      }
+      num_bytes += count[i];
+    }
+    if (num_bytes == 0) {
+      continue;
+    }
+    err = fabs(byte_count_entropy(count, num_bytes, dist) - byte_count_entropy_ref(count, num_bytes));
+    if (err > BYTE_DIST_ENTROPY_MAX_ERROR) {
+      printf("error: entropy differs from reference by %g\n", err);
+      test_failed = 1;
+    }
+    for (i=0; i<256; i++) {
+      if (dist[i] != (float) count[i] / (float) num_bytes) {
+	printf("error: byte distribution is not normalized\n");
+	test_failed = 1;
+	break;
+      }
+    }
+  }
+
+  for (i=0; i<256; i++) {
+    count[i] = rand() % 8192;
+  }
+  gettimeofday(&start, NULL);
+  for (j=0; j<iterations; j++) {
+    count[j & 0xff]++;
+    sum += byte_count_entropy_ref(count, 1 << 20);
+  }
+  t_ref = time_diff(&start);
+  gettimeofday(&start, NULL);
+  for (j=0; j<iterations; j++) {
+    count[j & 0xff]++;
+    sum -= byte_count_entropy(count, 1 << 20, dist);
+  }
+  t = time_diff(&start);
+  printf("byte entropy: %5.1f ns/flow (log per count: %5.1f ns/flow)\n", 
+	 t * 1e9 / iterations, t_ref * 1e9 / iterations);
+
+  return test_failed;
+}
+
+/*
+ * byte_dist_unit_test() checks byte_count_update() against a byte by
+ * byte count, for payloads of every length up to 64 at every
+ * alignment, and times both over typical payloads and packet sizes;
+ * it checks byte_count_mean_std_dev() against a byte by byte
+ * computation, and times the latter
+ */
+int byte_dist_unit_test() {
+  const char *payload_name[] = { "random", "text", "zeros", "mixed" };
+  unsigned int sizes[] = { 64, 512, 1460 };
+  unsigned int count[256], count_ref[256];
+  unsigned char *buf;
+  unsigned int i, j, len, type, iterations;
+  struct timeval start;
+  double t, t_ref, mean, std_dev, mean_ref, std_dev_ref;
+  int test_failed = 0;
+
+  buf = malloc(BYTE_DIST_TEST_BUF_LEN);
+  if (buf == NULL) {
+    return failure;
+  }
+
+  for (type = payload_random; type <= payload_mixed; type++) {
+    byte_dist_test_fill(buf, BYTE_DIST_TEST_BUF_LEN, type);
+    for (len=0; len<=64; len++) {
+      for (j=0; j<8; j++) {
+	memset(count, 0, sizeof(count));
+	memset(count_ref, 0, sizeof(count_ref));
+	byte_count_update(count, buf + 250 + j, len);
+	byte_count_update_ref(count_ref, buf + 250 + j, len);
+	if (memcmp(count, count_ref, sizeof(count)) != 0) {
+	  printf("error: byte count of %u %s bytes is wrong\n", len, payload_name[type]);
+	  test_failed = 1;
+	}
+      }
+    }
+
+    for (len=0; len<=BYTE_DIST_TEST_BUF_LEN; len = len ? len * 4 : 1) {
+      memset(count, 0, sizeof(count));
+      byte_count_update(count, buf, len);
+      byte_count_mean_std_dev(count, &mean, &std_dev);
+      byte_mean_std_dev_ref(buf, len, &mean_ref, &std_dev_ref);
+      if (fabs(mean - mean_ref) > 1e-9 * (1.0 + mean_ref) || fabs(std_dev - std_dev_ref) > 1e-9 * (1.0 + std_dev_ref)) {
+	printf("error: mean and std dev of %u %s bytes: %f, %f (byte by byte: %f, %f)\n",
+	       len, payload_name[type], mean, std_dev, mean_ref, std_dev_ref);
+	test_failed = 1;
+      }
+    }
+
+    for (i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++) {
+      len = sizes[i];
+      iterations = BYTE_DIST_TEST_BYTES / len;
+      memset(count, 0, sizeof(count));
+      memset(count_ref, 0, sizeof(count_ref));
+      gettimeofday(&start, NULL);
+      for (j=0; j<iterations; j++) {
+	byte_count_update_ref(count_ref, buf + (j * len) % (BYTE_DIST_TEST_BUF_LEN - len), len);
+      }
+      t_ref = time_diff(&start);
+      gettimeofday(&start, NULL);
+      for (j=0; j<iterations; j++) {
+	byte_count_update(count, buf + (j * len) % (BYTE_DIST_TEST_BUF_LEN - len), len);
+      }
+      t = time_diff(&start);
+      if (memcmp(count, count_ref, sizeof(count)) != 0) {
+	printf("error: byte count of %s payloads is wrong\n", payload_name[type]);
+	test_failed = 1;
+      }
+      printf("byte count: %-6s %4u bytes: %5.3f ns/byte (byte by byte: %5.3f ns/byte)\n",
+	     payload_name[type], len, t * 1e9 / (iterations * len), t_ref * 1e9 / (iterations * len));
+    }
+  }
+
+  /* per-byte cost of the byte by byte computation that the histogram replaces */
+  len = 1460;
+  iterations = BYTE_DIST_TEST_BYTES / len;
+  gettimeofday(&start, NULL);
+  for (j=0; j<iterations; j++) {
+    byte_mean_std_dev_ref(buf + (j * len) % (BYTE_DIST_TEST_BUF_LEN - len), len, &mean_ref, &std_dev_ref);
+    std_dev += mean_ref;
+  }
+  t_ref = time_diff(&start);
+  gettimeofday(&start, NULL);
+  for (j=0; j<iterations; j++) {
+    byte_count_mean_std_dev(count, &mean, &std_dev);
+    count[j & 0xff]++;
+  }
+  t = time_diff(&start);
+  printf("byte mean and std dev: %5.3f ns/byte byte by byte, %5.1f ns/flow from counts\n",
+	 t_ref * 1e9 / (iterations * len), t * 1e9 / iterations);
+  free(buf);
+
+  if (byte_count_entropy_test() != 0) {
+    test_failed = 1;
+  }
+
+  return test_failed ? failure : ok;
+}
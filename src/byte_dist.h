@@ -0,0 +1,86 @@
+/*
+ *	
+ * Copyright (c) 2016 Cisco Systems, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * byte_dist.h
+ *
+ * byte distribution of flow payloads
+ */
+
+#ifndef BYTE_DIST_H
+#define BYTE_DIST_H
+
+/*
+ * byte_count_update(count, data, len) adds the number of occurrences
+ * of each byte value in the len bytes at data to count[] 
+ *
+ * Incrementing count[data[i]] for each byte stalls on runs of a
+ * repeated byte value (such as zero padding), since each increment
+ * must wait for the store of the one before it.  This function reads
+ * the payload eight bytes at a time, and counts a word whose bytes
+ * are all equal with a single addition.  Splitting the counts across
+ * several sub-histograms, and merging them afterwards, was measured
+ * as well; clearing and merging them costs more than counting a
+ * typical packet, so it is not used.
+ */
+void byte_count_update(unsigned int count[256], const void *data, unsigned int len);
+
+/*
+ * byte_count_mean_std_dev(count, mean, std_dev) sets mean and std_dev
+ * to the mean and the (sample) standard deviation of the byte values
+ * counted in count[], or to zero if there are too few of them.  Since
+ * they are computed from the counts when a flow is reported, no work
+ * is needed for them as each byte is processed.
+ */
+void byte_count_mean_std_dev(const unsigned int count[256], double *mean, double *std_dev);
+
+/*
+ * byte_count_entropy(count, num_bytes, dist) returns the entropy, in
+ * bits per byte, of the num_bytes bytes counted in count[], and sets
+ * dist[i] to count[i] / num_bytes (the distribution that the
+ * classifier uses), so that the counts are read only once per flow
+ *
+ * The entropy is computed as log2(N) - (1/N) * sum(n * log2(n)), where
+ * n * log2(n) is read from a table for small counts, and computed
+ * with a short series for log2(n) for larger ones, rather than with a
+ * call to log() for each of the 256 counts.  The series is accurate to
+ * about 1e-9, and since the counts sum to N, so is the entropy.
+ */
+double byte_count_entropy(const unsigned int count[256], unsigned int num_bytes, float dist[256]);
+
+int byte_dist_unit_test();
+
+#endif /* BYTE_DIST_H */
@@ -419,7 +419,7 @@ float classify(const unsigned short *pkt_len, const struct timeval *pkt_time,
 	       const unsigned short *pkt_len_twin, const struct timeval *pkt_time_twin,
   	       struct timeval start_time, struct timeval start_time_twin, uint32_t max_num_pkt_len,
 	       uint16_t sp, uint16_t dp, uint32_t op, uint32_t ip, uint32_t np_o, uint32_t np_i,
-	       uint32_t ob, uint32_t ib, uint16_t use_bd, const uint32_t *bd, const uint32_t *bd_t) {
+	       uint32_t ob, uint32_t ib, const float *bd_dist) {
 
   float features[NUM_PARAMETERS_BD_LOGREG] = {1.0};
   float mc_lens[MC_BINS_LEN*MC_BINS_LEN];
@@ -469,17 +469,13 @@ float classify(const unsigned short *pkt_len, const struct timeval *pkt_time,
   }
 
   // fill out byte distribution features
-  if (ob+ib > 100 && use_bd) {
+  if (ob+ib > 100 && bd_dist != NULL) {
     for (i = 0; i < NUM_BD_VALUES; i++) {
-      if (pkt_len_twin != NULL) {
-        features[i+8+MC_BINS_LEN*MC_BINS_LEN+MC_BINS_TIME*MC_BINS_TIME] = (bd[i]+bd_t[i])/((float)(ob+ib));
-      } else {
-        features[i+8+MC_BINS_LEN*MC_BINS_LEN+MC_BINS_TIME*MC_BINS_TIME] = bd[i]/((float)(ob));
-      }
+      features[i+8+MC_BINS_LEN*MC_BINS_LEN+MC_BINS_TIME*MC_BINS_TIME] = bd_dist[i];
     }
   }
 
-  if (ob+ib > 100 && use_bd) {
+  if (ob+ib > 100 && bd_dist != NULL) {
     score = parameters_bd[0];
     for (i = 1; i < NUM_PARAMETERS_BD_LOGREG; i++) {
       score += features[i]*parameters_bd[i];
@@ -53,12 +53,18 @@
 #define MAX_BIN_LEN 1500
 #define NUM_BD_VALUES 256
 
-/* Classifier functions */
+/* 
+ * Classifier functions
+ *
+ * bd_dist is the byte distribution of the flow (in both directions),
+ * normalized by its number of bytes, or NULL if byte distributions
+ * are not in use
+ */
 float classify(const unsigned short *pkt_len, const struct timeval *pkt_time,
 	       const unsigned short *pkt_len_twin, const struct timeval *pkt_time_twin,
 	       struct timeval start_time, struct timeval start_time_twin, uint32_t max_num_pkt_len,
 	       uint16_t sp, uint16_t dp, uint32_t op, uint32_t ip, uint32_t np_o, uint32_t np_i,
-		 uint32_t ob, uint32_t ib, uint16_t use_bd, const uint32_t *bd, const uint32_t *bd_t);
+		 uint32_t ob, uint32_t ib, const float *bd_dist);
 
 void merge_splt_arrays(const uint16_t *pkt_len, const struct timeval *pkt_time, 
 		       const uint16_t *pkt_len_twin, const struct timeval *pkt_time_twin,
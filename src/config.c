@@ -175,9 +175,24 @@ int config_parse_command(struct configuration *config,
   } else if (match(command, "wht")) {
     parse_check(parse_bool(&config->report_wht, arg, num));
 
+  } else if (match(command, "hd_pkts")) {
+    parse_check(parse_int(&config->hd_pkts, arg, num, 1, INT_MAX));
+
   } else if (match(command, "hd")) {
     parse_check(parse_int(&config->report_hd, arg, num, 0, HDR_DSC_LEN));
 
+  } else if (match(command, "payload_budget")) {
+    parse_check(parse_int(&config->payload_budget, arg, num, 0, INT_MAX));
+
+  } else if (match(command, "payload_pkt_budget")) {
+    parse_check(parse_int(&config->payload_pkt_budget, arg, num, 0, INT_MAX));
+
+  } else if (match(command, "tls_fp")) {
+    parse_check(parse_int(&config->tls_fp, arg, num, 0, 2));
+
+  } else if (match(command, "tls_dict")) {
+    parse_check(parse_bool(&config->tls_dict, arg, num));
+
   } else if (match(command, "tls")) {
     parse_check(parse_bool(&config->include_tls, arg, num));
 
@@ -193,6 +208,9 @@ int config_parse_command(struct configuration *config,
   } else if (match(command, "num_pkts")) {
     parse_check(parse_int(&config->num_pkts, arg, num, 0, MAX_NUM_PKT_LEN));
 
+  } else if (match(command, "splt_enc")) {
+    parse_check(parse_bool(&config->splt_enc, arg, num));
+
   } else if (match(command, "type")) {
     parse_check(parse_int(&config->type, arg, num, 1, 2));
 
@@ -211,12 +229,18 @@ int config_parse_command(struct configuration *config,
   } else if (match(command, "dns")) {
     parse_check(parse_bool(&config->dns, arg, num));
 
+  } else if (match(command, "anon_pp")) {
+    parse_check(parse_bool(&config->anon_pp, arg, num));
+
   } else if (match(command, "anon")) {
     parse_check(parse_string(&config->anon_addrs_file, arg, num));
 
   } else if (match(command, "exe")) {
     parse_check(parse_bool(&config->report_exe, arg, num));
 
+  } else if (match(command, "vlan")) {
+    parse_check(parse_bool(&config->vlan, arg, num));
+
   } else {
     return failure;
   }
@@ -226,6 +250,7 @@ int config_parse_command(struct configuration *config,
 
 void config_set_defaults(struct configuration *config) {
   config->type = 1;
+  config->hd_pkts = HDR_DSC_PKTS;
 }
 
 int config_set_from_file(struct configuration *config, const char *fname) {
@@ -380,17 +405,25 @@ void config_print(FILE *f, const struct configuration *c) {
   fprintf(f, "bidir = %u\n", c->bidir);
   fprintf(f, "num_pkts = %u\n", c->num_pkts);
   fprintf(f, "type = %u\n", c->type);
+  fprintf(f, "splt_enc = %u\n", c->splt_enc);
   fprintf(f, "zeros = %u\n", c->include_zeroes);
   fprintf(f, "dist = %u\n", c->byte_distribution);
   fprintf(f, "entropy = %u\n", c->report_entropy);
   fprintf(f, "wht = %u\n", c->report_wht);
   fprintf(f, "hd = %u\n", c->report_hd);
+  fprintf(f, "hd_pkts = %u\n", c->hd_pkts);
+  fprintf(f, "payload_budget = %u\n", c->payload_budget);
+  fprintf(f, "payload_pkt_budget = %u\n", c->payload_pkt_budget);
   fprintf(f, "tls = %u\n", c->include_tls);
+  fprintf(f, "tls_dict = %u\n", c->tls_dict);
+  fprintf(f, "tls_fp = %u\n", c->tls_fp);
   fprintf(f, "classify = %u\n", c->include_classifier);
   fprintf(f, "idp = %u\n", c->idp);
   fprintf(f, "dns = %u\n", c->dns);
   fprintf(f, "exe = %u\n", c->report_exe);
+  fprintf(f, "vlan = %u\n", c->vlan);
   fprintf(f, "anon = %s\n", val(c->anon_addrs_file));
+  fprintf(f, "anon_pp = %u\n", c->anon_pp);
   fprintf(f, "bpf = %s\n", val(c->bpf_filter_exp));
   fprintf(f, "verbosity = %u\n", c->output_level);
 
@@ -420,17 +453,25 @@ void config_print_json(FILE *f, const struct configuration *c) {
   fprintf(f, "\t\"bidir\": %u,\n", c->bidir);
   fprintf(f, "\t\"num_pkts\": %u,\n", c->num_pkts);
   fprintf(f, "\t\"type\": %u,\n", c->type);
+  fprintf(f, "\t\"splt_enc\": %u,\n", c->splt_enc);
   fprintf(f, "\t\"zeros\": %u,\n", c->include_zeroes);
   fprintf(f, "\t\"dist\": %u,\n", c->byte_distribution);
   fprintf(f, "\t\"entropy\": %u,\n", c->report_entropy);
   fprintf(f, "\t\"wht\": %u,\n", c->report_wht);
   fprintf(f, "\t\"hd\": %u,\n", c->report_hd);
+  fprintf(f, "\t\"hd_pkts\": %u,\n", c->hd_pkts);
+  fprintf(f, "\t\"payload_budget\": %u,\n", c->payload_budget);
+  fprintf(f, "\t\"payload_pkt_budget\": %u,\n", c->payload_pkt_budget);
   fprintf(f, "\t\"tls\": %u,\n", c->include_tls);
+  fprintf(f, "\t\"tls_dict\": %u,\n", c->tls_dict);
+  fprintf(f, "\t\"tls_fp\": %u,\n", c->tls_fp);
   fprintf(f, "\t\"classify\": %u,\n", c->include_classifier);
   fprintf(f, "\t\"idp\": %u,\n", c->idp);
   fprintf(f, "\t\"dns\": %u,\n", c->dns);
   fprintf(f, "\t\"exe\": %u,\n", c->report_exe);
+  fprintf(f, "\t\"vlan\": %u,\n", c->vlan);
   fprintf(f, "\t\"anon\": \"%s\",\n", val(c->anon_addrs_file));
+  fprintf(f, "\t\"anon_pp\": %u,\n", c->anon_pp);
   fprintf(f, "\t\"bpf\": \"%s\",\n", val(c->bpf_filter_exp));
   fprintf(f, "\t\"verbosity\": %u\n", c->output_level);
   fprintf(f, "},\n");  
@@ -51,8 +51,14 @@ struct configuration {
   unsigned int report_entropy;
   unsigned int report_wht;
   unsigned int report_hd;
+  unsigned int hd_pkts;        /* number of headers described */
+  unsigned int payload_budget; /* payload bytes in features, per direction */
+  unsigned int payload_pkt_budget; /* payload packets in features, per direction */
   unsigned int report_exe;
   unsigned int include_tls;
+  unsigned int tls_dict;
+  unsigned int tls_fp;         /* 1=client fingerprints, 2=with strings */
+  unsigned int splt_enc;
   unsigned int include_classifier;
   unsigned int idp;
   unsigned int dns;
@@ -65,11 +71,13 @@ struct configuration {
   unsigned int output_level;
   unsigned int nfv9_capture_port;
   unsigned int flow_key_match_method;
+  unsigned int vlan;           /* include VLAN ID in flow key */
   char *interface;
   char *filename;              /* output file, if not NULL */
   char *outputdir;             /* directory to write output files */
   char *logfile; 
   char *anon_addrs_file;
+  unsigned int anon_pp;
   char *upload_servername;
   char *upload_key;
   char *bpf_filter_exp;
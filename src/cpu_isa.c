@@ -0,0 +1,85 @@
+/*
+ *	
+ * Copyright (c) 2016 Cisco Systems, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * cpu_isa.c
+ *
+ * run-time selection of the instruction set used by the SIMD
+ * kernels, and timing for their benchmarks
+ */
+
+#include <stddef.h>     /* for NULL            */
+#include "cpu_isa.h"
+
+static enum cpu_isa cpu_isa = cpu_isa_unknown;
+
+enum cpu_isa cpu_isa_get() {
+  if (cpu_isa == cpu_isa_unknown) {
+    enum cpu_isa isa = cpu_isa_scalar;
+
+#ifdef CPU_ISA_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      isa = cpu_isa_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+      isa = cpu_isa_sse2;
+    }
+#endif
+    cpu_isa = isa;
+  }
+  return cpu_isa;
+}
+
+const char *cpu_isa_name(enum cpu_isa isa) {
+  switch (isa) {
+  case cpu_isa_scalar:
+    return "scalar";
+  case cpu_isa_sse2:
+    return "sse2";
+  case cpu_isa_avx2:
+    return "avx2";
+  default:
+    break;
+  }
+  return "unknown";
+}
+
+double time_diff(const struct timeval *start) {
+  struct timeval end;
+
+  gettimeofday(&end, NULL);
+  return (end.tv_sec - start->tv_sec) + (end.tv_usec - start->tv_usec) / 1000000.0;
+}
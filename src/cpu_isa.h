@@ -0,0 +1,81 @@
+/*
+ *	
+ * Copyright (c) 2016 Cisco Systems, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * cpu_isa.h
+ *
+ * run-time selection of the instruction set used by the SIMD
+ * kernels, and timing for their benchmarks
+ */
+
+#ifndef CPU_ISA_H
+#define CPU_ISA_H
+
+#include <sys/time.h>   /* for struct timeval */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_ISA_X86 1
+#include <immintrin.h>  /* SSE2 and AVX2 intrinsics */
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#endif
+
+/*
+ * instruction sets, in increasing order, so that a kernel can be
+ * used whenever its instruction set is no greater than cpu_isa_get()
+ */
+enum cpu_isa {
+  cpu_isa_unknown = 0,
+  cpu_isa_scalar  = 1,
+  cpu_isa_sse2    = 2,
+  cpu_isa_avx2    = 3
+};
+
+/*
+ * cpu_isa_get() returns the best instruction set supported by the
+ * processor, which is determined the first time that it is called
+ */
+enum cpu_isa cpu_isa_get();
+
+const char *cpu_isa_name(enum cpu_isa isa);
+
+/*
+ * time_diff() returns the number of seconds elapsed since start,
+ * which was set by gettimeofday()
+ */
+double time_diff(const struct timeval *start);
+
+#endif /* CPU_ISA_H */
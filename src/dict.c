@@ -0,0 +1,216 @@
+/*
+ *	
+ * Copyright (c) 2016 Cisco Systems, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * dict.c
+ *
+ * dictionary of byte strings, which maps each distinct string to a
+ * small integer identifier
+ */
+
+#include <stdio.h>    /* for snprintf() */
+#include <stdlib.h>   /* for malloc()   */
+#include <string.h>   /* for memcmp()   */
+#include "dict.h"
+#include "p2f.h"      /* for flocap_stats_incr_malloc_fail() */
+#include "err.h"
+
+extern struct flocap_stats stats;
+
+/*
+ * FNV-1a hash; the strings are short, and this is computed at most
+ * once per string per flow record
+ */
+static uint32_t dict_hash(const unsigned char *data, unsigned int len) {
+  uint32_t h = 2166136261U;
+  unsigned int i;
+
+  for (i=0; i<len; i++) {
+    h ^= data[i];
+    h *= 16777619U;
+  }
+  return h;
+}
+
+void dict_init(struct dict *d, unsigned int max_entries) {
+  d->entry = NULL;
+  d->num_entries = 0;
+  d->max_entries = max_entries;
+  d->index = NULL;
+  d->index_mask = 0;
+}
+
+/*
+ * the hash table is allocated on first use, with at least twice as
+ * many slots as there can be entries, so that probe sequences are
+ * short and always terminate
+ */
+static enum status dict_alloc(struct dict *d) {
+  unsigned int i, size = 1;
+
+  while (size < 2 * d->max_entries) {
+    size <<= 1;
+  }
+  d->index = malloc(size * sizeof(int));
+  d->entry = malloc(d->max_entries * sizeof(struct dict_entry));
+  if (d->index == NULL || d->entry == NULL) {
+    flocap_stats_incr_malloc_fail();
+    free(d->index);
+    free(d->entry);
+    d->index = NULL;
+    d->entry = NULL;
+    return failure;
+  }
+  for (i=0; i<size; i++) {
+    d->index[i] = -1;
+  }
+  d->index_mask = size - 1;
+
+  return ok;
+}
+
+int dict_lookup_or_add(struct dict *d, const void *data, unsigned int len, unsigned int *is_new) {
+  uint32_t h = dict_hash(data, len);
+  unsigned int slot;
+  struct dict_entry *e;
+
+  *is_new = 0;
+  if (d->index == NULL) {
+    if (d->max_entries == 0 || dict_alloc(d) != ok) {
+      return DICT_FULL;
+    }
+  }
+
+  for (slot = h & d->index_mask; d->index[slot] != -1; slot = (slot + 1) & d->index_mask) {
+    e = &d->entry[d->index[slot]];
+    if (e->hash == h && e->len == len && memcmp(e->data, data, len) == 0) {
+      return d->index[slot];
+    }
+  }
+
+  if (d->num_entries >= d->max_entries) {
+    return DICT_FULL;
+  }
+  e = &d->entry[d->num_entries];
+  e->data = malloc(len ? len : 1);
+  if (e->data == NULL) {
+    flocap_stats_incr_malloc_fail();
+    return DICT_FULL;
+  }
+  memcpy(e->data, data, len);
+  e->len = len;
+  e->hash = h;
+  d->index[slot] = d->num_entries;
+  *is_new = 1;
+
+  return d->num_entries++;
+}
+
+const unsigned char *dict_get_entry(const struct dict *d, unsigned int id, unsigned int *len) {
+
+  if (id >= d->num_entries) {
+    *len = 0;
+    return NULL;
+  }
+  *len = d->entry[id].len;
+  return d->entry[id].data;
+}
+
+void dict_clear(struct dict *d) {
+  unsigned int i;
+
+  for (i=0; i<d->num_entries; i++) {
+    free(d->entry[i].data);
+  }
+  d->num_entries = 0;
+  if (d->index) {
+    for (i=0; i<=d->index_mask; i++) {
+      d->index[i] = -1;
+    }
+  }
+}
+
+void dict_free(struct dict *d) {
+
+  dict_clear(d);
+  free(d->entry);
+  free(d->index);
+  dict_init(d, d->max_entries);
+}
+
+int dict_unit_test() {
+  struct dict d;
+  unsigned int i, is_new, len;
+  int id, num_fails = 0;
+  char s[16];
+  const unsigned char *e;
+
+  dict_init(&d, 100);
+  for (i=0; i<150; i++) {
+    snprintf(s, sizeof(s), "entry %u", i % 120);
+    id = dict_lookup_or_add(&d, s, strlen(s), &is_new);
+    if (i < 100) {
+      if (id != i || is_new != 1) {
+	num_fails++;
+      }
+    } else if (i < 120) {
+      if (id != DICT_FULL) {  /* dictionary is full */
+	num_fails++;
+      }
+    } else if (id != i - 120 || is_new != 0) {
+      num_fails++;
+    }
+  }
+  e = dict_get_entry(&d, 42, &len);
+  if (e == NULL || len != strlen("entry 42") || memcmp(e, "entry 42", len) != 0) {
+    num_fails++;
+  }
+  if (dict_lookup_or_add(&d, "", 0, &is_new) != DICT_FULL) {
+    num_fails++;
+  }
+
+  dict_clear(&d);
+  id = dict_lookup_or_add(&d, "entry 99", strlen("entry 99"), &is_new);
+  if (id != 0 || is_new != 1) {
+    num_fails++;
+  }
+  dict_free(&d);
+
+  if (num_fails) {
+    fprintf(info, "error: %d dictionary tests failed\n", num_fails);
+  }
+  return num_fails ? failure : ok;
+}
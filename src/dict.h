@@ -0,0 +1,94 @@
+/*
+ *	
+ * Copyright (c) 2016 Cisco Systems, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * dict.h
+ *
+ * dictionary of byte strings, which maps each distinct string to a
+ * small integer identifier
+ */
+
+#ifndef DICT_H
+#define DICT_H
+
+#include <stdint.h>    /* for uint32_t */
+
+/*
+ * identifiers are assigned in order, starting from zero, so that the
+ * dictionary can be written out as an array whose index is the
+ * identifier of each entry
+ */
+
+#define DICT_FULL (-1)
+
+struct dict_entry {
+  uint32_t hash;
+  unsigned int len;
+  unsigned char *data;
+};
+
+struct dict {
+  struct dict_entry *entry;     /* entries, in identifier order      */
+  unsigned int num_entries;
+  unsigned int max_entries;     /* dictionary will not grow past max */
+  int *index;                   /* hash table of identifiers, or -1  */
+  unsigned int index_mask;
+};
+
+void dict_init(struct dict *d, unsigned int max_entries);
+
+/*
+ * dict_lookup_or_add(d, data, len, is_new) returns the identifier of
+ * the string data[0..len-1], adding it to the dictionary if it is not
+ * already there, in which case *is_new is set to 1.  If the
+ * dictionary is full, or memory could not be allocated, DICT_FULL is
+ * returned, and the caller should report the string inline.
+ */
+int dict_lookup_or_add(struct dict *d, const void *data, unsigned int len, unsigned int *is_new);
+
+const unsigned char *dict_get_entry(const struct dict *d, unsigned int id, unsigned int *len);
+
+/*
+ * dict_clear(d) removes all entries, so that identifiers are again
+ * assigned starting from zero
+ */
+void dict_clear(struct dict *d);
+
+void dict_free(struct dict *d);
+
+int dict_unit_test();
+
+#endif /* DICT_H */
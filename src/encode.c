@@ -0,0 +1,754 @@
+/*
+ *	
+ * Copyright (c) 2016 Cisco Systems, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * encode.c
+ *
+ * hex and string encoding kernels for JSON output
+ */
+
+#include <stdio.h>      /* for fprintf()       */
+#include <stdlib.h>     /* for rand()          */
+#include <string.h>     /* for memcpy()        */
+#include <ctype.h>      /* for isalnum()       */
+#include <sys/time.h>   /* for gettimeofday()  */
+#include <stdint.h>     /* for uint32_t        */
+#include "encode.h"
+#include "cpu_isa.h"
+#include "err.h"
+
+static const char hex_digit[] = "0123456789abcdef";
+
+static inline int char_is_alnum(unsigned char c) {
+  return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z');
+}
+
+
+/*
+ * hex encoding
+ */
+
+static unsigned int hex_encode_scalar(char *out, const unsigned char *in, unsigned int len) {
+  unsigned int i;
+
+  for (i=0; i<len; i++) {
+    out[2*i]   = hex_digit[in[i] >> 4];
+    out[2*i+1] = hex_digit[in[i] & 0x0f];
+  }
+  return 2*len;
+}
+
+#ifdef CPU_ISA_X86
+
+/*
+ * the vector kernels convert each nibble n into the character
+ * '0' + n + (n > 9 ? 'a' - '0' - 10 : 0), then interleave the high
+ * and low nibbles of each octet
+ */
+
+static TARGET_SSE2 unsigned int hex_encode_sse2(char *out, const unsigned char *in, unsigned int len) {
+  const __m128i low_nibble = _mm_set1_epi8(0x0f);
+  const __m128i nine = _mm_set1_epi8(9);
+  const __m128i zero = _mm_set1_epi8('0');
+  const __m128i alpha = _mm_set1_epi8('a' - '0' - 10);
+  unsigned int i = 0;
+
+  for ( ; i + 16 <= len; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), low_nibble);
+    __m128i lo = _mm_and_si128(x, low_nibble);
+
+    hi = _mm_add_epi8(_mm_add_epi8(hi, zero), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), alpha));
+    lo = _mm_add_epi8(_mm_add_epi8(lo, zero), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), alpha));
+    _mm_storeu_si128((__m128i *)(out + 2*i), _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i *)(out + 2*i + 16), _mm_unpackhi_epi8(hi, lo));
+  }
+  hex_encode_scalar(out + 2*i, in + i, len - i);
+
+  return 2*len;
+}
+
+static TARGET_AVX2 unsigned int hex_encode_avx2(char *out, const unsigned char *in, unsigned int len) {
+  const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+  const __m256i nine = _mm256_set1_epi8(9);
+  const __m256i zero = _mm256_set1_epi8('0');
+  const __m256i alpha = _mm256_set1_epi8('a' - '0' - 10);
+  unsigned int i = 0;
+
+  for ( ; i + 32 <= len; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(in + i));
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low_nibble);
+    __m256i lo = _mm256_and_si256(x, low_nibble);
+    __m256i a, b;
+
+    hi = _mm256_add_epi8(_mm256_add_epi8(hi, zero), _mm256_and_si256(_mm256_cmpgt_epi8(hi, nine), alpha));
+    lo = _mm256_add_epi8(_mm256_add_epi8(lo, zero), _mm256_and_si256(_mm256_cmpgt_epi8(lo, nine), alpha));
+
+    /* unpacking works within 128-bit lanes, so the halves must be reordered */
+    a = _mm256_unpacklo_epi8(hi, lo);  /* octets 0-7 and 16-23  */
+    b = _mm256_unpackhi_epi8(hi, lo);  /* octets 8-15 and 24-31 */
+    _mm256_storeu_si256((__m256i *)(out + 2*i), _mm256_permute2x128_si256(a, b, 0x20));
+    _mm256_storeu_si256((__m256i *)(out + 2*i + 32), _mm256_permute2x128_si256(a, b, 0x31));
+  }
+  hex_encode_scalar(out + 2*i, in + i, len - i);
+
+  return 2*len;
+}
+
+#endif /* CPU_ISA_X86 */
+
+unsigned int hex_encode(char *out, const void *data, unsigned int len) {
+
+  switch (cpu_isa_get()) {
+#ifdef CPU_ISA_X86
+  case cpu_isa_avx2:
+    return hex_encode_avx2(out, data, len);
+  case cpu_isa_sse2:
+    return hex_encode_sse2(out, data, len);
+#endif
+  default:
+    return hex_encode_scalar(out, data, len);
+  }
+}
+
+
+/*
+ * printable string conversion
+ */
+
+static unsigned int str_printable_finish(char *dst, const char *src, unsigned int i, unsigned int len) {
+
+  for ( ; i<len; i++) {
+    if (src[i] == 0) {
+      break;
+    }
+    dst[i] = char_is_alnum(src[i]) ? src[i] : '.';
+  }
+  if (i == len) {
+    i = len - 1;   /* there is no room for a null after the last character */
+  }
+  dst[i] = 0;
+
+  return i;
+}
+
+static unsigned int str_printable_scalar(char *dst, const char *src, unsigned int len) {
+
+  if (len == 0) {
+    return 0;
+  }
+  return str_printable_finish(dst, src, 0, len);
+}
+
+#ifdef CPU_ISA_X86
+
+/*
+ * the vector kernels handle sixteen or thirty-two characters at a
+ * time, and hand off to the scalar code at the block containing the
+ * first null character; the range checks use signed comparisons, so
+ * characters with the high bit set are never alphanumeric
+ */
+
+static TARGET_SSE2 unsigned int str_printable_sse2(char *dst, const char *src, unsigned int len) {
+  const __m128i nul = _mm_setzero_si128();
+  const __m128i dot = _mm_set1_epi8('.');
+  const __m128i case_bit = _mm_set1_epi8(0x20);
+  const __m128i below_0 = _mm_set1_epi8('0' - 1), above_9 = _mm_set1_epi8('9' + 1);
+  const __m128i below_a = _mm_set1_epi8('a' - 1), above_z = _mm_set1_epi8('z' + 1);
+  unsigned int i = 0;
+
+  if (len == 0) {
+    return 0;
+  }
+  for ( ; i + 16 <= len; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i lower, digit, alpha, alnum;
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, nul))) {
+      break;
+    }
+    lower = _mm_or_si128(x, case_bit);
+    digit = _mm_and_si128(_mm_cmpgt_epi8(x, below_0), _mm_cmplt_epi8(x, above_9));
+    alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, below_a), _mm_cmplt_epi8(lower, above_z));
+    alnum = _mm_or_si128(digit, alpha);
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(_mm_and_si128(alnum, x), _mm_andnot_si128(alnum, dot)));
+  }
+
+  return str_printable_finish(dst, src, i, len);
+}
+
+static TARGET_AVX2 unsigned int str_printable_avx2(char *dst, const char *src, unsigned int len) {
+  const __m256i nul = _mm256_setzero_si256();
+  const __m256i dot = _mm256_set1_epi8('.');
+  const __m256i case_bit = _mm256_set1_epi8(0x20);
+  const __m256i below_0 = _mm256_set1_epi8('0' - 1), above_9 = _mm256_set1_epi8('9' + 1);
+  const __m256i below_a = _mm256_set1_epi8('a' - 1), above_z = _mm256_set1_epi8('z' + 1);
+  unsigned int i = 0;
+
+  if (len == 0) {
+    return 0;
+  }
+  for ( ; i + 32 <= len; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i lower, digit, alpha, alnum;
+
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, nul))) {
+      break;
+    }
+    lower = _mm256_or_si256(x, case_bit);
+    digit = _mm256_and_si256(_mm256_cmpgt_epi8(x, below_0), _mm256_cmpgt_epi8(above_9, x));
+    alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, below_a), _mm256_cmpgt_epi8(above_z, lower));
+    alnum = _mm256_or_si256(digit, alpha);
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_blendv_epi8(dot, x, alnum));
+  }
+
+  return str_printable_finish(dst, src, i, len);
+}
+
+#endif /* CPU_ISA_X86 */
+
+unsigned int str_printable(char *dst, const char *src, unsigned int len) {
+
+  switch (cpu_isa_get()) {
+#ifdef CPU_ISA_X86
+  case cpu_isa_avx2:
+    return str_printable_avx2(dst, src, len);
+  case cpu_isa_sse2:
+    return str_printable_sse2(dst, src, len);
+#endif
+  default:
+    return str_printable_scalar(dst, src, len);
+  }
+}
+
+
+/*
+ * JSON string escaping
+ */
+
+static inline char *json_escape_char(char *out, unsigned char c) {
+
+  switch (c) {
+  case '"':
+  case '\\':
+    *out++ = '\\';
+    *out++ = c;
+    break;
+  case '\b':
+    *out++ = '\\';
+    *out++ = 'b';
+    break;
+  case '\f':
+    *out++ = '\\';
+    *out++ = 'f';
+    break;
+  case '\n':
+    *out++ = '\\';
+    *out++ = 'n';
+    break;
+  case '\r':
+    *out++ = '\\';
+    *out++ = 'r';
+    break;
+  case '\t':
+    *out++ = '\\';
+    *out++ = 't';
+    break;
+  default:
+    if (c < 0x20) {
+      *out++ = '\\';
+      *out++ = 'u';
+      *out++ = '0';
+      *out++ = '0';
+      *out++ = hex_digit[c >> 4];
+      *out++ = hex_digit[c & 0x0f];
+    } else {
+      *out++ = c;
+    }
+  }
+  return out;
+}
+
+static unsigned int json_escape_scalar(char *dst, const char *src, unsigned int len) {
+  char *out = dst;
+  unsigned int i;
+
+  for (i=0; i<len; i++) {
+    out = json_escape_char(out, src[i]);
+  }
+  *out = 0;
+
+  return out - dst;
+}
+
+#ifdef CPU_ISA_X86
+
+/*
+ * the vector kernels copy a whole block to the output, then advance
+ * past the characters that need no escaping and escape the first
+ * character that does; the output buffer is always long enough to
+ * hold a whole block, since each remaining input character could
+ * require six output characters
+ *
+ * the AVX2 kernels finish with scalar code rather than calling the
+ * SSE2 kernels, since mixing legacy SSE and AVX instructions incurs a
+ * large state transition penalty
+ */
+
+static TARGET_SSE2 unsigned int json_escape_sse2(char *dst, const char *src, unsigned int len) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i space = _mm_set1_epi8(0x20);
+  const __m128i minus_one = _mm_set1_epi8(-1);
+  const char *end = src + len;
+  char *out = dst;
+
+  while (src + 16 <= end) {
+    __m128i x = _mm_loadu_si128((const __m128i *)src);
+    __m128i ctrl = _mm_and_si128(_mm_cmpgt_epi8(x, minus_one), _mm_cmplt_epi8(x, space));
+    __m128i esc = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, backslash)), ctrl);
+    unsigned int bits = _mm_movemask_epi8(esc);
+
+    _mm_storeu_si128((__m128i *)out, x);
+    if (bits == 0) {
+      src += 16;
+      out += 16;
+    } else {
+      unsigned int n = __builtin_ctz(bits);
+      src += n;
+      out += n;
+      out = json_escape_char(out, *src++);
+    }
+  }
+
+  return (out - dst) + json_escape_scalar(out, src, end - src);
+}
+
+static TARGET_AVX2 unsigned int json_escape_avx2(char *dst, const char *src, unsigned int len) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i space = _mm256_set1_epi8(0x20);
+  const __m256i minus_one = _mm256_set1_epi8(-1);
+  const char *end = src + len;
+  char *out = dst;
+
+  while (src + 32 <= end) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)src);
+    __m256i ctrl = _mm256_and_si256(_mm256_cmpgt_epi8(x, minus_one), _mm256_cmpgt_epi8(space, x));
+    __m256i esc = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, quote), _mm256_cmpeq_epi8(x, backslash)), ctrl);
+    unsigned int bits = _mm256_movemask_epi8(esc);
+
+    _mm256_storeu_si256((__m256i *)out, x);
+    if (bits == 0) {
+      src += 32;
+      out += 32;
+    } else {
+      unsigned int n = __builtin_ctz(bits);
+      src += n;
+      out += n;
+      out = json_escape_char(out, *src++);
+    }
+  }
+
+  return (out - dst) + json_escape_scalar(out, src, end - src);
+}
+
+#endif /* CPU_ISA_X86 */
+
+unsigned int json_escape(char *dst, const char *src, unsigned int len) {
+
+  switch (cpu_isa_get()) {
+#ifdef CPU_ISA_X86
+  case cpu_isa_avx2:
+    return json_escape_avx2(dst, src, len);
+  case cpu_isa_sse2:
+    return json_escape_sse2(dst, src, len);
+#endif
+  default:
+    return json_escape_scalar(dst, src, len);
+  }
+}
+
+
+/*
+ * base64 encoding; the output is short (it is only used for compact
+ * binary fields), so there is no vector version
+ */
+
+static const char base64_digit[] = 
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+unsigned int base64_encode(char *out, const void *data, unsigned int len) {
+  const unsigned char *in = data;
+  char *o = out;
+  unsigned int i;
+  uint32_t x;
+
+  for (i=0; i + 3 <= len; i += 3) {
+    x = (in[i] << 16) | (in[i+1] << 8) | in[i+2];
+    *o++ = base64_digit[(x >> 18) & 0x3f];
+    *o++ = base64_digit[(x >> 12) & 0x3f];
+    *o++ = base64_digit[(x >> 6) & 0x3f];
+    *o++ = base64_digit[x & 0x3f];
+  }
+  if (i < len) {
+    x = in[i] << 16;
+    if (i + 1 < len) {
+      x |= in[i+1] << 8;
+    }
+    *o++ = base64_digit[(x >> 18) & 0x3f];
+    *o++ = base64_digit[(x >> 12) & 0x3f];
+    *o++ = (i + 1 < len) ? base64_digit[(x >> 6) & 0x3f] : '=';
+    *o++ = '=';
+  }
+  return o - out;
+}
+
+static int base64_value(char c) {
+  if (c >= 'A' && c <= 'Z') {
+    return c - 'A';
+  } else if (c >= 'a' && c <= 'z') {
+    return c - 'a' + 26;
+  } else if (c >= '0' && c <= '9') {
+    return c - '0' + 52;
+  } else if (c == '+') {
+    return 62;
+  } else if (c == '/') {
+    return 63;
+  }
+  return -1;
+}
+
+int base64_decode(void *out, const char *in, unsigned int len) {
+  unsigned char *o = out;
+  unsigned int i, j;
+
+  if (len % 4) {
+    return -1;
+  }
+  for (i=0; i<len; i += 4) {
+    uint32_t x = 0;
+    unsigned int num_pad = 0;
+
+    for (j=0; j<4; j++) {
+      int v = base64_value(in[i+j]);
+
+      if (in[i+j] == '=' && i + 4 == len && j >= 2) {
+	num_pad++;
+	v = 0;
+      } else if (v < 0 || num_pad) {
+	return -1;
+      }
+      x = (x << 6) | v;
+    }
+    *o++ = x >> 16;
+    if (num_pad < 2) {
+      *o++ = x >> 8;
+    }
+    if (num_pad < 1) {
+      *o++ = x;
+    }
+  }
+  return o - (unsigned char *)out;
+}
+
+
+/*
+ * unit test and benchmark
+ */
+
+/*
+ * reference implementations, which match the stdio-based functions
+ * in p2f.c and hdr_dsc.c that the kernels replaced
+ */
+
+static unsigned int hex_encode_ref(char *out, const unsigned char *in, unsigned int len) {
+  unsigned int i;
+  char tmp[3];
+
+  for (i=0; i<len; i++) {
+    snprintf(tmp, sizeof(tmp), "%02x", in[i]);
+    out[2*i] = tmp[0];
+    out[2*i+1] = tmp[1];
+  }
+  return 2*len;
+}
+
+static void str_printable_ref(char *s, unsigned int len) {
+  unsigned int i;
+
+  for (i=0; i<len; i++) {
+    if (s[i] == 0) {
+      break;
+    } else if (!isalnum(s[i])) {
+      s[i] = '.';
+    }
+  }
+  s[len-1] = 0;
+}
+
+static void fprintf_hex_ref(FILE *f, const unsigned char *x, unsigned int len) {
+  const unsigned char *end = x + len;
+
+  fprintf(f, "\"");
+  while (x < end) {
+    fprintf(f, "%02x", *x++);
+  }
+  fprintf(f, "\"");
+}
+
+#define ENCODE_TEST_LEN 512
+
+typedef unsigned int (*hex_func)(char *out, const unsigned char *in, unsigned int len);
+typedef unsigned int (*str_func)(char *dst, const char *src, unsigned int len);
+
+struct encode_kernels {
+  const char *name;
+  enum cpu_isa isa;
+  hex_func hex;
+  str_func printable;
+  str_func escape;
+};
+
+static const struct encode_kernels encode_kernels[] = {
+  { "scalar", cpu_isa_scalar, hex_encode_scalar, str_printable_scalar, json_escape_scalar },
+#ifdef CPU_ISA_X86
+  { "sse2",   cpu_isa_sse2,   hex_encode_sse2,   str_printable_sse2,   json_escape_sse2   },
+  { "avx2",   cpu_isa_avx2,   hex_encode_avx2,   str_printable_avx2,   json_escape_avx2   },
+#endif
+};
+
+#define NUM_ENCODE_KERNELS (sizeof(encode_kernels)/sizeof(struct encode_kernels))
+
+/*
+ * fill a buffer with test data that is rich in the characters that
+ * the kernels treat specially
+ */
+static void encode_test_fill(unsigned char *buf, unsigned int len, unsigned int nul_ratio) {
+  static const char special[] = "\"\\\n\t/09AZaz@[`{ .\x7f\x80\xff\x1f";
+  unsigned int i;
+
+  for (i=0; i<len; i++) {
+    unsigned int r = rand();
+    if (r % 4 == 0) {
+      buf[i] = special[(r >> 8) % (sizeof(special) - 1)];
+    } else {
+      buf[i] = r >> 8;
+    }
+    if (nul_ratio && (r >> 16) % nul_ratio == 0) {
+      buf[i] = 0;
+    } else if (buf[i] == 0) {
+      buf[i] = 'x';
+    }
+  }
+}
+
+static void encode_benchmark() {
+  unsigned char data[1500];
+  char out[JSON_ESCAPE_LEN(1500)];
+  unsigned int i, k, iters = 4000;
+  struct timeval start;
+  double mb = (double) sizeof(data) * iters / 1000000.0;
+  FILE *devnull;
+
+  devnull = fopen("/dev/null", "w");
+  if (devnull == NULL) {
+    return;
+  }
+  encode_test_fill(data, sizeof(data), 0);
+
+  gettimeofday(&start, NULL);
+  for (i=0; i<iters; i++) {
+    fprintf_hex_ref(devnull, data, sizeof(data));
+  }
+  printf("hex encoding of 1500-byte buffer, fprintf per byte: %8.1f MB/s\n", mb / time_diff(&start));
+
+  for (k=0; k<NUM_ENCODE_KERNELS; k++) {
+    if (encode_kernels[k].isa > cpu_isa_get()) {
+      continue;
+    }
+    gettimeofday(&start, NULL);
+    for (i=0; i<iters; i++) {
+      unsigned int n = encode_kernels[k].hex(out + 1, data, sizeof(data));
+      out[0] = out[n+1] = '"';
+      fwrite(out, 1, n+2, devnull);
+    }
+    printf("hex encoding of 1500-byte buffer, %-6s + fwrite:   %8.1f MB/s\n",
+	   encode_kernels[k].name, mb / time_diff(&start));
+  }
+
+  memset(data, 'a', sizeof(data));
+  data[sizeof(data)-1] = '-';
+  gettimeofday(&start, NULL);
+  for (i=0; i<iters; i++) {
+    memcpy(out, data, sizeof(data));
+    str_printable_ref(out, sizeof(data));
+  }
+  printf("printable conversion, isalnum per byte:             %8.1f MB/s\n", mb / time_diff(&start));
+
+  for (k=0; k<NUM_ENCODE_KERNELS; k++) {
+    if (encode_kernels[k].isa > cpu_isa_get()) {
+      continue;
+    }
+    gettimeofday(&start, NULL);
+    for (i=0; i<iters; i++) {
+      encode_kernels[k].printable(out, (char *)data, sizeof(data));
+    }
+    printf("printable conversion, %-6s:                       %8.1f MB/s\n",
+	   encode_kernels[k].name, mb / time_diff(&start));
+    gettimeofday(&start, NULL);
+    for (i=0; i<iters; i++) {
+      encode_kernels[k].escape(out, (char *)data, sizeof(data));
+    }
+    printf("json escaping, %-6s:                              %8.1f MB/s\n",
+	   encode_kernels[k].name, mb / time_diff(&start));
+  }
+
+  fclose(devnull);
+}
+
+int encode_unit_test() {
+  unsigned char data[ENCODE_TEST_LEN + 32];
+  char ref[JSON_ESCAPE_LEN(ENCODE_TEST_LEN + 32)];
+  char out[JSON_ESCAPE_LEN(ENCODE_TEST_LEN + 32)];
+  unsigned int len, offset, k, n, ref_n, trial;
+  int num_fails = 0;
+
+  srand(0xcafe);
+  for (trial=0; trial<4; trial++) {
+    for (len=0; len<=ENCODE_TEST_LEN; len += (len < 96 ? 1 : 29)) {
+      for (offset=0; offset<32; offset += 3) {
+	unsigned char *d = data + offset;
+
+	/* hex encoding matches "%02x" */
+	encode_test_fill(d, len, 0);
+	ref_n = hex_encode_ref(ref, d, len);
+	for (k=0; k<NUM_ENCODE_KERNELS; k++) {
+	  if (encode_kernels[k].isa > cpu_isa_get()) {
+	    continue;
+	  }
+	  n = encode_kernels[k].hex(out, d, len);
+	  if (n != ref_n || memcmp(out, ref, n) != 0) {
+	    fprintf(info, "error: hex_encode_%s mismatch (len %u)\n", encode_kernels[k].name, len);
+	    num_fails++;
+	  }
+	}
+
+	/* printable conversion matches convert_string_to_printable() */
+	if (len == 0) {
+	  continue;
+	}
+	encode_test_fill(d, len, trial == 0 ? 0 : 128 >> trial);
+	memcpy(ref, d, len);
+	str_printable_ref(ref, len);
+	for (k=0; k<NUM_ENCODE_KERNELS; k++) {
+	  if (encode_kernels[k].isa > cpu_isa_get()) {
+	    continue;
+	  }
+	  memcpy(out, d, len);
+	  n = encode_kernels[k].printable(out, out, len);   /* in place */
+	  if (n != strlen(ref) || strcmp(out, ref) != 0) {
+	    fprintf(info, "error: str_printable_%s mismatch (len %u)\n", encode_kernels[k].name, len);
+	    num_fails++;
+	  }
+	}
+
+	/* all of the escaping kernels agree with the scalar one */
+	ref_n = json_escape_scalar(ref, (char *)d, len);
+	for (k=1; k<NUM_ENCODE_KERNELS; k++) {
+	  if (encode_kernels[k].isa > cpu_isa_get()) {
+	    continue;
+	  }
+	  n = encode_kernels[k].escape(out, (char *)d, len);
+	  if (n != ref_n || memcmp(out, ref, n + 1) != 0) {
+	    fprintf(info, "error: json_escape_%s mismatch (len %u)\n", encode_kernels[k].name, len);
+	    num_fails++;
+	  }
+	}
+      }
+    }
+  }
+
+  /* known answers */
+  n = hex_encode(out, "\x00\x7f\x80\xff\xca\xfe", 6);
+  if (n != 12 || memcmp(out, "007f80ffcafe", 12) != 0) {
+    fprintf(info, "error: hex_encode known answer\n");
+    num_fails++;
+  }
+  strcpy(ref, "www.cisco-com\001xyz");
+  n = str_printable(out, ref, strlen(ref) + 1);
+  if (n != 17 || strcmp(out, "www.cisco.com.xyz") != 0) {
+    fprintf(info, "error: str_printable known answer\n");
+    num_fails++;
+  }
+  n = json_escape(out, "a\"b\\c\nd\001", 8);
+  if (n != 16 || strcmp(out, "a\\\"b\\\\c\\nd\\u0001") != 0) {
+    fprintf(info, "error: json_escape known answer\n");
+    num_fails++;
+  }
+
+  /* base64 round trip and known answers (from RFC 4648) */
+  for (len=0; len<64; len++) {
+    unsigned char dec[64];
+    int m;
+
+    encode_test_fill(data, len, 0);
+    n = base64_encode(out, data, len);
+    m = base64_decode(dec, out, n);
+    if (n != BASE64_LEN(len) || m != (int) len || memcmp(dec, data, len) != 0) {
+      fprintf(info, "error: base64 round trip (len %u)\n", len);
+      num_fails++;
+    }
+  }
+  n = base64_encode(out, "foobar", 6);
+  if (n != 8 || memcmp(out, "Zm9vYmFy", 8) != 0) {
+    fprintf(info, "error: base64_encode known answer\n");
+    num_fails++;
+  }
+  n = base64_encode(out, "foob", 4);
+  if (n != 8 || memcmp(out, "Zm9vYg==", 8) != 0) {
+    fprintf(info, "error: base64_encode known answer\n");
+    num_fails++;
+  }
+  if (base64_decode(out, "Zm9v=mFy", 8) != -1) {
+    fprintf(info, "error: base64_decode accepted bad input\n");
+    num_fails++;
+  }
+
+  encode_benchmark();
+
+  return num_fails ? failure : ok;
+}
@@ -0,0 +1,111 @@
+/*
+ *	
+ * Copyright (c) 2016 Cisco Systems, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * encode.h
+ *
+ * hex and string encoding kernels for JSON output
+ */
+
+#ifndef ENCODE_H
+#define ENCODE_H
+
+/*
+ * The functions in this file write their output into a buffer
+ * supplied by the caller, so that a whole field can be emitted with a
+ * single call to fwrite() or fprintf(), instead of one stdio call per
+ * byte.  On x86 processors, SSE2 and AVX2 versions of the kernels are
+ * selected at run time; otherwise, a portable scalar version is used.
+ * All versions produce identical output.
+ */
+
+/*
+ * hex_encode(out, data, len) writes the 2*len lowercase hexadecimal
+ * characters that represent the octets in data into out, and returns
+ * the number of characters written.  The output is NOT null
+ * terminated; out must have room for at least 2*len characters.
+ */
+unsigned int hex_encode(char *out, const void *data, unsigned int len);
+
+/*
+ * str_printable(dst, src, len) copies the character string src into
+ * dst, stopping at the first null character or after len characters,
+ * converting each character that is not alphanumeric into "." (a
+ * period), and null terminating dst at or before dst[len-1].  It
+ * returns the length of the resulting string.  The output is the
+ * same as that of convert_string_to_printable(), and src and dst may
+ * be the same buffer; dst must have room for len characters.
+ */
+unsigned int str_printable(char *dst, const char *src, unsigned int len);
+
+/*
+ * json_escape(dst, src, len) writes the len characters in src into
+ * dst as the contents of a JSON string, escaping quotation marks,
+ * backslashes, and control characters, and null terminates dst.  It
+ * returns the length of the resulting string.  In the worst case,
+ * dst must have room for JSON_ESCAPE_LEN(len) characters.
+ */
+#define JSON_ESCAPE_LEN(len) (6 * (len) + 1)
+
+unsigned int json_escape(char *dst, const char *src, unsigned int len);
+
+/*
+ * base64_encode(out, data, len) writes the base64 (RFC 4648)
+ * encoding of the octets in data into out, with padding, and returns
+ * the number of characters written, which is BASE64_LEN(len).  The
+ * output is NOT null terminated.
+ */
+#define BASE64_LEN(len) (4 * (((len) + 2) / 3))
+
+unsigned int base64_encode(char *out, const void *data, unsigned int len);
+
+/*
+ * base64_decode(out, in, len) writes the octets encoded in the len
+ * base64 characters in into out, which must have room for 3*len/4
+ * octets, and returns the number of octets written, or -1 if in is
+ * not valid base64
+ */
+int base64_decode(void *out, const char *in, unsigned int len);
+
+/*
+ * encode_unit_test() checks that all of the kernels produce output
+ * that is bit-for-bit identical to that of the reference
+ * implementations, and reports their throughput against the
+ * stdio-based functions that they replace; it returns ok or failure
+ */
+int encode_unit_test();
+
+#endif /* ENCODE_H */
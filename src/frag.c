@@ -0,0 +1,219 @@
+/*
+ *	
+ * Copyright (c) 2016 Cisco Systems, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * frag.c
+ *
+ * attribution of IP fragments to the flows of their datagrams
+ */
+
+#include <stdio.h>     /* for printf()   */
+#include <string.h>    /* for memcmp()   */
+#include "frag.h"
+#include "err.h"
+
+struct frag_entry {
+  union flow_addr sa;
+  union flow_addr da;
+  uint32_t id;               /* IP identification                    */
+  uint32_t expires;          /* seconds; zero if the entry is empty  */
+  uint32_t seq;              /* order in which entries were added    */
+  unsigned short sp;         /* ports of the first fragment          */
+  unsigned short dp;
+  unsigned short vlan;
+  unsigned char prot;
+  unsigned char ver;
+};
+
+static struct frag_entry frag_table[FRAG_TABLE_SETS][FRAG_TABLE_WAYS];
+
+static uint32_t frag_seq = 0;
+
+static inline unsigned int frag_table_set(const struct flow_key *key, uint32_t id) {
+  uint32_t h = id * 0x9e3779b1;
+  unsigned int i;
+
+  for (i=0; i<4; i++) {
+    h ^= (key->sa.u32[i] * 0x85ebca6b) ^ (key->da.u32[i] * 0xc2b2ae35);
+  }
+  h ^= ((uint32_t)key->prot << 16) ^ key->vlan;
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h & (FRAG_TABLE_SETS - 1);
+}
+
+static inline unsigned int frag_entry_matches(const struct frag_entry *e, const struct flow_key *key, uint32_t id) {
+  return e->id == id && e->prot == key->prot && e->vlan == key->vlan && e->ver == key->ver
+    && memcmp(&e->sa, &key->sa, sizeof(e->sa)) == 0 && memcmp(&e->da, &key->da, sizeof(e->da)) == 0;
+}
+
+void frag_table_add(const struct flow_key *key, uint32_t id, const struct timeval *ts) {
+  struct frag_entry *set = frag_table[frag_table_set(key, id)];
+  struct frag_entry *e = NULL;
+  uint32_t now = ts->tv_sec;
+  unsigned int i;
+
+  /* reuse the entry of the datagram, or an empty or expired one, or the oldest */
+  for (i=0; i<FRAG_TABLE_WAYS; i++) {
+    if (set[i].expires > now && frag_entry_matches(&set[i], key, id)) {
+      e = &set[i];
+      break;
+    }
+  }
+  for (i=0; e == NULL && i<FRAG_TABLE_WAYS; i++) {
+    if (set[i].expires <= now) {
+      e = &set[i];
+    }
+  }
+  if (e == NULL) {
+    e = &set[0];
+    for (i=1; i<FRAG_TABLE_WAYS; i++) {
+      if ((int32_t)(set[i].seq - e->seq) < 0) {
+	e = &set[i];
+      }
+    }
+  }
+  e->sa = key->sa;
+  e->da = key->da;
+  e->id = id;
+  e->expires = now + FRAG_TIMEOUT;
+  e->seq = frag_seq++;
+  e->sp = key->sp;
+  e->dp = key->dp;
+  e->vlan = key->vlan;
+  e->prot = key->prot;
+  e->ver = key->ver;
+}
+
+unsigned int frag_table_lookup(struct flow_key *key, uint32_t id, const struct timeval *ts) {
+  const struct frag_entry *set = frag_table[frag_table_set(key, id)];
+  uint32_t now = ts->tv_sec;
+  unsigned int i;
+
+  for (i=0; i<FRAG_TABLE_WAYS; i++) {
+    if (set[i].expires > now && frag_entry_matches(&set[i], key, id)) {
+      key->sp = set[i].sp;
+      key->dp = set[i].dp;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void frag_table_clear() {
+  memset(frag_table, 0, sizeof(frag_table));
+  frag_seq = 0;
+}
+
+/*
+ * frag_unit_test() checks that later fragments find the ports of
+ * their first fragments, but not those of other datagrams or expired
+ * ones, and that the table keeps the most recent entries of each set
+ * when it is full
+ */
+int frag_unit_test() {
+  struct flow_key k, l;
+  struct in_addr sa, da;
+  struct timeval ts = { 1000, 0 };
+  unsigned int i, found, capacity = FRAG_TABLE_SETS * FRAG_TABLE_WAYS;
+  int test_failed = 0;
+
+  frag_table_clear();
+  memset(&k, 0, sizeof(k));
+  sa.s_addr = htonl(0x0a000001);
+  da.s_addr = htonl(0x0a000002);
+  flow_key_set_ipv4_addrs(&k, sa, da);
+  k.prot = 17;
+  k.sp = 5353;
+  k.dp = 53;
+  frag_table_add(&k, 0x1234, &ts);
+
+  l = k;
+  l.sp = l.dp = 0;
+  ts.tv_sec += FRAG_TIMEOUT - 1;
+  if (frag_table_lookup(&l, 0x1234, &ts) != 1 || l.sp != 5353 || l.dp != 53) {
+    printf("error: fragment not attributed to its first fragment\n");
+    test_failed = 1;
+  }
+  l.sp = l.dp = 0;
+  l.prot = 6;
+  if (frag_table_lookup(&l, 0x1234, &ts) != 0) {
+    printf("error: fragment with another protocol attributed\n");
+    test_failed = 1;
+  }
+  l.prot = 17;
+  l.vlan = 10;
+  if (frag_table_lookup(&l, 0x1234, &ts) != 0 || frag_table_lookup(&k, 0x1235, &ts) != 0) {
+    printf("error: fragment of another datagram attributed\n");
+    test_failed = 1;
+  }
+  l.vlan = 0;
+  ts.tv_sec++;
+  if (frag_table_lookup(&l, 0x1234, &ts) != 0) {
+    printf("error: fragment attributed after timeout\n");
+    test_failed = 1;
+  }
+
+  /* a full table holds exactly its capacity, and the newest entries */
+  frag_table_clear();
+  for (i=0; i<8*capacity; i++) {
+    k.sp = i;
+    frag_table_add(&k, i, &ts);
+  }
+  found = 0;
+  for (i=0; i<8*capacity; i++) {
+    l = k;
+    if (frag_table_lookup(&l, i, &ts)) {
+      if (l.sp != (unsigned short)i) {
+	printf("error: fragment attributed to the wrong ports\n");
+	test_failed = 1;
+	break;
+      }
+      found++;
+    }
+  }
+  if (found != capacity || frag_table_lookup(&l, 8*capacity - 1, &ts) != 1) {
+    printf("error: full fragment table holds %u of %u entries\n", found, capacity);
+    test_failed = 1;
+  }
+  printf("fragment table: %u entries, %zu bytes\n", capacity, sizeof(frag_table));
+  frag_table_clear();
+
+  return test_failed ? failure : ok;
+}
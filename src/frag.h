@@ -0,0 +1,98 @@
+/*
+ *	
+ * Copyright (c) 2016 Cisco Systems, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * frag.h
+ *
+ * attribution of IP fragments to the flows of their datagrams
+ */
+
+#ifndef FRAG_H
+#define FRAG_H
+
+#include <stdint.h>
+#include <sys/time.h>
+#include "p2f.h"
+
+/*
+ * Only the first fragment of a fragmented datagram holds its
+ * transport header, so a later fragment cannot be assigned to a flow
+ * by its own headers.  The fragment table remembers the ports of
+ * each first fragment, keyed by the addresses, protocol, VLAN ID,
+ * and IP identification of its datagram, so that the later fragments
+ * (which share those) can be assigned to the same flow, without
+ * reassembly.  A later fragment that arrives before its first
+ * fragment, or after its entry has expired or been evicted, cannot
+ * be attributed, and is dropped.
+ *
+ * The table has a fixed size, set at compile time, and is never
+ * grown: it has FRAG_TABLE_SETS sets of FRAG_TABLE_WAYS entries, and
+ * a new entry replaces an empty or expired one in its set if there
+ * is one, and otherwise the one that expires soonest.  An entry
+ * expires FRAG_TIMEOUT seconds (of packet time) after its first
+ * fragment, as datagrams do in most IP stacks.
+ */
+#define FRAG_TABLE_SETS  1024
+#define FRAG_TABLE_WAYS     4
+#define FRAG_TIMEOUT       30
+
+enum frag_type {
+  frag_none  = 0,     /* not a fragment                       */
+  frag_first = 1,     /* offset zero, with more fragments     */
+  frag_later = 2      /* nonzero offset, no transport header  */
+};
+
+/*
+ * frag_table_add(key, id, ts) records that the datagram with
+ * identification id, whose first fragment was seen at time ts, is in
+ * the flow with the key key (including its ports)
+ */
+void frag_table_add(const struct flow_key *key, uint32_t id, const struct timeval *ts);
+
+/*
+ * frag_table_lookup(key, id, ts) sets the ports of key to those of
+ * the first fragment of the datagram with identification id, and
+ * returns 1, if that fragment is in the table and has not expired by
+ * time ts; otherwise, it returns 0
+ */
+unsigned int frag_table_lookup(struct flow_key *key, uint32_t id, const struct timeval *ts);
+
+/* frag_table_clear() empties the table */
+void frag_table_clear();
+
+int frag_unit_test();
+
+#endif /* FRAG_H */
@@ -41,8 +41,13 @@
  */
 
 #include "hdr_dsc.h"
+#include "encode.h"   /* for hex_encode() */
+#include "err.h"      /* for ok, failure  */
 
 #include <string.h>   /* for memset() */
+#include <stdlib.h>   /* for rand()   */
+#include <sys/time.h> /* for gettimeofday() */
+#include "cpu_isa.h"  /* for cpu_isa_get() */
 
 #if 0 /* this code not yet used */
 
@@ -78,44 +83,131 @@ void header_description_init(struct header_description *hd) {
   memset(hd->const_value, 0, sizeof(hd->const_value));
   memset(hd->const_mask, 0, sizeof(hd->const_mask));
   memset(hd->seq_mask, 0, sizeof(hd->seq_mask));
+  memset(hd->last_value, 0, sizeof(hd->last_value));
   hd->num_headers_seen = 0;
 }
 
 void header_description_set_initial(struct header_description *hd, const void *packet, unsigned int len) {
 
   memcpy(hd->const_value, packet, len);
+  memcpy(hd->last_value, packet, len);
   memset(hd->const_mask, 0xff, sizeof(hd->const_mask));
   hd->num_headers_seen = 1;
 }
 
-void header_description_set(struct header_description *hd, const void *packet, unsigned int len) {
-  int i;
-  const unsigned char *p = packet;
+/*
+ * the update kernels process all HDR_DSC_LEN bytes of a header that
+ * has been padded with zeros, in one AVX2 vector or two SSE2 vectors,
+ * so that they have no loop and no data-dependent branch; the padding
+ * leaves the bytes past report_hd constant and zero.  For each byte,
+ * the constant mask keeps the bits that equal the constant value, the
+ * constant value keeps the bits of the header under the mask.  A byte
+ * that first changes by one more (modulo 256) than in the last header
+ * is marked in the sequence mask, and it stays marked only for as long
+ * as every later change of it is by one more as well; the more
+ * significant bytes of a counter also stay the same between the
+ * headers in which the bytes that follow them carry into them.
+ */
 
-  /*
-   * find constant part of header, and set the constant mask and value
-   * in the header description
-   */
-  for (i=0; i<len; i++) {
+static void header_description_set_scalar(struct header_description *hd, const unsigned char *p) {
+  unsigned int i;
+
+  for (i=0; i<HDR_DSC_LEN; i++) {
+    if ((unsigned char)(hd->last_value[i] + 1) == p[i]) {
+      if (hd->const_mask[i] == 0xff) {
+	hd->seq_mask[i] = 0xff;   /* the first change of this byte */
+      }
+    } else if (hd->last_value[i] != p[i]) {
+      hd->seq_mask[i] = 0;
+    }
     hd->const_mask[i] &= ~(hd->const_value[i] ^ p[i]);
     hd->const_value[i] = hd->const_mask[i] & p[i];
+    hd->last_value[i] = p[i];
   }
+}
 
-  /* 
-   * loop over bytes of h1 and h2 from least significant to most
-   * significant, and for bytes that are not constant, detect
-   * counters, and assume counters propagate from least significant
-   * bytes to most significant bytes (i.e.  assume network byte order)
-   */
-  i=len-1; 
-  while (i >= 0) {
-    while ((hd->const_mask[i] == 0) && (hd->const_value[i] + 1 == p[i])) {
-      hd->seq_mask[i] = 0xff;
-      i--;
+#ifdef CPU_ISA_X86
+
+static TARGET_SSE2 void header_description_set_sse2(struct header_description *hd, const unsigned char *p) {
+  const __m128i one = _mm_set1_epi8(1);
+  const __m128i ones = _mm_set1_epi8(-1);
+  unsigned int i;
+
+  for (i=0; i<HDR_DSC_LEN; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i v = _mm_loadu_si128((const __m128i *)(hd->const_value + i));
+    __m128i m = _mm_loadu_si128((const __m128i *)(hd->const_mask + i));
+    __m128i s = _mm_loadu_si128((const __m128i *)(hd->seq_mask + i));
+    __m128i l = _mm_loadu_si128((const __m128i *)(hd->last_value + i));
+
+    __m128i inc = _mm_cmpeq_epi8(x, _mm_add_epi8(l, one));
+
+    s = _mm_or_si128(_mm_and_si128(s, _mm_or_si128(inc, _mm_cmpeq_epi8(x, l))),
+		     _mm_and_si128(inc, _mm_cmpeq_epi8(m, ones)));
+    m = _mm_andnot_si128(_mm_xor_si128(v, x), m);
+    _mm_storeu_si128((__m128i *)(hd->const_mask + i), m);
+    _mm_storeu_si128((__m128i *)(hd->const_value + i), _mm_and_si128(m, x));
+    _mm_storeu_si128((__m128i *)(hd->seq_mask + i), s);
+    _mm_storeu_si128((__m128i *)(hd->last_value + i), x);
+  }
+}
+
+static TARGET_AVX2 void header_description_set_avx2(struct header_description *hd, const unsigned char *p) {
+  const __m256i one = _mm256_set1_epi8(1);
+  const __m256i ones = _mm256_set1_epi8(-1);
+  __m256i x = _mm256_loadu_si256((const __m256i *)p);
+  __m256i v = _mm256_loadu_si256((const __m256i *)hd->const_value);
+  __m256i m = _mm256_loadu_si256((const __m256i *)hd->const_mask);
+  __m256i s = _mm256_loadu_si256((const __m256i *)hd->seq_mask);
+  __m256i l = _mm256_loadu_si256((const __m256i *)hd->last_value);
+
+  __m256i inc = _mm256_cmpeq_epi8(x, _mm256_add_epi8(l, one));
+
+  s = _mm256_or_si256(_mm256_and_si256(s, _mm256_or_si256(inc, _mm256_cmpeq_epi8(x, l))),
+		      _mm256_and_si256(inc, _mm256_cmpeq_epi8(m, ones)));
+  m = _mm256_andnot_si256(_mm256_xor_si256(v, x), m);
+  _mm256_storeu_si256((__m256i *)hd->const_mask, m);
+  _mm256_storeu_si256((__m256i *)hd->const_value, _mm256_and_si256(m, x));
+  _mm256_storeu_si256((__m256i *)hd->seq_mask, s);
+  _mm256_storeu_si256((__m256i *)hd->last_value, x);
+}
+
+#endif /* CPU_ISA_X86 */
+
+typedef void (*header_description_set_func)(struct header_description *hd, const unsigned char *p);
+
+/*
+ * the kernel is chosen at run time, the first time that a header is
+ * described
+ */
+static header_description_set_func header_description_set_kernel = NULL;
+
+static header_description_set_func header_description_get_kernel() {
+  if (header_description_set_kernel == NULL) {
+    switch (cpu_isa_get()) {
+#ifdef CPU_ISA_X86
+    case cpu_isa_avx2:
+      header_description_set_kernel = header_description_set_avx2;
+      break;
+    case cpu_isa_sse2:
+      header_description_set_kernel = header_description_set_sse2;
+      break;
+#endif
+    default:
+      header_description_set_kernel = header_description_set_scalar;
     }
-    i--;
   }
-  
+  return header_description_set_kernel;
+}
+
+void header_description_set(struct header_description *hd, const void *packet, unsigned int len) {
+  unsigned char p[HDR_DSC_LEN] = { 0, };
+
+  if (len < HDR_DSC_LEN) {
+    memcpy(p, packet, len);
+    packet = p;
+  }
+  header_description_get_kernel()(hd, packet);
   hd->num_headers_seen++;
 }
 
@@ -126,17 +218,14 @@ void header_description_set(struct header_description *hd, const void *packet, u
  */
 inline void header_description_update(struct header_description *hd, 
 			       const void *packet, 
-			       unsigned int report_hd) {
+			       unsigned int report_hd,
+			       unsigned int max_headers) {
   if (report_hd) {
     if (hd->num_headers_seen == 0) {
       header_description_set_initial(hd, packet, report_hd);
-    } else if (hd->num_headers_seen < 10) {
+    } else if (hd->num_headers_seen < max_headers) {
       header_description_set(hd, packet, report_hd);
     }
-    /*
-     * we could refine our description of the header based on an
-     * analysis of many successive headers, but for now we only do ten
-     */
   }
 
 } 
@@ -147,7 +236,7 @@ inline void header_description_update(struct header_description *hd,
  */
 
 void header_description_printf(const struct header_description *hd, FILE *f, unsigned int len) {
-  unsigned int i;
+  char cm[2*HDR_DSC_LEN+1], cv[2*HDR_DSC_LEN+1], sm[2*HDR_DSC_LEN+1];
 
   if (hd->num_headers_seen < 2) {
     return;  /* no point in printing out information-free data */
@@ -165,19 +254,168 @@ void header_description_printf(const struct header_description *hd, FILE *f, uns
    *  2 = other
    */
 
-  fprintf(f, ",\n\t\t\t\"hd\": [ \"n\": %u, \"cm\": \"", hd->num_headers_seen);
-  for (i=0; i<len; i++) {
-    fprintf(f, "%02x", hd->const_mask[i]);
+  if (len > HDR_DSC_LEN) {
+    len = HDR_DSC_LEN;
   }
-  fprintf(f, "\", \"cv\": \"");
-  for (i=0; i<len; i++) {
-    fprintf(f, "%02x", hd->const_value[i]);
+  cm[hex_encode(cm, hd->const_mask, len)] = 0;
+  cv[hex_encode(cv, hd->const_value, len)] = 0;
+  sm[hex_encode(sm, hd->seq_mask, len)] = 0;
+  fprintf(f, ",\n\t\t\t\"hd\": [ \"n\": %u, \"cm\": \"%s\", \"cv\": \"%s\", \"sm\": \"%s\" ]",
+	  hd->num_headers_seen, cm, cv, sm);
+
+}
+
+
+struct header_description_kernel {
+  const char *name;
+  header_description_set_func set;
+};
+
+/*
+ * header_description_unit_test() checks the description of a stream
+ * of RTP headers, checks each available kernel against the scalar one
+ * on random headers, and times the kernels
+ */
+int header_description_unit_test() {
+  struct header_description_kernel kernels[3];
+  struct header_description hd, ref;
+  unsigned char h[HDR_DSC_LEN], rtp[12], first[12], changed[12];
+  unsigned char headers[64][HDR_DSC_LEN];
+  unsigned int i, j, k, num_kernels = 0, iters = 1000000;
+  unsigned int seq, ts;
+  header_description_set_func kernel;
+  struct timeval start;
+  int num_fails = 0;
+
+  kernels[num_kernels].name = "scalar";
+  kernels[num_kernels++].set = header_description_set_scalar;
+#ifdef CPU_ISA_X86
+  if (cpu_isa_get() >= cpu_isa_sse2) {
+    kernels[num_kernels].name = "sse2";
+    kernels[num_kernels++].set = header_description_set_sse2;
   }
-  fprintf(f, "\", \"sm\": \"");
-  for (i=0; i<len; i++) {
-    fprintf(f, "%02x", hd->seq_mask[i]);
+  if (cpu_isa_get() >= cpu_isa_avx2) {
+    kernels[num_kernels].name = "avx2";
+    kernels[num_kernels++].set = header_description_set_avx2;
   }
-  fprintf(f, "\" ]");
+#endif
+  kernel = header_description_get_kernel();
 
-}
+  /*
+   * RTP: version 2, payload type 0, a sequence number that wraps its
+   * low byte, a timestamp that advances by 160, and a constant SSRC;
+   * the constant mask holds the bits that never changed over the
+   * first 500 headers
+   */
+  for (k=0; k<num_kernels; k++) {
+    header_description_set_kernel = kernels[k].set;
+    header_description_init(&hd);
+    memset(changed, 0, sizeof(changed));
+    seq = 0x00fe;
+    ts = 0x12345678;
+    for (i=0; i<600; i++, seq++, ts += 160) {
+      rtp[0] = 0x80;
+      rtp[1] = 0x00;
+      rtp[2] = seq >> 8;
+      rtp[3] = seq;
+      rtp[4] = ts >> 24;
+      rtp[5] = ts >> 16;
+      rtp[6] = ts >> 8;
+      rtp[7] = ts;
+      rtp[8] = 0xde;
+      rtp[9] = 0xad;
+      rtp[10] = 0xbe;
+      rtp[11] = 0xef;
+      header_description_update(&hd, rtp, sizeof(rtp), 500);
+      if (i == 0) {
+	memcpy(first, rtp, sizeof(rtp));
+      } else if (i < 500) {
+	for (j=0; j<sizeof(rtp); j++) {
+	  changed[j] |= first[j] ^ rtp[j];
+	}
+      }
+    }
+    if (hd.num_headers_seen != 500) {
+      printf("error: %s header description saw %u headers\n", kernels[k].name, hd.num_headers_seen);
+      num_fails++;
+    }
+    for (j=0; j<sizeof(rtp); j++) {
+      if (hd.const_mask[j] != (unsigned char)~changed[j] || hd.const_value[j] != (first[j] & ~changed[j])) {
+	printf("error: %s header description has wrong constant mask or value at byte %u\n", kernels[k].name, j);
+	num_fails++;
+      }
+    }
+    if (hd.const_mask[0] != 0xff || hd.const_value[0] != 0x80 || hd.const_mask[3] != 0
+	|| memcmp(hd.const_value + 8, rtp + 8, 4) != 0 || hd.const_mask[8] != 0xff || hd.const_mask[11] != 0xff) {
+      printf("error: %s header description has wrong constant mask\n", kernels[k].name);
+      num_fails++;
+    }
+    if (hd.seq_mask[0] != 0 || hd.seq_mask[1] != 0 || hd.seq_mask[2] != 0xff || hd.seq_mask[3] != 0xff
+	|| hd.seq_mask[7] != 0 || hd.seq_mask[8] != 0 || hd.seq_mask[11] != 0) {
+      printf("error: %s header description has wrong sequence mask\n", kernels[k].name);
+      num_fails++;
+    }
+  }
+
+  /*
+   * random headers, with some constant bytes, some counters, and some
+   * random bytes, over 1000 headers; only the counters are in the
+   * sequence mask, since every random byte changes by something other
+   * than one at some point
+   */
+  for (k=0; k<num_kernels; k++) {
+    header_description_init(&hd);
+    header_description_init(&ref);
+    for (i=0; i<1000; i++) {
+      for (j=0; j<HDR_DSC_LEN; j++) {
+	switch (j % 4) {
+	case 0:
+	  h[j] = j;
+	  break;
+	case 1:
+	  h[j] = i + j;
+	  break;
+	case 2:
+	  h[j] = rand() % (j + 2);
+	  break;
+	default:
+	  h[j] = rand();
+	  break;
+	}
+      }
+      header_description_set_kernel = header_description_set_scalar;
+      header_description_update(&ref, h, HDR_DSC_LEN, 1000);
+      header_description_set_kernel = kernels[k].set;
+      header_description_update(&hd, h, HDR_DSC_LEN, 1000);
+    }
+    if (memcmp(&hd, &ref, sizeof(hd)) != 0) {
+      printf("error: %s header description does not match scalar\n", kernels[k].name);
+      num_fails++;
+    }
+    for (j=0; j<HDR_DSC_LEN; j++) {
+      if (hd.seq_mask[j] != ((j % 4 == 1) ? 0xff : 0)) {
+	printf("error: %s header description has wrong sequence mask at byte %u of random headers\n", kernels[k].name, j);
+	num_fails++;
+      }
+    }
+  }
+
+  for (i=0; i<64; i++) {
+    for (j=0; j<HDR_DSC_LEN; j++) {
+      headers[i][j] = (j < 4) ? j : i * j;
+    }
+  }
+  for (k=0; k<num_kernels; k++) {
+    header_description_set_kernel = kernels[k].set;
+    header_description_init(&hd);
+    gettimeofday(&start, NULL);
+    for (i=0; i<iters; i++) {
+      header_description_update(&hd, headers[i % 64], HDR_DSC_LEN, iters);
+    }
+    printf("header description of %u-byte header, %-6s: %5.2f ns/header\n", 
+	   HDR_DSC_LEN, kernels[k].name, time_diff(&start) * 1e9 / iters);
+  }
+  header_description_set_kernel = kernel;
 
+  return num_fails ? failure : ok;
+}
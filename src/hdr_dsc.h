@@ -47,18 +47,39 @@
 
 #define HDR_DSC_LEN 32
 
+/* default number of headers of each flow that are described */
+#define HDR_DSC_PKTS 10
+
+/*
+ * a header description holds, for the first report_hd bytes of the
+ * payloads of a flow, a mask of the bits that have been constant
+ * and their values, and a mask of the bytes that have changed, and
+ * only ever by increasing by one from one header to the next, as the
+ * bytes of a counter in network byte order do (the most significant
+ * ones only when the ones that follow them wrap around); last_value
+ * holds the previous header, for the latter
+ */
 struct header_description {
   unsigned char const_mask[HDR_DSC_LEN];
   unsigned char const_value[HDR_DSC_LEN];
   unsigned char seq_mask[HDR_DSC_LEN];
+  unsigned char last_value[HDR_DSC_LEN];
   unsigned int num_headers_seen;
 };
 
 void header_description_init(struct header_description *hd);
 
+/*
+ * header_description_update(hd, packet, report_hd, max_headers) adds
+ * the first report_hd bytes at packet to the description hd, if it
+ * describes fewer than max_headers headers
+ */
 void header_description_update(struct header_description *hd, 
 			       const void *packet, 
-			       unsigned int report_hd);
+			       unsigned int report_hd,
+			       unsigned int max_headers);
+
+int header_description_unit_test();
 
 void header_description_printf(const struct header_description *hd, FILE *f, unsigned int len);
 
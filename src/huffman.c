@@ -42,22 +42,11 @@
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <ctype.h>  /* for isblank() */
+#include <string.h>  /* for memset() */
+#include <ctype.h>   /* for isblank() */
 
-#include "err.h"   /* for failure and ok */
-
-#define COUNT_SIZE 0xffffff
-
-unsigned int counts[COUNT_SIZE];
-unsigned int values[COUNT_SIZE];
-unsigned int num_values = 0;
-
-struct huffman_node {
-  unsigned int count;   /* number of instances of this node   */
-  unsigned int value;   /* codeword, if this node is a leaf   */
-  struct huffman_node *left;  /* left child, or NULL if leaf  */
-  struct huffman_node *right; /* right child, or NULL if leaf */
-}; 
+#include "huffman.h"
+#include "err.h"     /* for failure and ok */
 
 #include <math.h>
 #include <float.h>   /* for FLT_EPSILON */
@@ -82,30 +71,298 @@ float compute_entropy(const unsigned int *counts,
   return sum / logf(2.0);
 }
 
-struct huffman_node *make_code(unsigned int counts[COUNT_SIZE]) {
+/*
+ * huffman_lengths(counts, n, len) sets len[i] to the length of the
+ * codeword for symbol i in a Huffman code for the histogram counts,
+ * and returns the length of the longest codeword.  The tree is built
+ * by repeatedly merging the two lightest nodes; since there are at
+ * most HUFFMAN_MAX_SYMBOLS symbols, a linear search for those nodes
+ * is fast enough.
+ */
+static unsigned int huffman_lengths(const unsigned int *counts, unsigned int n, unsigned char *len) {
+  unsigned long long int weight[2*HUFFMAN_MAX_SYMBOLS];
+  int parent[2*HUFFMAN_MAX_SYMBOLS];
+  unsigned char active[2*HUFFMAN_MAX_SYMBOLS];
+  unsigned int i, num_nodes = n, num_active = 0, max_len = 0;
+
+  for (i=0; i<n; i++) {
+    weight[i] = counts[i];
+    parent[i] = -1;
+    active[i] = (counts[i] != 0);
+    num_active += active[i];
+  }
+
+  if (num_active == 1) {
+    /* a code with one codeword still needs one bit per symbol */
+    for (i=0; i<n; i++) {
+      len[i] = active[i];
+    }
+    return 1;
+  }
+
+  while (num_active > 1) {
+    int a = -1, b = -1;
+
+    for (i=0; i<num_nodes; i++) {
+      if (!active[i]) {
+	continue;
+      }
+      if (a < 0 || weight[i] < weight[a]) {
+	b = a;
+	a = i;
+      } else if (b < 0 || weight[i] < weight[b]) {
+	b = i;
+      }
+    }
+    weight[num_nodes] = weight[a] + weight[b];
+    parent[num_nodes] = -1;
+    active[num_nodes] = 1;
+    parent[a] = parent[b] = num_nodes;
+    active[a] = active[b] = 0;
+    num_nodes++;
+    num_active--;
+  }
+
+  for (i=0; i<n; i++) {
+    int node;
+
+    len[i] = 0;
+    if (counts[i]) {
+      for (node = parent[i]; node >= 0; node = parent[node]) {
+	len[i]++;
+      }
+      if (len[i] > max_len) {
+	max_len = len[i];
+      }
+    }
+  }
+  return max_len;
+}
+
+int huffman_code_init_from_lengths(struct huffman_code *c, const unsigned char *len, unsigned int num_symbols) {
+  uint32_t next_code[HUFFMAN_MAX_LEN+1];
+  uint32_t code = 0;
+  unsigned long long int kraft = 0;
+  unsigned int i, l, k = 0;
+
+  if (num_symbols > HUFFMAN_MAX_SYMBOLS) {
+    return failure;
+  }
+  c->num_symbols = num_symbols;
+  memset(c->count, 0, sizeof(c->count));
+  for (i=0; i<num_symbols; i++) {
+    if (len[i] > HUFFMAN_MAX_LEN) {
+      return failure;
+    }
+    c->len[i] = len[i];
+    c->count[len[i]]++;
+    if (len[i]) {
+      kraft += 1ULL << (HUFFMAN_MAX_LEN - len[i]);
+    }
+  }
+  if (kraft > (1ULL << HUFFMAN_MAX_LEN)) {
+    return failure;   /* lengths do not describe a prefix code */
+  }
+  c->count[0] = 0;
+
+  /* assign consecutive codewords to the symbols of each length */
+  for (l=1; l<=HUFFMAN_MAX_LEN; l++) {
+    code = (code + c->count[l-1]) << 1;
+    next_code[l] = code;
+  }
+  for (l=1; l<=HUFFMAN_MAX_LEN; l++) {
+    for (i=0; i<num_symbols; i++) {
+      if (c->len[i] == l) {
+	c->code[i] = next_code[l]++;
+	c->symbol[k++] = i;
+      }
+    }
+  }
+  for (i=0; i<num_symbols; i++) {
+    if (c->len[i] == 0) {
+      c->code[i] = 0;
+    }
+  }
+
+  return ok;
+}
+
+int huffman_code_init_from_counts(struct huffman_code *c, const unsigned int *counts, unsigned int num_symbols) {
+  unsigned int scaled[HUFFMAN_MAX_SYMBOLS];
+  unsigned char len[HUFFMAN_MAX_SYMBOLS];
   unsigned int i;
-  struct huffman_node *list;
-  struct huffman_node *node_array[COUNT_SIZE];
 
-  for (i=0; i<COUNT_SIZE; i++) {
-    /*
-     * allocate and initialize huffman_node
-     */
-    struct huffman_node *node = malloc(sizeof(struct huffman_node));
-    if (node == NULL) {
-      return NULL;   
+  if (num_symbols > HUFFMAN_MAX_SYMBOLS) {
+    return failure;
+  }
+  memcpy(scaled, counts, num_symbols * sizeof(unsigned int));
+
+  /*
+   * if the code is too deep, flatten the histogram and try again;
+   * each pass halves the ratio of the largest and smallest counts
+   */
+  while (huffman_lengths(scaled, num_symbols, len) > HUFFMAN_MAX_LEN) {
+    for (i=0; i<num_symbols; i++) {
+      if (scaled[i]) {
+	scaled[i] = (scaled[i] >> 1) | 1;
+      }
     }
-    node->left = NULL;
-    node->right = NULL;
-    node->count = counts[i];
-    node_array[i] = node;
   }
 
-  /* heapify */
-  
-  return NULL;
+  return huffman_code_init_from_lengths(c, len, num_symbols);
+}
+
+void bit_buffer_init(struct bit_buffer *b, void *data, unsigned int size) {
+  b->data = data;
+  b->size = size;
+  b->bit = 0;
+}
+
+int bit_buffer_put(struct bit_buffer *b, uint32_t bits, unsigned int num_bits) {
+
+  if (b->bit + num_bits > b->size * 8) {
+    return failure;
+  }
+  while (num_bits--) {
+    unsigned int octet = b->bit / 8;
+    unsigned int shift = 7 - (b->bit % 8);
+
+    if (shift == 7) {
+      b->data[octet] = 0;
+    }
+    b->data[octet] |= ((bits >> num_bits) & 1) << shift;
+    b->bit++;
+  }
+  return ok;
+}
+
+int bit_buffer_get(struct bit_buffer *b, unsigned int num_bits, uint32_t *bits) {
+  uint32_t x = 0;
+
+  if (b->bit + num_bits > b->size * 8) {
+    return failure;
+  }
+  while (num_bits--) {
+    x = (x << 1) | ((b->data[b->bit / 8] >> (7 - (b->bit % 8))) & 1);
+    b->bit++;
+  }
+  *bits = x;
+  return ok;
+}
+
+int huffman_encode(struct bit_buffer *b, const struct huffman_code *c, unsigned int symbol) {
+
+  if (symbol >= c->num_symbols || c->len[symbol] == 0) {
+    return failure;
+  }
+  return bit_buffer_put(b, c->code[symbol], c->len[symbol]);
 }
 
+int huffman_decode(struct bit_buffer *b, const struct huffman_code *c) {
+  uint32_t bit, code = 0, first = 0, index = 0;
+  unsigned int l;
+
+  /*
+   * the codewords of each length are consecutive integers, starting
+   * at first; so a codeword of length l has been read when code -
+   * first is less than the number of codewords of that length
+   */
+  for (l=1; l<=HUFFMAN_MAX_LEN; l++) {
+    if (bit_buffer_get(b, 1, &bit) != ok) {
+      return -1;
+    }
+    code |= bit;
+    if (code - first < c->count[l]) {
+      return c->symbol[index + code - first];
+    }
+    index += c->count[l];
+    first = (first + c->count[l]) << 1;
+    code <<= 1;
+  }
+  return -1;
+}
+
+int huffman_unit_test() {
+  struct huffman_code c;
+  unsigned int counts[HUFFMAN_MAX_SYMBOLS];
+  unsigned char buf[4096];
+  struct bit_buffer b;
+  unsigned int i, n, num_octets, sym[1024];
+  unsigned long long int bits = 0;
+  int num_fails = 0;
+
+  /* a skewed (geometric) distribution yields a deep code */
+  for (i=0; i<40; i++) {
+    counts[i] = 1 << (i < 30 ? 30 - i : 0);
+  }
+  if (huffman_code_init_from_counts(&c, counts, 40) != ok) {
+    num_fails++;
+  }
+  for (i=0; i<40; i++) {
+    if (c.len[i] == 0 || c.len[i] > HUFFMAN_MAX_LEN) {
+      num_fails++;
+    }
+  }
+
+  /* round trip through the bit buffer */
+  srand(1);
+  bit_buffer_init(&b, buf, sizeof(buf));
+  for (n=0; n<1024; n++) {
+    sym[n] = (rand() % 7) * (rand() % 6);   /* favors small symbols */
+    if (huffman_encode(&b, &c, sym[n]) != ok) {
+      num_fails++;
+    }
+  }
+  num_octets = bit_buffer_get_num_octets(&b);
+  bit_buffer_init(&b, buf, num_octets);
+  for (i=0; i<n; i++) {
+    if (huffman_decode(&b, &c) != (int) sym[i]) {
+      num_fails++;
+      break;
+    }
+  }
+
+  /* the average codeword length is within one bit of the entropy */
+  memset(counts, 0, sizeof(counts));
+  for (i=0; i<n; i++) {
+    counts[sym[i]]++;
+  }
+  huffman_code_init_from_counts(&c, counts, 40);
+  for (i=0; i<40; i++) {
+    bits += (unsigned long long int) counts[i] * c.len[i];
+  }
+  if ((float) bits / n > compute_entropy(counts, 40) + 1.0) {
+    num_fails++;
+  }
+
+  /* lengths that violate the Kraft inequality are rejected */
+  {
+    unsigned char bad[3] = { 1, 1, 1 };
+    if (huffman_code_init_from_lengths(&c, bad, 3) != failure) {
+      num_fails++;
+    }
+  }
+
+  if (num_fails) {
+    fprintf(info, "error: %d huffman tests failed\n", num_fails);
+  }
+  return num_fails ? failure : ok;
+}
+
+#ifdef MAIN
+
+/*
+ * the huffman program reads a histogram of values, in the form of a
+ * file of weights and values, and prints out the corresponding
+ * Huffman code; the codeword lengths can be used as a static table
+ */
+
+FILE *info;
+
+unsigned int counts[HUFFMAN_MAX_SYMBOLS];
+unsigned int values[HUFFMAN_MAX_SYMBOLS];
+unsigned int num_values = 0;
+
 #define LINEMAX 1024
 
 int file_read_weights_and_values(const char *fname) {
@@ -149,8 +406,8 @@ int file_read_weights_and_values(const char *fname) {
        */
       num = sscanf(line, "%u %u", &weight, &value);
       if (num == 2) {
-	if (value > 0xffffffff) {
-	  printf("error: value %u too large at line %u in file %s\n", value, linecount, fname);
+	if (i >= HUFFMAN_MAX_SYMBOLS) {
+	  printf("error: too many values at line %u in file %s\n", linecount, fname);
 	  exit(EXIT_FAILURE);
 	}
 
@@ -174,6 +431,7 @@ int file_read_weights_and_values(const char *fname) {
   }
   
   free(line);
+  fclose(f);
 
   num_values = i;
 
@@ -185,14 +443,42 @@ void usage(const char *progname) {
 }
 
 int main(int argc, char *argv[]) {
+  struct huffman_code code;
+  unsigned long long int total = 0, bits = 0;
+  unsigned int i, j;
+
+  info = stderr;
 
   if (argc == 2) {
-    file_read_weights_and_values(argv[1]);
+    if (file_read_weights_and_values(argv[1]) != ok) {
+      return EXIT_FAILURE;
+    }
   } else {
     usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (huffman_code_init_from_counts(&code, counts, num_values) != ok) {
+    fprintf(stderr, "error: could not generate code\n");
+    return EXIT_FAILURE;
   }
 
+  printf("# weight\tvalue\tlength\tcodeword\n");
+  for (i=0; i<num_values; i++) {
+    printf("%u\t%u\t%u\t", counts[i], values[i], code.len[i]);
+    for (j=code.len[i]; j>0; j--) {
+      printf("%u", (code.code[i] >> (j-1)) & 1);
+    }
+    printf("\n");
+    total += counts[i];
+    bits += (unsigned long long int) counts[i] * code.len[i];
+  }
   printf("entropy: %f\n", compute_entropy(counts, num_values));
+  if (total) {
+    printf("average codeword length: %f\n", (float) bits / total);
+  }
   
   return 0;
 }
+
+#endif /* MAIN */
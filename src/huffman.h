@@ -0,0 +1,101 @@
+/*
+ *	
+ * Copyright (c) 2016 Cisco Systems, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * huffman.h
+ *
+ * huffman code generation, encoding, and decoding routines
+ */
+
+#ifndef HUFFMAN_H
+#define HUFFMAN_H
+
+#include <stdint.h>   /* for uint32_t */
+
+/*
+ * a huffman_code is a canonical Huffman code over the symbols 0,
+ * ..., num_symbols-1; it can be generated from a histogram of symbol
+ * counts, or from a (static) table of codeword lengths.  Symbols with
+ * a codeword length of zero cannot be encoded.
+ */
+
+#define HUFFMAN_MAX_SYMBOLS 256
+#define HUFFMAN_MAX_LEN      24
+
+struct huffman_code {
+  unsigned int num_symbols;
+  unsigned char len[HUFFMAN_MAX_SYMBOLS];       /* codeword lengths         */
+  uint32_t code[HUFFMAN_MAX_SYMBOLS];           /* codewords, right aligned */
+  unsigned short count[HUFFMAN_MAX_LEN+1];      /* codewords of each length */
+  unsigned short symbol[HUFFMAN_MAX_SYMBOLS];   /* symbols, canonical order */
+};
+
+int huffman_code_init_from_counts(struct huffman_code *c, const unsigned int *counts, unsigned int num_symbols);
+
+int huffman_code_init_from_lengths(struct huffman_code *c, const unsigned char *len, unsigned int num_symbols);
+
+/*
+ * a bit_buffer holds a sequence of bits, most significant bit of each
+ * octet first, in memory supplied by the caller; it is used for both
+ * writing and reading
+ */
+struct bit_buffer {
+  unsigned char *data;
+  unsigned int size;      /* size of data, in octets      */
+  unsigned int bit;       /* bits written or read so far  */
+};
+
+void bit_buffer_init(struct bit_buffer *b, void *data, unsigned int size);
+
+int bit_buffer_put(struct bit_buffer *b, uint32_t bits, unsigned int num_bits);
+
+int bit_buffer_get(struct bit_buffer *b, unsigned int num_bits, uint32_t *bits);
+
+#define bit_buffer_get_num_octets(b) (((b)->bit + 7) / 8)
+
+int huffman_encode(struct bit_buffer *b, const struct huffman_code *c, unsigned int symbol);
+
+/*
+ * huffman_decode(b, c) returns the next symbol read from b, or -1 if
+ * the bits in b do not form a codeword
+ */
+int huffman_decode(struct bit_buffer *b, const struct huffman_code *c);
+
+float compute_entropy(const unsigned int *counts, unsigned int num_elements);
+
+int huffman_unit_test();
+
+#endif /* HUFFMAN_H */
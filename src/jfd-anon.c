@@ -45,19 +45,44 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <unistd.h>      /* for getopt(), sysconf() */
+#include <fcntl.h>       /* for open()              */
+#include <pthread.h>
+#include <sys/mman.h>    /* for mmap()              */
+#include <sys/stat.h>    /* for fstat()             */
 #include "anon.h"
-#include "radix_trie.h"   /* for rt_test() */
+#include "jfd_reader.h"
 
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 
-char *address_string_anonymize(char *addr_string) {
+/*
+ * address_string_anonymize(addr_string, anon_string) returns
+ * anon_string, into which it has written the anonymized form of the
+ * address addr_string, or addr_string if the address does not need
+ * anonymization, or NULL if it is not an address; anon_string must
+ * have room for ANON_STRING6_LEN characters
+ */
+char *address_string_anonymize(char *addr_string, char *anon_string) {
   struct in_addr addr;
+  struct in6_addr addr6;
   int l;
 
   l = strnlen(addr_string, 256);
+  if (strchr(addr_string, ':')) {
+    if (l >= INET6_ADDRSTRLEN) {
+      return addr_string;
+    }
+    if (inet_pton(AF_INET6, addr_string, &addr6) != 1) {
+      return NULL;
+    }
+    if (ipv6_addr_needs_anonymization(&addr6)) {
+      return addr_get_anon_string6(&addr6, anon_string);
+    }
+    return addr_string;
+  }
   if (l >= 32) {
     return addr_string;  /* probably already anonymized */
   }
@@ -66,61 +91,151 @@ char *address_string_anonymize(char *addr_string) {
     return NULL;
   }
   if (ipv4_addr_needs_anonymization(&addr)) {
-    return addr_get_anon_hexstring(&addr);
+    return addr_get_anon_hexstring(&addr, anon_string);
   }
   return addr_string;
 }
 
-void anon_addresses(char *line) {
-  char *addr;
-  char addr_string[256];
+/*
+ * output is accumulated in an out_buf, so that each thread can
+ * format its records independently, and the results can be written
+ * in order
+ */
+struct out_buf {
+  char *data;
+  size_t len;
+  size_t size;
+};
 
-  addr = strstr(line, "\"sa\":");
-  if (addr) {
-    sscanf(addr + 7, "%[a-fA-F0-9.]", addr_string);
-    printf("\t\t\t\"sa\": \"%s\",\n", address_string_anonymize(addr_string));
-    //      printf("%s", addr);
-  } else {
-    addr = strstr(line, "\"da\":");
-    if (addr) {
-      sscanf(addr + 7, "%[a-fA-F0-9.]", addr_string);
-      printf("\t\t\t\"da\": \"%s\",\n", address_string_anonymize(addr_string));
-      //      printf("%s", addr);
-    } else {
-      printf("%s", line);
+static void out_buf_write(struct out_buf *b, const void *data, size_t len) {
+  if (b->len + len > b->size) {
+    size_t size = b->size ? b->size : 4096;
+    char *tmp;
+
+    while (size < b->len + len) {
+      size *= 2;
+    }
+    tmp = realloc(b->data, size);
+    if (tmp == NULL) {
+      fprintf(stderr, "error: could not allocate output buffer\n");
+      exit(EXIT_FAILURE);
+    }
+    b->data = tmp;
+    b->size = size;
+  }
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+}
+
+static void out_buf_flush(struct out_buf *b, FILE *f) {
+  fwrite(b->data, 1, b->len, f);
+  b->len = 0;
+}
+
+/*
+ * the fields of a flow object that hold addresses, in the order in
+ * which pcap2flow writes them
+ */
+#define NUM_ADDR_FIELDS 2
+
+static const char *addr_field[NUM_ADDR_FIELDS] = { "sa", "da" };
+
+/*
+ * anon_addresses(out, rec, flow) writes the text of the record rec,
+ * with the addresses in the flow object (which is either rec or
+ * inside of it) anonymized, and everything else unchanged; the
+ * addresses that need anonymization are encrypted together
+ */
+void anon_addresses(struct out_buf *out, const struct jfd_object *rec, const struct jfd_object *flow) {
+  const char *text = rec->text;
+  const char *value[NUM_ADDR_FIELDS];
+  unsigned int len[NUM_ADDR_FIELDS];
+  int anon_index[NUM_ADDR_FIELDS];
+  struct in_addr addr[NUM_ADDR_FIELDS];
+  char anon[NUM_ADDR_FIELDS][ANON_HEXSTRING_LEN];
+  char anon6[NUM_ADDR_FIELDS][ANON_STRING6_LEN];
+  const char *anon_string[NUM_ADDR_FIELDS];
+  char addr_string[INET6_ADDRSTRLEN];
+  struct in6_addr addr6;
+  unsigned int i, num_anon = 0;
+
+  for (i=0; i<NUM_ADDR_FIELDS; i++) {
+    value[i] = jfd_object_get(flow, addr_field[i], &len[i]);
+  }
+  if (value[0] && value[1] && value[1] < value[0]) {
+    const char *tmp = value[0];
+    unsigned int tmp_len = len[0];
+
+    value[0] = value[1];
+    len[0] = len[1];
+    value[1] = tmp;
+    len[1] = tmp_len;
+  }
+
+  /* IPv4 addresses are encrypted together; IPv6 ones, one at a time */
+  for (i=0; i<NUM_ADDR_FIELDS; i++) {
+    anon_index[i] = -1;
+    anon_string[i] = NULL;
+    if (value[i] == NULL || value[i][0] != '"' || len[i] - 2 >= sizeof(addr_string)) {
+      continue;   /* long strings are probably already anonymized */
+    }
+    memcpy(addr_string, value[i] + 1, len[i] - 2);
+    addr_string[len[i] - 2] = 0;
+    if (memchr(addr_string, ':', len[i] - 2)) {
+      if (inet_pton(AF_INET6, addr_string, &addr6) == 1 && ipv6_addr_needs_anonymization(&addr6)) {
+	anon_string[i] = addr_get_anon_string6(&addr6, anon6[i]);
+      }
+    } else if (len[i] - 2 < 32 && inet_aton(addr_string, &addr[num_anon]) 
+	       && ipv4_addr_needs_anonymization(&addr[num_anon])) {
+      anon_index[i] = num_anon++;
+    }
+  }
+  if (num_anon) {
+    addr_get_anon_hexstring_batch(addr, anon, num_anon);
+  }
+
+  for (i=0; i<NUM_ADDR_FIELDS; i++) {
+    if (anon_index[i] >= 0) {
+      anon_string[i] = anon[anon_index[i]];
+    }
+    if (anon_string[i] == NULL) {
+      continue;
     }
-  }   
+    out_buf_write(out, text, value[i] - text);
+    out_buf_write(out, "\"", 1);
+    out_buf_write(out, anon_string[i], strlen(anon_string[i]));
+    out_buf_write(out, "\"", 1);
+    text = value[i] + len[i];
+  }
+  out_buf_write(out, text, rec->text + rec->len - text);
 }
 
-void check_anon_addresses(char *line) {
-  char *addr;
+void check_anon_addresses(struct out_buf *out, const struct jfd_object *flow) {
   char addr_string[256];
+  char anon_string[ANON_STRING6_LEN];
+  char line[512];
   char *retval;
+  unsigned int i;
 
-  addr = strstr(line, "\"sa\":");
-  if (addr) {
-    sscanf(addr + 7, "%[a-fA-F0-9.]", addr_string);
-    
-    retval =  address_string_anonymize(addr_string);
+  for (i=0; i<NUM_ADDR_FIELDS; i++) {
+    if (jfd_object_get_string(flow, addr_field[i], addr_string, sizeof(addr_string)) < 0) {
+      continue;
+    }
+    retval = address_string_anonymize(addr_string, anon_string);
     if (retval && retval != addr_string) {
-      printf("sa needs anonymization: %s\t%s\n", addr_string, retval);
+      out_buf_write(out, line, snprintf(line, sizeof(line), "%s needs anonymization: %s\t%s\n",
+					addr_field[i], addr_string, retval));
     }
-  } else {
-    addr = strstr(line, "\"da\":");
-    if (addr) {
-      sscanf(addr + 7, "%[a-fA-F0-9.]", addr_string);
-      retval =  address_string_anonymize(addr_string);
-      if (retval && retval != addr_string) {
-	printf("da needs anonymization: %s\t%s\n", addr_string, retval);
-      }
-    }   
   }
 }
 
 
 int usage(char *name) {
-  fprintf(stderr, "usage: %s [-c] [ anonfile ]\n", name);
-  fprintf(stderr, "   reads JSON Flow Data from stdin, and anonymizes the subnets in anonfile\n");
+  fprintf(stderr, "usage: %s [-c] [-p] [-t threads] [ anonfile [ file ... ] ]\n", name);
+  fprintf(stderr, "   reads JSON Flow Data from each file, or from stdin, and anonymizes the subnets in anonfile\n");
+  fprintf(stderr, "   -c           report the addresses that need anonymization, instead of anonymizing them\n");
+  fprintf(stderr, "   -p           use prefix-preserving anonymization, with dotted quad output\n");
+  fprintf(stderr, "   -t threads   number of threads used for files (default: number of processors)\n");
   return 1;
 }
 
@@ -129,88 +244,360 @@ enum mode {
   check = 1
 };
 
+/*
+ * process_records(out, r, mode, f) processes each record from the
+ * reader r, writing its output to out; in translate mode, the text
+ * between records is copied to the output unchanged.  If f is not
+ * NULL, out is flushed to f as it fills.
+ */
+static enum status process_records(struct out_buf *out, struct jfd_reader *r, enum mode mode, FILE *f) {
+  struct jfd_object rec, flow;
+  const char *gap;
+  size_t gap_len;
 
-int main(int argc, char *argv[]) {
-  ssize_t bytes_read;
+  while (jfd_reader_next(r, &rec) == ok) {
+    if (jfd_object_get_object(&rec, "flow", &flow) != ok) {
+      flow = rec;
+    }
+    if (mode == translate) {
+      gap = jfd_reader_gap(r, &gap_len);
+      out_buf_write(out, gap, gap_len);
+      anon_addresses(out, &rec, &flow);
+    } else {
+      /* mode == check */
+      check_anon_addresses(out, &flow);
+    }
+    if (f && out->len > 65536) {
+      out_buf_flush(out, f);
+    }
+  }
+  if (mode == translate) {
+    gap = jfd_reader_gap(r, &gap_len);
+    out_buf_write(out, gap, gap_len);
+  }
+  if (f) {
+    out_buf_flush(out, f);
+  }
+  if (jfd_reader_error(r)) {
+    return failure;
+  }
+  return ok;
+}
+
+/*
+ * Files are read with mmap(), and split into chunks of whole records,
+ * which are processed by a pool of threads; the output of each chunk
+ * is held in its own buffer, and the buffers are written out in
+ * order.  At most num_slots chunks are in progress at once, so that
+ * memory use does not depend on the size of the file.  A chunk ends
+ * at the first record boundary found by jfd_record_boundary() after
+ * CHUNK_SIZE octets, so that the file is only scanned for structure
+ * once, by the threads, each of which reads its chunk as a fragment.
+ * A file whose first record does not start a line is not split.
+ */
+
+#define CHUNK_SIZE   (4 << 20)
+#define MAX_THREADS  256
+
+struct chunk {
+  const char *text;        /* records, and the text between them    */
   size_t len;
-  char *line = NULL;  
+  struct out_buf out;
+  unsigned int done;
+  long int balance;        /* from jfd_reader_balance()             */
+  const char *error;
+};
+
+struct chunk_queue {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct chunk *chunk;
+  unsigned int num_slots;
+  unsigned long int produced;
+  unsigned long int taken;
+  unsigned long int written;
+  unsigned int finished;
+  enum mode mode;
+  unsigned int errors;
+  long int balance;        /* sum of the balances of the chunks     */
+};
+
+static void *chunk_worker(void *arg) {
+  struct chunk_queue *q = arg;
+  struct chunk *c;
+  struct jfd_reader r;
+
+  pthread_mutex_lock(&q->lock);
+  while (1) {
+    if (q->taken < q->produced) {
+      c = &q->chunk[q->taken % q->num_slots];
+      q->taken++;
+      pthread_mutex_unlock(&q->lock);
+
+      c->error = NULL;
+      c->balance = 0;
+      if (jfd_reader_init_fragment(&r, c->text, c->len) != ok) {
+	c->error = "could not initialize JSON reader";
+      } else {
+	if (process_records(&c->out, &r, q->mode, NULL) != ok) {
+	  c->error = jfd_reader_error(&r);
+	}
+	c->balance = jfd_reader_balance(&r);
+	jfd_reader_free(&r);
+      }
+
+      pthread_mutex_lock(&q->lock);
+      c->done = 1;
+      pthread_cond_broadcast(&q->cond);
+    } else if (q->finished) {
+      break;
+    } else {
+      pthread_cond_wait(&q->cond, &q->lock);
+    }
+  }
+  pthread_mutex_unlock(&q->lock);
+  return NULL;
+}
+
+/*
+ * chunk_queue_write_oldest(q) waits for the oldest chunk to be
+ * processed, and writes it to stdout; it is called with q->lock held.
+ * A closing bracket in a chunk that matches nothing in the chunks
+ * before it means that the file is malformed.
+ */
+static void chunk_queue_write_oldest(struct chunk_queue *q) {
+  struct chunk *c = &q->chunk[q->written % q->num_slots];
+
+  while (!c->done) {
+    pthread_cond_wait(&q->cond, &q->lock);
+  }
+  pthread_mutex_unlock(&q->lock);
+  out_buf_flush(&c->out, stdout);
+  if (c->error) {
+    fprintf(stderr, "error: %s\n", c->error);
+    q->errors++;
+  }
+  q->balance += c->balance;
+  if (q->balance < 0 && !c->error) {
+    fprintf(stderr, "error: mismatched brackets\n");
+    q->errors++;
+  }
+  pthread_mutex_lock(&q->lock);
+  c->done = 0;
+  q->written++;
+}
+
+static void chunk_queue_put(struct chunk_queue *q, const struct chunk *chunk) {
+  struct chunk *c;
+
+  pthread_mutex_lock(&q->lock);
+  while (q->produced - q->written == q->num_slots) {
+    chunk_queue_write_oldest(q);
+  }
+  c = &q->chunk[q->produced % q->num_slots];
+  c->text = chunk->text;
+  c->len = chunk->len;
+  q->produced++;
+  pthread_cond_broadcast(&q->cond);
+  pthread_mutex_unlock(&q->lock);
+}
+
+/*
+ * record_indent(text, len, indent_len) returns the whitespace in front
+ * of the first record in text, on its line, and sets *indent_len to
+ * its length, or returns NULL if the first record does not start a
+ * line or there is no record
+ */
+static const char *record_indent(const char *text, size_t len, size_t *indent_len) {
+  struct jfd_reader r;
+  const char *rec, *indent = NULL;
+  size_t rec_len;
+
+  if (jfd_reader_init_buffer(&r, text, len) != ok) {
+    return NULL;
+  }
+  if (jfd_reader_next_text(&r, &rec, &rec_len) == ok) {
+    indent = rec;
+    while (indent > text && (indent[-1] == ' ' || indent[-1] == '\t')) {
+      indent--;
+    }
+    if (indent > text && indent[-1] != '\n') {
+      indent = NULL;
+    }
+    *indent_len = rec - indent;
+  }
+  jfd_reader_free(&r);
+  return indent;
+}
+
+/*
+ * anon_file(path, mode, num_threads) processes the file path, writing
+ * its output to stdout
+ */
+static enum status anon_file(const char *path, enum mode mode, unsigned int num_threads) {
+  int fd;
+  struct stat st;
+  const char *text, *indent;
+  size_t pos, next, indent_len = 0;
+  struct chunk_queue q;
+  struct chunk chunk;
+  pthread_t thread[MAX_THREADS];
+  unsigned int i;
+  enum status status = ok;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(path);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return failure;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return ok;
+  }
+  text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (text == MAP_FAILED) {
+    perror(path);
+    close(fd);
+    return failure;
+  }
+  madvise((void *)text, st.st_size, MADV_SEQUENTIAL);
+
+  memset(&q, 0, sizeof(q));
+  pthread_mutex_init(&q.lock, NULL);
+  pthread_cond_init(&q.cond, NULL);
+  q.mode = mode;
+  q.num_slots = 2 * num_threads;
+  q.chunk = calloc(q.num_slots, sizeof(struct chunk));
+  if (q.chunk == NULL) {
+    fprintf(stderr, "error: could not allocate memory\n");
+    exit(EXIT_FAILURE);
+  }
+  for (i=0; i<num_threads; i++) {
+    if (pthread_create(&thread[i], NULL, chunk_worker, &q) != 0) {
+      fprintf(stderr, "error: could not create thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  /* split the file at the first record boundary after each CHUNK_SIZE octets */
+  indent = record_indent(text, st.st_size, &indent_len);
+  for (pos = 0; pos < (size_t)st.st_size; pos = next) {
+    next = st.st_size;
+    if (indent && next - pos > CHUNK_SIZE) {
+      next = jfd_record_boundary(text, st.st_size, pos + CHUNK_SIZE, indent, indent_len);
+    }
+    chunk.text = text + pos;
+    chunk.len = next - pos;
+    chunk_queue_put(&q, &chunk);
+  }
+
+  pthread_mutex_lock(&q.lock);
+  q.finished = 1;
+  pthread_cond_broadcast(&q.cond);
+  while (q.written < q.produced) {
+    chunk_queue_write_oldest(&q);
+  }
+  pthread_mutex_unlock(&q.lock);
+  for (i=0; i<num_threads; i++) {
+    pthread_join(thread[i], NULL);
+  }
+
+  if (q.balance > 0 && !q.errors) {
+    fprintf(stderr, "error: %s: unexpected end of input\n", path);
+    status = failure;
+  }
+  if (q.errors) {
+    status = failure;
+  }
+
+  for (i=0; i<q.num_slots; i++) {
+    free(q.chunk[i].out.data);
+  }
+  free(q.chunk);
+  pthread_cond_destroy(&q.cond);
+  pthread_mutex_destroy(&q.lock);
+  munmap((void *)text, st.st_size);
+  close(fd);
+
+  return status;
+}
+
+int main(int argc, char *argv[]) {
   enum status err;
   char *anonfile = NULL;
   enum mode mode = translate;
+  enum anon_mode anon_mode = anon_mode_aes;
+  long int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int c;
 
-  // rt_test();
-  // exit(1);
-
-  if (argc == 1) {
-    mode = translate;   /* this option just copies stdin to stdout */
-  } else if (argc == 2) {
-    anonfile = argv[1];
-  } else if (argc == 3) {
-    if (strcmp(argv[1], "-c")) {
-      usage(argv[0]);
+  while ((c = getopt(argc, argv, "cpt:")) != -1) {
+    switch (c) {
+    case 'c':
+      mode = check;
+      break;
+    case 'p':
+      anon_mode = anon_mode_prefix_preserving;
+      break;
+    case 't':
+      num_threads = atoi(optarg);
+      if (num_threads < 1 || num_threads > MAX_THREADS) {
+	fprintf(stderr, "error: number of threads must be between 1 and %u\n", MAX_THREADS);
+	return EXIT_FAILURE;
+      }
+      break;
+    default:
+      return usage(argv[0]);
     }
-    mode = check;
-    anonfile = argv[2];
-  } else {    
+  }
+  if (num_threads < 1) {
+    num_threads = 1;
+  } else if (num_threads > MAX_THREADS) {
+    num_threads = MAX_THREADS;
+  }
+
+  if (optind < argc) {
+    anonfile = argv[optind++];
+  } else if (mode == check) {
     return usage(argv[0]);
   }
+  /* with no anonfile, stdin is just copied to stdout */
+
   if (anonfile) {
     err = anon_init(anonfile, stderr);
     if (err) {
       fprintf(stderr, "error: could not initialize anonymization from file %s\n",
-	      argv[1]);
+	      anonfile);
       return EXIT_FAILURE;
     }
+    anon_set_mode(anon_mode);
   }
-  //  printf("mode: %u\n", mode);
-
-  /*
-   * read and then process each line of input
-   */
-  while ((bytes_read = getline(&line, &len, stdin)) != -1) {
-
-#if 0
-    unsigned int i;
-    char *text;
-    char lhs[256];
 
-    /* remove leading whitespace */
-    i = 0;
-    text = line;
-    while (isblank(*text) && (i < len)) { 
-      text++;
-      i++;
-    } 
-
-#if 0
-    if (*text == '{') {
-      printf("{");
-    } else if (*text == '}') {
-      printf("}");
-    }
-#endif
-
-    if (sscanf(text, "%[\"a-zA-Z_{}]", lhs) > 0) {
-      printf("lhs: %s\n", lhs);
-      if (strncmp(lhs, "flow", 5) == 0) {
-	printf("found flow\n");
+  if (optind < argc) {
+    err = ok;
+    for ( ; optind < argc; optind++) {
+      if (anon_file(argv[optind], mode, num_threads) != ok) {
+	err = failure;
       }
     }
+    return err == ok ? 0 : EXIT_FAILURE;
 
-#else 
-    
-    if (mode == translate) {
-      anon_addresses(line);
-    } else {
-      /* mode == check */
-      check_anon_addresses(line);
-    }
-#endif    
-
+  } else {
+    struct jfd_reader reader;
+    struct out_buf out = { NULL, 0, 0 };
 
+    if (jfd_reader_init_file(&reader, stdin) != ok) {
+      fprintf(stderr, "error: could not initialize JSON reader\n");
+      return EXIT_FAILURE;
+    }
+    err = process_records(&out, &reader, mode, stdout);
+    if (err != ok) {
+      fprintf(stderr, "error: %s\n", jfd_reader_error(&reader));
+    }
+    jfd_reader_free(&reader);
+    free(out.data);
+    return err == ok ? 0 : EXIT_FAILURE;
   }
-      
-  free(line);
- 
-  return 0;
 }
@@ -0,0 +1,1278 @@
+/*
+ *	
+ * Copyright (c) 2016 Cisco Systems, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * jfd_reader.c
+ *
+ * streaming reader for JSON flow data
+ */
+
+#include <stdio.h>      /* for fread()         */
+#include <stdlib.h>     /* for malloc()        */
+#include <string.h>     /* for memcpy()        */
+#include <sys/time.h>   /* for gettimeofday()  */
+#include "jfd_reader.h"
+
+#define JFD_BLOCK       64
+#define JFD_SCAN_BATCH  (64 * 1024)   /* octets scanned at a time */
+
+static inline unsigned int jfd_is_space(char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+/*
+ * jfd_escaped(backslash, carry) returns the bits of the characters in
+ * a block that are escaped by a backslash, given the bits of the
+ * backslashes; *carry is 1 if the first character of the block is
+ * escaped, and is set to 1 if the first character of the next block
+ * is.  Backslashes are rare outside of the "exe" and "hd" fields, so
+ * a simple loop suffices.
+ */
+static inline uint64_t jfd_escaped(uint64_t backslash, uint64_t *carry) {
+  uint64_t escaped = *carry;
+  uint64_t next_carry = 0;
+
+  backslash &= ~escaped;
+  while (backslash) {
+    uint64_t bit = backslash & (~backslash + 1);
+
+    backslash ^= bit;
+    if (bit & 0x8000000000000000ULL) {
+      next_carry = 1;
+    } else {
+      escaped |= bit << 1;
+      backslash &= ~(bit << 1);
+    }
+  }
+  *carry = next_carry;
+  return escaped;
+}
+
+/*
+ * prefix_xor(x) sets each bit of x to the exclusive-or of that bit and
+ * all of the bits below it, which turns the bits of the quotation
+ * marks into a mask of the characters inside of strings
+ */
+static inline uint64_t prefix_xor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+/*
+ * jfd_ctz(x) returns the number of trailing zero bits of x, or 64 if x
+ * is zero
+ */
+static inline uint32_t jfd_ctz(uint64_t x) {
+  return x ? __builtin_ctzll(x) : 64;
+}
+
+/*
+ * jfd_block_finish(r, quote, backslash, op, offset) appends the
+ * offsets of the structural characters of the block at offset to the
+ * index, given the bits of its quotation marks, backslashes, and
+ * other structural characters
+ */
+static inline __attribute__((always_inline))
+void jfd_block_finish(struct jfd_reader *r, uint64_t quote, uint64_t backslash,
+		      uint64_t op, uint32_t offset) {
+  uint64_t in_string, structural;
+  uint32_t *si = r->si + r->num_si;
+
+  if (backslash | r->escape_carry) {
+    quote &= ~jfd_escaped(backslash, &r->escape_carry);
+  }
+  in_string = prefix_xor(quote) ^ r->in_string;
+  r->in_string = (uint64_t)((int64_t)in_string >> 63);
+
+  /* an opening quotation mark is inside of its string */
+  structural = (op & ~in_string) | (quote & in_string);
+
+  /*
+   * the offsets are written four at a time, without a branch for each
+   * one; the entries past the last one are overwritten later, and the
+   * index has room for them (see jfd_reader_scan())
+   */
+  r->num_si += __builtin_popcountll(structural);
+  while (structural) {
+    si[0] = offset + jfd_ctz(structural);
+    structural &= structural - 1;
+    si[1] = offset + jfd_ctz(structural);
+    structural &= structural - 1;
+    si[2] = offset + jfd_ctz(structural);
+    structural &= structural - 1;
+    si[3] = offset + jfd_ctz(structural);
+    structural &= structural - 1;
+    si += 4;
+  }
+}
+
+/*
+ * The scalar scanner classifies eight characters at a time in a 64-bit
+ * word.  jfd_swar_eq(w, c) sets the high bit of each byte of w that
+ * equals c, without carries between bytes, and jfd_swar_bits(m)
+ * gathers those high bits into the low eight bits, in the order of the
+ * characters in memory.
+ */
+#define JFD_SWAR_ONES 0x0101010101010101ULL
+#define JFD_SWAR_LOW7 0x7f7f7f7f7f7f7f7fULL
+#define JFD_SWAR_HIGH 0x8080808080808080ULL
+
+static inline uint64_t jfd_swar_eq(uint64_t w, unsigned char c) {
+  uint64_t x = w ^ (JFD_SWAR_ONES * c);
+
+  return ~(((x & JFD_SWAR_LOW7) + JFD_SWAR_LOW7) | x) & JFD_SWAR_HIGH;
+}
+
+static inline uint64_t jfd_swar_bits(uint64_t m) {
+  return ((m >> 7) * 0x0102040810204080ULL) >> 56;
+}
+
+static void jfd_scan_block_scalar(struct jfd_reader *r, const char *p, uint32_t offset) {
+  uint64_t quote = 0, backslash = 0, op = 0, w, b;
+  unsigned int i;
+
+  for (i=0; i<JFD_BLOCK; i += 8) {
+    memcpy(&w, p + i, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    b = w | (JFD_SWAR_ONES * 0x20);   /* '[' and ']' become '{' and '}' */
+    quote |= jfd_swar_bits(jfd_swar_eq(w, '"')) << i;
+    backslash |= jfd_swar_bits(jfd_swar_eq(w, '\\')) << i;
+    op |= jfd_swar_bits(jfd_swar_eq(b, '{') | jfd_swar_eq(b, '}') | 
+			jfd_swar_eq(w, ':') | jfd_swar_eq(w, ',')) << i;
+  }
+  jfd_block_finish(r, quote, backslash, op, offset);
+}
+
+static void jfd_scan_scalar(struct jfd_reader *r, size_t end) {
+  while (r->scanned + JFD_BLOCK <= end) {
+    jfd_scan_block_scalar(r, r->text + r->scanned, r->scanned);
+    r->scanned += JFD_BLOCK;
+  }
+}
+
+#ifdef CPU_ISA_X86
+
+/*
+ * The SIMD scanners classify characters with comparisons.  Braces
+ * and brackets differ only in bit 0x20, so (c | 0x20) is compared
+ * against '{' and '}' to find all four.
+ */
+
+static TARGET_SSE2 uint64_t jfd_mask_sse2(const char *p, char c) {
+  __m128i v = _mm_set1_epi8(c);
+  uint64_t m0 = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), v));
+  uint64_t m1 = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 16)), v));
+  uint64_t m2 = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 32)), v));
+  uint64_t m3 = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 48)), v));
+
+  return m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+}
+
+static TARGET_SSE2 uint64_t jfd_op_sse2(const char *p) {
+  const __m128i x20 = _mm_set1_epi8(0x20);
+  const __m128i open = _mm_set1_epi8('{');
+  const __m128i close = _mm_set1_epi8('}');
+  const __m128i colon = _mm_set1_epi8(':');
+  const __m128i comma = _mm_set1_epi8(',');
+  uint64_t op = 0;
+  unsigned int i;
+
+  for (i=0; i<JFD_BLOCK; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i b = _mm_or_si128(v, x20);
+    __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(b, open), _mm_cmpeq_epi8(b, close)),
+			     _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+
+    op |= (uint64_t)_mm_movemask_epi8(m) << i;
+  }
+  return op;
+}
+
+static TARGET_SSE2 void jfd_scan_sse2(struct jfd_reader *r, size_t end) {
+  while (r->scanned + JFD_BLOCK <= end) {
+    const char *p = r->text + r->scanned;
+
+    jfd_block_finish(r, jfd_mask_sse2(p, '"'), jfd_mask_sse2(p, '\\'), jfd_op_sse2(p), r->scanned);
+    r->scanned += JFD_BLOCK;
+  }
+}
+
+static TARGET_AVX2 void jfd_scan_avx2(struct jfd_reader *r, size_t end) {
+  const __m256i x20 = _mm256_set1_epi8(0x20);
+  const __m256i open = _mm256_set1_epi8('{');
+  const __m256i close = _mm256_set1_epi8('}');
+  const __m256i colon = _mm256_set1_epi8(':');
+  const __m256i comma = _mm256_set1_epi8(',');
+  const __m256i dquote = _mm256_set1_epi8('"');
+  const __m256i bslash = _mm256_set1_epi8('\\');
+
+  while (r->scanned + JFD_BLOCK <= end) {
+    const char *p = r->text + r->scanned;
+    __m256i v0 = _mm256_loadu_si256((const __m256i *)p);
+    __m256i v1 = _mm256_loadu_si256((const __m256i *)(p + 32));
+    __m256i b0 = _mm256_or_si256(v0, x20);
+    __m256i b1 = _mm256_or_si256(v1, x20);
+    __m256i op0 = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(b0, open), _mm256_cmpeq_epi8(b0, close)),
+				  _mm256_or_si256(_mm256_cmpeq_epi8(v0, colon), _mm256_cmpeq_epi8(v0, comma)));
+    __m256i op1 = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(b1, open), _mm256_cmpeq_epi8(b1, close)),
+				  _mm256_or_si256(_mm256_cmpeq_epi8(v1, colon), _mm256_cmpeq_epi8(v1, comma)));
+    uint64_t quote = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v0, dquote))
+      | ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, dquote)) << 32);
+    uint64_t backslash = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v0, bslash))
+      | ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, bslash)) << 32);
+    uint64_t op = (uint32_t)_mm256_movemask_epi8(op0)
+      | ((uint64_t)(uint32_t)_mm256_movemask_epi8(op1) << 32);
+
+    jfd_block_finish(r, quote, backslash, op, r->scanned);
+    r->scanned += JFD_BLOCK;
+  }
+}
+
+#endif /* CPU_ISA_X86 */
+
+/*
+ * jfd_reader_scan(r) scans up to JFD_SCAN_BATCH more octets of text,
+ * and at the end of the input, the final partial block
+ */
+static enum status jfd_reader_scan(struct jfd_reader *r) {
+  size_t end = r->len;
+
+  if (end - r->scanned > JFD_SCAN_BATCH) {
+    end = r->scanned + JFD_SCAN_BATCH;
+  }
+  if (r->num_si + (end - r->scanned) + JFD_BLOCK > r->si_size) {
+    unsigned int size = r->num_si + (end - r->scanned) + JFD_BLOCK;
+    uint32_t *tmp = realloc(r->si, size * sizeof(uint32_t));
+
+    if (tmp == NULL) {
+      r->error = "could not allocate structural index";
+      return failure;
+    }
+    r->si = tmp;
+    r->si_size = size;
+  }
+
+  switch (r->isa) {
+#ifdef CPU_ISA_X86
+  case cpu_isa_avx2:
+    jfd_scan_avx2(r, end);
+    break;
+  case cpu_isa_sse2:
+    jfd_scan_sse2(r, end);
+    break;
+#endif
+  default:
+    jfd_scan_scalar(r, end);
+  }
+
+  if (r->eof && end == r->len && r->scanned < r->len) {
+    char block[JFD_BLOCK];
+
+    memset(block, ' ', sizeof(block));
+    memcpy(block, r->text + r->scanned, r->len - r->scanned);
+    jfd_scan_block_scalar(r, block, r->scanned);
+    r->scanned = r->len;
+  }
+  return ok;
+}
+
+/*
+ * jfd_reader_compact(r) discards the text and structural index
+ * entries that precede the current position, so that offsets stay
+ * small and, for a file, there is room to read more
+ */
+static void jfd_reader_compact(struct jfd_reader *r) {
+  size_t delta = r->consumed;
+  unsigned int keep = r->in_record ? r->record_si : r->si_pos;
+  unsigned int i;
+
+  for (i=keep; i<r->num_si; i++) {
+    r->si[i - keep] = r->si[i] - delta;
+  }
+  r->num_si -= keep;
+  r->si_pos -= keep;
+  r->record_si -= keep;
+
+  if (r->f) {
+    if (r->len > delta) {
+      memmove(r->buf, r->buf + delta, r->len - delta);
+    }
+  } else {
+    r->text += delta;
+  }
+  r->len -= delta;
+  r->scanned -= delta;
+  r->record_start -= delta;
+  r->last_quote = r->last_quote > delta ? r->last_quote - delta : 0;
+  r->consumed = 0;
+}
+
+static enum status jfd_reader_read(struct jfd_reader *r) {
+  size_t bytes;
+
+  if (r->buf_size - r->len < r->read_size) {
+    size_t size = r->len + r->read_size;
+    char *tmp = realloc(r->buf, size);
+
+    if (tmp == NULL) {
+      r->error = "could not allocate input buffer";
+      return failure;
+    }
+    r->buf = tmp;
+    r->text = tmp;
+    r->buf_size = size;
+  }
+  bytes = fread(r->buf + r->len, 1, r->read_size, r->f);
+  if (bytes == 0) {
+    if (ferror(r->f)) {
+      r->error = "could not read input";
+      return failure;
+    }
+    r->eof = 1;
+  }
+  r->len += bytes;
+  return ok;
+}
+
+static enum status jfd_reader_init(struct jfd_reader *r) {
+  memset(r, 0, sizeof(*r));
+  r->isa = cpu_isa_get();
+  r->si_size = JFD_SCAN_BATCH + JFD_BLOCK;
+  r->si = malloc(r->si_size * sizeof(uint32_t));
+  if (r->si == NULL) {
+    return failure;
+  }
+  return ok;
+}
+
+enum status jfd_reader_init_file(struct jfd_reader *r, FILE *f) {
+  if (jfd_reader_init(r) != ok) {
+    return failure;
+  }
+  r->f = f;
+  r->read_size = JFD_READ_SIZE;
+  return ok;
+}
+
+enum status jfd_reader_init_buffer(struct jfd_reader *r, const char *text, size_t len) {
+  if (jfd_reader_init(r) != ok) {
+    return failure;
+  }
+  r->text = text;
+  r->len = len;
+  r->eof = 1;
+  return ok;
+}
+
+enum status jfd_reader_init_fragment(struct jfd_reader *r, const char *text, size_t len) {
+  if (jfd_reader_init_buffer(r, text, len) != ok) {
+    return failure;
+  }
+  r->fragment = 1;
+  return ok;
+}
+
+long int jfd_reader_balance(const struct jfd_reader *r) {
+  return (long int)r->depth - (long int)r->num_unmatched;
+}
+
+size_t jfd_record_boundary(const char *text, size_t len, size_t pos, const char *indent, size_t indent_len) {
+  const char *p = text + pos, *end = text + len;
+
+  while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+    p++;
+    if ((size_t)(end - p) > indent_len && memcmp(p, indent, indent_len) == 0 && p[indent_len] == '{') {
+      return p + indent_len - text;
+    }
+  }
+  return len;
+}
+
+void jfd_reader_free(struct jfd_reader *r) {
+  free(r->buf);
+  free(r->si);
+  r->buf = NULL;
+  r->si = NULL;
+}
+
+const char *jfd_reader_error(const struct jfd_reader *r) {
+  return r->error;
+}
+
+const char *jfd_reader_gap(const struct jfd_reader *r, size_t *len) {
+  *len = r->gap_len;
+  return r->gap;
+}
+
+/*
+ * jfd_object_index(o, base, si, a, b) indexes the fields of the
+ * object whose braces are the structural characters si[a] and si[b]
+ */
+static enum status jfd_object_index(struct jfd_object *o, const char *base, 
+				    const uint32_t *si, unsigned int a, unsigned int b) {
+  unsigned int k = a + 1;
+
+  o->text = base + si[a];
+  o->len = si[b] - si[a] + 1;
+  o->base = base;
+  o->si = si;
+  o->num_fields = 0;
+
+  while (k < b) {
+    struct jfd_field field;
+    const char *v, *end;
+
+    /* key */
+    if (base[si[k]] != '"' || k + 1 >= b || base[si[k+1]] != ':') {
+      return failure;
+    }
+    field.key = base + si[k] + 1;
+    end = base + si[k+1] - 1;
+    while (jfd_is_space(*end)) {
+      end--;
+    }
+    if (end < field.key) {
+      return failure;
+    }
+    field.key_len = end - field.key;
+
+    /* value */
+    v = base + si[k+1] + 1;
+    while (jfd_is_space(*v)) {
+      v++;
+    }
+    k += 2;
+    field.value = v;
+    field.si_begin = field.si_end = 0;
+    if (*v == '{' || *v == '[') {
+      unsigned int depth = 0;
+
+      if (base + si[k] != v) {
+	return failure;
+      }
+      field.si_begin = k;
+      for ( ; k < b; k++) {
+	char c = base[si[k]];
+
+	if (c == '{' || c == '[') {
+	  depth++;
+	} else if (c == '}' || c == ']') {
+	  if (--depth == 0) {
+	    break;
+	  }
+	}
+      }
+      if (k >= b) {
+	return failure;
+      }
+      field.si_end = k;
+      field.value_len = base + si[k] - v + 1;
+      k++;
+    } else {
+      if (*v == '"') {
+	if (base + si[k] != v) {
+	  return failure;
+	}
+	k++;
+      }
+      end = base + si[k] - 1;
+      while (end >= v && jfd_is_space(*end)) {
+	end--;
+      }
+      if (end < v) {
+	return failure;
+      }
+      field.value_len = end - v + 1;
+    }
+
+    if (o->num_fields < JFD_MAX_FIELDS) {
+      o->field[o->num_fields++] = field;
+    }
+
+    /* separator */
+    if (base[si[k]] == ',') {
+      k++;
+    } else if (k != b) {
+      return failure;
+    }
+  }
+  return ok;
+}
+
+/*
+ * jfd_reader_process(r, c, o) updates the state of the parser with
+ * the structural character c at offset o, and returns 1 if it
+ * completed a record
+ */
+static inline int jfd_reader_process(struct jfd_reader *r, char c, size_t o) {
+  switch (c) {
+  case '{':
+  case '[':
+    if (r->depth >= JFD_MAX_DEPTH) {
+      r->error = "objects nested too deeply";
+      return -1;
+    }
+    if (!r->in_record && c == '{' && (r->depth == 0 || r->depth == r->list_depth)) {
+      r->in_record = 1;
+      r->record_start = o;
+      r->record_si = r->si_pos;
+      r->record_depth = r->depth + 1;
+    }
+    if (c == '[' && (r->depth == 0 || (r->depth == 1 && r->list_pending))) {
+      r->list_depth = r->depth + 1;
+    }
+    r->list_pending = 0;
+    r->stack[r->depth++] = c;
+    break;
+  case '}':
+  case ']':
+    if (r->depth == 0 && r->fragment) {
+      r->num_unmatched++;   /* closes something before the fragment */
+      break;
+    }
+    if (r->depth == 0 || r->stack[r->depth - 1] != c - 2) {
+      r->error = "mismatched brackets";
+      return -1;
+    }
+    r->depth--;
+    if (r->depth < r->list_depth) {
+      r->list_depth = 0;
+    }
+    if (r->in_record && r->depth == r->record_depth - 1) {
+      r->in_record = 0;
+      return 1;
+    }
+    break;
+  case '"':
+    r->last_quote = o;
+    break;
+  case ':':
+    /*
+     * a pcap2flow file is a single object, whose records are in the
+     * "appflows" array
+     */
+    if (r->depth == 1 && r->stack[0] == '{' && o - r->last_quote >= 10 &&
+	memcmp(r->text + r->last_quote, "\"appflows\"", 10) == 0) {
+      r->in_record = 0;
+      r->list_pending = 1;
+    }
+    break;
+  default:
+    r->list_pending = 0;
+  }
+  return 0;
+}
+
+/*
+ * jfd_reader_skip(r) advances through the structural characters of a
+ * record, in which only the brackets matter, stopping at the one that
+ * closes the record, or at a key of a top-level object, which might
+ * be "appflows"
+ */
+static inline void jfd_reader_skip(struct jfd_reader *r) {
+  unsigned int pos = r->si_pos, depth = r->depth;
+  
+  for ( ; pos < r->num_si; pos++) {
+    char c = r->text[r->si[pos]];
+
+    if ((c | 0x20) == '{') {
+      if (depth >= JFD_MAX_DEPTH) {
+	break;
+      }
+      r->stack[depth++] = c;
+    } else if ((c | 0x20) == '}') {
+      if (depth == r->record_depth || r->stack[depth - 1] != c - 2) {
+	break;
+      }
+      depth--;
+    } else if (depth == 1 && c != ',') {
+      break;
+    }
+  }
+  r->si_pos = pos;
+  r->depth = depth;
+}
+
+/*
+ * jfd_reader_find(r, end) locates the next record, whose braces are
+ * the structural characters r->record_si and *end
+ */
+static enum status jfd_reader_find(struct jfd_reader *r, unsigned int *end) {
+
+  if (r->error) {
+    return failure;
+  }
+
+  while (1) {
+    while (r->si_pos < r->num_si) {
+      size_t o;
+      int retval;
+
+      if (r->in_record) {
+	jfd_reader_skip(r);
+	if (r->si_pos == r->num_si) {
+	  break;
+	}
+      }
+      o = r->si[r->si_pos];
+      retval = jfd_reader_process(r, r->text[o], o);
+
+      if (retval < 0) {
+	return failure;
+      }
+      if (retval > 0) {
+	*end = r->si_pos;
+	r->gap = r->text + r->consumed;
+	r->gap_len = r->record_start - r->consumed;
+	r->consumed = o + 1;
+	r->si_pos++;
+	return ok;
+      }
+      r->si_pos++;
+    }
+
+    /* need more of the structural index */
+    if (r->scanned + (r->eof ? 0 : JFD_BLOCK - 1) < r->len) {
+      if (r->f == NULL) {
+	jfd_reader_compact(r);
+      }
+      if (jfd_reader_scan(r) != ok) {
+	return failure;
+      }
+    } else if (r->eof) {
+      break;
+    } else {
+      jfd_reader_compact(r);
+      if (jfd_reader_read(r) != ok) {
+	return failure;
+      }
+    }
+  }
+
+  /* end of input */
+  r->gap = r->text + r->consumed;
+  r->gap_len = r->len - r->consumed;
+  r->consumed = r->len;
+  if ((r->depth != 0 && !r->fragment) || r->in_record || r->in_string) {
+    r->error = "unexpected end of input";
+  }
+  return failure;
+}
+
+enum status jfd_reader_next(struct jfd_reader *r, struct jfd_object *rec) {
+  unsigned int end;
+
+  if (jfd_reader_find(r, &end) != ok) {
+    return failure;
+  }
+  if (jfd_object_index(rec, r->text, r->si, r->record_si, end) != ok) {
+    r->error = "malformed object";
+    return failure;
+  }
+  return ok;
+}
+
+enum status jfd_reader_next_text(struct jfd_reader *r, const char **text, size_t *len) {
+  unsigned int end;
+
+  if (jfd_reader_find(r, &end) != ok) {
+    return failure;
+  }
+  *text = r->text + r->record_start;
+  *len = r->consumed - r->record_start;
+  return ok;
+}
+
+const char *jfd_object_get(const struct jfd_object *o, const char *key, unsigned int *len) {
+  unsigned int i, key_len = strlen(key);
+
+  for (i=0; i<o->num_fields; i++) {
+    const struct jfd_field *f = &o->field[i];
+
+    if (f->key_len == key_len && memcmp(f->key, key, key_len) == 0) {
+      *len = f->value_len;
+      return f->value;
+    }
+  }
+  return NULL;
+}
+
+enum status jfd_object_get_object(const struct jfd_object *o, const char *key, struct jfd_object *child) {
+  unsigned int i, key_len = strlen(key);
+
+  for (i=0; i<o->num_fields; i++) {
+    const struct jfd_field *f = &o->field[i];
+
+    if (f->key_len == key_len && memcmp(f->key, key, key_len) == 0) {
+      if (f->value[0] != '{') {
+	return failure;
+      }
+      return jfd_object_index(child, o->base, o->si, f->si_begin, f->si_end);
+    }
+  }
+  return failure;
+}
+
+static unsigned int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  c |= 0x20;
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return 16;
+}
+
+int jfd_object_get_string(const struct jfd_object *o, const char *key, char *out, unsigned int size) {
+  const char *v, *end;
+  unsigned int len, n = 0;
+
+  v = jfd_object_get(o, key, &len);
+  if (v == NULL || len < 2 || v[0] != '"' || v[len-1] != '"') {
+    return -1;
+  }
+  end = v + len - 1;
+  v++;
+  while (v < end) {
+    char c = *v++;
+
+    if (n + 4 >= size) {
+      return -1;
+    }
+    if (c != '\\') {
+      out[n++] = c;
+      continue;
+    }
+    c = *v++;
+    switch (c) {
+    case 'b': out[n++] = '\b'; break;
+    case 'f': out[n++] = '\f'; break;
+    case 'n': out[n++] = '\n'; break;
+    case 'r': out[n++] = '\r'; break;
+    case 't': out[n++] = '\t'; break;
+    case 'u': {
+      unsigned int i, u = 0;
+      
+      if (end - v < 4) {
+	return -1;
+      }
+      for (i=0; i<4; i++) {
+	unsigned int x = hex_value(*v++);
+
+	if (x > 15) {
+	  return -1;
+	}
+	u = (u << 4) | x;
+      }
+      /* UTF-8; surrogate pairs are not combined */
+      if (u < 0x80) {
+	out[n++] = u;
+      } else if (u < 0x800) {
+	out[n++] = 0xc0 | (u >> 6);
+	out[n++] = 0x80 | (u & 0x3f);
+      } else {
+	out[n++] = 0xe0 | (u >> 12);
+	out[n++] = 0x80 | ((u >> 6) & 0x3f);
+	out[n++] = 0x80 | (u & 0x3f);
+      }
+      break;
+    }
+    default:
+      out[n++] = c;   /* '"', '\\', and '/' */
+    }
+  }
+  out[n] = 0;
+  return n;
+}
+
+enum status jfd_object_get_uint(const struct jfd_object *o, const char *key, unsigned long long *x) {
+  const char *v;
+  unsigned int i, len;
+  unsigned long long value = 0;
+
+  v = jfd_object_get(o, key, &len);
+  if (v == NULL || len == 0 || len > 19) {
+    return failure;
+  }
+  for (i=0; i<len; i++) {
+    if (v[i] < '0' || v[i] > '9') {
+      return failure;
+    }
+    value = value * 10 + (v[i] - '0');
+  }
+  *x = value;
+  return ok;
+}
+
+/*
+ * unit test
+ */
+
+static const char *jfd_test_doc = 
+  "{\n"
+  "\"version\": \"1.0\",\n"
+  "\"metadata\": {\n"
+  "  \"note\": \"appflows\", \"list\": [ 1, { \"appflows\": 2 } ]\n"
+  "},\n"
+  "\"appflows\": [\n"
+  "\t{\n"
+  "\t\t\"flow\": {\n"
+  "\t\t\t\"sa\": \"10.0.0.1\",\n"
+  "\t\t\t\"da\": \"10.0.0.2\",\n"
+  "\t\t\t\"sp\": 1234,\n"
+  "\t\t\t\"dp\": 443,\n"
+  "\t\t\t\"exe\": \"C:\\\\Program Files\\\\x \\\"{[,:]}\\\" \\u00e9\",\n"
+  "\t\t\t\"non_norm_stats\": [\n"
+  "\t\t\t\t{ \"b\": 31, \"dir\": \">\", \"ipt\": 0 },\n"
+  "\t\t\t\t{ \"b\": 158, \"dir\": \"<\", \"ipt\": 31 }\n"
+  "\t\t\t]\n"
+  "\t\t}\n"
+  "\t},\n"
+  "\t{\n"
+  "\t\t\"flow\": {\n"
+  "\t\t\t\"sa\": \"192.168.1.1\",\n"
+  "\t\t\t\"da\": \"8.8.8.8\",\n"
+  "\t\t\t\"sp\": 53,\n"
+  "\t\t\t\"dp\": 53\n"
+  "\t\t}\n"
+  "\t},\n"
+  "\t{ \"sa\": \"1.2.3.4\", \"da\": \"\\\\\", \"sp\": 0, \"dp\": 0, \"x\": {} }\n"
+  "]\n"
+  "}\n";
+
+static const char *jfd_test_sa[] = { "10.0.0.1", "192.168.1.1", "1.2.3.4" };
+static const char *jfd_test_da[] = { "10.0.0.2", "8.8.8.8", "\\" };
+static unsigned long long jfd_test_sp[] = { 1234, 53, 0 };
+
+#define JFD_TEST_RECORDS 3
+
+/*
+ * jfd_test_compact(out, in) copies in to out, removing the whitespace
+ * that is outside of strings
+ */
+static size_t jfd_test_compact(char *out, const char *in) {
+  size_t n = 0;
+  unsigned int in_string = 0, escape = 0;
+
+  for ( ; *in; in++) {
+    if (escape) {
+      escape = 0;
+    } else if (*in == '\\') {
+      escape = 1;
+    } else if (*in == '"') {
+      in_string = !in_string;
+    } else if (!in_string && jfd_is_space(*in)) {
+      continue;
+    }
+    out[n++] = *in;
+  }
+  out[n] = 0;
+  return n;
+}
+
+/*
+ * jfd_test_records(r, text, len, num_records) reads all of the
+ * records from r, checks their fields, and checks that the records
+ * and the gaps between them make up the original text
+ */
+static int jfd_test_records(struct jfd_reader *r, const char *text, size_t len, unsigned int num_records) {
+  struct jfd_object rec, flow;
+  unsigned int n = 0, l;
+  size_t pos = 0, gap_len;
+  const char *gap, *v;
+  char s[64];
+  unsigned long long sp;
+  int num_fails = 0;
+
+  while (jfd_reader_next(r, &rec) == ok) {
+    gap = jfd_reader_gap(r, &gap_len);
+    if (pos + gap_len + rec.len > len || memcmp(text + pos, gap, gap_len) != 0 ||
+	memcmp(text + pos + gap_len, rec.text, rec.len) != 0) {
+      printf("error: jfd_reader record %u does not match input\n", n);
+      return 1;
+    }
+    pos += gap_len + rec.len;
+
+    if (jfd_object_get_object(&rec, "flow", &flow) != ok) {
+      flow = rec;
+    }
+    if (jfd_object_get_string(&flow, "sa", s, sizeof(s)) < 0 || strcmp(s, jfd_test_sa[n % JFD_TEST_RECORDS]) ||
+	jfd_object_get_string(&flow, "da", s, sizeof(s)) < 0 || strcmp(s, jfd_test_da[n % JFD_TEST_RECORDS]) ||
+	jfd_object_get_uint(&flow, "sp", &sp) != ok || sp != jfd_test_sp[n % JFD_TEST_RECORDS]) {
+      printf("error: jfd_reader record %u has wrong fields\n", n);
+      num_fails++;
+    }
+    if (n % JFD_TEST_RECORDS == 0) {
+      v = jfd_object_get(&flow, "non_norm_stats", &l);
+    } else {
+      v = NULL;
+    }
+    if (n % JFD_TEST_RECORDS == 0 && (jfd_object_get_string(&flow, "exe", s, sizeof(s)) < 0 ||
+				      strcmp(s, "C:\\Program Files\\x \"{[,:]}\" \xc3\xa9") != 0 ||
+				      v == NULL || v[0] != '[' || v[l-1] != ']' || l < 56)) {
+      printf("error: jfd_reader string or array value is wrong\n");
+      num_fails++;
+    }
+    n++;
+  }
+  gap = jfd_reader_gap(r, &gap_len);
+  if (jfd_reader_error(r) != NULL) {
+    printf("error: jfd_reader: %s\n", jfd_reader_error(r));
+    num_fails++;
+  }
+  if (n != num_records) {
+    printf("error: jfd_reader found %u records, expected %u\n", n, num_records);
+    num_fails++;
+  }
+  if (pos + gap_len != len || memcmp(text + pos, gap, gap_len) != 0) {
+    printf("error: jfd_reader trailing text does not match input\n");
+    num_fails++;
+  }
+  return num_fails;
+}
+
+/*
+ * jfd_test_fragments(text, len, indent, num_records) reads text as
+ * fragments cut at each record boundary, and checks that the records and the
+ * gaps between them make up the original text, and that the balances
+ * of the fragments sum to zero
+ */
+static int jfd_test_fragments(const char *text, size_t len, const char *indent, unsigned int num_records) {
+  struct jfd_reader r;
+  struct jfd_object rec;
+  size_t pos = 0, next, covered = 0, gap_len;
+  unsigned int n = 0, num_fragments = 0;
+  long int balance = 0;
+  const char *gap;
+  int num_fails = 0;
+
+  while (pos < len) {
+    next = jfd_record_boundary(text, len, pos + 1, indent, strlen(indent));
+    jfd_reader_init_fragment(&r, text + pos, next - pos);
+    while (jfd_reader_next(&r, &rec) == ok) {
+      gap = jfd_reader_gap(&r, &gap_len);
+      if (gap != text + covered || rec.text != gap + gap_len) {
+	printf("error: jfd_reader record %u of fragment %u does not match input\n", n, num_fragments);
+	num_fails++;
+      }
+      covered += gap_len + rec.len;
+      n++;
+    }
+    gap = jfd_reader_gap(&r, &gap_len);
+    covered += gap_len;
+    if (jfd_reader_error(&r) != NULL) {
+      printf("error: jfd_reader fragment %u: %s\n", num_fragments, jfd_reader_error(&r));
+      num_fails++;
+    }
+    balance += jfd_reader_balance(&r);
+    jfd_reader_free(&r);
+    pos = next;
+    num_fragments++;
+  }
+  if (n != num_records || covered != len || balance != 0 || num_fragments < num_records) {
+    printf("error: jfd_reader found %u records in %u fragments, with balance %ld\n", n, num_fragments, balance);
+    num_fails++;
+  }
+  return num_fails;
+}
+
+/*
+ * jfd_test_scan_ref(text, len, si) is a character-at-a-time version
+ * of the structural scanner
+ */
+static unsigned int jfd_test_scan_ref(const char *text, size_t len, uint32_t *si) {
+  unsigned int i, n = 0, in_string = 0, escape = 0;
+
+  for (i=0; i<len; i++) {
+    char c = text[i];
+
+    if (c == '"' && !escape) {
+      if (!in_string) {
+	si[n++] = i;
+      }
+      in_string = !in_string;
+    } else if (!in_string && c != 0 && strchr("{}[]:,", c) != NULL) {
+      si[n++] = i;
+    }
+    escape = (c == '\\' && !escape);
+  }
+  return n;
+}
+
+static int jfd_test_scanners() {
+  static const char alphabet[] = "\"\\{}[]:, ax\"\\\xdb\xfd";
+  char text[1024];
+  uint32_t ref[1024];
+  unsigned int trial, n, isa;
+  struct jfd_reader r;
+  int num_fails = 0;
+
+  srand(0xf00d);
+  for (trial=0; trial<2000; trial++) {
+    size_t i, len = rand() % sizeof(text);
+
+    for (i=0; i<len; i++) {
+      text[i] = (rand() % 4) ? alphabet[rand() % (sizeof(alphabet) - 1)] : 'a';
+    }
+    n = jfd_test_scan_ref(text, len, ref);
+
+    for (isa=cpu_isa_scalar; isa<=cpu_isa_get(); isa++) {
+      if (jfd_reader_init_buffer(&r, text, len) != ok) {
+	return 1;
+      }
+      r.isa = isa;
+      while (r.scanned < len) {
+	jfd_reader_scan(&r);
+      }
+      if (r.num_si != n || memcmp(r.si, ref, n * sizeof(uint32_t)) != 0) {
+	printf("error: jfd_reader scanner %s mismatch (len %zu)\n", cpu_isa_name(isa), len);
+	num_fails++;
+      }
+      jfd_reader_free(&r);
+    }
+  }
+  return num_fails;
+}
+
+static void jfd_benchmark() {
+  size_t i, size = 64 * 1024 * 1024, len = 0, doc_len = strlen(jfd_test_doc);
+  char *text = malloc(size);
+  unsigned int isa, n;
+  struct jfd_reader r;
+  struct jfd_object rec, flow;
+  struct timeval start;
+  
+  if (text == NULL) {
+    return;
+  }
+  while (len + doc_len < size) {
+    memcpy(text + len, jfd_test_doc, doc_len);
+    len += doc_len;
+  }
+
+  /* line-at-a-time matching, as jfd-anon did before */
+  gettimeofday(&start, NULL);
+  n = 0;
+  for (i=0; i<len; ) {
+    char *eol = memchr(text + i, '\n', len - i);
+    size_t l = eol ? eol - (text + i) + 1 : len - i;
+    char line[1024], addr[256];
+    
+    if (l < sizeof(line)) {
+      memcpy(line, text + i, l);
+      line[l] = 0;
+      if (strstr(line, "\"sa\":") && sscanf(strstr(line, "\"sa\":") + 7, "%[a-fA-F0-9.]", addr) == 1) {
+	n++;
+      }
+    }
+    i += l;
+  }
+  printf("json flow data, line at a time with strstr(): %8.1f MB/s\n", len / 1e6 / time_diff(&start));
+
+  for (isa=cpu_isa_scalar; isa<=cpu_isa_get(); isa++) {
+    if (jfd_reader_init_buffer(&r, text, len) != ok) {
+      break;
+    }
+    r.isa = isa;
+    gettimeofday(&start, NULL);
+    n = 0;
+    while (jfd_reader_next(&r, &rec) == ok) {
+      if (jfd_object_get_object(&rec, "flow", &flow) == ok && 
+	  jfd_object_get(&flow, "sa", &n) != NULL) {
+	n++;
+      }
+    }
+    printf("json flow data, jfd_reader %-6s:              %8.1f MB/s\n", cpu_isa_name(isa), len / 1e6 / time_diff(&start));
+    jfd_reader_free(&r);
+  }
+  free(text);
+}
+
+int jfd_reader_unit_test() {
+  size_t doc_len = strlen(jfd_test_doc);
+  char *text, *compact;
+  size_t len, compact_len, i, pad, rec_len;
+  const char *rec_text;
+  struct jfd_reader r, r2;
+  struct jfd_object rec;
+  FILE *f;
+  int num_fails = 0;
+  static const size_t read_size[] = { 1, 7, 64, 1000, JFD_READ_SIZE };
+
+  text = malloc(8 * doc_len + 128);
+  compact = malloc(doc_len + 1);
+  if (text == NULL || compact == NULL) {
+    free(text);
+    free(compact);
+    return failure;
+  }
+  compact_len = jfd_test_compact(compact, jfd_test_doc);
+
+  num_fails += jfd_test_scanners();
+
+  for (pad=0; pad<70; pad += 3) {
+
+    /* pcap2flow layout, pretty and compact, from memory */
+    memset(text, ' ', pad);
+    memcpy(text + pad, jfd_test_doc, doc_len);
+    len = pad + doc_len;
+    jfd_reader_init_buffer(&r, text, len);
+    num_fails += jfd_test_records(&r, text, len, JFD_TEST_RECORDS);
+    jfd_reader_free(&r);
+
+    memcpy(text + pad, compact, compact_len);
+    len = pad + compact_len;
+    jfd_reader_init_buffer(&r, text, len);
+    num_fails += jfd_test_records(&r, text, len, JFD_TEST_RECORDS);
+    jfd_reader_free(&r);
+
+    /* one object per line, and a top-level array */
+    len = pad;
+    for (i=0; i<2; i++) {
+      jfd_reader_init_buffer(&r, compact, compact_len);
+      while (jfd_reader_next(&r, &rec) == ok) {
+	memcpy(text + len, rec.text, rec.len);
+	len += rec.len;
+	text[len++] = '\n';
+      }
+      jfd_reader_free(&r);
+    }
+    jfd_reader_init_buffer(&r, text, len);
+    num_fails += jfd_test_records(&r, text, len, 2 * JFD_TEST_RECORDS);
+    jfd_reader_free(&r);
+
+    memmove(text + pad + 1, text + pad, len - pad);
+    text[pad] = '[';
+    len++;
+    for (i=pad+1; i<len; i++) {
+      if (text[i] == '\n') {
+	text[i] = (i == len - 1) ? ']' : ',';
+      }
+    }
+    jfd_reader_init_buffer(&r, text, len);
+    num_fails += jfd_test_records(&r, text, len, 2 * JFD_TEST_RECORDS);
+    jfd_reader_free(&r);
+  }
+
+  /* from a file, in small and large chunks */
+  f = tmpfile();
+  if (f == NULL) {
+    num_fails++;
+  } else {
+    fwrite(jfd_test_doc, 1, doc_len, f);
+    for (i=0; i<sizeof(read_size)/sizeof(read_size[0]); i++) {
+      rewind(f);
+      jfd_reader_init_file(&r, f);
+      r.read_size = read_size[i];
+      num_fails += jfd_test_records(&r, jfd_test_doc, doc_len, JFD_TEST_RECORDS);
+      jfd_reader_free(&r);
+    }
+    fclose(f);
+  }
+
+  /* locating records without indexing them */
+  jfd_reader_init_buffer(&r, jfd_test_doc, doc_len);
+  jfd_reader_init_buffer(&r2, jfd_test_doc, doc_len);
+  i = 0;
+  while (jfd_reader_next_text(&r2, &rec_text, &rec_len) == ok) {
+    if (jfd_reader_next(&r, &rec) != ok || rec.text != rec_text || rec.len != rec_len) {
+      printf("error: jfd_reader_next_text() disagrees with jfd_reader_next()\n");
+      num_fails++;
+    }
+    i++;
+  }
+  if (i != JFD_TEST_RECORDS || jfd_reader_error(&r2) != NULL) {
+    printf("error: jfd_reader_next_text() found %zu records\n", i);
+    num_fails++;
+  }
+  jfd_reader_free(&r);
+  jfd_reader_free(&r2);
+
+  /* fragments, cut at record boundaries and inside of a record */
+  num_fails += jfd_test_fragments(jfd_test_doc, doc_len, "\t", JFD_TEST_RECORDS);
+  len = 0;
+  jfd_reader_init_buffer(&r2, compact, compact_len);
+  while (jfd_reader_next(&r2, &rec) == ok) {
+    memcpy(text + len, rec.text, rec.len);
+    len += rec.len;
+    text[len++] = '\n';
+  }
+  jfd_reader_free(&r2);
+  num_fails += jfd_test_fragments(text, len, "", JFD_TEST_RECORDS);
+  jfd_reader_init_fragment(&r, jfd_test_doc, strstr(jfd_test_doc, "{ \"b\": 158") - jfd_test_doc);
+  while (jfd_reader_next(&r, &rec) == ok) {
+    ;
+  }
+  if (jfd_reader_error(&r) == NULL) {
+    printf("error: jfd_reader accepted a fragment that ends inside of a record\n");
+    num_fails++;
+  }
+  jfd_reader_free(&r);
+
+  /* malformed input */
+  jfd_reader_init_buffer(&r, jfd_test_doc, doc_len - 20);
+  while (jfd_reader_next(&r, &rec) == ok) {
+    ;
+  }
+  if (jfd_reader_error(&r) == NULL) {
+    printf("error: jfd_reader accepted truncated input\n");
+    num_fails++;
+  }
+  jfd_reader_free(&r);
+  jfd_reader_init_buffer(&r, "[{\"a\":1]}", 9);
+  if (jfd_reader_next(&r, &rec) == ok || jfd_reader_error(&r) == NULL) {
+    printf("error: jfd_reader accepted mismatched brackets\n");
+    num_fails++;
+  }
+  jfd_reader_free(&r);
+
+  free(text);
+  free(compact);
+
+  if (num_fails) {
+    return failure;
+  }
+  jfd_benchmark();
+  return ok;
+}
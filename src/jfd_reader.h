@@ -0,0 +1,247 @@
+/*
+ *	
+ * Copyright (c) 2016 Cisco Systems, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * jfd_reader.h
+ *
+ * streaming reader for JSON flow data
+ */
+
+#ifndef JFD_READER_H
+#define JFD_READER_H
+
+#include <stdio.h>     /* for FILE     */
+#include <stdint.h>    /* for uint32_t */
+#include "err.h"       /* for enum status */
+#include "cpu_isa.h"   /* for enum cpu_isa */
+
+/*
+ * A jfd_reader reads JSON text from a file or from memory, a chunk at
+ * a time, and returns each flow record in turn as a jfd_object, whose
+ * fields can then be looked up by name.  The reader does not depend
+ * on the layout of the whitespace in its input.  A record is
+ *
+ *    each element of the "appflows" array of a top-level object, as
+ *    written by pcap2flow, or
+ *
+ *    each object in a top-level array, or
+ *
+ *    each top-level object that has no "appflows" field, as in a file
+ *    with one JSON object per line.
+ *
+ * The input is first scanned for structural characters (braces,
+ * brackets, colons, commas, and the quotation marks that start
+ * strings), ignoring any that appear inside of strings, a 64-byte
+ * block at a time.  On x86 processors, SSE2 and AVX2 versions of the
+ * scanner are selected at run time; otherwise, a portable scalar
+ * version is used.  The offsets of the structural characters are
+ * stored in an index, from which records and their fields are
+ * located without looking at the other characters.
+ *
+ * The text between records, such as the metadata of a pcap2flow
+ * file, is available from jfd_reader_gap(), so that a tool can copy
+ * its input to its output, changing only some of the fields.
+ */
+
+#define JFD_MAX_FIELDS  64       /* fields indexed in each object  */
+#define JFD_MAX_DEPTH   64       /* maximum nesting of objects     */
+#define JFD_READ_SIZE   (1 << 20)
+
+struct jfd_field {
+  const char *key;               /* key, without quotation marks   */
+  unsigned int key_len;
+  const char *value;             /* JSON text of value             */
+  unsigned int value_len;
+  unsigned int si_begin;         /* structural index range, if the */
+  unsigned int si_end;           /* value is an object or array    */
+};
+
+/*
+ * a jfd_object points into the buffer of the reader that returned
+ * it, and is valid until the next call to jfd_reader_next()
+ */
+struct jfd_object {
+  const char *text;              /* JSON text, starting with '{'   */
+  unsigned int len;
+  const char *base;
+  const uint32_t *si;
+  unsigned int num_fields;
+  struct jfd_field field[JFD_MAX_FIELDS];
+};
+
+struct jfd_reader {
+  FILE *f;                       /* NULL if reading from memory    */
+  char *buf;                     /* allocated buffer, for files    */
+  size_t buf_size;
+  size_t read_size;              /* octets read from f at a time   */
+  const char *text;              /* unconsumed input               */
+  size_t len;                    /* octets of input in text        */
+  size_t scanned;                /* octets of text scanned         */
+  size_t consumed;               /* octets of text returned        */
+  unsigned int eof;
+  unsigned int fragment;         /* input is part of a larger one  */
+  unsigned int num_unmatched;    /* closing brackets that matched  */
+                                 /* nothing, in a fragment         */
+
+  uint32_t *si;                  /* structural index: offsets into */
+  unsigned int num_si;           /* text of structural characters  */
+  unsigned int si_size;
+  unsigned int si_pos;           /* next structural to process     */
+  uint64_t in_string;            /* scanner state carried between  */
+  uint64_t escape_carry;         /* blocks                         */
+  enum cpu_isa isa;              /* instruction set of scanner     */
+
+  unsigned int depth;
+  char stack[JFD_MAX_DEPTH];
+  unsigned int list_depth;       /* depth of elements of list      */
+  unsigned int list_pending;     /* "appflows" key just seen       */
+  unsigned int in_record;
+  unsigned int record_depth;
+  size_t record_start;
+  unsigned int record_si;
+  size_t last_quote;
+
+  const char *gap;               /* text before the last record    */
+  size_t gap_len;
+  const char *error;
+};
+
+/*
+ * jfd_reader_init_file(r, f) initializes r to read from the stream
+ * f, which is not closed by jfd_reader_free(); it returns failure if
+ * memory could not be allocated
+ */
+enum status jfd_reader_init_file(struct jfd_reader *r, FILE *f);
+
+/*
+ * jfd_reader_init_buffer(r, text, len) initializes r to read the len
+ * characters in text, which are not copied, and which must remain
+ * unchanged until the reader is freed
+ */
+enum status jfd_reader_init_buffer(struct jfd_reader *r, const char *text, size_t len);
+
+/*
+ * jfd_reader_init_fragment(r, text, len) is like
+ * jfd_reader_init_buffer(), for a fragment of a larger input that
+ * starts at the beginning of that input or at a record boundary, and
+ * that ends at a record boundary or at the end of that input.  Closing
+ * brackets that match nothing in the fragment are treated as text
+ * between records, and the fragment may end inside of the array that
+ * holds the records.  The fragments of an input can be read in
+ * parallel; the input is well formed if each of them is, and the sum
+ * of their jfd_reader_balance() values is zero.
+ */
+enum status jfd_reader_init_fragment(struct jfd_reader *r, const char *text, size_t len);
+
+/*
+ * jfd_reader_balance(r) returns, after the end of a fragment, the
+ * number of brackets that are still open less the number of closing
+ * brackets that matched nothing
+ */
+long int jfd_reader_balance(const struct jfd_reader *r);
+
+/*
+ * jfd_record_boundary(text, len, pos, indent, indent_len) returns the
+ * offset of the first record boundary in text at or after pos, or len
+ * if there is none.  A boundary is an opening brace at the start of a
+ * line, after the indent_len characters of indent, which should be
+ * those in front of the first record; pcap2flow and one-object-per-
+ * line files start each record that way, and other objects are
+ * indented further.  The text does not need to be scanned for
+ * structure, since a newline is never inside of a JSON string; if the
+ * object at a boundary is not a record after all, the reader of the
+ * fragment before it reports an error.
+ */
+size_t jfd_record_boundary(const char *text, size_t len, size_t pos, const char *indent, size_t indent_len);
+
+/*
+ * jfd_reader_next(r, rec) sets rec to the next record and returns
+ * ok, or returns failure at the end of the input or if there was an
+ * error, in which case jfd_reader_error(r) returns a description of
+ * the error, or NULL at the end of well formed input
+ */
+enum status jfd_reader_next(struct jfd_reader *r, struct jfd_object *rec);
+
+/*
+ * jfd_reader_next_text(r, text, len) is like jfd_reader_next(), but
+ * only locates the next record, setting *text and *len to its JSON
+ * text, without indexing its fields
+ */
+enum status jfd_reader_next_text(struct jfd_reader *r, const char **text, size_t *len);
+
+const char *jfd_reader_error(const struct jfd_reader *r);
+
+/*
+ * jfd_reader_gap(r, len) returns the text between the previous
+ * record and the one most recently returned by jfd_reader_next(), or
+ * after the end of the input, the text after the last record
+ */
+const char *jfd_reader_gap(const struct jfd_reader *r, size_t *len);
+
+void jfd_reader_free(struct jfd_reader *r);
+
+/*
+ * jfd_object_get(o, key, len) returns the JSON text of the value of
+ * the field key in the object o, and sets *len to its length, or
+ * returns NULL if there is no such field
+ */
+const char *jfd_object_get(const struct jfd_object *o, const char *key, unsigned int *len);
+
+/*
+ * jfd_object_get_object(o, key, child) sets child to the object that
+ * is the value of the field key, and returns ok, or returns failure
+ * if there is no such field or its value is not an object
+ */
+enum status jfd_object_get_object(const struct jfd_object *o, const char *key, struct jfd_object *child);
+
+/*
+ * jfd_object_get_string(o, key, out, size) copies the value of the
+ * string field key into out, with escape sequences decoded and a
+ * null terminator, and returns its length, or returns -1 if there is
+ * no such field, its value is not a string, or it does not fit
+ */
+int jfd_object_get_string(const struct jfd_object *o, const char *key, char *out, unsigned int size);
+
+/*
+ * jfd_object_get_uint(o, key, x) sets *x to the value of the numeric
+ * field key and returns ok, or returns failure if there is no such
+ * field or its value is not a non-negative integer
+ */
+enum status jfd_object_get_uint(const struct jfd_object *o, const char *key, unsigned long long *x);
+
+int jfd_reader_unit_test();
+
+#endif /* JFD_READER_H */
@@ -763,14 +763,29 @@ void nfv9_process_lengths(struct flow_record *nf_record, const void *length_data
 
 void nfv9_flow_key_init(struct flow_key *key, const struct nfv9_template *cur_template, const void *flow_data) {
   int i;
+  struct in_addr unspecified;
+
+  unspecified.s_addr = 0;
+  memset(key, 0, sizeof(struct flow_key));
+  flow_key_set_ipv4_addrs(key, unspecified, unspecified);
   for (i = 0; i < cur_template->hdr.FieldCount; i++) {
     switch (htons(cur_template->fields[i].FieldType)) {
     case IPV4_SRC_ADDR:
-      key->sa.s_addr = *(const int *)flow_data;
+      flow_addr_set_ipv4(&key->sa, *(const struct in_addr *)flow_data);
       flow_data += htons(cur_template->fields[i].FieldLength);
       break;
     case IPV4_DST_ADDR:
-      key->da.s_addr = *(const int *)flow_data;
+      flow_addr_set_ipv4(&key->da, *(const struct in_addr *)flow_data);
+      flow_data += htons(cur_template->fields[i].FieldLength);
+      break;
+    case IPV6_SRC_ADDR:
+      memcpy(&key->sa.v6, flow_data, sizeof(struct in6_addr));
+      key->ver = 6;
+      flow_data += htons(cur_template->fields[i].FieldLength);
+      break;
+    case IPV6_DST_ADDR:
+      memcpy(&key->da.v6, flow_data, sizeof(struct in6_addr));
+      key->ver = 6;
       flow_data += htons(cur_template->fields[i].FieldLength);
       break;
     case L4_SRC_PORT:
@@ -799,11 +814,11 @@ void nfv9_process_flow_record(struct flow_record *nf_record, const struct nfv9_t
   for (i = 0; i < cur_template->hdr.FieldCount; i++) {
     switch (htons(cur_template->fields[i].FieldType)) {
       /*case IPV4_SRC_ADDR:
-      nf_record->key.sa.s_addr = *(const int *)flow_data;
+      nf_record->key.sa.v4.addr.s_addr = *(const int *)flow_data;
       flow_data += htons(cur_template->fields[i].FieldLength);
       break;
     case IPV4_DST_ADDR:
-      nf_record->key.da.s_addr = *(const int *)flow_data;
+      nf_record->key.da.v4.addr.s_addr = *(const int *)flow_data;
       flow_data += htons(cur_template->fields[i].FieldLength);
       break;
     case L4_SRC_PORT:
@@ -48,6 +48,9 @@
 #include <unistd.h>    /* for fork()                     */
 #include <sys/types.h> /* for waitpid()                  */
 #include <sys/wait.h>  /* for waitpid()                  */
+#ifdef __SSE2__
+#include <emmintrin.h> /* for flow key comparison         */
+#endif
 #include "pkt_proc.h" /* packet processing               */
 #include "p2f.h"      /* pcap2flow data structures       */
 #include "err.h"      /* error codes and error reporting */
@@ -58,6 +61,11 @@
 #include "procwatch.h"  /* process to flow mapping       */
 #include "radix_trie.h" /* trie for subnet labels        */
 #include "config.h"     /* configuration                 */
+#include "encode.h"     /* hex and string encoding       */
+#include "dict.h"       /* dictionary of byte strings    */
+#include "splt.h"       /* compact SPLT encoding         */
+#include "byte_dist.h"  /* byte distribution of payloads */
+#include "cpu_isa.h"    /* for time_diff()               */
 
 /*
  * for portability and static analysis, we define our own timer
@@ -141,8 +149,11 @@ void flocap_stats_output(FILE *f) {
   rps = (float) (stats.num_records_output - last_stats.num_records_output) / seconds;
 
   strftime(time_str, sizeof(time_str)-1, "%a %b %2d %H:%M:%S %Z %Y", localtime(&now.tv_sec));
-  fprintf(f, "%s info: %lu packets, %lu active records, %lu records output, %lu alloc fails, %.4e bytes/sec, %.4e packets/sec, %.4e records/sec\n", 
-	  time_str, stats.num_packets, stats.num_records_in_table, stats.num_records_output, stats.malloc_fail, bps, pps, rps);
+  fprintf(f, "%s info: %lu packets, %lu active records, %lu records output, %lu alloc fails, %.4e bytes/sec, %.4e packets/sec, %.4e records/sec, %lu fragments attributed, %lu dropped, %lu TLS allocs (%lu bytes), %lu bytes in TLS reassembly (%lu max, %lu evictions), %lu TLS fingerprints\n", 
+	  time_str, stats.num_packets, stats.num_records_in_table, stats.num_records_output, stats.malloc_fail, bps, pps, rps,
+	  stats.num_frags_attributed, stats.num_frags_dropped, stats.num_tls_allocs, stats.tls_alloc_bytes,
+	  tls_reassembly_stats.bytes, tls_reassembly_stats.max_bytes, tls_reassembly_stats.evictions,
+	  stats.num_tls_fps);
   fflush(f);
 
   last_stats_output_time = now;
@@ -173,14 +184,28 @@ unsigned int report_idp = 0;
 
 unsigned int report_hd = 0;
 
+unsigned int report_hd_pkts = HDR_DSC_PKTS;
+
 unsigned int report_dns = 0;
 
+unsigned int payload_budget = 0;
+
+unsigned int payload_pkt_budget = 0;
+
 unsigned int include_tls = 0;
 
+unsigned int report_tls_dict = 0;
+
+unsigned int report_tls_fp = 0;
+
+unsigned int report_splt_enc = 0;
+
 unsigned int include_classifier = 0;
 
 unsigned int nfv9_capture_port = 0;
 
+unsigned int include_vlan = 0;
+
 FILE *output = NULL;
 
 FILE *info = NULL;
@@ -227,11 +252,20 @@ enum twins_match { exact = 0, near = 1 };
 
 // enum twins_match flow_key_match_method = exact;
 
+/*
+ * flow_addr_fold() reduces an address to 32 bits for hashing; for an
+ * IPv4 address, the mapped prefix contributes only a constant
+ */
+static inline unsigned int flow_addr_fold(const union flow_addr *a) {
+  return (a->u32[0] * 0x9e3779b1) ^ (a->u32[1] * 0x85ebca6b) 
+    ^ (a->u32[2] * 0xc2b2ae35) ^ a->u32[3];
+}
+
 unsigned int flow_key_hash(const struct flow_key *f) {
 
   if (config.flow_key_match_method == exact) {
-    return (((unsigned int)f->sa.s_addr * 0xef6e15aa) 
-	    ^ ((unsigned int)f->da.s_addr * 0x65cd52a0) 
+    return ((flow_addr_fold(&f->sa) * 0xef6e15aa) 
+	    ^ (flow_addr_fold(&f->da) * 0x65cd52a0) 
 	    ^ ((unsigned int)f->sp * 0x8216) 
 	    ^ ((unsigned int)f->dp * 0xdda37) 
 	    ^ ((unsigned int)f->prot * 0xbc06)) & flow_key_hash_mask;
@@ -292,24 +326,71 @@ void flow_record_list_free() {
 }
 
 
+/*
+ * flow keys are compared as a whole: each address is a single
+ * sixteen-byte load (SSE2 where available), and the ports, protocol,
+ * version, and VLAN ID are a single eight-byte word, so IPv4 and IPv6
+ * keys cost the same to compare
+ */
+static inline uint64_t flow_key_tail(const struct flow_key *k) {
+  uint64_t t;
+
+  memcpy(&t, &k->sp, sizeof(t));
+  return t;
+}
+
+/* the tail of a key with its source and destination ports exchanged */
+static inline uint64_t flow_key_tail_swapped(const struct flow_key *k) {
+  struct flow_key tmp;
+
+  tmp.sp = k->dp;
+  tmp.dp = k->sp;
+  tmp.prot = k->prot;
+  tmp.ver = k->ver;
+  tmp.vlan = k->vlan;
+  return flow_key_tail(&tmp);
+}
+
+#ifdef __SSE2__
+
+static inline int flow_addr_is_eq(const union flow_addr *a, const union flow_addr *b) {
+  __m128i x = _mm_loadu_si128((const __m128i *)a);
+  __m128i y = _mm_loadu_si128((const __m128i *)b);
+
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) == 0xffff;
+}
+
+static inline int flow_addrs_are_eq(const union flow_addr *a0, const union flow_addr *b0,
+				    const union flow_addr *a1, const union flow_addr *b1) {
+  __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a0), 
+			       _mm_loadu_si128((const __m128i *)b0));
+  __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a1), 
+			       _mm_loadu_si128((const __m128i *)b1));
+
+  return _mm_movemask_epi8(_mm_and_si128(eq0, eq1)) == 0xffff;
+}
+
+#else
+
+static inline int flow_addr_is_eq(const union flow_addr *a, const union flow_addr *b) {
+  return ((a->u32[0] ^ b->u32[0]) | (a->u32[1] ^ b->u32[1]) 
+	  | (a->u32[2] ^ b->u32[2]) | (a->u32[3] ^ b->u32[3])) == 0;
+}
+
+static inline int flow_addrs_are_eq(const union flow_addr *a0, const union flow_addr *b0,
+				    const union flow_addr *a1, const union flow_addr *b1) {
+  return flow_addr_is_eq(a0, b0) && flow_addr_is_eq(a1, b1);
+}
+
+#endif /* __SSE2__ */
+
 int flow_key_is_eq(const struct flow_key *a, const struct flow_key *b) {
-  //return (memcmp(a, b, sizeof(struct flow_key)));
-  // more robust way of checking keys are equal
   //   0: flow keys are equal
   //   1: flow keys are not equal
-  if (a->sa.s_addr != b->sa.s_addr) {
+  if (flow_key_tail(a) != flow_key_tail(b)) {
     return 1;
   }
-  if (a->da.s_addr != b->da.s_addr) {
-    return 1;
-  }
-  if (a->sp != b->sp) {
-    return 1;
-  }
-  if (a->dp != b->dp) {
-    return 1;
-  }
-  if (a->prot != b->prot) {
+  if (!flow_addrs_are_eq(&a->sa, &b->sa, &a->da, &b->da)) {
     return 1;
   }
 
@@ -318,10 +399,11 @@ int flow_key_is_eq(const struct flow_key *a, const struct flow_key *b) {
 }
 
 int flow_key_is_twin(const struct flow_key *a, const struct flow_key *b) {
-  //return (memcmp(a, b, sizeof(struct flow_key)));
-  // more robust way of checking keys are equal
-  //   0: flow keys are equal
-  //   1: flow keys are not equal
+  //   0: flow keys are twins
+  //   1: flow keys are not twins
+  if (flow_key_tail(a) != flow_key_tail_swapped(b)) {
+    return 1;
+  }
   if (config.flow_key_match_method == near) {
     /* 
      * Require that only one address match, so that we can find twins
@@ -332,40 +414,77 @@ int flow_key_is_twin(const struct flow_key *a, const struct flow_key *b) {
      * Translation (NAT), and not Port Address Translation (PAT).  NAT
      * is commonly done with and without PAT.
      */ 
-    if (a->sa.s_addr != b->da.s_addr && a->da.s_addr != b->sa.s_addr) {
+    if (!flow_addr_is_eq(&a->sa, &b->da) && !flow_addr_is_eq(&a->da, &b->sa)) {
       return 1;
     }
   } else {
     /*
      * require that both addresses match, that is, (sa, da) == (da, sa)
      */
-    if (a->sa.s_addr != b->da.s_addr) {
-      return 1;
-    }
-    if (a->da.s_addr != b->sa.s_addr) {
+    if (!flow_addrs_are_eq(&a->sa, &b->da, &a->da, &b->sa)) {
       return 1;
     }
   }
-  if (a->sp != b->dp) {
-    return 1;
-  }
-  if (a->dp != b->sp) {
-    return 1;
-  }
-  if (a->prot != b->prot) {
-    return 1;
-  }
 
   // match was found
   return 0;
 }
 
 void flow_key_copy(struct flow_key *dst, const struct flow_key *src) {
-  dst->sa.s_addr = src->sa.s_addr;
-  dst->da.s_addr = src->da.s_addr;
-  dst->sp = src->sp;
-  dst->dp = src->dp;
-  dst->prot = src->prot;
+  *dst = *src;
+}
+
+/* flow_key_twin() sets twin to the key of the reverse direction of key */
+static void flow_key_twin(struct flow_key *twin, const struct flow_key *key) {
+  twin->sa = key->da;
+  twin->da = key->sa;
+  twin->sp = key->dp;
+  twin->dp = key->sp;
+  twin->prot = key->prot;
+  twin->ver = key->ver;
+  twin->vlan = key->vlan;
+}
+
+void flow_key_set_ipv4_addrs(struct flow_key *key, struct in_addr sa, struct in_addr da) {
+  flow_addr_set_ipv4(&key->sa, sa);
+  flow_addr_set_ipv4(&key->da, da);
+  key->ver = 4;
+}
+
+void flow_key_set_ipv6_addrs(struct flow_key *key, const struct in6_addr *sa, const struct in6_addr *da) {
+  memcpy(&key->sa.v6, sa, sizeof(struct in6_addr));
+  memcpy(&key->da.v6, da, sizeof(struct in6_addr));
+  key->ver = 6;
+}
+
+/*
+ * flow_key_addr_ntop() writes the printable form of the address a,
+ * which is one of the addresses of key, into buf
+ */
+const char *flow_key_addr_ntop(const struct flow_key *key, const union flow_addr *a, 
+			       char *buf, unsigned int len) {
+  if (flow_key_is_ipv4(key)) {
+    return inet_ntop(AF_INET, &a->v4.addr, buf, len);
+  }
+  return inet_ntop(AF_INET6, &a->v6, buf, len);
+}
+
+/*
+ * flow_key_addr_string() returns the form in which the address a of
+ * key is reported: anonymized, if it is in one of the anonymization
+ * subnets, and otherwise as written by flow_key_addr_ntop(); buf
+ * must have room for ANON_STRING6_LEN characters
+ */
+static const char *flow_key_addr_string(const struct flow_key *key, const union flow_addr *a, 
+					char *buf, unsigned int len) {
+  if (flow_key_is_ipv4(key)) {
+    if (ipv4_addr_needs_anonymization(&a->v4.addr)) {
+      return addr_get_anon_hexstring(&a->v4.addr, buf);
+    }
+  } else if (ipv6_addr_needs_anonymization(&a->v6)) {
+    return addr_get_anon_string6(&a->v6, buf);
+  }
+  return flow_key_addr_ntop(key, a, buf, len);
 }
 
 #define MAX_TTL 255
@@ -383,9 +502,8 @@ void flow_record_init(/* @out@ */ struct flow_record *record,
   record->np = 0;
   record->op = 0;
   record->ob = 0;
-  record->num_bytes = 0;
-  record->bd_mean = 0.0;
-  record->bd_variance = 0.0;
+  record->fp = 0;
+  record->fb = 0;
   record->seq = 0;
   record->ack = 0;
   record->invalid = 0;
@@ -411,14 +529,17 @@ void flow_record_init(/* @out@ */ struct flow_record *record,
   record->idp_len = 0;
   record->exp_type = 0;
   record->first_switched_found = 0;
+  record->sa_labels = 0;
+  record->da_labels = 0;
+  record->labels_pending = 0;
   record->next = NULL;
   record->prev = NULL;
   record->time_prev = NULL;
   record->time_next = NULL;
   record->twin = NULL;
 
-  /* initialize TLS data */
-  tls_record_init(&record->tls_info);
+  /* TLS data is allocated when TLS is seen */
+  record->tls_info = NULL;
 
   wht_init(&record->wht);
 
@@ -530,8 +651,23 @@ void flow_record_list_unit_test() {
   flow_record_list list;
   struct flow_record a, b, c, d;
   struct flow_record *rp;
-  struct flow_key k1 = { { 0xcafe }, { 0xbabe }, 0xfa, 0xce, 0xdd };
-  struct flow_key k2 = { { 0xdead }, { 0xbeef }, 0xfa, 0xce, 0xdd };
+  struct flow_key k1, k2;
+  struct in_addr sa, da;
+
+  sa.s_addr = 0xcafe;
+  da.s_addr = 0xbabe;
+  flow_key_set_ipv4_addrs(&k1, sa, da);
+  k1.sp = 0xfa;
+  k1.dp = 0xce;
+  k1.prot = 0xdd;
+  k1.vlan = 0;
+  sa.s_addr = 0xdead;
+  da.s_addr = 0xbeef;
+  flow_key_set_ipv4_addrs(&k2, sa, da);
+  k2.sp = 0xfa;
+  k2.dp = 0xce;
+  k2.prot = 0xdd;
+  k2.vlan = 0;
 
   flow_record_init(&a, &k1);
   flow_record_init(&b, &k2);
@@ -608,6 +744,250 @@ void flow_record_list_unit_test() {
   
 }
 
+/*
+ * flow_key_is_eq_ref() is the field by field comparison of IPv4 flow
+ * keys, against which flow_key_is_eq() is timed
+ */
+static int flow_key_is_eq_ref(const struct flow_key *a, const struct flow_key *b) {
+  if (a->sa.v4.addr.s_addr != b->sa.v4.addr.s_addr) {
+    return 1;
+  }
+  if (a->da.v4.addr.s_addr != b->da.v4.addr.s_addr) {
+    return 1;
+  }
+  if (a->sp != b->sp) {
+    return 1;
+  }
+  if (a->dp != b->dp) {
+    return 1;
+  }
+  if (a->prot != b->prot) {
+    return 1;
+  }
+  return 0;
+}
+
+#define FLOW_KEY_TEST_KEYS   4096
+#define FLOW_KEY_TEST_ROUNDS 1000
+
+int flow_key_unit_test() {
+  struct flow_key k4, t4, k6, t6, *keys;
+  struct in_addr sa, da;
+  struct in6_addr sa6, da6;
+  unsigned int method = config.flow_key_match_method;
+  unsigned int i, j, n;
+  struct timeval start;
+  double t, t_ref;
+  int test_failed = 0;
+
+  inet_pton(AF_INET, "10.1.2.3", &sa);
+  inet_pton(AF_INET, "192.0.2.7", &da);
+  flow_key_set_ipv4_addrs(&k4, sa, da);
+  k4.sp = 49152;
+  k4.dp = 443;
+  k4.prot = 6;
+  k4.vlan = 0;
+  flow_key_twin(&t4, &k4);
+
+  /* the IPv6 key has the same ports and the IPv4-mapped addresses */
+  inet_pton(AF_INET6, "::ffff:10.1.2.3", &sa6);
+  inet_pton(AF_INET6, "::ffff:192.0.2.7", &da6);
+  flow_key_set_ipv6_addrs(&k6, &sa6, &da6);
+  k6.sp = 49152;
+  k6.dp = 443;
+  k6.prot = 6;
+  k6.vlan = 0;
+  flow_key_twin(&t6, &k6);
+
+  config.flow_key_match_method = exact;
+  if (flow_key_is_eq(&k4, &k4) != 0 || flow_key_is_eq(&k6, &k6) != 0) {
+    printf("error: flow key not equal to itself\n");
+    test_failed = 1;
+  }
+  if (flow_key_is_eq(&k4, &k6) == 0 || flow_key_is_eq(&k4, &t4) == 0) {
+    printf("error: distinct flow keys found equal\n");
+    test_failed = 1;
+  }
+  if (flow_key_is_twin(&k4, &t4) != 0 || flow_key_is_twin(&t6, &k6) != 0) {
+    printf("error: twin flow keys not found to be twins\n");
+    test_failed = 1;
+  }
+  if (flow_key_is_twin(&k4, &t6) == 0 || flow_key_is_twin(&k4, &k4) == 0) {
+    printf("error: flow keys wrongly found to be twins\n");
+    test_failed = 1;
+  }
+
+  /* keys on different VLANs are distinct, and twins share a VLAN */
+  k6.vlan = 100;
+  flow_key_twin(&t6, &k6);
+  if (flow_key_is_twin(&k6, &t6) != 0 || flow_key_is_eq(&k6, &k6) != 0) {
+    printf("error: flow keys with a VLAN ID do not match\n");
+    test_failed = 1;
+  }
+  t6.vlan = 0;
+  if (flow_key_is_twin(&k6, &t6) == 0) {
+    printf("error: flow keys on different VLANs found to be twins\n");
+    test_failed = 1;
+  }
+  k6.vlan = 0;
+  flow_key_twin(&t6, &k6);
+
+  /* in near mode, twins need only one matching address */
+  inet_pton(AF_INET, "198.51.100.9", &da);
+  flow_addr_set_ipv4(&t4.sa, da);
+  if (flow_key_is_twin(&k4, &t4) == 0) {
+    printf("error: flow keys with a translated address found to be exact twins\n");
+    test_failed = 1;
+  }
+  config.flow_key_match_method = near;
+  if (flow_key_is_twin(&k4, &t4) != 0) {
+    printf("error: flow keys with a translated address not found to be near twins\n");
+    test_failed = 1;
+  }
+  if (flow_key_hash(&k4) != flow_key_hash(&t4)) {
+    printf("error: near twins have different hashes\n");
+    test_failed = 1;
+  }
+  t4.sp++;
+  if (flow_key_is_twin(&k4, &t4) == 0) {
+    printf("error: flow keys with different ports found to be twins\n");
+    test_failed = 1;
+  }
+  config.flow_key_match_method = exact;
+
+  /* 
+   * time the comparison of IPv4 keys that differ only in their last
+   * fields, which is the worst case for the field by field comparison
+   */
+  keys = malloc(FLOW_KEY_TEST_KEYS * sizeof(struct flow_key));
+  if (keys == NULL) {
+    config.flow_key_match_method = method;
+    return 1;
+  }
+  for (i=0; i<FLOW_KEY_TEST_KEYS; i++) {
+    keys[i] = k4;
+    keys[i].dp = rand() & 3;
+    keys[i].prot = 6 + (rand() & 1);
+  }
+  n = 0;
+  gettimeofday(&start, NULL);
+  for (j=0; j<FLOW_KEY_TEST_ROUNDS; j++) {
+    for (i=1; i<FLOW_KEY_TEST_KEYS; i++) {
+      n += flow_key_is_eq_ref(&keys[i-1], &keys[i]);
+    }
+  }
+  t_ref = time_diff(&start);
+  gettimeofday(&start, NULL);
+  for (j=0; j<FLOW_KEY_TEST_ROUNDS; j++) {
+    for (i=1; i<FLOW_KEY_TEST_KEYS; i++) {
+      n -= flow_key_is_eq(&keys[i-1], &keys[i]);
+    }
+  }
+  t = time_diff(&start);
+  if (n != 0) {
+    printf("error: flow_key_is_eq() and field by field comparison disagree\n");
+    test_failed = 1;
+  }
+  n = FLOW_KEY_TEST_ROUNDS * (FLOW_KEY_TEST_KEYS - 1);
+  printf("flow key comparison: %5.2f ns/key (field by field: %5.2f ns/key)\n", 
+	 t * 1e9 / n, t_ref * 1e9 / n);
+  free(keys);
+
+  config.flow_key_match_method = method;
+  return test_failed;
+}
+
+/*
+ * flow_record_tls_fp_unit_test() prints a TLS flow with and without
+ * tls_fp=1, and checks that the fingerprint replaces the ciphersuite
+ * list of the ClientHello, but not the TLS record lengths
+ */
+int flow_record_tls_fp_unit_test() {
+  struct flow_record a, b;
+  struct flow_key k, t;
+  struct in_addr sa, da;
+  FILE *saved_output = output;
+  unsigned int saved_tls = include_tls, saved_fp = report_tls_fp;
+  unsigned int saved_records = records_in_file;
+  unsigned int fp;
+  char buf[8192];
+  size_t len;
+  int test_failed = 0;
+
+  inet_pton(AF_INET, "10.1.2.3", &sa);
+  inet_pton(AF_INET, "192.0.2.7", &da);
+  flow_key_set_ipv4_addrs(&k, sa, da);
+  k.sp = 49152;
+  k.dp = 443;
+  k.prot = 6;
+  k.vlan = 0;
+  flow_key_twin(&t, &k);
+  flow_record_init(&a, &k);
+  flow_record_init(&b, &t);
+  a.twin = &b;
+  b.twin = &a;
+  a.start.tv_sec = a.end.tv_sec = 1;
+  b.start.tv_sec = b.end.tv_sec = 2;
+  a.tls_info = tls_record_alloc();
+  b.tls_info = tls_record_alloc();
+  if (a.tls_info == NULL || b.tls_info == NULL) {
+    tls_record_free(a.tls_info);
+    tls_record_free(b.tls_info);
+    return 1;
+  }
+
+  /* a ClientHello and application data, answered by a ServerHello */
+  a.tls_info->num_ciphersuites = 2;
+  a.tls_info->ciphersuites[0] = 0xc02f;
+  a.tls_info->ciphersuites[1] = 0x009c;
+  memset(a.tls_info->tls_fp, 0xab, TLS_FP_LEN);
+  a.tls_info->tls_fp_valid = 1;
+  a.tls_info->tls_op = 2;
+  a.tls_info->tls_len[0] = 517;
+  a.tls_info->tls_len[1] = 100;
+  b.tls_info->num_ciphersuites = 1;
+  b.tls_info->ciphersuites[0] = 0xc02f;
+  b.tls_info->tls_op = 1;
+  b.tls_info->tls_len[0] = 1200;
+
+  include_tls = 1;
+  for (fp=0; fp<2; fp++) {
+    report_tls_fp = fp;
+    records_in_file = 0;
+    output = tmpfile();
+    if (output == NULL) {
+      test_failed = 1;
+      break;
+    }
+    flow_record_print_json(&a);
+    rewind(output);
+    len = fread(buf, 1, sizeof(buf) - 1, output);
+    buf[len] = 0;
+    fclose(output);
+
+    if (strstr(buf, "\"tls\": [") == NULL || strstr(buf, "{ \"b\": 517,") == NULL) {
+      printf("error: tls_fp=%u: no TLS record lengths\n", fp);
+      test_failed = 1;
+    }
+    if ((strstr(buf, "\"tls_fp\":") != NULL) != fp || (strstr(buf, "\"cs\":") != NULL) == fp) {
+      printf("error: tls_fp=%u: wrong choice of fingerprint or ciphersuite list\n", fp);
+      test_failed = 1;
+    }
+    if (strstr(buf, "\"scs\": \"c02f\"") == NULL) {
+      printf("error: tls_fp=%u: no ServerHello ciphersuite\n", fp);
+      test_failed = 1;
+    }
+  }
+
+  output = saved_output;
+  include_tls = saved_tls;
+  report_tls_fp = saved_fp;
+  records_in_file = saved_records;
+  tls_record_free(a.tls_info);
+  tls_record_free(b.tls_info);
+  return test_failed;
+}
+
 void flow_record_chrono_list_append(struct flow_record *record) {
   extern struct flow_record *flow_record_chrono_first;
   extern struct flow_record *flow_record_chrono_last;
@@ -667,6 +1047,81 @@ unsigned int flow_record_is_past_active_expiration(const struct flow_record *rec
   return 0;
 }
 
+/*
+ * subnet labels: the labels of the addresses of a flow are looked up
+ * once, when its record is created, rather than each time that it is
+ * printed.  New records are queued, and their addresses are looked up
+ * together with radix_trie_lookup_addr_batch() when the queue fills,
+ * or before any queued record is printed or deleted.  A record whose
+ * twin has the same addresses takes its labels from the twin.  A
+ * record that replaces an active-expired one is looked up again,
+ * since the subnets may have been reloaded since the expired one was
+ * created.
+ */
+#define FLOW_LABEL_BATCH 32
+
+static struct flow_record *flow_label_queue[FLOW_LABEL_BATCH];
+
+static unsigned int flow_label_queue_len = 0;
+
+static inline int flow_record_twin_has_same_addrs(const struct flow_record *r) {
+  return r->twin && flow_addrs_are_eq(&r->twin->key.sa, &r->key.da, &r->twin->key.da, &r->key.sa);
+}
+
+static void flow_record_labels_flush() {
+  struct in_addr addr[2 * FLOW_LABEL_BATCH];
+  attr_flags flags[2 * FLOW_LABEL_BATCH];
+  unsigned char copy[FLOW_LABEL_BATCH];
+  unsigned int i, n = 0;
+
+  /* 
+   * a record copies the labels of its twin only if the twin is ahead
+   * of it in the queue (labels_pending == 2 marks the records that
+   * have been passed), or is not in the queue
+   */
+  for (i=0; i<flow_label_queue_len; i++) {
+    struct flow_record *r = flow_label_queue[i];
+
+    copy[i] = flow_record_twin_has_same_addrs(r) && r->twin->labels_pending != 1;
+    r->labels_pending = 2;
+    if (!copy[i] && flow_key_is_ipv4(&r->key)) {
+      addr[n++] = r->key.sa.v4.addr;
+      addr[n++] = r->key.da.v4.addr;
+    }
+  }
+  radix_trie_lookup_addr_batch(rt, addr, flags, n);
+  n = 0;
+  for (i=0; i<flow_label_queue_len; i++) {
+    struct flow_record *r = flow_label_queue[i];
+
+    if (copy[i]) {
+      r->sa_labels = r->twin->da_labels;
+      r->da_labels = r->twin->sa_labels;
+    } else if (!flow_key_is_ipv4(&r->key)) {
+      r->sa_labels = radix_trie_lookup_addr6(rt, &r->key.sa.v6);
+      r->da_labels = radix_trie_lookup_addr6(rt, &r->key.da.v6);
+    } else {
+      r->sa_labels = flags[n++];
+      r->da_labels = flags[n++];
+    }
+    r->labels_pending = 0;
+  }
+  flow_label_queue_len = 0;
+}
+
+static void flow_record_labels_init(struct flow_record *r) {
+  if (flow_record_twin_has_same_addrs(r) && !r->twin->labels_pending) {
+    r->sa_labels = r->twin->da_labels;
+    r->da_labels = r->twin->sa_labels;
+    return;
+  }
+  r->labels_pending = 1;
+  flow_label_queue[flow_label_queue_len++] = r;
+  if (flow_label_queue_len == FLOW_LABEL_BATCH) {
+    flow_record_labels_flush();
+  }
+}
+
 struct flow_record *flow_key_get_record(const struct flow_key *key, 
 					unsigned int create_new_records) {
   struct flow_record *record;
@@ -732,6 +1187,10 @@ struct flow_record *flow_key_get_record(const struct flow_key *key,
       /* this flow has no twin, so add it to chronological list */
       flow_record_chrono_list_append(record);      
     }
+
+    if (rt != NULL) {
+      flow_record_labels_init(record);
+    }
   } 
   
   return record;
@@ -740,6 +1199,10 @@ struct flow_record *flow_key_get_record(const struct flow_key *key,
 void flow_record_delete(struct flow_record *r) {
   unsigned int i;
 
+  if (r->labels_pending) {
+    flow_record_labels_flush();
+  }
+
   //  hash_key = flow_key_hash(&r->key);
   if (flow_record_list_remove(&flow_record_list_array[flow_key_hash(&r->key)], r) != 0) {
     fprintf(info, "warning: error removing flow record %p from list\n", r);
@@ -759,7 +1222,7 @@ void flow_record_delete(struct flow_record *r) {
   if (r->idp) {
     free(r->idp);
   }
-  tls_record_delete(&r->tls_info);
+  tls_record_free(r->tls_info);
 
   if (r->exe_name) {
     free(r->exe_name);
@@ -791,13 +1254,9 @@ int flow_key_set_exe_name(const struct flow_key *key, const char *name) {
 }
 
 void flow_record_update_byte_count(struct flow_record *f, const void *x, unsigned int len) {
-  const unsigned char *data = x;
-  int i;
 
   if (byte_distribution || report_entropy) {
-    for (i=0; i<len; i++) {
-      f->byte_count[data[i]]++;
-    }
+    byte_count_update(f->byte_count, x, len);
   }
 
   /*
@@ -808,39 +1267,6 @@ void flow_record_update_byte_count(struct flow_record *f, const void *x, unsigne
 
 }
 
-void flow_record_update_byte_dist_mean_var(struct flow_record *f, const void *x, unsigned int len) {
-  const unsigned char *data = x;
-  double delta;
-  int i;
-
-  if (byte_distribution || report_entropy) {
-    for (i=0; i<len; i++) {
-      f->num_bytes += 1;
-      delta = ((double)data[i] - f->bd_mean);
-      f->bd_mean += delta/((double)f->num_bytes);
-      f->bd_variance += delta*((double)data[i] - f->bd_mean);
-    }
-  }
-}
-
-#include <math.h>
-#include <float.h>   /* for FLT_EPSILON */
-
-float flow_record_get_byte_count_entropy(const unsigned int byte_count[256], 
-					 unsigned int num_bytes) {
-  int i;
-  float tmp, sum = 0.0;
-
-  for (i=0; i<256; i++) {
-    tmp = (float) byte_count[i] / (float) num_bytes;
-    if (tmp > FLT_EPSILON) {
-      sum -= tmp * logf(tmp);
-    }
-    // fprintf(output, "tmp: %f\tsum: %f\n", tmp, sum);
-  }
-  return sum / logf(2.0);
-}
-
 void mem_print(const void *mem, unsigned int len) {
   const unsigned char *x = mem;
 
@@ -851,9 +1277,13 @@ void mem_print(const void *mem, unsigned int len) {
 }
 
 void flow_key_print(const struct flow_key *key) {
+  char sa[INET6_ADDRSTRLEN], da[INET6_ADDRSTRLEN];
+
+  flow_key_addr_ntop(key, &key->sa, sa, sizeof(sa));
+  flow_key_addr_ntop(key, &key->da, da, sizeof(da));
   debug_printf("flow key:\n");
-  debug_printf("\tsa: %s\n", inet_ntoa(key->sa));
-  debug_printf("\tda: %s\n", inet_ntoa(key->da));
+  debug_printf("\tsa: %s\n", sa);
+  debug_printf("\tda: %s\n", da);
   debug_printf("\tsp: %u\n", key->sp);
   debug_printf("\tdp: %u\n", key->dp);
   debug_printf("\tpr: %u\n", key->prot);
@@ -862,23 +1292,17 @@ void flow_key_print(const struct flow_key *key) {
 
 void flow_record_print(const struct flow_record *record) {
   unsigned int i, imax;
-  char addr_string[INET6_ADDRSTRLEN];
+  char addr_string[ANON_STRING6_LEN];
 
   fprintf(output, "flow record:\n");
-  if (ipv4_addr_needs_anonymization(&record->key.sa)) {
-    fprintf(output, "\tsa: %s\n", addr_get_anon_hexstring(&record->key.sa));
-  } else {
-    inet_ntop(AF_INET, &record->key.sa, addr_string, INET6_ADDRSTRLEN);
-    fprintf(output, "\tsa: %s\n", addr_string);
-  }
-  if (ipv4_addr_needs_anonymization(&record->key.da)) {
-    fprintf(output, "\tda: %s\n", addr_get_anon_hexstring(&record->key.da));
-  } else {
-    fprintf(output, "\tda: %s\n", inet_ntoa(record->key.da));
-  }
+  fprintf(output, "\tsa: %s\n", flow_key_addr_string(&record->key, &record->key.sa, addr_string, sizeof(addr_string)));
+  fprintf(output, "\tda: %s\n", flow_key_addr_string(&record->key, &record->key.da, addr_string, sizeof(addr_string)));
   fprintf(output, "\tsp: %u\n", record->key.sp);
   fprintf(output, "\tdp: %u\n", record->key.dp);
   fprintf(output, "\tpr: %u\n", record->key.prot);
+  if (record->key.vlan) {
+    fprintf(output, "\tvlan: %u\n", record->key.vlan);
+  }
   fprintf(output, "\tob: %u\n", record->ob);
   fprintf(output, "\top: %u\n", record->np);  /* not just packets with data */
   fprintf(output, "\tttl: %u\n", record->ttl);  
@@ -891,8 +1315,12 @@ void flow_record_print(const struct flow_record *record) {
     fprintf(output, "%u ", record->pkt_len[i-1]);
   }
   fprintf(output, "]\n");
+  if ((payload_budget || payload_pkt_budget) && record->fb < record->ob) {
+    fprintf(output, "\tfb: %u\n", record->fb);
+    fprintf(output, "\tfp: %u\n", record->fp);
+  }
   if (byte_distribution) {
-    if (record->ob != 0) {
+    if (record->fb != 0) {
       fprintf(output, "\tbd: [ ");
       for (i = 0; i < 255; i++) {
 	fprintf(output, "%u, ", record->byte_count[i]);
@@ -901,20 +1329,22 @@ void flow_record_print(const struct flow_record *record) {
     }
   }
   if (report_entropy) {
-    if (record->ob != 0) {
+    if (record->fb != 0) {
+      float bd_dist[256];
+
       fprintf(output, "\tbe: %f\n", 
-	      flow_record_get_byte_count_entropy(record->byte_count, record->ob));
+	      byte_count_entropy(record->byte_count, record->fb, bd_dist));
     }
   }
 }
 
-void print_bytes_dir_time(unsigned short int pkt_len, char *dir, struct timeval ts, char *term) {
+void print_bytes_dir_time(unsigned short int pkt_len, char *dir, unsigned int ipt, char *term) {
   if (pkt_len < 32768) {
     fprintf(output, "\t\t\t\t{ \"b\": %u, \"dir\": \"%s\", \"ipt\": %u }%s", 
-	    pkt_len, dir, timeval_to_milliseconds(ts), term);
+	    pkt_len, dir, ipt, term);
   } else {
     fprintf(output, "\t\t\t\t{ \"rep\": %u, \"dir\": \"%s\", \"ipt\": %u }%s", 
-	    65536-pkt_len, dir, timeval_to_milliseconds(ts), term);    
+	    65536-pkt_len, dir, ipt, term);    
   }
 }
 
@@ -1029,26 +1459,289 @@ void len_time_print_interleaved(unsigned int op, const unsigned short *len, cons
 
 }
 
+#define FPRINTF_HEX_CHUNK 1024
+
 void fprintf_raw_as_hex(FILE *f, const void *data, unsigned int len) {
   const unsigned char *x = data;
-  const unsigned char *end = data + len;
-  
-  fprintf(f, "\"");   /* quotes needed for JSON */
-  while (x < end) {
-    fprintf(f, "%02x", *x++);
+  const unsigned char *end = x + len;
+  char buf[2*FPRINTF_HEX_CHUNK+2];
+  unsigned int n;
+
+  /*
+   * encode the data a chunk at a time into buf, so that each chunk
+   * is written out with a single call to fwrite()
+   */
+  buf[0] = '"';   /* quotes needed for JSON */
+  n = 1;
+  do {
+    unsigned int chunk = (end - x) > FPRINTF_HEX_CHUNK ? FPRINTF_HEX_CHUNK : (end - x);
+
+    n += hex_encode(buf + n, x, chunk);
+    x += chunk;
+    if (x == end) {
+      buf[n++] = '"';
+    }
+    fwrite(buf, 1, n, f);
+    n = 0;
+  } while (x < end);
+
+}
+
+
+
+/*
+ * flow_record_get_splt(rec, ts_start, splt) fills in the array splt
+ * with the lengths, directions, and inter-packet times of the first
+ * num_pkt_len packets of rec and of its twin, in time order, and
+ * returns the number of entries; ts_start is the start time of the
+ * (possibly bidirectional) flow
+ */
+static unsigned int flow_record_get_splt(const struct flow_record *rec, struct timeval ts_start, 
+					 struct splt_entry *splt) {
+  unsigned int i, j, imax, jmax, n = 0;
+  struct timeval ts, ts_last, tmp;
+
+  imax = rec->op > num_pkt_len ? num_pkt_len : rec->op;
+
+  if (rec->twin == NULL) {
+
+    for (i = 0; i < imax; i++) {
+      if (i > 0) {
+	timer_sub(&rec->pkt_time[i], &rec->pkt_time[i-1], &ts);
+      } else {
+	timer_clear(&ts);
+      }
+      splt[n].len = rec->pkt_len[i];
+      splt[n].dir = SPLT_DIR_OUT;
+      splt[n].ipt = timeval_to_milliseconds(ts);
+      n++;
+    }
+
+  } else {
+
+    jmax = rec->twin->op > num_pkt_len ? num_pkt_len : rec->twin->op;
+    i = j = 0;
+    ts_last = ts_start;
+    while ((i < imax) || (j < jmax)) {      
+
+      /* use the list with the lowest time, until one is exhausted */
+      if ((j >= jmax) || ((i < imax) && timer_lt(&rec->pkt_time[i], &rec->twin->pkt_time[j]))) {
+	ts = rec->pkt_time[i];
+	splt[n].len = rec->pkt_len[i];
+	splt[n].dir = SPLT_DIR_IN;
+	i++;
+      } else {
+	ts = rec->twin->pkt_time[j];
+	splt[n].len = rec->twin->pkt_len[j];
+	splt[n].dir = SPLT_DIR_OUT;
+	j++;
+      }
+      timer_sub(&ts, &ts_last, &tmp);
+      splt[n].ipt = timeval_to_milliseconds(tmp);
+      ts_last = ts;
+      n++;
+    }
+  }
+
+  return n;
+}
+
+/*
+ * TLS dictionary: when tls_dict=1, each distinct list of offered
+ * ciphersuites and each distinct list of TLS extensions is printed
+ * only once per output file, in the "tls_dict" object that follows
+ * the "appflows" array, and flow records refer to a list by its
+ * position in the corresponding dictionary array ("cs_id" or
+ * "tls_ext_id").  If a dictionary fills up, the lists that do not fit
+ * are printed inline, as they are when tls_dict=0.
+ */
+#define TLS_DICT_MAX_ENTRIES 16384
+
+static struct dict cs_dict = { NULL, 0, TLS_DICT_MAX_ENTRIES, NULL, 0 };
+
+static struct dict tls_ext_dict = { NULL, 0, TLS_DICT_MAX_ENTRIES, NULL, 0 };
+
+static void fprintf_ciphersuites(FILE *f, const unsigned short *cs, unsigned int num_cs) {
+  unsigned int i;
+
+  fprintf(f, "[ ");
+  for (i = 0; i < num_cs-1; i++) {
+    if ((i % 8) == 0) {
+      fprintf(f, "\n\t\t\t        ");	    
+    }
+    fprintf(f, "\"%04x\", ", cs[i]);
   }
-  fprintf(f, "\"");
+  fprintf(f, "\"%04x\"\n\t\t\t]", cs[i]);
+}
 
+static void fprintf_tls_extensions(FILE *f, const struct tls_extension *ext, unsigned int num_ext) {
+  unsigned int i;
+
+  fprintf(f, "[ ");
+  for (i = 0; i < num_ext; i++) {
+    fprintf(f, "\n\t\t\t\t{ \"type\": \"%04x\", ", ext[i].type);
+    fprintf(f, "\"length\": %i, \"data\": ", ext[i].length);
+    fprintf_raw_as_hex(f, ext[i].data, ext[i].length);
+    fprintf(f, i < num_ext-1 ? "}," : "}\n\t\t\t]");
+  }
 }
 
+/*
+ * a list of extensions is stored in the dictionary as a sequence of
+ * (type, length, data) elements, with type and length in host byte
+ * order
+ */
+static unsigned int tls_extensions_serialize(unsigned char *buf, const struct tls_extension *ext, unsigned int num_ext) {
+  unsigned char *b = buf;
+  unsigned int i;
+
+  for (i = 0; i < num_ext; i++) {
+    memcpy(b, &ext[i].type, sizeof(ext[i].type));
+    b += sizeof(ext[i].type);
+    memcpy(b, &ext[i].length, sizeof(ext[i].length));
+    b += sizeof(ext[i].length);
+    memcpy(b, ext[i].data, ext[i].length);
+    b += ext[i].length;
+  }
+  return b - buf;
+}
+
+static unsigned int tls_extensions_deserialize(struct tls_extension *ext, const unsigned char *buf, unsigned int len) {
+  const unsigned char *b = buf;
+  const unsigned char *end = buf + len;
+  unsigned int num_ext = 0;
+
+  while (b < end && num_ext < MAX_EXTENSIONS) {
+    memcpy(&ext[num_ext].type, b, sizeof(ext[num_ext].type));
+    b += sizeof(ext[num_ext].type);
+    memcpy(&ext[num_ext].length, b, sizeof(ext[num_ext].length));
+    b += sizeof(ext[num_ext].length);
+    ext[num_ext].data = (void *)b;
+    b += ext[num_ext].length;
+    num_ext++;
+  }
+  return num_ext;
+}
 
+static void tls_ciphersuites_print_json(FILE *f, const struct tls_information *tls_info) {
+  unsigned int is_new;
+  int id;
+
+  if (tls_info->num_ciphersuites == 1) {
+    fprintf(f, ",\n\t\t\t\"scs\": \"%04x\"", tls_info->ciphersuites[0]);
+    return;
+  }
+  if (report_tls_dict) {
+    id = dict_lookup_or_add(&cs_dict, tls_info->ciphersuites, 
+			    tls_info->num_ciphersuites * sizeof(unsigned short), &is_new);
+    if (id != DICT_FULL) {
+      fprintf(f, ",\n\t\t\t\"cs_id\": %d", id);
+      return;
+    }
+  }
+  fprintf(f, ",\n\t\t\t\"cs\": ");
+  fprintf_ciphersuites(f, tls_info->ciphersuites, tls_info->num_ciphersuites);
+}
+
+static void tls_extensions_print_json(FILE *f, const struct tls_information *tls_info) {
+  unsigned int i, len, is_new;
+  unsigned char *buf;
+  int id = DICT_FULL;
+
+  if (report_tls_dict) {
+    len = 0;
+    for (i = 0; i < tls_info->num_tls_extensions; i++) {
+      len += sizeof(unsigned short) * 2 + tls_info->tls_extensions[i].length;
+    }
+    buf = malloc(len);
+    if (buf == NULL) {
+      flocap_stats_incr_malloc_fail();
+    } else {
+      tls_extensions_serialize(buf, tls_info->tls_extensions, tls_info->num_tls_extensions);
+      id = dict_lookup_or_add(&tls_ext_dict, buf, len, &is_new);
+      free(buf);
+    }
+    if (id != DICT_FULL) {
+      fprintf(f, ",\n\t\t\t\"tls_ext_id\": %d", id);
+      return;
+    }
+  }
+  fprintf(f, ",\n\t\t\t\"tls_ext\": ");
+  fprintf_tls_extensions(f, tls_info->tls_extensions, tls_info->num_tls_extensions);
+}
+
+/*
+ * TLS client fingerprints: when tls_fp=1, a flow whose ClientHello
+ * was parsed reports its fingerprint ("tls_fp") instead of its list
+ * of offered ciphersuites and its list of TLS extensions.  The
+ * distinct fingerprints are kept in a table for the lifetime of the
+ * process; when tls_fp=2, the fingerprint string ("tls_fp_str") is
+ * also reported the first time that a fingerprint is seen, or if it
+ * does not fit in the table.
+ */
+#define TLS_FP_MAX_ENTRIES 65536
+
+static struct dict tls_fp_dict = { NULL, 0, TLS_FP_MAX_ENTRIES, NULL, 0 };
+
+static void tls_fingerprint_print_json(FILE *f, const struct tls_information *tls_info) {
+  char hex[2*TLS_FP_LEN+1];
+  unsigned int is_new = 0;
+  char *str;
+  int id;
+
+  hex[hex_encode(hex, tls_info->tls_fp, TLS_FP_LEN)] = 0;
+  fprintf(f, ",\n\t\t\t\"tls_fp\": \"%s\"", hex);
+
+  id = dict_lookup_or_add(&tls_fp_dict, tls_info->tls_fp, TLS_FP_LEN, &is_new);
+  if (is_new) {
+    flocap_stats_incr_tls_fps();
+  }
+  if (report_tls_fp > 1 && (is_new || id == DICT_FULL)) {
+    str = tls_client_fingerprint_string(tls_info);
+    if (str == NULL) {
+      flocap_stats_incr_malloc_fail();
+    } else {
+      fprintf(f, ",\n\t\t\t\"tls_fp_str\": \"%s\"", str);
+      free(str);
+    }
+  }
+}
+
+void tls_dict_print_json(FILE *f) {
+  static struct tls_extension ext[MAX_EXTENSIONS];
+  const unsigned char *data;
+  unsigned int i, len;
+
+  if (!report_tls_dict) {
+    return;
+  }
+
+  fprintf(f, ",\n\"tls_dict\": {\n\t\"cs\": [");
+  for (i = 0; i < cs_dict.num_entries; i++) {
+    data = dict_get_entry(&cs_dict, i, &len);
+    fprintf(f, i ? ",\n\t\t" : "\n\t\t");
+    fprintf_ciphersuites(f, (const unsigned short *)data, len / sizeof(unsigned short));
+  }
+  fprintf(f, "\n\t],\n\t\"tls_ext\": [");
+  for (i = 0; i < tls_ext_dict.num_entries; i++) {
+    data = dict_get_entry(&tls_ext_dict, i, &len);
+    fprintf(f, i ? ",\n\t\t" : "\n\t\t");
+    fprintf_tls_extensions(f, ext, tls_extensions_deserialize(ext, data, len));
+  }
+  fprintf(f, "\n\t]\n}");
+
+  /* each output file has its own dictionary */
+  dict_clear(&cs_dict);
+  dict_clear(&tls_ext_dict);
+}
 
 void flow_record_print_json(const struct flow_record *record) {
-  unsigned int i, j, imax, jmax;
-  struct timeval ts, ts_last, ts_start, ts_end, tmp;
+  unsigned int i;
+  struct timeval ts_start, ts_end;
   const struct flow_record *rec;
-  unsigned int pkt_len;
-  char *dir;
+  char addr_string[ANON_STRING6_LEN];
+  float bd_dist[256];
+  const float *dist = NULL;
 
   if (records_in_file != 0) {
     fprintf(output, ",\n");
@@ -1079,33 +1772,29 @@ void flow_record_print_json(const struct flow_record *record) {
   fprintf(output, "\t\{\n\t\t\"flow\": {\n");
 
   /* print flow key */
-  if (ipv4_addr_needs_anonymization(&rec->key.sa)) {
-    fprintf(output, "\t\t\t\"sa\": \"%s\",\n", addr_get_anon_hexstring(&rec->key.sa));
-  } else {
-    fprintf(output, "\t\t\t\"sa\": \"%s\",\n", inet_ntoa(rec->key.sa));
-  }
-  if (ipv4_addr_needs_anonymization(&rec->key.da)) {
-    fprintf(output, "\t\t\t\"da\": \"%s\",\n", addr_get_anon_hexstring(&rec->key.da));
-  } else {
-    fprintf(output, "\t\t\t\"da\": \"%s\",\n", inet_ntoa(rec->key.da));
-  }
+  fprintf(output, "\t\t\t\"sa\": \"%s\",\n", 
+	  flow_key_addr_string(&rec->key, &rec->key.sa, addr_string, sizeof(addr_string)));
+  fprintf(output, "\t\t\t\"da\": \"%s\",\n", 
+	  flow_key_addr_string(&rec->key, &rec->key.da, addr_string, sizeof(addr_string)));
   fprintf(output, "\t\t\t\"pr\": %u,\n", rec->key.prot);
   if (1 || rec->key.prot == 6 || rec->key.prot == 17) {
     fprintf(output, "\t\t\t\"sp\": %u,\n", rec->key.sp);
     fprintf(output, "\t\t\t\"dp\": %u,\n", rec->key.dp);
   }
+  if (rec->key.vlan) {
+    fprintf(output, "\t\t\t\"vlan\": %u,\n", rec->key.vlan);
+  }
 
   /* 
    * if src or dst address matches a subnets associated with labels,
    * then print out those labels
    */
   if (config.num_subnets) {
-    attr_flags flag;
-
-    flag = radix_trie_lookup_addr(rt, rec->key.sa);
-    attr_flags_json_print_labels(rt, flag, "sa_labels", output);
-    flag = radix_trie_lookup_addr(rt, rec->key.da);
-    attr_flags_json_print_labels(rt, flag, "da_labels", output);
+    if (rec->labels_pending) {
+      flow_record_labels_flush();
+    }
+    attr_flags_json_print_labels(rt, rec->sa_labels, "sa_labels", output);
+    attr_flags_json_print_labels(rt, rec->da_labels, "da_labels", output);
   }
 
   /* print flow stats */
@@ -1115,6 +1804,19 @@ void flow_record_print_json(const struct flow_record *record) {
     fprintf(output, "\t\t\t\"ib\": %u,\n", rec->twin->ob);
     fprintf(output, "\t\t\t\"ip\": %u,\n", rec->twin->np);
   }
+  /*
+   * if the payload budget cut short the payload features of either
+   * direction, report the prefix over which they were computed
+   */
+  if ((payload_budget || payload_pkt_budget) 
+      && (rec->fb < rec->ob || (rec->twin != NULL && rec->twin->fb < rec->twin->ob))) {
+    fprintf(output, "\t\t\t\"ofb\": %u,\n", rec->fb);
+    fprintf(output, "\t\t\t\"ofp\": %u,\n", rec->fp);
+    if (rec->twin != NULL) {
+      fprintf(output, "\t\t\t\"ifb\": %u,\n", rec->twin->fb);
+      fprintf(output, "\t\t\t\"ifp\": %u,\n", rec->twin->fp);
+    }
+  }
   fprintf(output, "\t\t\t\"ts\": %ld.%06ld,\n", ts_start.tv_sec, ts_start.tv_usec);
   fprintf(output, "\t\t\t\"te\": %ld.%06ld,\n", ts_end.tv_sec, ts_end.tv_usec);
   fprintf(output, "\t\t\t\"ottl\": %u,\n", rec->ttl);
@@ -1191,83 +1893,27 @@ void flow_record_print_json(const struct flow_record *record) {
 			     rec->twin->op, rec->twin->pkt_len, rec->twin->pkt_time);
 #else
   /* print length and time arrays */
-  fprintf(output, "\t\t\t\"non_norm_stats\": [\n");
+  {
+    struct splt_entry splt[2*MAX_NUM_PKT_LEN];
+    unsigned int num_splt = flow_record_get_splt(rec, ts_start, splt);
 
-  if (rec->twin == NULL) {
-    
-    imax = rec->op > num_pkt_len ? num_pkt_len : rec->op;
-    if (imax == 0) { 
-      ; /* no packets had data, so we print out nothing */
-    } else {
-      for (i = 0; i < imax-1; i++) {
-	if (i > 0) {
-	  timer_sub(&rec->pkt_time[i], &rec->pkt_time[i-1], &ts);
-	} else {
-	  timer_clear(&ts);
-	}
-	print_bytes_dir_time(rec->pkt_len[i], OUT, ts, ",\n");
-	// fprintf(output, "\t\t\t\t{ \"b\": %u, \"dir\": \">\", \"ipt\": %u },\n", 
-	//    record->pkt_len[i], timeval_to_milliseconds(ts));
-      }
-      if (i == 0) {        /* this code could be simplified */ 	
-	timer_clear(&ts);  
-      } else {
-	timer_sub(&rec->pkt_time[i], &rec->pkt_time[i-1], &ts);
-      }
-      print_bytes_dir_time(rec->pkt_len[i], OUT, ts, "\n");
-      // fprintf(output, "\t\t\t\t{ \"b\": %u, \"dir\": \">\", \"ipt\": %u }\n", 
-      //    record->pkt_len[i], timeval_to_milliseconds(ts));
-    }
-    fprintf(output, "\t\t\t]"); 
-  } else {
+    if (report_splt_enc) {
+      unsigned char buf[SPLT_MAX_ENCODED_LEN(2*MAX_NUM_PKT_LEN)];
+      char b64[BASE64_LEN(sizeof(buf)) + 1];
+      unsigned int len;
 
-    imax = rec->op > num_pkt_len ? num_pkt_len : rec->op;
-    jmax = rec->twin->op > num_pkt_len ? num_pkt_len : rec->twin->op;
-    i = j = 0;
-    ts_last = ts_start;
-    while ((i < imax) || (j < jmax)) {      
-
-      if (i >= imax) {  /* record list is exhausted, so use twin */
-	dir = OUT;
-	ts = rec->twin->pkt_time[j];
-	pkt_len = rec->twin->pkt_len[j];
-	j++;
-      } else if (j >= jmax) {  /* twin list is exhausted, so use record */
-	dir = IN;
-	ts = rec->pkt_time[i];
-	pkt_len = rec->pkt_len[i];
-	i++;
-      } else { /* neither list is exhausted, so use list with lowest time */     
+      len = splt_encode(buf, sizeof(buf), splt, num_splt);
+      b64[base64_encode(b64, buf, len)] = 0;
+      fprintf(output, "\t\t\t\"splt_enc\": \"%s\"", b64);
 
-	if (timer_lt(&rec->pkt_time[i], &rec->twin->pkt_time[j])) {
-	  ts = rec->pkt_time[i];
-	  pkt_len = rec->pkt_len[i];
-	  dir = IN;
-	  if (i < imax) {
-	    i++;
-	  }
-	} else {
-	  ts = rec->twin->pkt_time[j];
-	  pkt_len = rec->twin->pkt_len[j];
-	  dir = OUT;
-	  if (j < jmax) {
-	    j++;
-	  }
-	}
-      }
-      // fprintf(output, "i: %d\tj: %d\timax: %d\t jmax: %d", i, j, imax, jmax);
-      timer_sub(&ts, &ts_last, &tmp);
-      //      fprintf(output, "\t\t\t\t{ \"b\": %u, \"dir\": \"%s\", \"ipt\": %u }", 
-      //     pkt_len, dir, timeval_to_milliseconds(tmp));
-      print_bytes_dir_time(pkt_len, dir, tmp, "");
-      ts_last = ts;
-      if ((i == imax) & (j == jmax)) { /* we are done */
-      	fprintf(output, "\n"); 
-      } else {
-	fprintf(output, ",\n");
+    } else {
+      fprintf(output, "\t\t\t\"non_norm_stats\": [\n");
+      for (i = 0; i < num_splt; i++) {
+	print_bytes_dir_time(splt[i].len, splt[i].dir == SPLT_DIR_IN ? IN : OUT, 
+			     splt[i].ipt, i < num_splt-1 ? ",\n" : "\n");
       }
+      fprintf(output, "\t\t\t]");
     }
-    fprintf(output, "\t\t\t]");
   }
 #endif /* 0 */
 
@@ -1275,7 +1921,7 @@ void flow_record_print_json(const struct flow_record *record) {
     const unsigned int *array;
     unsigned int tmp[256];
     unsigned int num_bytes;
-    double mean = 0.0, variance = 0.0;
+    double mean, std_dev;
 
     /* 
      * sum up the byte_count array for outbound and inbound flows, if
@@ -1283,34 +1929,13 @@ void flow_record_print_json(const struct flow_record *record) {
      */
     if (rec->twin == NULL) {
       array = rec->byte_count;
-      num_bytes = rec->ob;
-
-      if (rec->num_bytes != 0) {
-	mean = rec->bd_mean;
-	variance = rec->bd_variance/(rec->num_bytes - 1);
-	variance = sqrt(variance);
-	if (rec->num_bytes == 1) {
-	  variance = 0.0;
-	}
-      }
+      num_bytes = rec->fb;
     } else {
       for (i=0; i<256; i++) {
 	tmp[i] = rec->byte_count[i] + rec->twin->byte_count[i];
       }
       array = tmp;
-      num_bytes = rec->ob + rec->twin->ob;
-
-      if (rec->num_bytes + rec->twin->num_bytes != 0) {
-	mean = ((double)rec->num_bytes)/((double)(rec->num_bytes+rec->twin->num_bytes))*rec->bd_mean +
-	  ((double)rec->twin->num_bytes)/((double)(rec->num_bytes+rec->twin->num_bytes))*rec->twin->bd_mean;
-	variance = ((double)rec->num_bytes)/((double)(rec->num_bytes+rec->twin->num_bytes))*rec->bd_variance +
-	  ((double)rec->twin->num_bytes)/((double)(rec->num_bytes+rec->twin->num_bytes))*rec->twin->bd_variance;
-	variance = variance/((double)(rec->num_bytes + rec->twin->num_bytes - 1));
-	variance = sqrt(variance);
-	if (rec->num_bytes + rec->twin->num_bytes == 1) {
-	  variance = 0.0;
-	}
-      }
+      num_bytes = rec->fb + rec->twin->fb;
     }
     
     if (byte_distribution) {
@@ -1325,16 +1950,19 @@ void flow_record_print_json(const struct flow_record *record) {
 
       // output the mean
       if (num_bytes != 0) {
+	byte_count_mean_std_dev(array, &mean, &std_dev);
 	fprintf(output, ",\n\t\t\t\"bd_mean\": %f", mean);
-	fprintf(output, ",\n\t\t\t\"bd_std\": %f", variance);
+	fprintf(output, ",\n\t\t\t\"bd_std\": %f", std_dev);
       }
 
     }
 
-    if (report_entropy) {
-      if (num_bytes != 0) {
-	double entropy = flow_record_get_byte_count_entropy(array, num_bytes);
+    /* the normalized distribution is shared with the classifier */
+    if (num_bytes != 0 && (report_entropy || (byte_distribution && include_classifier))) {
+      double entropy = byte_count_entropy(array, num_bytes, bd_dist);
 	
+      dist = bd_dist;
+      if (report_entropy) {
 	fprintf(output, ",\n\t\t\t\"be\": %f", entropy);
 	fprintf(output, ",\n\t\t\t\"tbe\": %f", entropy * num_bytes);
       }
@@ -1349,13 +1977,11 @@ void flow_record_print_json(const struct flow_record *record) {
       score = classify(rec->pkt_len, rec->pkt_time, rec->twin->pkt_len, rec->twin->pkt_time,
 		       rec->start, rec->twin->start,
 		       NUM_PKT_LEN, rec->key.sp, rec->key.dp, rec->np, rec->twin->np, rec->op, rec->twin->op,
-		       rec->ob, rec->twin->ob, byte_distribution,
-		       rec->byte_count, rec->twin->byte_count);
+		       rec->ob, rec->twin->ob, byte_distribution ? dist : NULL);
     } else {
       score = classify(rec->pkt_len, rec->pkt_time, NULL, NULL,	rec->start, rec->start,
 		       NUM_PKT_LEN, rec->key.sp, rec->key.dp, rec->np, 0, rec->op, 0,
-		       rec->ob, 0, byte_distribution,
-		       rec->byte_count, NULL);
+		       rec->ob, 0, byte_distribution ? dist : NULL);
     }
 
     fprintf(output, ",\n\t\t\t\"p_malware\": \"%f\"", score);
@@ -1363,9 +1989,9 @@ void flow_record_print_json(const struct flow_record *record) {
 
   if (report_wht) { 
     if (rec->twin) {
-      wht_printf_scaled_bidir(&rec->wht, rec->ob, &rec->twin->wht, rec->twin->ob, output);
+      wht_printf_scaled_bidir(&rec->wht, rec->fb, &rec->twin->wht, rec->twin->fb, output);
     } else {
-      wht_printf_scaled(&rec->wht, output, rec->ob);
+      wht_printf_scaled(&rec->wht, output, rec->fb);
     }
   }
 
@@ -1389,21 +2015,24 @@ void flow_record_print_json(const struct flow_record *record) {
   }
 
   if (include_tls) { 
+    const struct tls_information *otls = rec->tls_info;
+    const struct tls_information *itls = rec->twin ? rec->twin->tls_info : NULL;
+    unsigned int olists, ilists;
 
-    if (rec->tls_info.tls_v) {
-      fprintf(output, ",\n\t\t\t\"tls_ov\": %u", rec->tls_info.tls_v);
-      //      fprintf(output, ",\n\t\t\t\"tls_ov\": %s", tls_version_get_string(record->tls_info.tls_v));
+    if (otls && otls->tls_v) {
+      fprintf(output, ",\n\t\t\t\"tls_ov\": %u", otls->tls_v);
+      //      fprintf(output, ",\n\t\t\t\"tls_ov\": %s", tls_version_get_string(otls->tls_v));
     }
-    if (rec->twin && rec->twin->tls_info.tls_v) {
-      fprintf(output, ",\n\t\t\t\"tls_iv\": %u", rec->twin->tls_info.tls_v);
-      //      fprintf(output, ",\n\t\t\t\"tls_iv\": %s", tls_version_get_string(record->twin->tls_info.tls_v));
+    if (itls && itls->tls_v) {
+      fprintf(output, ",\n\t\t\t\"tls_iv\": %u", itls->tls_v);
+      //      fprintf(output, ",\n\t\t\t\"tls_iv\": %s", tls_version_get_string(itls->tls_v));
     }
 
-    if (rec->tls_info.tls_client_key_length) {
-      fprintf(output, ",\n\t\t\t\"tls_client_key_length\": %u", rec->tls_info.tls_client_key_length);
+    if (otls && otls->tls_client_key_length) {
+      fprintf(output, ",\n\t\t\t\"tls_client_key_length\": %u", otls->tls_client_key_length);
     }
-    if (rec->twin && rec->twin->tls_info.tls_client_key_length) {
-      fprintf(output, ",\n\t\t\t\"tls_client_key_length\": %u", rec->twin->tls_info.tls_client_key_length);
+    if (itls && itls->tls_client_key_length) {
+      fprintf(output, ",\n\t\t\t\"tls_client_key_length\": %u", itls->tls_client_key_length);
     }
 
     /*
@@ -1411,94 +2040,68 @@ void flow_record_print_json(const struct flow_record *record) {
      * determine whether or not we have seen a clientHello or a
      * serverHello
      */
-    if (rec->tls_info.num_ciphersuites) {
+    if (otls && otls->num_ciphersuites) {
       fprintf(output, ",\n\t\t\t\"tls_orandom\": ");
-      fprintf_raw_as_hex(output, rec->tls_info.tls_random, 32);
+      fprintf_raw_as_hex(output, otls->tls_random, 32);
     }
-    if (rec->twin && rec->twin->tls_info.num_ciphersuites) {
+    if (itls && itls->num_ciphersuites) {
       fprintf(output, ",\n\t\t\t\"tls_irandom\": ");
-      fprintf_raw_as_hex(output, rec->twin->tls_info.tls_random, 32);
+      fprintf_raw_as_hex(output, itls->tls_random, 32);
     }
 
-    if (rec->tls_info.tls_sid_len) {
+    if (otls && otls->tls_sid_len) {
       fprintf(output, ",\n\t\t\t\"tls_osid\": ");
-      fprintf_raw_as_hex(output, rec->tls_info.tls_sid, rec->tls_info.tls_sid_len);
+      fprintf_raw_as_hex(output, otls->tls_sid, otls->tls_sid_len);
     }
 
-    if (rec->twin && rec->twin->tls_info.tls_sid_len) {
+    if (itls && itls->tls_sid_len) {
       fprintf(output, ",\n\t\t\t\"tls_isid\": ");
-      fprintf_raw_as_hex(output, rec->twin->tls_info.tls_sid, rec->twin->tls_info.tls_sid_len);
+      fprintf_raw_as_hex(output, itls->tls_sid, itls->tls_sid_len);
     }
 
-    if (rec->tls_info.num_ciphersuites) {
-      if (rec->tls_info.num_ciphersuites == 1) {
-	fprintf(output, ",\n\t\t\t\"scs\": \"%04x\"", rec->tls_info.ciphersuites[0]);
-      } else {
-	fprintf(output, ",\n\t\t\t\"cs\": [ ");
-	for (i = 0; i < rec->tls_info.num_ciphersuites-1; i++) {
-	  if ((i % 8) == 0) {
-	    fprintf(output, "\n\t\t\t        ");	    
-	  }
-	  fprintf(output, "\"%04x\", ", rec->tls_info.ciphersuites[i]);
-	}
-	fprintf(output, "\"%04x\"\n\t\t\t]", rec->tls_info.ciphersuites[i]);
+    if (report_tls_fp) {
+      if (otls && otls->tls_fp_valid) {
+	tls_fingerprint_print_json(output, otls);
       }
-    }  
-
-    if (rec->twin && rec->twin->tls_info.num_ciphersuites) {
-      if (rec->twin->tls_info.num_ciphersuites == 1) {
-	fprintf(output, ",\n\t\t\t\"scs\": \"%04x\"", rec->tls_info.ciphersuites[0]);
-      } else {
-	fprintf(output, ",\n\t\t\t\"cs\": [ ");
-	for (i = 0; i < rec->twin->tls_info.num_ciphersuites-1; i++) {
-	  if ((i % 8) == 0) {
-	    fprintf(output, "\n\t\t\t        ");	    
-	  }
-	  fprintf(output, "\"%04x\", ", rec->twin->tls_info.ciphersuites[i]);
-	}
-	fprintf(output, "\"%04x\"\n\t\t\t]", rec->twin->tls_info.ciphersuites[i]);
+      if (itls && itls->tls_fp_valid) {
+	tls_fingerprint_print_json(output, itls);
       }
+    }
+
+    /*
+     * the fingerprint replaces the lists of a ClientHello, but not
+     * the record lengths and times that follow them
+     */
+    olists = otls && !(report_tls_fp && otls->tls_fp_valid);
+    ilists = itls && !(report_tls_fp && itls->tls_fp_valid);
+
+    if (olists && otls->num_ciphersuites) {
+      tls_ciphersuites_print_json(output, otls);
+    }  
+    if (ilists && itls->num_ciphersuites) {
+      tls_ciphersuites_print_json(output, itls);
     }    
   
-    if (rec->tls_info.num_tls_extensions) {
-      fprintf(output, ",\n\t\t\t\"tls_ext\": [ ");
-      for (i = 0; i < rec->tls_info.num_tls_extensions-1; i++) {
-	fprintf(output, "\n\t\t\t\t{ \"type\": \"%04x\", ", rec->tls_info.tls_extensions[i].type);
-	fprintf(output, "\"length\": %i, \"data\": ", rec->tls_info.tls_extensions[i].length);
-	fprintf_raw_as_hex(output, rec->tls_info.tls_extensions[i].data, rec->tls_info.tls_extensions[i].length);
-	fprintf(output, "},");
-      }
-      fprintf(output, "\n\t\t\t\t{ \"type\": \"%04x\", ", rec->tls_info.tls_extensions[i].type);
-      fprintf(output, "\"length\": %i, \"data\": ", rec->tls_info.tls_extensions[i].length);
-      fprintf_raw_as_hex(output, rec->tls_info.tls_extensions[i].data, rec->tls_info.tls_extensions[i].length);
-      fprintf(output, "}\n\t\t\t]");
+    if (olists && otls->num_tls_extensions) {
+      tls_extensions_print_json(output, otls);
     }  
-    if (rec->twin && rec->twin->tls_info.num_tls_extensions) {
-      fprintf(output, ",\n\t\t\t\"tls_ext\": [ ");
-      for (i = 0; i < rec->twin->tls_info.num_tls_extensions-1; i++) {
-	fprintf(output, "\n\t\t\t\t{ \"type\": \"%04x\", ", rec->twin->tls_info.tls_extensions[i].type);
-	fprintf(output, "\"length\": %i, \"data\": ", rec->twin->tls_info.tls_extensions[i].length);
-	fprintf_raw_as_hex(output, rec->twin->tls_info.tls_extensions[i].data, rec->twin->tls_info.tls_extensions[i].length);
-	fprintf(output, "},");
-      }
-      fprintf(output, "\n\t\t\t\t{ \"type\": \"%04x\", ", rec->twin->tls_info.tls_extensions[i].type);
-      fprintf(output, "\"length\": %i, \"data\": ", rec->twin->tls_info.tls_extensions[i].length);
-      fprintf_raw_as_hex(output, rec->twin->tls_info.tls_extensions[i].data, rec->twin->tls_info.tls_extensions[i].length);
-      fprintf(output, "}\n\t\t\t]");
+    if (ilists && itls->num_tls_extensions) {
+      tls_extensions_print_json(output, itls);
     }
 
   
     /* print out TLS application data lengths and times, if any */
-    if (rec->tls_info.tls_op) {
-      if (rec->twin) {
-	len_time_print_interleaved(rec->tls_info.tls_op, rec->tls_info.tls_len, rec->tls_info.tls_time, rec->tls_info.tls_type,
-				   rec->twin->tls_info.tls_op, rec->twin->tls_info.tls_len, rec->twin->tls_info.tls_time, rec->twin->tls_info.tls_type);
+    if (otls && otls->tls_op) {
+      if (itls) {
+	len_time_print_interleaved(otls->tls_op, otls->tls_len, otls->tls_time, otls->tls_type,
+				   itls->tls_op, itls->tls_len, itls->tls_time, itls->tls_type);
       } else {
 	/*
 	 * unidirectional TLS does not typically happen, but if it
 	 * does, we need to pass in zero/NULLs, since there is no twin
+	 * with TLS data
 	 */
-	len_time_print_interleaved(rec->tls_info.tls_op, rec->tls_info.tls_len, rec->tls_info.tls_time, rec->tls_info.tls_type, 0, NULL, NULL, NULL);
+	len_time_print_interleaved(otls->tls_op, otls->tls_len, otls->tls_time, otls->tls_type, 0, NULL, NULL, NULL);
       }
     }
   }
@@ -1581,7 +2184,11 @@ void flow_record_print_json(const struct flow_record *record) {
   }
 
   if (rec->exe_name) {
-    fprintf(output, ",\n\t\t\t\"exe\": \"%s\"", rec->exe_name);
+    unsigned int len = strlen(rec->exe_name);
+    char exe_name[JSON_ESCAPE_LEN(len)];
+
+    json_escape(exe_name, rec->exe_name, len);
+    fprintf(output, ",\n\t\t\t\"exe\": \"%s\"", exe_name);
   }
 
   if (rec->exp_type) {
@@ -1737,11 +2344,7 @@ struct flow_record *flow_key_get_twin(const struct flow_key *key) {
      * find_twin_by_key() function because it does not map near twins
      * to the same flow_record_list
      */
-    twin.sa.s_addr = key->da.s_addr;
-    twin.da.s_addr = key->sa.s_addr;
-    twin.sp = key->dp;
-    twin.dp = key->sp;
-    twin.prot = key->prot;
+    flow_key_twin(&twin, key);
 
     return flow_record_list_find_record_by_key(&flow_record_list_array[flow_key_hash(&twin)], &twin);
   
@@ -1774,11 +2377,7 @@ void flow_record_list_find_twins(const struct timeval *expiration) {
       break;
     }
 
-    key.sa = record->key.da;
-    key.da = record->key.sa;
-    key.sp = record->key.dp;
-    key.dp = record->key.sp;
-    key.prot = record->key.prot;
+    flow_key_twin(&key, &record->key);
     
     twin = flow_key_get_record(&key, DONT_CREATE_RECORDS);
     if (twin != NULL) {
@@ -1985,7 +2584,6 @@ int upload_file(const char *filename, const char *servername, const char *key, u
 
 
 
-#include <ctype.h>
 /* 
  * convert_string_to_printable(s, len) convers the character string s
  * into a JSON-safe, NULL-terminated printable string.
@@ -1996,14 +2594,6 @@ int upload_file(const char *filename, const char *servername, const char *key, u
  */ 
 
 void convert_string_to_printable(char *s, unsigned int len) {
-  unsigned int i;
 
-  for (i=0; i<len; i++) {
-    if (s[i] == 0) {
-      break;
-    } else if (!isalnum(s[i])) {
-      s[i] = '.';
-    }
-  }
-  s[len-1] = 0;  /* NULL termination */
+  str_printable(s, s, len);   /* conversion happens in place */
 }
@@ -43,6 +43,7 @@
 #ifndef P2F_H
 #define P2F_H
 
+#include <stdint.h>       /* for uint32_t */
 #include <sys/socket.h>   /* for struct in_addr */
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -54,6 +55,7 @@
 #include "pkt_proc.h"     /* for struct tls_type_code      */
 #include "hdr_dsc.h"      /* header description (proto id) */
 #include "wht.h"          /* walsh-hadamard transform      */
+#include "addr_attr.h"    /* for attr_flags                */
 
 enum print_level { 
   none = 0, 
@@ -62,13 +64,51 @@ enum print_level {
 };
 
 
+/*
+ * union flow_addr holds an IPv4 or an IPv6 address in a single
+ * sixteen-byte form: an IPv6 address as it is, and an IPv4 address
+ * as an IPv4-mapped IPv6 address (::ffff:a.b.c.d, RFC 4291), so that
+ * flow keys have the same layout for both versions
+ */
+union flow_addr {
+  struct in6_addr v6;
+  struct {
+    uint32_t mapped[3];     /* 0, 0, htonl(0xffff) */
+    struct in_addr addr;
+  } v4;
+  uint32_t u32[4];
+};
+
+static inline void flow_addr_set_ipv4(union flow_addr *a, struct in_addr addr) {
+  a->v4.mapped[0] = 0;
+  a->v4.mapped[1] = 0;
+  a->v4.mapped[2] = htonl(0x0000ffff);
+  a->v4.addr = addr;
+}
+
+/*
+ * struct flow_key is forty bytes with no padding, so that keys can be
+ * compared and hashed with a few wide loads rather than field by
+ * field; every field, including ver, must be set in each key
+ */
 struct flow_key {
-  struct in_addr sa;
-  struct in_addr da;
+  union flow_addr sa;
+  union flow_addr da;
   unsigned short int sp;
   unsigned short int dp;
-  unsigned short int prot;
-};
+  unsigned char prot;
+  unsigned char ver;        /* IP version: 4 or 6                  */
+  unsigned short int vlan;  /* outer VLAN ID, if vlan=1; otherwise 0 */
+} __attribute__((aligned(8)));
+
+#define flow_key_is_ipv4(k) ((k)->ver == 4)
+
+void flow_key_set_ipv4_addrs(struct flow_key *key, struct in_addr sa, struct in_addr da);
+
+void flow_key_set_ipv6_addrs(struct flow_key *key, const struct in6_addr *sa, const struct in6_addr *da);
+
+const char *flow_key_addr_ntop(const struct flow_key *key, const union flow_addr *a, 
+			       char *buf, unsigned int len);
 
 /*
  * default and maximum number of packets on which to report
@@ -83,6 +123,8 @@ struct flow_record {
   unsigned int np;                      /* number of packets                   */
   unsigned int op;                      /* number of packets (w/nonzero data)  */
   unsigned int ob;                      /* number of bytes of application data */
+  unsigned int fp;                      /* packets with data in payload features */
+  unsigned int fb;                      /* bytes of data in payload features   */
   unsigned char ttl;                    /* smallest IP TTL in flow             */
   struct timeval start;                 /* start time                          */ 
   struct timeval end;                   /* end time                            */
@@ -91,12 +133,9 @@ struct flow_record {
   struct timeval pkt_time[MAX_NUM_PKT_LEN]; /* array of arrival times          */
   unsigned char pkt_flags[MAX_NUM_PKT_LEN]; /* array of packet flags           */
   unsigned int byte_count[256];         /* number of occurences of each byte   */
-  unsigned long int num_bytes;
-  double bd_mean;
-  double bd_variance;
   struct wht wht;                       /* walsh hadamard transform            */
   struct header_description hd;         /* header description (proto ident)    */
-  struct tls_information tls_info;      /* TLS awareness                       */
+  struct tls_information *tls_info;     /* TLS awareness, once TLS is seen     */
   char *dns_name[MAX_NUM_PKT_LEN];       /* array of DNS names                 */
   void *idp;
   unsigned int idp_len;
@@ -114,6 +153,9 @@ struct flow_record {
   unsigned int tcp_syn_size;
   unsigned char exp_type;
   unsigned char first_switched_found;   /* hack to make sure we only correct once */
+  attr_flags sa_labels;                 /* subnet labels of source address     */
+  attr_flags da_labels;                 /* subnet labels of destination address */
+  unsigned char labels_pending;         /* labels not yet looked up            */
   struct flow_record *twin;             /* other half of bidirectional flow    */
   struct flow_record *next;             /* next record in flow_record_list     */
   struct flow_record *prev;             /* previous record in flow_record_list */
@@ -204,8 +246,6 @@ void flow_record_print_json(const struct flow_record *record);
 
 void flow_record_update_byte_count(struct flow_record *f, const void *x, unsigned int len);
 
-void flow_record_update_byte_dist_mean_var(struct flow_record *f, const void *x, unsigned int len);
-
 void flow_record_delete(struct flow_record *r);
 
 void flow_record_print_and_delete(struct flow_record *record);
@@ -218,6 +258,15 @@ void flow_record_list_free();
 
 void flow_record_list_print_json(const struct timeval *inactive_cutoff);
 
+/*
+ * tls_dict_print_json(f) prints the "tls_dict" object, which holds
+ * the ciphersuite and extension lists that flow records in the
+ * current output file refer to, and then empties the dictionary; it
+ * must be called after the "appflows" array is closed and before the
+ * top-level object is closed, and does nothing unless tls_dict=1
+ */
+void tls_dict_print_json(FILE *f);
+
 /*
  * flow_record_is_past_active_expiration(record) returns 1 if the age
  * of the flow record is greater than active_max, and returns 0 otherwise
@@ -240,6 +289,10 @@ int process_pcap_file(char *file_name, char *filter_exp, bpf_u_int32 *net, struc
  * num_records_output is the total number of flow records that have been 
  * written to output
  *
+ * num_frags_attributed and num_frags_dropped are the numbers of IP
+ * fragments other than the first that were, and were not, attributed
+ * to the flow of the first fragment of their datagram
+ *
  */
 struct flocap_stats {
   unsigned long int num_packets;
@@ -247,6 +300,11 @@ struct flocap_stats {
   unsigned long int num_records_in_table;
   unsigned long int num_records_output;
   unsigned long int malloc_fail;
+  unsigned long int num_frags_attributed;
+  unsigned long int num_frags_dropped;
+  unsigned long int num_tls_allocs;
+  unsigned long int tls_alloc_bytes;
+  unsigned long int num_tls_fps;
 };
 
 #define flocap_stats_init() struct flocap_stats stats = {  0, 0, 0, 0 };
@@ -267,6 +325,14 @@ struct flocap_stats {
 
 #define flocap_stats_incr_malloc_fail() (stats.malloc_fail++)
 
+#define flocap_stats_incr_frags_attributed() (stats.num_frags_attributed++)
+
+#define flocap_stats_incr_frags_dropped() (stats.num_frags_dropped++)
+
+#define flocap_stats_incr_tls_allocs(x) (stats.num_tls_allocs++, stats.tls_alloc_bytes += (x))
+
+#define flocap_stats_incr_tls_fps() (stats.num_tls_fps++)
+
 #define flocap_stats_format "packets: %lu\tcurrent records: %lu\toutput records: %lu"
 
 
@@ -307,6 +373,10 @@ int upload_file(const char *filename, const char *servername, const char *key, u
 
 void flow_record_list_unit_test();
 
+int flow_key_unit_test();
+
+int flow_record_tls_fp_unit_test();
+
 /* 
  * convert_string_to_printable(s, len) convers the character string s
  * into a JSON-safe, NULL-terminated printable string.
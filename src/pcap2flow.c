@@ -61,6 +61,7 @@
 #include <limits.h>         /* for LONG_MAX  */
 #include <getopt.h>
 #include <unistd.h>         /* for daemon()  */
+#include <pthread.h>        /* for subnet reloading */
 
 #include "pkt_proc.h" /* packet processing               */
 #include "p2f.h"      /* pcap2flow data structures       */
@@ -110,15 +111,25 @@ extern unsigned int report_wht;
 extern unsigned int report_idp;
 
 extern unsigned int report_hd;
+extern unsigned int report_hd_pkts;
+extern unsigned int payload_budget;
+extern unsigned int payload_pkt_budget;
 
 extern unsigned int report_dns;
 
 extern unsigned int include_tls;
 
+extern unsigned int report_tls_dict;
+extern unsigned int report_tls_fp;
+
+extern unsigned int report_splt_enc;
+
 extern unsigned int include_classifier;
 
 extern unsigned int nfv9_capture_port;
 
+extern unsigned int include_vlan;
+
 extern FILE *output;
 
 extern FILE *info;
@@ -264,11 +275,167 @@ void sig_close(int signal_arg) {
    */
   flow_record_list_print_json(NULL);
   fprintf(info, "got signal %d, shutting down\n", signal_arg); 
-  fprintf(output, "\n] }\n");
+  fprintf(output, "\n]");
+  tls_dict_print_json(output);
+  fprintf(output, " }\n");
   exit(EXIT_SUCCESS);
 }
 
 
+/*
+ * subnet_labels_load(c) returns a new (compact) radix_trie containing
+ * the labeled subnets in the files named in the configuration c, or
+ * NULL if there was an error, which is reported on the secondary
+ * output
+ */
+radix_trie_t subnet_labels_load(const struct configuration *c) {
+  radix_trie_t trie;
+  attr_flags subnet_flag;
+  unsigned int i;
+
+  trie = radix_trie_alloc();
+  if (trie == NULL) {
+    fprintf(info, "could not allocate memory\n");
+    return NULL;
+  }
+  if (radix_trie_init(trie) != ok) {
+    fprintf(info, "error: could not initialize subnet labels (radix_trie)\n");
+    return NULL;
+  }
+  for (i=0; i<c->num_subnets; i++) {
+    char label[LINEMAX], subnet_file[LINEMAX];
+    int num;
+      
+    num = sscanf(c->subnet[i], "%[^=:]:%[^=:\n#]", label, subnet_file);
+    if (num != 2) {
+      fprintf(info, "error: could not parse command \"%s\" into form label:subnet\n", c->subnet[i]);
+      radix_trie_free(trie);
+      return NULL;
+    }
+      
+    subnet_flag = radix_trie_add_attr_label(trie, label);
+    if (subnet_flag == 0) {
+      fprintf(info, "error: count not add subnet label %s to radix_trie\n", label);
+      radix_trie_free(trie);
+      return NULL;
+    }
+      
+    if (radix_trie_add_subnets_from_file(trie, subnet_file, subnet_flag, info) != ok) {
+      fprintf(info, "error: could not add labeled subnets from file %s\n", subnet_file);
+      radix_trie_free(trie);
+      return NULL;
+    }
+  }
+  if (radix_trie_compact(trie) != ok) {
+    fprintf(info, "error: could not compact labeled subnets (radix_trie)\n");
+    radix_trie_free(trie);
+    return NULL;
+  }
+  return trie;
+}
+
+/*
+ * reloading subnets: SIGHUP causes the label and anonymization subnet
+ * files to be read again, by a background thread that builds a new
+ * radix_trie and a new anonymization set, so that packet processing
+ * does not pause.  The capture loop checks for the completion of that
+ * thread between batches of packets, and swaps the new structures in
+ * then.  Packets are processed and flows are printed only in that
+ * loop, so once the swap is done nothing refers to the old structures
+ * any more, and they are freed right away.  The labels themselves
+ * come from the configuration, which does not change, so the flags
+ * of existing flow records keep their meaning.
+ */
+enum subnet_reload_state {
+  reload_idle = 0,
+  reload_running = 1,
+  reload_done = 2
+};
+
+static volatile sig_atomic_t subnet_reload_requested = 0;
+
+static struct {
+  pthread_t thread;
+  int state;
+  enum status status;
+  radix_trie_t rt;
+  struct anon_subnets *anon;
+} subnet_reload;
+
+static void *subnet_reload_thread(void *arg) {
+
+  subnet_reload.status = ok;
+  subnet_reload.rt = NULL;
+  subnet_reload.anon = NULL;
+  if (config.num_subnets > 0) {
+    subnet_reload.rt = subnet_labels_load(&config);
+    if (subnet_reload.rt == NULL) {
+      subnet_reload.status = failure;
+    }
+  }
+  if (subnet_reload.status == ok && config.anon_addrs_file != NULL) {
+    subnet_reload.anon = anon_subnets_load(config.anon_addrs_file);
+    if (subnet_reload.anon == NULL) {
+      fprintf(info, "error: could not read anonymization subnets from file %s\n", 
+	      config.anon_addrs_file); 
+      subnet_reload.status = failure;
+    }
+  }
+  __atomic_store_n(&subnet_reload.state, reload_done, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+/*
+ * subnet_reload_check() is called between batches of packets; it
+ * starts a reload if one has been requested, and swaps in the results
+ * of a reload that has completed
+ */
+static void subnet_reload_check() {
+  int state = __atomic_load_n(&subnet_reload.state, __ATOMIC_ACQUIRE);
+
+  if (state == reload_idle && subnet_reload_requested) {
+    subnet_reload_requested = 0;
+    subnet_reload.state = reload_running;
+    if (pthread_create(&subnet_reload.thread, NULL, subnet_reload_thread, NULL) != 0) {
+      fprintf(info, "error: could not start thread to reload subnets\n");
+      subnet_reload.state = reload_idle;
+    }
+
+  } else if (state == reload_done) {
+    pthread_join(subnet_reload.thread, NULL);
+    if (subnet_reload.status == ok) {
+      if (subnet_reload.rt) {
+	radix_trie_t old_rt = rt;
+
+	rt = subnet_reload.rt;
+	radix_trie_free(old_rt);
+      }
+      if (subnet_reload.anon) {
+	anon_subnets_free(anon_subnets_swap(subnet_reload.anon));
+	anon_print_subnets(info);
+      }
+      fprintf(info, "reloaded subnets; labeled subnets (radix_trie) using %u bytes of memory\n", 
+	      get_rt_mem_usage());
+    } else {
+      radix_trie_free(subnet_reload.rt);
+      anon_subnets_free(subnet_reload.anon);
+      fprintf(info, "error: could not reload subnets; continuing with the previous ones\n");
+    }
+    subnet_reload.state = reload_idle;
+  }
+}
+
+/*
+ * sig_reload_subnets() requests a reload of the subnet files
+ */
+void sig_reload_subnets(int signal_arg) {
+
+  subnet_reload_requested = 1;
+  if (handle) {
+    pcap_breakloop(handle);
+  }
+}
+
 /*
  * sig_reload() 
  */
@@ -297,16 +464,28 @@ int usage(char *s) {
          "  retain=1                   retain a local copy of file after upload\n" 
          "  zeros=1                    include zero-length data (e.g. ACKs) in packet list\n" 
          "  bidir=1                    merge unidirectional flows into bidirectional ones\n" 
+         "  vlan=1                     include the VLAN ID in the flow key\n" 
          "  dist=1                     include byte distribution array\n" 
          "  entropy=1                  include byte entropy\n" 
+         "  wht=1                      include Walsh-Hadamard transform of payloads\n" 
+         "  hd=N                       describe the first N bytes of payloads (0 <= N <= %d)\n" 
+         "  hd_pkts=N                  describe the headers of the first N payloads (default %d)\n" 
+         "  payload_budget=N           compute payload features over at most N bytes per direction\n" 
+         "  payload_pkt_budget=N       compute payload features over at most N packets per direction\n" 
          "  tls=1                      include TLS ciphersuites\n" 
+         "  tls_dict=1                 print each distinct TLS ciphersuite/extension list once per file\n" 
+         "  tls_fp=1                   report TLS client fingerprints instead of ciphersuite/extension lists\n" 
+         "  tls_fp=2                   as tls_fp=1, with the fingerprint string when first seen\n" 
          "  bpf=\"expression\"           only process packets matching BPF \"expression\"\n" 
          "  verbosity=L                verbosity level: 0=quiet, 1=packet metadata, 2=packet payloads\n" 
          "  num_pkts=N                 report on at most N packets per flow (0 <= N < %d)\n" 
          "  type=T                     select message type: 1=SPLT, 2=SALT\n" 
+         "  splt_enc=1                 report packet lengths and times in compact encoded form\n" 
          "  nfv9_port=N                enable Netflow V9 capture on port N\n" 
          "  anon=F                     anonymize addresses matching the subnets listed in file F\n" 
-         "  idp=N                      report N bytes of the initial data packet of each flow\n", MAX_NUM_PKT_LEN); 
+         "  anon_pp=1                  anonymize addresses with prefix-preserving anonymization\n" 
+         "  idp=N                      report N bytes of the initial data packet of each flow\n", 
+	 HDR_DSC_LEN, HDR_DSC_PKTS, MAX_NUM_PKT_LEN); 
   printf("RETURN VALUE                 0 if no errors; nonzero otherwise\n"); 
   return -1;
 }
@@ -326,7 +505,7 @@ int usage(char *s) {
 int main(int argc, char **argv) {
   char errbuf[PCAP_ERRBUF_SIZE]; 
   bpf_u_int32 net = PCAP_NETMASK_UNKNOWN;		
-  char *filter_exp = "ip";	
+  char *filter_exp = NULL;   /* frames other than IP are discarded by process_packet() */
   struct bpf_program fp;	
   int i;
   int c;
@@ -435,13 +614,20 @@ int main(int argc, char **argv) {
     report_entropy = config.report_entropy;
     report_wht = config.report_wht;
     report_hd = config.report_hd;
-    include_tls = config.include_tls;
+    report_hd_pkts = config.hd_pkts;
+    payload_budget = config.payload_budget;
+    payload_pkt_budget = config.payload_pkt_budget;
+    include_tls = config.include_tls || config.tls_fp;  /* fingerprints need TLS data */
+    report_tls_dict = config.tls_dict;
+    report_tls_fp = config.tls_fp;
+    report_splt_enc = config.splt_enc;
     include_classifier = config.include_classifier;
     output_level = config.output_level;
     report_idp = config.idp;
     report_dns = config.dns;
     salt_algo = config.type;
     nfv9_capture_port = config.nfv9_capture_port;
+    include_vlan = config.vlan;
     if (config.bpf_filter_exp) {
       filter_exp = config.bpf_filter_exp;
     }
@@ -525,41 +711,11 @@ int main(int argc, char **argv) {
    * addresses that match subnets associated with labels)
    */  
   if (config.num_subnets > 0) {
-    attr_flags subnet_flag;
-    enum status err;
-
-    rt = radix_trie_alloc();
+    rt = subnet_labels_load(&config);
     if (rt == NULL) {
-      fprintf(info, "could not allocate memory\n");
-    }
-    err = radix_trie_init(rt);
-    if (err != ok) {
-      fprintf(stderr, "error: could not initialize subnet labels (radix_trie)\n");
-    }
-    for (i=0; i<config.num_subnets; i++) {
-      char label[LINEMAX], subnet_file[LINEMAX];
-      int num;
-      
-      num = sscanf(config.subnet[i], "%[^=:]:%[^=:\n#]", label, subnet_file);
-      if (num != 2) {
-	fprintf(info, "error: could not parse command \"%s\" into form label:subnet\n", config.subnet[i]);
-	exit(1);
-      }
-      
-      subnet_flag = radix_trie_add_attr_label(rt, label);
-      if (subnet_flag == 0) {
-	fprintf(info, "error: count not add subnet label %s to radix_trie\n", label);
-	exit(1);
-      }
-      
-      err = radix_trie_add_subnets_from_file(rt, subnet_file, subnet_flag, info);
-      if (err != ok) {
-	fprintf(info, "error: could not add labeled subnets from file %s\n", subnet_file);
-	exit(1);
-      }
+      exit(1);
     }
     fprintf(info, "configured labeled subnets (radix_trie), using %u bytes of memory\n", get_rt_mem_usage());
-    
   }
 
   if (config.anon_addrs_file != NULL) {
@@ -568,6 +724,9 @@ int main(int argc, char **argv) {
 	      config.anon_addrs_file); 
       return -1;
     }
+    if (config.anon_pp) {
+      anon_set_mode(anon_mode_prefix_preserving);
+    }
   }
 
   if (config.filename != NULL) {
@@ -649,7 +808,7 @@ int main(int argc, char **argv) {
     
     signal(SIGINT, sig_close);     /* Ctl-C causes graceful shutdown */
     signal(SIGTERM, sig_close);
-    // signal(SIGHUP, sig_reload);
+    signal(SIGHUP, sig_reload_subnets);   /* kill -HUP reloads subnet files */
     // signal(SIGTSTP, sig_reload);
     signal(SIGQUIT, sig_reload);   /* Ctl-\ causes an info dump      */
 
@@ -675,7 +834,7 @@ int main(int argc, char **argv) {
 
     /* verify that we can handle the link layer headers */
     linktype = pcap_datalink(handle);
-    if (linktype != DLT_EN10MB) {
+    if (pkt_proc_set_linktype(linktype) != ok) {
       fprintf(info, "device %s has unsupported linktype (%d)\n", 
 	      capture_if, linktype);
       return -2;
@@ -724,6 +883,9 @@ int main(int argc, char **argv) {
 
       /* loop over packets captured from interface */
       pcap_loop(handle, NUM_PACKETS_IN_LOOP, process_packet, NULL);
+
+      /* swap in reloaded subnets, or start reloading them, if needed */
+      subnet_reload_check();
       
       if (output_level > none) { 
 	fprintf(output, "# pcap processing loop done\n");
@@ -759,7 +921,9 @@ int main(int argc, char **argv) {
 	  /*
 	   * write JSON postamble
 	   */
-	  fprintf(output, "\n] }\n");
+	  fprintf(output, "\n]");
+	  tls_dict_print_json(output);
+	  fprintf(output, " }\n");
 
 	  fclose(output);
 	  if (config.upload_servername) {
@@ -789,7 +953,9 @@ int main(int argc, char **argv) {
       // fflush(output);
     }
 
-    fprintf(output, "\n] }\n");
+    fprintf(output, "\n]");
+    tls_dict_print_json(output);
+    fprintf(output, " }\n");
     
     if (filter_exp) {
       pcap_freecode(&fp);
@@ -847,6 +1013,7 @@ int main(int argc, char **argv) {
     }
     
     fprintf(output, "\n]");
+    tls_dict_print_json(output);
     fprintf(output, "\n}\n");
     
   }
@@ -870,6 +1037,12 @@ int process_pcap_file(char *file_name, char *filter_exp, bpf_u_int32 *net, struc
     fprintf(stderr,"Couldn't open pcap file %s: %s\n", file_name, errbuf); 
     return -1;
   }   
+  if (pkt_proc_set_linktype(pcap_datalink(handle)) != ok) {
+    fprintf(stderr, "error: pcap file %s has unsupported linktype (%d)\n", 
+	    file_name, pcap_datalink(handle));
+    pcap_close(handle);
+    return -1;
+  }
 	
   if (filter_exp) {
 	  
@@ -57,6 +57,31 @@ struct ethernet_hdr {
   unsigned short ether_type;                  
 };
 
+#define ETH_TYPE_IP    0x0800
+#define ETH_TYPE_IPV6  0x86dd
+
+/*
+ * link layer encapsulations that can precede the network layer
+ * header: 802.1Q VLAN tags and 802.1ad (QinQ) service tags, each of
+ * which holds a VLAN ID followed by the ethertype of what follows it;
+ * MPLS label stack entries, the last of which has the bottom of
+ * stack bit set; and the Linux "cooked" (SLL) header, which replaces
+ * the ethernet header in captures on the "any" device
+ */
+#define ETH_TYPE_VLAN        0x8100
+#define ETH_TYPE_QINQ        0x88a8
+#define ETH_TYPE_QINQ_OLD    0x9100
+#define ETH_TYPE_MPLS        0x8847
+#define ETH_TYPE_MPLS_MCAST  0x8848
+
+#define VLAN_TAG_LEN          4
+#define VLAN_ID_MASK     0x0fff
+#define MPLS_LABEL_LEN        4
+#define MPLS_BOTTOM_OF_STACK 0x01   /* in the third byte of a label */
+
+#define SLL_HDR_LEN          16
+#define SLL_PROTOCOL_OFFSET  14
+
 /*
  * Internet Protocol (IP) version four header
  */
@@ -91,6 +116,41 @@ struct ip_hdr {
   struct in_addr ip_dst;    /* destination address    */
 };
 
+/*
+ * Internet Protocol (IP) version six header
+ */
+#define IPV6_HDR_LEN 40
+#define ipv6_version(ip6) (((const unsigned char *)(ip6))[0] >> 4)
+
+struct ipv6_hdr {
+  unsigned int    ipv6_vtcfl; /* version, class, flow label */
+  unsigned short  ipv6_plen;  /* payload length             */
+  unsigned char   ipv6_nxt;   /* next header                */
+  unsigned char   ipv6_hlim;  /* hop limit                  */
+  struct in6_addr ipv6_src;   /* source address             */
+  struct in6_addr ipv6_dst;   /* destination address        */
+};
+
+/*
+ * IPv6 extension headers that can precede the transport header
+ */
+#define IPV6_EXT_HOPOPTS   0
+#define IPV6_EXT_ROUTING  43
+#define IPV6_EXT_FRAGMENT 44
+#define IPV6_EXT_AH       51
+#define IPV6_EXT_DSTOPTS  60
+#define IPV6_EXT_MOBILITY 135
+
+struct ipv6_frag_hdr {
+  unsigned char  ipv6f_nxt;   /* next header                */
+  unsigned char  ipv6f_rsv;   /* reserved                   */
+  unsigned short ipv6f_offlg; /* offset and flags           */
+  unsigned int   ipv6f_ident; /* identification             */
+};
+
+#define ipv6_fragment_offset(f) (ntohs((f)->ipv6f_offlg) & 0xfff8)
+#define ipv6_more_fragments(f)  (ntohs((f)->ipv6f_offlg) & 0x0001)
+
 /*
  * Transmission Control Protocol (TCP) header 
 */
@@ -50,6 +50,7 @@
 #include "err.h"
 #include "tls.h"
 #include "nfv9.h"
+#include "frag.h"
 
 /*
  * external variables, defined in pcap2flow
@@ -65,7 +66,11 @@ extern unsigned int report_dns;
 extern unsigned int report_idp;
 extern unsigned int report_wht;
 extern unsigned int report_hd;
+extern unsigned int report_hd_pkts;
+extern unsigned int payload_budget;
+extern unsigned int payload_pkt_budget;
 extern unsigned int nfv9_capture_port;
+extern unsigned int include_vlan;
 extern enum SALT_algorithm salt_algo;
 extern enum print_level output_level;
 extern struct flocap_stats stats;
@@ -318,7 +323,7 @@ enum status process_nfv9(const struct pcap_pkthdr *h, const void *start, int len
   int flowset_num = 0;
 
   if (output_level > none) {
-    fprintf(info,"Source IP: %s\n",inet_ntoa(r->key.sa));
+    fprintf(info,"Source IP: %s\n",inet_ntoa(r->key.sa.v4.addr));
     fprintf(info,"Source ID: %i\n",htonl(nfv9->SourceID));
   }
 
@@ -353,7 +358,7 @@ enum status process_nfv9(const struct pcap_pkthdr *h, const void *start, int len
 	u_short field_count = htons(template_hdr->FieldCount);
 	
 	struct nfv9_template_key nf_template_key;
-	nfv9_template_key_init(&nf_template_key, r->key.sa.s_addr, htonl(nfv9->SourceID), template_id);
+	nfv9_template_key_init(&nf_template_key, r->key.sa.v4.addr.s_addr, htonl(nfv9->SourceID), template_id);
 	
 	// check to see if template already exists, if so, continue
 	int i;
@@ -401,7 +406,7 @@ enum status process_nfv9(const struct pcap_pkthdr *h, const void *start, int len
       u_short template_id = flowset_id;
 
       struct nfv9_template_key nf_template_key;
-      nfv9_template_key_init(&nf_template_key, r->key.sa.s_addr, htonl(nfv9->SourceID), template_id);
+      nfv9_template_key_init(&nf_template_key, r->key.sa.v4.addr.s_addr, htonl(nfv9->SourceID), template_id);
 
       // construct key and look for templates
       const struct nfv9_template *cur_template = NULL;
@@ -459,11 +464,39 @@ enum status process_nfv9(const struct pcap_pkthdr *h, const void *start, int len
   return ok;
 }
 
+/*
+ * flow_record_payload_budget() returns the number of bytes at the
+ * start of a payload of length len that go into the payload features
+ * of record (the byte distribution, WHT, header description, and TLS
+ * data), and counts them against its budget of payload_budget bytes
+ * and payload_pkt_budget packets, where zero means no limit.  Once
+ * the budget is spent, it returns zero, and the packet only updates
+ * the counters and timestamps of the record.
+ */
+static inline unsigned int flow_record_payload_budget(struct flow_record *record, unsigned int len) {
+
+  if (len == 0 || (payload_pkt_budget && record->fp >= payload_pkt_budget)) {
+    return 0;
+  }
+  if (payload_budget) {
+    if (record->fb >= payload_budget) {
+      return 0;
+    }
+    if (len > payload_budget - record->fb) {
+      len = payload_budget - record->fb;
+    }
+  }
+  record->fp++;
+  record->fb += len;
+
+  return len;
+}
+
 struct flow_record *
 process_tcp(const struct pcap_pkthdr *h, const void *tcp_start, int tcp_len, struct flow_key *key) {
   unsigned int tcp_hdr_len;
   const unsigned char *payload;
-  unsigned int payload_len;
+  unsigned int payload_len, feature_len;
   const struct tcp_hdr *tcp = (const struct tcp_hdr *)tcp_start;
   struct flow_record *record = NULL;
   
@@ -563,20 +596,43 @@ process_tcp(const struct pcap_pkthdr *h, const void *tcp_start, int tcp_len, str
   }
 
   record->ob += payload_len; 
+
+  feature_len = flow_record_payload_budget(record, payload_len);
+  if (feature_len == 0) {
+    return record;
+  }
   
-  flow_record_update_byte_count(record, payload, payload_len);
-  flow_record_update_byte_dist_mean_var(record, payload, payload_len);
+  flow_record_update_byte_count(record, payload, feature_len);
+  wht_update(&record->wht, payload, feature_len, report_wht);
   
-  /* if packet has port 443 and nonzero data length, process it as TLS */
-  if (include_tls && payload_len && (key->sp == 443 || key->dp == 443)) {
-    process_tls(h, payload, payload_len, &record->tls_info);
+  /*
+   * allocate TLS data on demand, when the first packet with data in
+   * this direction (or any packet on port 443) looks like a TLS
+   * record, and then process packets as TLS, except for
+   * retransmissions
+   */
+  if (include_tls) {
+    if (record->tls_info == NULL && (record->fp == 1 || key->sp == 443 || key->dp == 443)
+	&& packet_is_tls(payload, payload_len)) {
+      record->tls_info = tls_record_alloc();
+      if (record->tls_info == NULL) {
+	flocap_stats_incr_malloc_fail();
+      } else {
+	flocap_stats_incr_tls_allocs(sizeof(struct tls_information));
+      }
+    }
+    if (record->tls_info != NULL 
+	&& tls_seq_check(record->tls_info, ntohl(tcp->tcp_seq), payload_len) == ok) {
+      process_tls(h, payload, payload_len, record->tls_info, 
+		  num_pkt_len < MAX_NUM_RCD_LEN ? num_pkt_len : MAX_NUM_RCD_LEN);
+    }
   }
 
   /*
    * update header description
    */
   if (payload_len >= report_hd) {
-    header_description_update(&record->hd, payload, report_hd);
+    header_description_update(&record->hd, payload, report_hd, report_hd_pkts);
   }
 
   return record;
@@ -587,7 +643,7 @@ struct flow_record *
 process_udp(const struct pcap_pkthdr *h, const void *udp_start, int udp_len, struct flow_key *key) {
   unsigned int udp_hdr_len;
   const unsigned char *payload;
-  unsigned int size_payload;
+  unsigned int size_payload, feature_len;
   const struct udp_hdr *udp = (const struct udp_hdr *)udp_start;
   struct flow_record *record = NULL;
   
@@ -639,8 +695,9 @@ process_udp(const struct pcap_pkthdr *h, const void *udp_start, int udp_len, str
   }
   record->ob += size_payload; 
 
-  flow_record_update_byte_count(record, payload, size_payload);
-  flow_record_update_byte_dist_mean_var(record, payload, size_payload);
+  feature_len = flow_record_payload_budget(record, size_payload);
+  flow_record_update_byte_count(record, payload, feature_len);
+  wht_update(&record->wht, payload, feature_len, report_wht);
 
   if (nfv9_capture_port && (key->dp == nfv9_capture_port)) {
     process_nfv9(h, payload, size_payload, record);
@@ -707,23 +764,23 @@ process_icmp(const struct pcap_pkthdr *h, const void *start, int len, struct flo
   }
   record->ob += size_payload; 
 
-  flow_record_update_byte_count(record, payload, size_payload);
-  flow_record_update_byte_dist_mean_var(record, payload, size_payload);
+  flow_record_update_byte_count(record, payload, flow_record_payload_budget(record, size_payload));
   
   return record;
 }
 
 
-struct flow_record *
-process_ip(const struct pcap_pkthdr *h, const void *ip_start, int ip_len, struct flow_key *key) {
+/*
+ * process_ip_payload() accounts for the payload of a packet that has
+ * no transport header that we parse, in the flow with the key key,
+ * whose ports the caller has set
+ */
+static struct flow_record *
+process_ip_payload(const struct pcap_pkthdr *h, const void *ip_start, int ip_len, const struct flow_key *key) {
   const unsigned char *payload;
   int size_payload;
-  //  const struct udp_hdr *udp = (const struct udp_hdr *)udp_start;
   struct flow_record *record = NULL;
 
-  if (output_level > none) {
-    fprintf(output, "   protocol: IP\n");
-  }
 
   payload = (unsigned char *)(ip_start);  
   size_payload = ip_len;
@@ -739,9 +796,6 @@ process_ip(const struct pcap_pkthdr *h, const void *ip_start, int ip_len, struct
     }
   }
   
-  /* signify IP by using zero (reserved) port values */
-  key->sp = key->dp = 0;
-  
   record = flow_key_get_record(key, CREATE_RECORDS); 
   if (record == NULL) {
     return NULL;
@@ -755,12 +809,202 @@ process_ip(const struct pcap_pkthdr *h, const void *ip_start, int ip_len, struct
   }
   record->ob += size_payload; 
 
-  flow_record_update_byte_count(record, payload, size_payload);
-  flow_record_update_byte_dist_mean_var(record, payload, size_payload);
+  flow_record_update_byte_count(record, payload, flow_record_payload_budget(record, size_payload));
 
   return record;
 }
 
+struct flow_record *
+process_ip(const struct pcap_pkthdr *h, const void *ip_start, int ip_len, struct flow_key *key) {
+
+  if (output_level > none) {
+    fprintf(output, "   protocol: IP\n");
+  }
+
+  /* signify IP by using zero (reserved) port values */
+  key->sp = key->dp = 0;
+  
+  return process_ip_payload(h, ip_start, ip_len, key);
+}
+
+/*
+ * process_ip_fragment() accounts for a fragment other than the first
+ * in the flow of the first fragment of its datagram, whose ports
+ * frag_table_lookup() has set in key
+ */
+static struct flow_record *
+process_ip_fragment(const struct pcap_pkthdr *h, const void *start, int len, const struct flow_key *key) {
+
+  if (output_level > none) {
+    fprintf(output, "   fragment of: %u -> %u\n", key->sp, key->dp);
+  }
+
+  return process_ip_payload(h, start, len, key);
+}
+
+
+/*
+ * ipv6_skip_ext_hdrs() walks the extension headers that follow an
+ * IPv6 header, starting with the one of type *nxt at start; it sets
+ * *nxt to the type of the first header that is not an extension
+ * header, and returns the offset of that header, or -1 if the
+ * extension headers do not fit in len bytes.  If the packet is a
+ * fragment, *fragment is set to its enum frag_type and *frag_id to
+ * its identification.  A fragment other than the first has no
+ * transport header; for it, *nxt is set to the type of the header
+ * that it continues.
+ */
+static int
+ipv6_skip_ext_hdrs(const unsigned char *start, unsigned int len, unsigned char *nxt, 
+		   enum frag_type *fragment, uint32_t *frag_id) {
+  const struct ipv6_frag_hdr *frag;
+  unsigned int offset = 0;
+  unsigned int ext_len;
+
+  *fragment = frag_none;
+  while (1) {
+    switch (*nxt) {
+    case IPV6_EXT_HOPOPTS:
+    case IPV6_EXT_ROUTING:
+    case IPV6_EXT_DSTOPTS:
+    case IPV6_EXT_MOBILITY:
+      if (offset + 2 > len) {
+	return -1;
+      }
+      ext_len = (start[offset + 1] + 1) * 8;
+      break;
+    case IPV6_EXT_AH:
+      if (offset + 2 > len) {
+	return -1;
+      }
+      ext_len = (start[offset + 1] + 2) * 4;
+      break;
+    case IPV6_EXT_FRAGMENT:
+      if (offset + sizeof(struct ipv6_frag_hdr) > len) {
+	return -1;
+      }
+      frag = (const struct ipv6_frag_hdr *)(start + offset);
+      *frag_id = ntohl(frag->ipv6f_ident);
+      if (ipv6_fragment_offset(frag) != 0) {
+	*nxt = start[offset];
+	*fragment = frag_later;
+	return offset + sizeof(struct ipv6_frag_hdr);
+      }
+      if (ipv6_more_fragments(frag)) {
+	*fragment = frag_first;
+      }
+      ext_len = sizeof(struct ipv6_frag_hdr);
+      break;
+    default:
+      return offset;
+    }
+    *nxt = start[offset];
+    offset += ext_len;
+    if (offset > len) {
+      return -1;
+    }
+  }
+}
+
+/*
+ * link layer decoding: a decoder returns the length of the link layer
+ * headers of a packet, and sets ethertype to the type of the network
+ * layer packet that follows them and vlan to the outermost VLAN ID,
+ * if there is one; it returns 0 if the headers are truncated or do
+ * not lead to an IP packet.  VLAN tags and MPLS label stacks are
+ * skipped, in any number.  The decoder is chosen once per pcap handle
+ * by pkt_proc_set_linktype(), rather than for each packet, and an
+ * untagged frame costs a single comparison beyond reading its type.
+ */
+typedef unsigned int (*link_decoder)(const unsigned char *packet, unsigned int caplen,
+				     unsigned short *ethertype, unsigned short *vlan);
+
+static inline unsigned int eth_type_is_vlan(unsigned short type) {
+  return type == ETH_TYPE_VLAN || type == ETH_TYPE_QINQ || type == ETH_TYPE_QINQ_OLD;
+}
+
+static inline unsigned int link_skip_tags(const unsigned char *packet, unsigned int caplen, unsigned int offset,
+					  unsigned short *ethertype, unsigned short *vlan) {
+  unsigned short type = *ethertype;
+
+  if (type == ETH_TYPE_IP || type == ETH_TYPE_IPV6) {
+    return offset;
+  }
+  if (eth_type_is_vlan(type)) {
+    if (offset + VLAN_TAG_LEN > caplen) {
+      return 0;
+    }
+    *vlan = ((packet[offset] << 8) | packet[offset + 1]) & VLAN_ID_MASK;
+    do {
+      if (offset + VLAN_TAG_LEN > caplen) {
+	return 0;
+      }
+      type = (packet[offset + 2] << 8) | packet[offset + 3];
+      offset += VLAN_TAG_LEN;
+    } while (eth_type_is_vlan(type));
+  }
+  if (type == ETH_TYPE_MPLS || type == ETH_TYPE_MPLS_MCAST) {
+    do {
+      if (offset + MPLS_LABEL_LEN > caplen) {
+	return 0;
+      }
+      offset += MPLS_LABEL_LEN;
+    } while ((packet[offset - 2] & MPLS_BOTTOM_OF_STACK) == 0);
+
+    /* the label stack does not identify its payload, so use the IP version */
+    if (offset >= caplen) {
+      return 0;
+    }
+    switch (packet[offset] >> 4) {
+    case 4:
+      type = ETH_TYPE_IP;
+      break;
+    case 6:
+      type = ETH_TYPE_IPV6;
+      break;
+    default:
+      return 0;
+    }
+  }
+  if (type != ETH_TYPE_IP && type != ETH_TYPE_IPV6) {
+    return 0;
+  }
+  *ethertype = type;
+  return offset;
+}
+
+static unsigned int link_decode_ethernet(const unsigned char *packet, unsigned int caplen,
+					 unsigned short *ethertype, unsigned short *vlan) {
+  if (caplen < ETHERNET_HDR_LEN) {
+    return 0;
+  }
+  *ethertype = ntohs(((const struct ethernet_hdr *)packet)->ether_type);
+  return link_skip_tags(packet, caplen, ETHERNET_HDR_LEN, ethertype, vlan);
+}
+
+static unsigned int link_decode_sll(const unsigned char *packet, unsigned int caplen,
+				    unsigned short *ethertype, unsigned short *vlan) {
+  if (caplen < SLL_HDR_LEN) {
+    return 0;
+  }
+  *ethertype = (packet[SLL_PROTOCOL_OFFSET] << 8) | packet[SLL_PROTOCOL_OFFSET + 1];
+  return link_skip_tags(packet, caplen, SLL_HDR_LEN, ethertype, vlan);
+}
+
+static link_decoder link_decode = link_decode_ethernet;
+
+enum status pkt_proc_set_linktype(int linktype) {
+  switch (linktype) {
+  case DLT_EN10MB:
+    link_decode = link_decode_ethernet;
+    return ok;
+  case DLT_LINUX_SLL:
+    link_decode = link_decode_sll;
+    return ok;
+  default:
+    return failure;
+  }
+}
 
 void
 process_packet(unsigned char *ignore, const struct pcap_pkthdr *header, const unsigned char *packet) {
@@ -769,10 +1013,17 @@ process_packet(unsigned char *ignore, const struct pcap_pkthdr *header, const un
   unsigned char proto = 0;
 
   /* declare pointers to packet headers */
-  const struct ip_hdr *ip;              
+  unsigned int link_len;                /* link layer headers   */
+  unsigned int caplen;                  /* captured after them  */
+  unsigned short ethertype, vlan = 0;
+  const void *ip_start;                 /* IPv4 or IPv6 header  */
+  unsigned int ip_len;                  /* length of IP packet  */
+  unsigned char ttl;                    /* TTL or hop limit     */
   unsigned int transport_len;
   unsigned int ip_hdr_len;
   const void *transport_start;
+  enum frag_type fragment = frag_none;
+  uint32_t frag_id = 0;
 
   struct flow_key key;
   
@@ -782,69 +1033,128 @@ process_packet(unsigned char *ignore, const struct pcap_pkthdr *header, const un
   }
   //  packet_count++;
   
-  // ethernet = (struct ethernet_hdr*)(packet);
-  
-  /* define/compute ip header offset */
-  ip = (struct ip_hdr*)(packet + ETHERNET_HDR_LEN);
-  ip_hdr_len = ip_hdr_length(ip);
-  if (ip_hdr_len < 20) {
-    if (output_level > none) { 
-      fprintf(output, "   * Invalid IP header length: %u bytes\n", ip_hdr_len);
-    }
-    return;
-  }
-  if (ntohs(ip->ip_len) < sizeof(struct ip_hdr) || ntohs(ip->ip_len) > header->caplen) {
-    /* 
-     * IP packet is malformed (shorter than a complete IP header, or
-     * claims to be longer than it is), or not entirely captured by
-     * libpcap (which will depend on MTU and SNAPLEN; you can change
-     * the latter if need be).
-     */
-    return ;
+  link_len = link_decode(packet, header->caplen, &ethertype, &vlan);
+  if (link_len == 0) {
+    return;   /* not IP, or truncated */
   }
-  transport_len =  ntohs(ip->ip_len) - ip_hdr_len;
+  ip_start = packet + link_len;
+  caplen = header->caplen - link_len;
+  key.vlan = include_vlan ? vlan : 0;
 
-  /* print source and destination IP addresses */
-  if (output_level > none) {
-    fprintf(output, "       from: %s\n", inet_ntoa(ip->ip_src));
-    fprintf(output, "         to: %s\n", inet_ntoa(ip->ip_dst));
-    fprintf(output, "     ip len: %u\n", ntohs(ip->ip_len));
-    fprintf(output, " ip hdr len: %u\n", ip_hdr_len);
-  }
+  if (ethertype == ETH_TYPE_IPV6) {
+    const struct ipv6_hdr *ip6 = ip_start;
+    char addr_string[INET6_ADDRSTRLEN];
+    int ext_len;
+
+    if (caplen < IPV6_HDR_LEN || ipv6_version(ip6) != 6) {
+      return;
+    }
+    ip_len = IPV6_HDR_LEN + ntohs(ip6->ipv6_plen);
+    if (ip_len > caplen) {
+      /* not entirely captured, or a jumbogram */
+      return;
+    }
+    proto = ip6->ipv6_nxt;
+    ext_len = ipv6_skip_ext_hdrs(ip_start + IPV6_HDR_LEN, ip_len - IPV6_HDR_LEN, &proto, &fragment, &frag_id);
+    if (ext_len < 0) {
+      if (output_level > none) { 
+	fprintf(output, "   * Invalid IPv6 extension header length\n");
+      }
+      return;
+    }
+    ip_hdr_len = IPV6_HDR_LEN + ext_len;
+    ttl = ip6->ipv6_hlim;
+
+    if (output_level > none) {
+      fprintf(output, "       from: %s\n", inet_ntop(AF_INET6, &ip6->ipv6_src, addr_string, sizeof(addr_string)));
+      fprintf(output, "         to: %s\n", inet_ntop(AF_INET6, &ip6->ipv6_dst, addr_string, sizeof(addr_string)));
+      fprintf(output, "     ip len: %u\n", ip_len);
+      fprintf(output, " ip hdr len: %u\n", ip_hdr_len);
+    }
 
-  if (ip_fragment_offset(ip) == 0) {
+    flow_key_set_ipv6_addrs(&key, &ip6->ipv6_src, &ip6->ipv6_dst);
+    key.prot = proto;
+
+  } else {
+    const struct ip_hdr *ip = ip_start;
+
+    if (caplen < sizeof(struct ip_hdr)) {
+      return;
+    }
+
+    /* define/compute ip header offset */
+    ip_hdr_len = ip_hdr_length(ip);
+    if (ip_hdr_len < 20) {
+      if (output_level > none) { 
+	fprintf(output, "   * Invalid IP header length: %u bytes\n", ip_hdr_len);
+      }
+      return;
+    }
+    if (ntohs(ip->ip_len) < sizeof(struct ip_hdr) || ntohs(ip->ip_len) > caplen) {
+      /* 
+       * IP packet is malformed (shorter than a complete IP header, or
+       * claims to be longer than it is), or not entirely captured by
+       * libpcap (which will depend on MTU and SNAPLEN; you can change
+       * the latter if need be).
+       */
+      return ;
+    }
+    ip_len = ntohs(ip->ip_len);
+    ttl = ip->ip_ttl;
+
+    /* print source and destination IP addresses */
+    if (output_level > none) {
+      fprintf(output, "       from: %s\n", inet_ntoa(ip->ip_src));
+      fprintf(output, "         to: %s\n", inet_ntoa(ip->ip_dst));
+      fprintf(output, "     ip len: %u\n", ntohs(ip->ip_len));
+      fprintf(output, " ip hdr len: %u\n", ip_hdr_len);
+    }
 
     /* fill out IP-specific fields of flow key, plus proto selector */
-    key.sa = ip->ip_src;
-    key.da = ip->ip_dst;
+    flow_key_set_ipv4_addrs(&key, ip->ip_src, ip->ip_dst);
     proto = key.prot = ip->ip_prot;  
 
-  }  else {
-    // fprintf(info, "found IP fragment (offset: %02x)\n", ip_fragment_offset(ip));
-
-    /*
-     * select IP processing, since we don't have a TCP or UDP header 
-     */
-    proto = IPPROTO_IP;
-  }  
+    if (ip_is_fragment(ip)) {
+      fragment = ip_fragment_offset(ip) != 0 ? frag_later : frag_first;
+      frag_id = ntohs(ip->ip_id);
+    }  
+  }
+  if (ip_hdr_len > ip_len) {
+    return;
+  }
+  transport_len = ip_len - ip_hdr_len;
 
   /* determine transport protocol and handle appropriately */
 
-  transport_start = (void *)ip + ip_hdr_len;
-  switch(proto) {
-  case IPPROTO_TCP:
-    record = process_tcp(header, transport_start, transport_len, &key);
-    break;
-  case IPPROTO_UDP:
-    record = process_udp(header, transport_start, transport_len, &key);
-    break;
-  case IPPROTO_ICMP:
-    record = process_icmp(header, transport_start, transport_len, &key);
-    break;    
-  case IPPROTO_IP:
-  default:
-    record = process_ip(header, transport_start, transport_len, &key);
-    break;
+  transport_start = ip_start + ip_hdr_len;
+  if (fragment == frag_later) {
+    /*
+     * a later fragment has no transport header, so it goes to the
+     * flow of the first fragment of its datagram, if we have seen it
+     */
+    if (!frag_table_lookup(&key, frag_id, &header->ts)) {
+      flocap_stats_incr_frags_dropped();
+      return;
+    }
+    flocap_stats_incr_frags_attributed();
+    record = process_ip_fragment(header, transport_start, transport_len, &key);
+  } else {
+    switch(proto) {
+    case IPPROTO_TCP:
+      record = process_tcp(header, transport_start, transport_len, &key);
+      break;
+    case IPPROTO_UDP:
+      record = process_udp(header, transport_start, transport_len, &key);
+      break;
+    case IPPROTO_ICMP:
+    case IPPROTO_ICMPV6:
+      record = process_icmp(header, transport_start, transport_len, &key);
+      break;    
+    case IPPROTO_IP:
+    default:
+      record = process_ip(header, transport_start, transport_len, &key);
+      break;
+    }
   }
 
   /*
@@ -869,11 +1179,16 @@ process_packet(unsigned char *ignore, const struct pcap_pkthdr *header, const un
 #endif
   }
   
+  /* remember the flow of a first fragment, for the fragments that follow */
+  if (fragment == frag_first) {
+    frag_table_add(&key, frag_id, &header->ts);
+  }
+
   /*
    * set minimum ttl in flow record
    */
-  if (record->ttl > ip->ip_ttl) {
-    record->ttl = ip->ip_ttl; 
+  if (record->ttl > ttl) {
+    record->ttl = ttl; 
   }
 
   /* increment packet count in flow record */
@@ -891,9 +1206,9 @@ process_packet(unsigned char *ignore, const struct pcap_pkthdr *header, const un
    * is the first packet in the flow with nonzero data payload
    */
   if ((report_idp) && record->op && (record->idp_len == 0)) {
-    record->idp_len = (ntohs(ip->ip_len) < report_idp ? ntohs(ip->ip_len) : report_idp);
+    record->idp_len = (ip_len < report_idp ? ip_len : report_idp);
     record->idp = malloc(record->idp_len);
-    memcpy(record->idp, ip, record->idp_len);
+    memcpy(record->idp, ip_start, record->idp_len);
     if (output_level > none) {
       fprintf(output, "stashed %u bytes of IDP\n", record->idp_len);
     }
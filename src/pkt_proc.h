@@ -44,10 +44,20 @@
 #define PKT_PROC_H
 
 #include <pcap.h>
+#include "err.h"
 
 void
 process_packet(unsigned char *ignore, const struct pcap_pkthdr *header, const unsigned char *packet);
 
+/*
+ * pkt_proc_set_linktype(linktype) selects the link layer decoder that
+ * process_packet() uses, for the linktype of a pcap handle (as
+ * returned by pcap_datalink()); it returns failure if the linktype is
+ * not supported, in which case the decoder is left unchanged.  The
+ * ethernet decoder is used until it is called.
+ */
+enum status pkt_proc_set_linktype(int linktype);
+
 
 int data_sanity_check();
 
@@ -91,9 +91,9 @@ void host_flow_print(const struct host_flow *hf) {
   printf("pid: %u\tind: %u\tsrc: %s:%-5u\t", 
 	 hf->pid,
 	 hf->inode, 
-	 inet_ntoa(key->sa), key->sp);
+	 inet_ntoa(key->sa.v4.addr), key->sp);
   printf("dst: %s:%-5u\tprot: %-3u\texe: %s\n",
-	 inet_ntoa(key->da), key->dp, 
+	 inet_ntoa(key->da.v4.addr), key->dp, 
 	 key->prot, hf->exe_name);
 }
 
@@ -172,6 +172,7 @@ void host_flow_table_add_tcp(unsigned int all_sockets) {
   unsigned int inode;
   struct host_flow tmp;
   struct flow_key *key = &tmp.key;
+  struct in_addr sa, da;
   
   fd = open("/proc/net/tcp", O_RDONLY);
   if (fd == -1) {
@@ -184,7 +185,7 @@ void host_flow_table_add_tcp(unsigned int all_sockets) {
   line = buffer + 156;
   while (len > 0) {
     //    line = buffer + 156;
-    key->sa.s_addr = (strtoul(line, NULL, 16));
+    sa.s_addr = (strtoul(line, NULL, 16));
     //   printf("line: %s\n", line);
     // printf("addr: %x\n", addr);
     line += 9;
@@ -193,7 +194,7 @@ void host_flow_table_add_tcp(unsigned int all_sockets) {
     // printf("port: %x\n", port);
 
     line += 5;
-    key->da.s_addr = (strtoul(line, NULL, 16));
+    da.s_addr = (strtoul(line, NULL, 16));
     //   printf("line: %s\n", line);
     // fprintf(stderr, "XXX addr: %s\n", inet_ntoa(key->da));
     line += 10;
@@ -205,12 +206,14 @@ void host_flow_table_add_tcp(unsigned int all_sockets) {
     inode = strtoul(line, NULL, 10);
     
     key->prot = 6; /* tcp */
+    key->vlan = 0;
+    flow_key_set_ipv4_addrs(key, sa, da);
 
-    if (key->da.s_addr != 0 || all_sockets) {
+    if (da.s_addr != 0 || all_sockets) {
       struct host_flow *hf;
 
       /* ignore localhost source addresses */
-      if (key->sa.s_addr != 0x7f000001) {
+      if (sa.s_addr != 0x7f000001) {
 
 	/* found internet socket; create host_flow_table entry  */
 	hf = inode_get_host_flow(inode, CREATE_NEW);
@@ -242,6 +245,7 @@ void host_flow_table_add_udp(unsigned int all_sockets) {
   unsigned int inode;
   struct host_flow tmp;
   struct flow_key *key = &tmp.key;
+  struct in_addr sa, da;
   
   fd = open("/proc/net/udp", O_RDONLY);
   if (fd == -1) {
@@ -253,7 +257,7 @@ void host_flow_table_add_udp(unsigned int all_sockets) {
   // printf("%s\n", buffer);
   line = buffer + 135;
   while (len > 0) {
-    key->sa.s_addr = (strtoul(line, NULL, 16));
+    sa.s_addr = (strtoul(line, NULL, 16));
     // printf("line: %s\n", line);
     // printf("saddr: %x\n", key->sa.s_addr);
     line += 9; len -= 9;
@@ -262,7 +266,7 @@ void host_flow_table_add_udp(unsigned int all_sockets) {
     // printf("port: %x\n", key->sp);
 
     line += 5; len -= 5;
-    key->da.s_addr = (strtoul(line, NULL, 16));
+    da.s_addr = (strtoul(line, NULL, 16));
     // fprintf(stderr, "line: %s\n", line);
     // fprintf(stderr, "daddr: %x\n", key->da.s_addr);
     line += 9; len -= 9;
@@ -276,12 +280,14 @@ void host_flow_table_add_udp(unsigned int all_sockets) {
     // printf("inode: %u\n", inode);
     
     key->prot = 17; /* udp */
+    key->vlan = 0;
+    flow_key_set_ipv4_addrs(key, sa, da);
 
-    if (key->da.s_addr != 0 || all_sockets) {
+    if (da.s_addr != 0 || all_sockets) {
       struct host_flow *hf;
       
       /* ignore localhost source addresses */
-      if (key->sa.s_addr != 0x7f000001) {
+      if (sa.s_addr != 0x7f000001) {
 	
 	/* found internet socket; create host_flow_table entry  */
 	hf = inode_get_host_flow(inode, CREATE_NEW);
@@ -466,6 +472,8 @@ int get_host_flow_data() {
 	twin.sp = record->key.dp;
 	twin.dp = record->key.sp;
 	twin.prot = record->key.prot;
+	twin.ver = record->key.ver;
+	twin.vlan = record->key.vlan;
 	if (flow_key_set_exe_name(&twin, record->exe_name) != ok) {
 	  // fprintf(stderr, "twin host flow not found\n");
 	  
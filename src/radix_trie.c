@@ -48,8 +48,13 @@
 #include <stdlib.h>      /* for malloc()                 */
 #include <string.h>      /* for memset()                 */
 #include <ctype.h>       /* for isblank(), etc.          */
+#include <stdint.h>      /* for uint32_t, uint64_t       */
+#include <unistd.h>      /* for unlink()                 */
+#include <endian.h>      /* for be64toh()                */
+#include <sys/time.h>    /* for gettimeofday()           */
 #include "radix_trie.h"
 #include "addr.h"
+#include "cpu_isa.h"     /* for time_diff()              */
 
 /*
  * radix_trie internals
@@ -121,8 +126,76 @@ struct radix_trie_leaf {
 
 #define MAX_LABEL_LEN 256
 
+/*
+ * compact (read-only) form of a radix_trie, built by
+ * radix_trie_compact(), in the style of Poptrie (Asai and Ohara,
+ * SIGCOMM 2015)
+ *
+ * The first 16 bits of an address index the direct table, each entry
+ * of which is either a leaf (the RT_COMPACT_LEAF bit is set, and the
+ * remaining bits are an index into the leaf array) or the index of a
+ * node for the third byte of the address.  Each node stands in for a
+ * 256-entry table: bit b of vec is set if entry b is a node for the
+ * next byte, in which case it is child number rank(vec, b) of the
+ * node.  Otherwise, entry b is a leaf; runs of entries with the same
+ * leaf value are stored once, and bit b of leafvec is set where a new
+ * run starts, so that the leaf is number rank(leafvec, b+1) - 1 of
+ * the node.  The children of a node are contiguous in the node array,
+ * as are its leaves in the leaf array, so a node needs only the index
+ * of its first child and its first leaf.  Each node also holds the
+ * number of bits set before each 64-bit word of its bitmaps, so that
+ * a rank takes a single population count.
+ */
+#define RT_COMPACT_DIRECT_BITS 16
+#define RT_COMPACT_LEAF 0x80000000
+
+struct radix_trie_compact_node {
+  uint64_t vec[4];          /* entries that are nodes             */
+  uint64_t leafvec[4];      /* entries that start a run of leaves */
+  uint8_t vec_rank[4];      /* bits set in vec[0..i-1]            */
+  uint8_t leafvec_rank[4];  /* bits set in leafvec[0..i-1]        */
+  uint32_t base1;           /* index of first child node          */
+  uint32_t base0;           /* index of first leaf                */
+};
+
+struct radix_trie_compact {
+  uint32_t direct[1 << RT_COMPACT_DIRECT_BITS];
+  struct radix_trie_compact_node *node;
+  unsigned int num_nodes;
+  attr_flags *leaf;
+  unsigned int num_leaves;
+};
+
+/*
+ * IPv6 subnets are kept apart from IPv4 ones, in a path-compressed
+ * binary trie (a PATRICIA trie): each node holds a prefix and its
+ * length, and there is a node only for each subnet and for each
+ * point at which the prefixes below it diverge.  A trie with n
+ * subnets thus has fewer than 2n nodes, whatever their lengths, and a
+ * lookup visits one node per prefix on the path of the address,
+ * rather than one per bit or byte.  The value of a node is the
+ * bitwise-OR of the flags of all of the subnets that cover its
+ * prefix (the analog of pushing flags down to the leaves of the IPv4
+ * trie), so a lookup returns the value of the last node whose prefix
+ * matches the address.  The nodes are kept in a single array and
+ * linked by their indices, which keeps them to 32 bytes and makes
+ * them contiguous; node 0 is the root, whose prefix is empty, so an
+ * index of 0 can stand for no child.
+ */
+struct radix_trie_node6 {
+  uint64_t prefix[2];      /* host order, most significant word first */
+  uint32_t child[2];       /* index of the child for the next bit     */
+  attr_flags value;        /* flags of the subnets covering prefix    */
+  uint32_t len;            /* prefix length, in bits                  */
+};
+
 struct radix_trie {
   struct radix_trie_node *root;
+  struct radix_trie_compact *compact;  /* if not NULL, used instead of root */
+  struct radix_trie_node6 *node6;      /* IPv6 subnets                      */
+  unsigned int num_nodes6;
+  unsigned int size6;
+  struct radix_trie_compact6 *compact6; /* if not NULL, used instead of node6 */
   unsigned int num_flags;
   char *flag[MAX_NUM_FLAGS];
 };
@@ -159,6 +232,46 @@ struct radix_trie_leaf *radix_trie_leaf_init(attr_flags value) {
   return radix_trie;   /* could be NULL */
 }
 
+/*
+ * popcount(x) returns the number of bits set in x; it is written out
+ * rather than using __builtin_popcountll(), which is a library call
+ * unless the compiler targets a processor with a POPCNT instruction
+ */
+static inline unsigned int popcount(uint64_t x) {
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (x * 0x0101010101010101ULL) >> 56;
+}
+
+/*
+ * rank(vec, count, b) returns the number of bits of the bitmap vec
+ * that are set below bit b, where count[i] is the number of bits set
+ * in vec[0..i-1]
+ */
+static inline unsigned int rank(const uint64_t *vec, const uint8_t *count, unsigned int b) {
+  return count[b >> 6] + popcount(vec[b >> 6] & ((1ULL << (b & 63)) - 1));
+}
+
+static inline attr_flags radix_trie_compact_lookup(const struct radix_trie_compact *c, uint32_t a) {
+  uint32_t e = c->direct[a >> (32 - RT_COMPACT_DIRECT_BITS)];
+  unsigned int shift = 32 - RT_COMPACT_DIRECT_BITS;
+
+  while ((e & RT_COMPACT_LEAF) == 0) {
+    const struct radix_trie_compact_node *n = &c->node[e];
+    unsigned int b;
+
+    shift -= 8;
+    b = (a >> shift) & 0xff;
+    if ((n->vec[b >> 6] >> (b & 63)) & 1) {
+      e = n->base1 + rank(n->vec, n->vec_rank, b);
+    } else {
+      return c->leaf[n->base0 + rank(n->leafvec, n->leafvec_rank, b) + ((n->leafvec[b >> 6] >> (b & 63)) & 1) - 1];
+    }
+  }
+  return c->leaf[e & ~RT_COMPACT_LEAF];
+}
+
 attr_flags radix_trie_lookup_addr(struct radix_trie *trie, struct in_addr addr) {
   unsigned char *a = (void *) &addr.s_addr;
   unsigned int i;
@@ -166,9 +279,13 @@ attr_flags radix_trie_lookup_addr(struct radix_trie *trie, struct in_addr addr)
   
   debug_printf("lookup\n");
 
+  if (trie->compact) {
+    return radix_trie_compact_lookup(trie->compact, ntohl(addr.s_addr));
+  }
+
   /* sanity check */
   if (rt == NULL) {
-    return failure;
+    return 0;
   }
 
   for (i=0; i<4; i++) {
@@ -190,11 +307,60 @@ attr_flags radix_trie_lookup_addr(struct radix_trie *trie, struct in_addr addr)
   return 0;  /* indicate that no match occured */
 }
 
-inline void radix_trie_node_add_flag_to_all_leaves(const struct radix_trie_node *rt, attr_flags flags) {
+/*
+ * radix_trie_lookup_addr_batch() works through the addresses in
+ * groups of RT_BATCH_SIZE, prefetching the memory that each lookup in
+ * a group will touch first (the direct table entries, then the nodes
+ * that they point to) before doing the lookups, so that the cache
+ * misses of a group overlap rather than being taken one at a time
+ */
+#define RT_BATCH_SIZE 16
+
+void radix_trie_lookup_addr_batch(struct radix_trie *trie, const struct in_addr *addr, 
+				  attr_flags *flags, unsigned int n) {
+  unsigned int i, batch;
+
+  while (n > 0) {
+    batch = n < RT_BATCH_SIZE ? n : RT_BATCH_SIZE;
+
+    if (trie->compact) {
+      const struct radix_trie_compact *c = trie->compact;
+      uint32_t e[RT_BATCH_SIZE];
+
+      for (i=0; i<batch; i++) {
+	__builtin_prefetch(&c->direct[ntohl(addr[i].s_addr) >> (32 - RT_COMPACT_DIRECT_BITS)]);
+      }
+      for (i=0; i<batch; i++) {
+	e[i] = c->direct[ntohl(addr[i].s_addr) >> (32 - RT_COMPACT_DIRECT_BITS)];
+	if ((e[i] & RT_COMPACT_LEAF) == 0) {
+	  __builtin_prefetch(&c->node[e[i]]);
+	}
+      }
+    } else if (trie->root) {
+      for (i=0; i<batch; i++) {
+	__builtin_prefetch(trie->root->table[((const unsigned char *)&addr[i].s_addr)[0]]);
+      }
+    }
+    for (i=0; i<batch; i++) {
+      flags[i] = radix_trie_lookup_addr(trie, addr[i]);
+    }
+    addr += batch;
+    flags += batch;
+    n -= batch;
+  }
+}
+
+/*
+ * radix_trie_node_add_flags(rt, flags) adds flags to all of the leaves
+ * below the node rt, and creates leaves with the value flags for all
+ * of its empty table entries, so that every address covered by rt
+ * matches flags
+ */
+enum status radix_trie_node_add_flags(struct radix_trie_node *rt, attr_flags flags) {
   unsigned int i;
   
   if (rt == NULL) {
-    return;
+    return ok;
   }
   switch(rt->type) {
   case leaf:
@@ -203,14 +369,49 @@ inline void radix_trie_node_add_flag_to_all_leaves(const struct radix_trie_node
     break;
   case internal:
     for (i=0; i<256; i++) {    
-     debug_printf("adding flags %x to leaves at %x\n", flags, i);
-      radix_trie_node_add_flag_to_all_leaves(rt->table[i], flags);
+      debug_printf("adding flags %x to leaves at %x\n", flags, i);
+      if (rt->table[i] == NULL) {
+	rt->table[i] = (struct radix_trie_node *)radix_trie_leaf_init(flags);
+	if (rt->table[i] == NULL) {
+	  return failure;
+	}
+      } else if (radix_trie_node_add_flags(rt->table[i], flags) != ok) {
+	return failure;
+      }
     }
     break;
   default:
     ;
   }
-  return;
+  return ok;
+}
+
+static void radix_trie_node_free(struct radix_trie_node *rt);
+
+/*
+ * radix_trie_leaf_split(leaf) returns an internal node that replaces
+ * leaf, whose table entries are all leaves with the value of leaf, so
+ * that a longer subnet can be added below it; it returns NULL, and
+ * leaves leaf unchanged, if memory could not be allocated
+ */
+struct radix_trie_node *radix_trie_leaf_split(struct radix_trie_leaf *l) {
+  struct radix_trie_node *rt;
+  unsigned int i;
+
+  rt = radix_trie_node_init();
+  if (rt == NULL) {
+    return NULL;
+  }
+  for (i=0; i<256; i++) {
+    rt->table[i] = (struct radix_trie_node *)radix_trie_leaf_init(l->value);
+    if (rt->table[i] == NULL) {
+      radix_trie_node_free(rt);
+      return NULL;
+    }
+  }
+  free(l);
+  rt_mem_usage -= sizeof(struct radix_trie_leaf);
+  return rt;
 }
 
 #define MAX(x,y) (x > y ? x : y)
@@ -219,12 +420,16 @@ enum status radix_trie_add_subnet(struct radix_trie *trie, struct in_addr addr,
   unsigned char *a = (void *) &addr.s_addr;
   unsigned int i, x, bits, bytes, max, num_internal_nodes;
   struct radix_trie_node *tmp;
-  struct radix_trie_node *rt = trie->root;
+  struct radix_trie_node *rt;
 
   /* sanity checks */
-  if (!trie || (netmasklen > 32)) {
-    return failure;   /* no null pointers or giant netmasks allowed */
+  if (!trie || !trie->root || (netmasklen > 32) || (netmasklen == 0)) {
+    return failure;   /* no null pointers, giant or empty netmasks allowed */
   }
+  if (trie->compact) {
+    return failure;   /* a compact trie is read-only */
+  }
+  rt = trie->root;
   if (!flags) {
     return failure;   /* flags must be nonzero; 0 value indicates the absence of flags */
   }
@@ -249,8 +454,13 @@ enum status radix_trie_add_subnet(struct radix_trie *trie, struct in_addr addr,
       rt->table[a[i]] = tmp;
     }
     if (tmp->type == leaf) {
-      debug_printf("warning: found a leaf during creation\n");
-      break;
+      /* a shorter subnet covers this one, so push its leaf down */
+      debug_printf("splitting a leaf during creation\n");
+      tmp = radix_trie_leaf_split((struct radix_trie_leaf *)tmp);
+      if (tmp == NULL) {
+	return failure;
+      }
+      rt->table[a[i]] = tmp;
     }
     rt = tmp;
   }  
@@ -260,7 +470,9 @@ enum status radix_trie_add_subnet(struct radix_trie *trie, struct in_addr addr,
     debug_printf("L: a[%d]: %x\n", i, a[i]); 
 
     if (rt->table[a[i]] != NULL) {
-      radix_trie_node_add_flag_to_all_leaves(rt->table[a[i]], flags);
+      if (radix_trie_node_add_flags(rt->table[a[i]], flags) != ok) {
+	return failure;
+      }
     } else {
       tmp = (struct radix_trie_node *)radix_trie_leaf_init(flags);
       if (tmp == NULL) {
@@ -278,7 +490,9 @@ enum status radix_trie_add_subnet(struct radix_trie *trie, struct in_addr addr,
 
       /* if table entry exists, then add flag into all leaves */
       if (rt->table[prefix|x] != NULL) {
-	radix_trie_node_add_flag_to_all_leaves(rt->table[prefix|x], flags);
+	if (radix_trie_node_add_flags(rt->table[prefix|x], flags) != ok) {
+	  return failure;
+	}
       } else { 
 	tmp = (struct radix_trie_node *)radix_trie_leaf_init(flags);
 	if (tmp == NULL) {
@@ -292,6 +506,636 @@ enum status radix_trie_add_subnet(struct radix_trie *trie, struct in_addr addr,
   return ok;
 }
 
+/*
+ * IPv6 addresses are handled as two 64-bit words in host order, so
+ * that bits are counted from the most significant end
+ */
+static inline void rt_addr6_load(uint64_t *x, const struct in6_addr *a) {
+  memcpy(x, a->s6_addr, 16);
+  x[0] = be64toh(x[0]);
+  x[1] = be64toh(x[1]);
+}
+
+static inline uint64_t rt_mask64(unsigned int len) {
+  return len == 0 ? 0 : len >= 64 ? ~0ULL : ~0ULL << (64 - len);
+}
+
+static inline unsigned int rt_prefix6_match(const uint64_t *x, const uint64_t *p, unsigned int len) {
+  return (((x[0] ^ p[0]) & rt_mask64(len)) 
+	  | ((x[1] ^ p[1]) & rt_mask64(len > 64 ? len - 64 : 0))) == 0;
+}
+
+static inline unsigned int rt_bit6(const uint64_t *x, unsigned int i) {
+  return (x[i >> 6] >> (63 - (i & 63))) & 1;
+}
+
+/* the length of the longest common prefix of x and y, at most max */
+static inline unsigned int rt_common_len6(const uint64_t *x, const uint64_t *y, unsigned int max) {
+  unsigned int n;
+
+  if (x[0] != y[0]) {
+    n = __builtin_clzll(x[0] ^ y[0]);
+  } else if (x[1] != y[1]) {
+    n = 64 + __builtin_clzll(x[1] ^ y[1]);
+  } else {
+    n = 128;
+  }
+  return n < max ? n : max;
+}
+
+/*
+ * rt_node6_new(trie, x, len, value) appends a node to the IPv6 trie,
+ * and returns its index, or 0 on failure; it may move the array
+ */
+static uint32_t rt_node6_new(struct radix_trie *trie, const uint64_t *x, unsigned int len, attr_flags value) {
+  struct radix_trie_node6 *n;
+
+  if (trie->num_nodes6 == trie->size6) {
+    unsigned int size = trie->size6 ? 2 * trie->size6 : 64;
+
+    n = realloc(trie->node6, size * sizeof(struct radix_trie_node6));
+    if (n == NULL) {
+      return 0;
+    }
+    rt_mem_usage += (size - trie->size6) * sizeof(struct radix_trie_node6);
+    trie->node6 = n;
+    trie->size6 = size;
+  }
+  n = &trie->node6[trie->num_nodes6];
+  n->prefix[0] = x[0] & rt_mask64(len);
+  n->prefix[1] = x[1] & rt_mask64(len > 64 ? len - 64 : 0);
+  n->len = len;
+  n->value = value;
+  n->child[0] = n->child[1] = 0;
+  return trie->num_nodes6++;
+}
+
+/* rt_node6_add_flags(trie, i, flags) adds flags to node i and all nodes below it */
+static void rt_node6_add_flags(struct radix_trie *trie, uint32_t i, attr_flags flags) {
+  struct radix_trie_node6 *n = &trie->node6[i];
+
+  n->value |= flags;
+  if (n->child[0]) {
+    rt_node6_add_flags(trie, n->child[0], flags);
+  }
+  if (n->child[1]) {
+    rt_node6_add_flags(trie, n->child[1], flags);
+  }
+}
+
+enum status radix_trie_add_subnet6(struct radix_trie *trie, const struct in6_addr *addr, 
+				   unsigned int netmasklen, attr_flags flags) {
+  uint64_t x[2];
+  uint32_t n = 0, c, m, g;
+  unsigned int b, common;
+  attr_flags covering;
+
+  /* sanity checks */
+  if (!trie || !addr || (netmasklen > 128) || (netmasklen == 0) || !flags) {
+    return failure;
+  }
+  if (trie->compact) {
+    return failure;   /* a compact trie is read-only */
+  }
+  if (trie->node6 == NULL) {
+    uint64_t zero[2] = { 0, 0 };
+
+    rt_node6_new(trie, zero, 0, 0);   /* root; its index is 0 */
+    if (trie->node6 == NULL) {
+      return failure;
+    }
+  }
+  rt_addr6_load(x, addr);
+
+  /* 
+   * descend while the prefix of the current node n covers the subnet
+   * and is shorter than it
+   */
+  while (trie->node6[n].len < netmasklen) {
+    b = rt_bit6(x, trie->node6[n].len);
+    c = trie->node6[n].child[b];
+    covering = trie->node6[n].value;
+    if (c == 0) {
+      if ((m = rt_node6_new(trie, x, netmasklen, covering | flags)) == 0) {
+	return failure;
+      }
+      trie->node6[n].child[b] = m;
+      return ok;
+    }
+    common = rt_common_len6(x, trie->node6[c].prefix, 
+			    netmasklen < trie->node6[c].len ? netmasklen : trie->node6[c].len);
+    if (common == trie->node6[c].len) {
+      n = c;      /* the child covers the subnet, or is the subnet */
+      continue;
+    }
+    if (common == netmasklen) {
+      /* the subnet covers the child, so goes between it and n */
+      if ((m = rt_node6_new(trie, x, netmasklen, covering | flags)) == 0) {
+	return failure;
+      }
+      trie->node6[m].child[rt_bit6(trie->node6[c].prefix, netmasklen)] = c;
+      trie->node6[n].child[b] = m;
+      rt_node6_add_flags(trie, c, flags);
+      return ok;
+    }
+    /* the subnet and the child diverge, so join them under a new node */
+    if ((g = rt_node6_new(trie, x, common, covering)) == 0 
+	|| (m = rt_node6_new(trie, x, netmasklen, covering | flags)) == 0) {
+      return failure;
+    }
+    trie->node6[g].child[rt_bit6(x, common)] = m;
+    trie->node6[g].child[rt_bit6(trie->node6[c].prefix, common)] = c;
+    trie->node6[n].child[b] = g;
+    return ok;
+  }
+
+  /* the subnet is already a node */
+  rt_node6_add_flags(trie, n, flags);
+  return ok;
+}
+
+/*
+ * radix_trie_node_free(rt) frees the node rt and all of the nodes
+ * below it
+ */
+static void radix_trie_node_free(struct radix_trie_node *rt) {
+  unsigned int i;
+
+  if (rt == NULL) {
+    return;
+  }
+  if (rt->type == internal) {
+    for (i=0; i<256; i++) {
+      radix_trie_node_free(rt->table[i]);
+    }
+    rt_mem_usage -= sizeof(struct radix_trie_node);
+  } else {
+    rt_mem_usage -= sizeof(struct radix_trie_leaf);
+  }
+  free(rt);
+}
+
+/*
+ * construction of the compact form: the node and leaf arrays grow
+ * as needed, and are trimmed to size when construction is complete
+ */
+struct radix_trie_compact_builder {
+  struct radix_trie_compact *c;
+  unsigned int node_size;
+  unsigned int leaf_size;
+};
+
+static int rt_compact_add_leaf(struct radix_trie_compact_builder *b, attr_flags value) {
+  struct radix_trie_compact *c = b->c;
+
+  if (c->num_leaves >= b->leaf_size) {
+    unsigned int size = b->leaf_size ? 2 * b->leaf_size : 256;
+    attr_flags *tmp = realloc(c->leaf, size * sizeof(attr_flags));
+
+    if (tmp == NULL) {
+      return -1;
+    }
+    c->leaf = tmp;
+    b->leaf_size = size;
+  }
+  c->leaf[c->num_leaves] = value;
+  return c->num_leaves++;
+}
+
+static int rt_compact_add_nodes(struct radix_trie_compact_builder *b, unsigned int n) {
+  struct radix_trie_compact *c = b->c;
+  unsigned int first = c->num_nodes;
+
+  if (c->num_nodes + n > b->node_size) {
+    unsigned int size = b->node_size ? 2 * b->node_size : 256;
+    struct radix_trie_compact_node *tmp;
+
+    while (size < c->num_nodes + n) {
+      size *= 2;
+    }
+    if (size >= RT_COMPACT_LEAF) {
+      return -1;
+    }
+    tmp = realloc(c->node, size * sizeof(struct radix_trie_compact_node));
+    if (tmp == NULL) {
+      return -1;
+    }
+    c->node = tmp;
+    b->node_size = size;
+  }
+  c->num_nodes += n;
+  return first;
+}
+
+static inline attr_flags rt_leaf_value(const struct radix_trie_node *rt) {
+  return rt ? ((const struct radix_trie_leaf *)rt)->value : 0;
+}
+
+/*
+ * rt_compact_node_build(b, rt, index) builds the compact form of the
+ * internal node rt at position index in the node array, and then the
+ * compact forms of its children
+ */
+static enum status rt_compact_node_build(struct radix_trie_compact_builder *b, 
+					 const struct radix_trie_node *rt, 
+					 unsigned int index) {
+  struct radix_trie_compact_node n;
+  unsigned int i, k, num_children = 0;
+  attr_flags last = 0;
+  int x, first_leaf = 1;
+
+  memset(&n, 0, sizeof(n));
+  for (i=0; i<256; i++) {
+    const struct radix_trie_node *e = rt->table[i];
+
+    if (e && e->type == internal) {
+      n.vec[i >> 6] |= 1ULL << (i & 63);
+      num_children++;
+    } else if (first_leaf || rt_leaf_value(e) != last) {
+      last = rt_leaf_value(e);
+      n.leafvec[i >> 6] |= 1ULL << (i & 63);
+      if ((x = rt_compact_add_leaf(b, last)) < 0) {
+	return failure;
+      }
+      if (first_leaf) {
+	n.base0 = x;
+	first_leaf = 0;
+      }
+    }
+  }
+  for (i=1; i<4; i++) {
+    n.vec_rank[i] = n.vec_rank[i-1] + popcount(n.vec[i-1]);
+    n.leafvec_rank[i] = n.leafvec_rank[i-1] + popcount(n.leafvec[i-1]);
+  }
+  if ((x = rt_compact_add_nodes(b, num_children)) < 0) {
+    return failure;
+  }
+  n.base1 = x;
+  b->c->node[index] = n;
+
+  for (i=0, k=0; i<256; i++) {
+    const struct radix_trie_node *e = rt->table[i];
+
+    if (e && e->type == internal) {
+      if (rt_compact_node_build(b, e, n.base1 + k++) != ok) {
+	return failure;
+      }
+    }
+  }
+  return ok;
+}
+
+/*
+ * The compact form of the IPv6 trie is level-compressed (in the
+ * style of the LC-trie of Nilsson and Karlsson, IEEE JSAC 1999): each
+ * node indexes an array of 2^stride slots with the stride bits of the
+ * address that follow its prefix, so that a dense part of the trie is
+ * crossed in one step rather than one step per bit.  The stride of a
+ * node is the largest (up to 8) for which at least half of the slots
+ * lead to a subtree; a slot that does not is a leaf, which holds the
+ * flags of the addresses that reach it.  A node whose prefix does
+ * not match the address gives the flags held in miss, which are those
+ * of the deepest subnet above it.  Nodes are numbered in the order in
+ * which they are built, depth first, so a lookup tends to move
+ * forward through memory.
+ */
+#define RT6_MAX_STRIDE 8
+
+struct radix_trie_compact6_node {
+  uint64_t prefix[2];       /* host order, as in radix_trie_node6    */
+  uint32_t base;            /* index of first slot                   */
+  attr_flags value;         /* flags, if stride is zero              */
+  attr_flags miss;          /* flags, if the prefix does not match   */
+  uint8_t len;              /* prefix length, in bits                */
+  uint8_t stride;           /* bits of address that index the slots  */
+};
+
+struct radix_trie_compact6 {
+  struct radix_trie_compact6_node *node;
+  unsigned int num_nodes;
+  uint32_t *slot;           /* node index, or RT_COMPACT_LEAF | leaf */
+  unsigned int num_slots;
+  attr_flags *leaf;
+  unsigned int num_leaves;
+};
+
+/* rt_bits6(x, pos, n) returns the n bits of x that start at bit pos */
+static inline unsigned int rt_bits6(const uint64_t *x, unsigned int pos, unsigned int n) {
+  unsigned int end = pos + n;
+
+  if (end <= 64) {
+    return (x[0] >> (64 - end)) & ((1 << n) - 1);
+  }
+  if (pos >= 64) {
+    return (x[1] >> (128 - end)) & ((1 << n) - 1);
+  }
+  return ((x[0] << (end - 64)) | (x[1] >> (128 - end))) & ((1 << n) - 1);
+}
+
+static inline attr_flags radix_trie_compact6_lookup(const struct radix_trie_compact6 *c, const uint64_t *x) {
+  const struct radix_trie_compact6_node *n = &c->node[0];
+  uint32_t e;
+
+  while (1) {
+    if (!rt_prefix6_match(x, n->prefix, n->len)) {
+      return n->miss;
+    }
+    if (n->stride == 0) {
+      return n->value;
+    }
+    e = c->slot[n->base + rt_bits6(x, n->len, n->stride)];
+    if (e & RT_COMPACT_LEAF) {
+      return c->leaf[e & ~RT_COMPACT_LEAF];
+    }
+    n = &c->node[e];
+  }
+}
+
+struct rt6_compact_builder {
+  const struct radix_trie_node6 *pn;     /* the PATRICIA trie */
+  struct radix_trie_compact6 *c;
+  unsigned int node_size, slot_size, leaf_size;
+};
+
+/* rt6_grow(array, num, size, elt, n) makes room for n more elements */
+static int rt6_grow(void **array, unsigned int num, unsigned int *size, size_t elt, unsigned int n) {
+  if (num + n > *size) {
+    unsigned int new_size = *size ? *size : 256;
+    void *tmp;
+
+    while (new_size < num + n) {
+      new_size *= 2;
+    }
+    tmp = realloc(*array, new_size * elt);
+    if (tmp == NULL) {
+      return -1;
+    }
+    *array = tmp;
+    *size = new_size;
+  }
+  return num;
+}
+
+/*
+ * rt6_count(pn, u, L, count) adds to count[k] the number of subtrees
+ * below u that would be reached through the slots of a node with
+ * prefix length L and stride k, for each k
+ */
+static void rt6_count(const struct radix_trie_node6 *pn, uint32_t u, unsigned int L, unsigned int *count) {
+  unsigned int b, k;
+
+  for (b=0; b<2; b++) {
+    uint32_t c = pn[u].child[b];
+
+    if (c == 0) {
+      continue;
+    }
+    for (k = pn[u].len - L + 1; k <= pn[c].len - L && k <= RT6_MAX_STRIDE; k++) {
+      count[k]++;
+    }
+    if (pn[c].len - L < RT6_MAX_STRIDE) {
+      rt6_count(pn, c, L, count);
+    }
+  }
+}
+
+/*
+ * rt6_fill(pn, u, L, k, value, target) sets value[j] to the flags of
+ * the deepest node below u whose prefix covers slot j, and target[j]
+ * to the node at or below the end of the stride in that slot, if any
+ */
+static void rt6_fill(const struct radix_trie_node6 *pn, uint32_t u, unsigned int L, unsigned int k, 
+		     attr_flags *value, uint32_t *target) {
+  unsigned int b, i;
+
+  for (b=0; b<2; b++) {
+    uint32_t c = pn[u].child[b];
+
+    if (c == 0) {
+      continue;
+    }
+    if (pn[c].len >= L + k) {
+      target[rt_bits6(pn[c].prefix, L, k)] = c;
+    } else {
+      unsigned int start = rt_bits6(pn[c].prefix, L, k);
+
+      for (i=0; i < (1u << (L + k - pn[c].len)); i++) {
+	value[start + i] = pn[c].value;
+      }
+      rt6_fill(pn, c, L, k, value, target);
+    }
+  }
+}
+
+static int rt6_compact_leaf(struct rt6_compact_builder *b, attr_flags value) {
+  struct radix_trie_compact6 *c = b->c;
+
+  if (c->num_leaves && c->leaf[c->num_leaves - 1] == value) {
+    return c->num_leaves - 1;
+  }
+  if (rt6_grow((void **)&c->leaf, c->num_leaves, &b->leaf_size, sizeof(attr_flags), 1) < 0) {
+    return -1;
+  }
+  c->leaf[c->num_leaves] = value;
+  return c->num_leaves++;
+}
+
+/*
+ * rt6_compact_build(b, u, miss) builds the compact node for the node
+ * u of the PATRICIA trie, and the nodes below it, and returns its
+ * index, or -1 on failure
+ */
+static int rt6_compact_build(struct rt6_compact_builder *b, uint32_t u, attr_flags miss) {
+  const struct radix_trie_node6 *pn = b->pn;
+  struct radix_trie_compact6 *c = b->c;
+  unsigned int count[RT6_MAX_STRIDE + 1] = { 0, };
+  attr_flags value[1 << RT6_MAX_STRIDE];
+  uint32_t target[1 << RT6_MAX_STRIDE];
+  unsigned int L = pn[u].len, k, stride = 0, j;
+  int x, base;
+
+  if ((x = rt6_grow((void **)&c->node, c->num_nodes, &b->node_size, 
+		    sizeof(struct radix_trie_compact6_node), 1)) < 0) {
+    return -1;
+  }
+  c->num_nodes++;
+  c->node[x].prefix[0] = pn[u].prefix[0];
+  c->node[x].prefix[1] = pn[u].prefix[1];
+  c->node[x].len = L;
+  c->node[x].value = pn[u].value;
+  c->node[x].miss = miss;
+  c->node[x].stride = 0;
+  c->node[x].base = 0;
+  if (pn[u].child[0] == 0 && pn[u].child[1] == 0) {
+    return x;
+  }
+
+  rt6_count(pn, u, L, count);
+  for (k=1; k <= RT6_MAX_STRIDE && L + k <= 128; k++) {
+    if (2 * count[k] >= (1u << k) || k == 1) {
+      stride = k;
+    }
+  }
+  for (j=0; j < (1u << stride); j++) {
+    value[j] = pn[u].value;
+    target[j] = 0;
+  }
+  rt6_fill(pn, u, L, stride, value, target);
+
+  if ((base = rt6_grow((void **)&c->slot, c->num_slots, &b->slot_size, sizeof(uint32_t), 1 << stride)) < 0) {
+    return -1;
+  }
+  c->num_slots += 1 << stride;
+  c->node[x].stride = stride;
+  c->node[x].base = base;
+  for (j=0; j < (1u << stride); j++) {
+    int e = target[j] ? rt6_compact_build(b, target[j], value[j]) : rt6_compact_leaf(b, value[j]);
+
+    if (e < 0) {
+      return -1;
+    }
+    c->slot[base + j] = target[j] ? (uint32_t)e : (RT_COMPACT_LEAF | e);
+  }
+  return x;
+}
+
+attr_flags radix_trie_lookup_addr6(const struct radix_trie *trie, const struct in6_addr *addr) {
+  const struct radix_trie_node6 *node6 = trie->node6;
+  const struct radix_trie_node6 *n;
+  attr_flags value = 0;
+  uint64_t x[2];
+  uint32_t i = 0;
+
+  rt_addr6_load(x, addr);
+  if (trie->compact6) {
+    return radix_trie_compact6_lookup(trie->compact6, x);
+  }
+  if (node6 == NULL) {
+    return 0;
+  }
+  do {
+    n = &node6[i];
+    if (!rt_prefix6_match(x, n->prefix, n->len)) {
+      break;
+    }
+    value = n->value;
+    if (n->len == 128) {
+      break;
+    }
+    i = n->child[rt_bit6(x, n->len)];
+  } while (i != 0);
+
+  return value;
+}
+
+/*
+ * rt_compact6(trie) replaces the PATRICIA trie of IPv6 subnets with
+ * its compact form
+ */
+static enum status rt_compact6(struct radix_trie *trie) {
+  struct rt6_compact_builder b;
+  struct radix_trie_compact6 *c;
+
+  c = calloc(1, sizeof(struct radix_trie_compact6));
+  if (c == NULL) {
+    return failure;
+  }
+  b.pn = trie->node6;
+  b.c = c;
+  b.node_size = b.slot_size = b.leaf_size = 0;
+  if (rt6_compact_build(&b, 0, 0) < 0) {
+    free(c->node);
+    free(c->slot);
+    free(c->leaf);
+    free(c);
+    return failure;
+  }
+
+  /* trim the arrays, and account for them */
+  c->node = realloc(c->node, c->num_nodes * sizeof(struct radix_trie_compact6_node));
+  if (c->num_slots) {
+    c->slot = realloc(c->slot, c->num_slots * sizeof(uint32_t));
+  }
+  c->leaf = realloc(c->leaf, (c->num_leaves ? c->num_leaves : 1) * sizeof(attr_flags));
+  rt_mem_usage += sizeof(struct radix_trie_compact6) 
+    + c->num_nodes * sizeof(struct radix_trie_compact6_node)
+    + c->num_slots * sizeof(uint32_t) + c->num_leaves * sizeof(attr_flags);
+
+  rt_mem_usage -= trie->size6 * sizeof(struct radix_trie_node6);
+  free(trie->node6);
+  trie->node6 = NULL;
+  trie->num_nodes6 = trie->size6 = 0;
+  trie->compact6 = c;
+
+  return ok;
+}
+
+enum status radix_trie_compact(struct radix_trie *trie) {
+  struct radix_trie_compact_builder b;
+  struct radix_trie_compact *c;
+  unsigned int d;
+  attr_flags last = 0;
+  int x, last_leaf = -1;
+
+  if (trie == NULL || trie->root == NULL || trie->compact != NULL) {
+    return failure;
+  }
+  c = rt_malloc(sizeof(struct radix_trie_compact));
+  if (c == NULL) {
+    return failure;
+  }
+  memset(c, 0, sizeof(struct radix_trie_compact));
+  b.c = c;
+  b.node_size = b.leaf_size = 0;
+
+  for (d=0; d < (1 << RT_COMPACT_DIRECT_BITS); d++) {
+    const struct radix_trie_node *e = trie->root->table[d >> 8];
+
+    if (e && e->type == internal) {
+      e = e->table[d & 0xff];
+    }
+    if (e && e->type == internal) {
+      if ((x = rt_compact_add_nodes(&b, 1)) < 0 || rt_compact_node_build(&b, e, x) != ok) {
+	goto fail;
+      }
+      c->direct[d] = x;
+    } else {
+      if (last_leaf < 0 || rt_leaf_value(e) != last) {
+	last = rt_leaf_value(e);
+	if ((last_leaf = rt_compact_add_leaf(&b, last)) < 0) {
+	  goto fail;
+	}
+      }
+      c->direct[d] = RT_COMPACT_LEAF | last_leaf;
+    }
+  }
+
+  /* trim the arrays, and account for them */
+  if (c->num_nodes) {
+    c->node = realloc(c->node, c->num_nodes * sizeof(struct radix_trie_compact_node));
+  }
+  c->leaf = realloc(c->leaf, c->num_leaves * sizeof(attr_flags));
+  rt_mem_usage += c->num_nodes * sizeof(struct radix_trie_compact_node) 
+    + c->num_leaves * sizeof(attr_flags);
+
+  radix_trie_node_free(trie->root);
+  trie->root = NULL;
+  trie->compact = c;
+
+  if (trie->node6 && rt_compact6(trie) != ok) {
+    return failure;   /* the IPv4 trie is compact, and the IPv6 trie is as it was */
+  }
+
+  return ok;
+
+ fail:
+  free(c->node);
+  free(c->leaf);
+  free(c);
+  rt_mem_usage -= sizeof(struct radix_trie_compact);
+  return failure;
+}
+
 unsigned int index_to_flag(unsigned int x) {
   unsigned int flag;
 
@@ -380,16 +1224,55 @@ void attr_flags_json_print_labels(const struct radix_trie *rt, attr_flags f, cha
 
 enum status radix_trie_init(struct radix_trie *rt) {
   rt->root = radix_trie_node_init();
+  rt->compact = NULL;
+  rt->node6 = NULL;
+  rt->num_nodes6 = rt->size6 = 0;
+  rt->compact6 = NULL;
   rt->num_flags = 0;
   memset(rt->flag, 0, sizeof(rt->flag));
   return ok;
 }
 
 
+void radix_trie_free(struct radix_trie *rt) {
+  unsigned int i;
+
+  if (rt == NULL) {
+    return;
+  }
+  radix_trie_node_free(rt->root);
+  if (rt->compact) {
+    rt_mem_usage -= sizeof(struct radix_trie_compact) 
+      + rt->compact->num_nodes * sizeof(struct radix_trie_compact_node) 
+      + rt->compact->num_leaves * sizeof(attr_flags);
+    free(rt->compact->node);
+    free(rt->compact->leaf);
+    free(rt->compact);
+  }
+  rt_mem_usage -= rt->size6 * sizeof(struct radix_trie_node6);
+  free(rt->node6);
+  if (rt->compact6) {
+    rt_mem_usage -= sizeof(struct radix_trie_compact6) 
+      + rt->compact6->num_nodes * sizeof(struct radix_trie_compact6_node)
+      + rt->compact6->num_slots * sizeof(uint32_t) 
+      + rt->compact6->num_leaves * sizeof(attr_flags);
+    free(rt->compact6->node);
+    free(rt->compact6->slot);
+    free(rt->compact6->leaf);
+    free(rt->compact6);
+  }
+  for (i=0; i < rt->num_flags; i++) {
+    free(rt->flag[i]);
+  }
+  rt_mem_usage -= sizeof(struct radix_trie);
+  free(rt);
+}
+
 enum status radix_trie_add_subnet_from_string(struct radix_trie *rt, char *addr, attr_flags attr, FILE *loginfo) {
-  int i, masklen = 0;
+  int i, masklen = 0, maxlen;
   char *mask = NULL;
   struct in_addr a;
+  struct in6_addr a6;
 
   debug_printf("adding subnet %s\n", addr);
   for (i=0; i<80; i++) {
@@ -404,6 +1287,7 @@ enum status radix_trie_add_subnet_from_string(struct radix_trie *rt, char *addr,
     }
   }
   debug_printf("address: %s\n", addr);
+  maxlen = strchr(addr, ':') ? 128 : 32;
   if (mask) {
 
     /* avoid confusing atoi() with nondigit characters */
@@ -417,14 +1301,22 @@ enum status radix_trie_add_subnet_from_string(struct radix_trie *rt, char *addr,
       }
     }    
     masklen = atoi(mask);
-    if (masklen < 1 || masklen > 32) {
+    if (masklen < 1 || masklen > maxlen) {
       fprintf(loginfo, "error: cannot parse subnet; netmask is %d bits\n", masklen);
       return failure;
     }
     debug_printf("masklen: %d\n", masklen);
         
   } else {
-    masklen = 32;   /* no netmask, so match entire address */
+    masklen = maxlen;   /* no netmask, so match entire address */
+  }
+
+  if (maxlen == 128) {
+    if (inet_pton(AF_INET6, addr, &a6) != 1) {
+      fprintf(loginfo, "error: cannot parse IPv6 address %s\n", addr);
+      return failure;
+    }
+    return radix_trie_add_subnet6(rt, &a6, masklen, attr);
   }
   
   inet_aton(addr, &a);
@@ -540,6 +1432,328 @@ void radix_trie_print(const struct radix_trie *rt) {
   radix_trie_node_print(rt, rt->root, "");
 }
 
+/*
+ * radix_trie_compact_unit_test() checks that a compacted radix_trie
+ * gives the same results as the original one, for a large set of
+ * subnets resembling an address management export, and compares
+ * their memory use and lookup times
+ */
+#define RT_TEST_SUBNETS 50000
+#define RT_TEST_LOOKUPS 1000000
+
+static uint32_t rt_test_addr() {
+  static const uint32_t base[4] = { 0x0a000000, 0xac100000, 0xc0a80000, 0x40660000 };
+  static const uint32_t mask[4] = { 0x00ffffff, 0x000fffff, 0x0000ffff, 0x0003ffff };
+  unsigned int i = rand() & 3;
+
+  return base[i] | ((uint32_t)rand() & mask[i]);
+}
+
+int radix_trie_compact_unit_test() {
+  struct radix_trie *rt;
+  attr_flags label[4], *expected;
+  uint32_t *addr;
+  unsigned int i, mem, mem_before = get_rt_mem_usage(), sum, test_failed = 0;
+  struct timeval start;
+  double t;
+
+  expected = malloc(RT_TEST_LOOKUPS * sizeof(attr_flags));
+  addr = malloc(RT_TEST_LOOKUPS * sizeof(uint32_t));
+  rt = radix_trie_alloc();
+  if (rt == NULL || radix_trie_init(rt) != ok || expected == NULL || addr == NULL) {
+    fprintf(stdout, "error: could not initialize compact radix_trie test\n");
+    free(expected);
+    free(addr);
+    radix_trie_free(rt);
+    return 1;
+  }
+  label[0] = radix_trie_add_attr_label(rt, "site");
+  label[1] = radix_trie_add_attr_label(rt, "dmz");
+  label[2] = radix_trie_add_attr_label(rt, "lab");
+  label[3] = radix_trie_add_attr_label(rt, "guest");
+
+  srand(0x5eed);
+  mem = get_rt_mem_usage();
+  for (i=0; i<RT_TEST_SUBNETS; i++) {
+    unsigned int r = rand() % 100;
+    unsigned int len = r < 60 ? 24 : r < 80 ? 16 + rand() % 8 : r < 95 ? 25 + rand() % 6 : 32;
+
+    if (radix_trie_add_subnet(rt, hex2addr(ntohl(addr_mask(htonl(rt_test_addr()), len))), len, label[rand() & 3]) != ok) {
+      fprintf(stdout, "error: could not add subnet %u\n", i);
+      test_failed = 1;
+    }
+  }
+  mem = get_rt_mem_usage() - mem;
+  for (i=0; i<RT_TEST_LOOKUPS; i++) {
+    addr[i] = htonl(rt_test_addr());
+  }
+
+  sum = 0;
+  gettimeofday(&start, NULL);
+  for (i=0; i<RT_TEST_LOOKUPS; i++) {
+    struct in_addr a;
+
+    a.s_addr = addr[i];
+    sum += (expected[i] = radix_trie_lookup_addr(rt, a));
+  }
+  t = time_diff(&start);
+  printf("radix_trie, %u subnets:   %10u bytes, %6.1f ns/lookup\n", RT_TEST_SUBNETS, mem, t * 1e9 / RT_TEST_LOOKUPS);
+
+  if (radix_trie_compact(rt) != ok) {
+    fprintf(stdout, "error: could not compact radix_trie\n");
+    free(expected);
+    free(addr);
+    radix_trie_free(rt);
+    return 1;
+  }
+  mem = sizeof(struct radix_trie_compact) + rt->compact->num_nodes * sizeof(struct radix_trie_compact_node)
+    + rt->compact->num_leaves * sizeof(attr_flags);
+
+  gettimeofday(&start, NULL);
+  for (i=0; i<RT_TEST_LOOKUPS; i++) {
+    struct in_addr a;
+
+    a.s_addr = addr[i];
+    sum -= radix_trie_lookup_addr(rt, a);
+  }
+  t = time_diff(&start);
+  printf("compact radix_trie:         %10u bytes, %6.1f ns/lookup (%u nodes, %u leaves)\n", 
+	 mem, t * 1e9 / RT_TEST_LOOKUPS, rt->compact->num_nodes, rt->compact->num_leaves);
+
+  for (i=0; i<RT_TEST_LOOKUPS; i++) {
+    struct in_addr a;
+
+    a.s_addr = addr[i];
+    if (radix_trie_lookup_addr(rt, a) != expected[i]) {
+      fprintf(stdout, "error: compact lookup of %s returned %x, expected %x\n", 
+	      inet_ntoa(a), radix_trie_lookup_addr(rt, a), expected[i]);
+      test_failed = 1;
+      break;
+    }
+  }
+  if (sum != 0) {
+    test_failed = 1;
+  }
+  if (radix_trie_add_subnet(rt, hex2addr(0x0a000000), 8, label[0]) == ok) {
+    fprintf(stdout, "error: subnet added to compact radix_trie\n");
+    test_failed = 1;
+  }
+  free(expected);
+  free(addr);
+  radix_trie_free(rt);
+  if (get_rt_mem_usage() != mem_before) {
+    fprintf(stdout, "error: radix_trie memory use not restored after free\n");
+    test_failed = 1;
+  }
+
+  if (test_failed) {
+    printf("FAILURE; compact radix_trie test failed\n");
+  } else {
+    printf("all compact radix_trie tests passed\n");
+  }
+  return test_failed;
+}
+
+/*
+ * radix_trie_ipv6_unit_test() checks IPv6 lookups against a linear
+ * scan of the subnets, for a set of prefixes resembling an address
+ * plan (a few /32 allocations, carved into /48, /56, and /64
+ * subnets, with some host routes), checks that a file of mixed IPv4
+ * and IPv6 subnets is read, and measures memory use and lookup time
+ */
+#define RT6_TEST_SUBNETS 50000
+#define RT6_TEST_CHECKS  2000
+
+struct rt6_test_subnet {
+  struct in6_addr addr;
+  unsigned int len;
+  attr_flags flags;
+};
+
+static void rt6_test_addr(struct in6_addr *a) {
+  static const uint32_t base[4] = { 0x20010db8, 0x2a0204a0, 0x26001f00, 0xfd3c5a11 };
+  unsigned int i;
+
+  for (i=0; i<16; i++) {
+    a->s6_addr[i] = rand();
+  }
+  i = rand() & 3;
+  a->s6_addr[0] = base[i] >> 24;
+  a->s6_addr[1] = base[i] >> 16;
+  a->s6_addr[2] = base[i] >> 8;
+  a->s6_addr[3] = base[i];
+  a->s6_addr[4] &= 0x0f;      /* /36 of each allocation in use */
+}
+
+static void rt6_addr_mask(struct in6_addr *a, unsigned int len) {
+  unsigned int i;
+
+  for (i=0; i<16; i++) {
+    if (len >= 8) {
+      len -= 8;
+    } else {
+      a->s6_addr[i] &= 0xff << (8 - len);
+      len = 0;
+    }
+  }
+}
+
+static unsigned int rt6_prefix_match(const struct in6_addr *a, const struct in6_addr *p, unsigned int len) {
+  struct in6_addr tmp = *a;
+
+  rt6_addr_mask(&tmp, len);
+  return memcmp(&tmp, p, sizeof(tmp)) == 0;
+}
+
+int radix_trie_ipv6_unit_test() {
+  struct radix_trie *rt;
+  struct rt6_test_subnet *subnet;
+  struct in6_addr *addr, a;
+  attr_flags label[4], expected;
+  unsigned int i, j, mem, sum, nodes, pass, test_failed = 0;
+  struct timeval start;
+  double t;
+  char pathname[] = "/tmp/rt6_test_XXXXXX";
+  char addr_string[INET6_ADDRSTRLEN];
+  FILE *f;
+  int fd;
+
+  subnet = malloc(RT6_TEST_SUBNETS * sizeof(struct rt6_test_subnet));
+  addr = malloc(RT_TEST_LOOKUPS * sizeof(struct in6_addr));
+  rt = radix_trie_alloc();
+  if (subnet == NULL || addr == NULL || rt == NULL || radix_trie_init(rt) != ok) {
+    fprintf(stdout, "error: could not initialize IPv6 radix_trie test\n");
+    return 1;
+  }
+  label[0] = radix_trie_add_attr_label(rt, "site");
+  label[1] = radix_trie_add_attr_label(rt, "dmz");
+  label[2] = radix_trie_add_attr_label(rt, "lab");
+  label[3] = radix_trie_add_attr_label(rt, "guest");
+
+  srand(0x5eed6);
+  for (i=0; i<RT6_TEST_SUBNETS; i++) {
+    unsigned int r = rand() % 100;
+    unsigned int len = r < 10 ? 48 : r < 30 ? 56 : r < 90 ? 64 : 128;
+
+    rt6_test_addr(&subnet[i].addr);
+    rt6_addr_mask(&subnet[i].addr, len);
+    subnet[i].len = len;
+    subnet[i].flags = label[rand() & 3];
+    if (radix_trie_add_subnet6(rt, &subnet[i].addr, len, subnet[i].flags) != ok) {
+      fprintf(stdout, "error: could not add IPv6 subnet %u\n", i);
+      test_failed = 1;
+    }
+  }
+  if (radix_trie_add_subnet(rt, hex2addr(0x0a000000), 8, label[0]) != ok) {
+    fprintf(stdout, "error: could not add IPv4 subnet to IPv6 radix_trie\n");
+    test_failed = 1;
+  }
+
+  /* half of the lookups are for addresses inside of the subnets */
+  for (i=0; i<RT_TEST_LOOKUPS; i++) {
+    rt6_test_addr(&addr[i]);
+    if (i & 1) {
+      const struct rt6_test_subnet *n = &subnet[rand() % RT6_TEST_SUBNETS];
+
+      for (j=0; j<n->len/8; j++) {
+	addr[i].s6_addr[j] = n->addr.s6_addr[j];
+      }
+    }
+  }
+  /* the first pass uses the PATRICIA trie, and the second its compact form */
+  for (pass=0; pass<2; pass++) {
+    if (pass == 1 && radix_trie_compact(rt) != ok) {
+      fprintf(stdout, "error: could not compact IPv6 radix_trie\n");
+      test_failed = 1;
+      break;
+    }
+    if (rt->compact6) {
+      nodes = rt->compact6->num_nodes;
+      mem = nodes * sizeof(struct radix_trie_compact6_node) 
+	+ (rt->compact6->num_slots + rt->compact6->num_leaves) * sizeof(uint32_t);
+    } else {
+      nodes = rt->num_nodes6;
+      mem = rt->size6 * sizeof(struct radix_trie_node6);
+    }
+    for (i=0; i<RT6_TEST_CHECKS; i++) {
+      expected = 0;
+      for (j=0; j<RT6_TEST_SUBNETS; j++) {
+	if (rt6_prefix_match(&addr[i], &subnet[j].addr, subnet[j].len)) {
+	  expected |= subnet[j].flags;
+	}
+      }
+      if (radix_trie_lookup_addr6(rt, &addr[i]) != expected) {
+	fprintf(stdout, "error: IPv6 lookup of %s returned %x, expected %x\n", 
+		inet_ntop(AF_INET6, &addr[i], addr_string, sizeof(addr_string)), 
+		radix_trie_lookup_addr6(rt, &addr[i]), expected);
+	test_failed = 1;
+	break;
+      }
+    }
+
+    sum = 0;
+    gettimeofday(&start, NULL);
+    for (i=0; i<RT_TEST_LOOKUPS; i++) {
+      sum += radix_trie_lookup_addr6(rt, &addr[i]) != 0;
+    }
+    t = time_diff(&start);
+    printf("%-18s %u IPv6 subnets: %8u bytes, %6.1f ns/lookup (%u nodes, %u%% matched)\n", 
+	   pass ? "compact radix_trie," : "radix_trie,", RT6_TEST_SUBNETS, mem, 
+	   t * 1e9 / RT_TEST_LOOKUPS, nodes, sum * 100 / RT_TEST_LOOKUPS);
+  }
+  radix_trie_free(rt);
+
+  /* a file can mix IPv4 and IPv6 subnets */
+  fd = mkstemp(pathname);
+  if (fd < 0 || (f = fdopen(fd, "w")) == NULL) {
+    fprintf(stdout, "error: could not create subnet file\n");
+    test_failed = 1;
+  } else {
+    fprintf(f, "# mixed subnets\n10.0.0.0/8\n2001:db8::/32\n2001:db8:0:1::/64\n192.168.1.1\n::1\n");
+    fclose(f);
+    rt = radix_trie_alloc();
+    if (rt == NULL || radix_trie_init(rt) != ok) {
+      return 1;
+    }
+    label[0] = radix_trie_add_attr_label(rt, "internal");
+    if (radix_trie_add_subnets_from_file(rt, pathname, label[0], stdout) != ok) {
+      fprintf(stdout, "error: could not read mixed subnet file\n");
+      test_failed = 1;
+    }
+    inet_pton(AF_INET6, "2001:db8:0:1::5", &a);
+    if (radix_trie_lookup_addr6(rt, &a) != label[0]) {
+      test_failed = 1;
+    }
+    inet_pton(AF_INET6, "::1", &a);
+    if (radix_trie_lookup_addr6(rt, &a) != label[0]) {
+      test_failed = 1;
+    }
+    inet_pton(AF_INET6, "2001:db9::1", &a);
+    if (radix_trie_lookup_addr6(rt, &a) != 0) {
+      test_failed = 1;
+    }
+    if (radix_trie_lookup_addr(rt, hex2addr(0x0a010203)) != label[0]
+	|| radix_trie_lookup_addr(rt, hex2addr(0xc0a80101)) != label[0]
+	|| radix_trie_lookup_addr(rt, hex2addr(0xc0a80102)) != 0) {
+      test_failed = 1;
+    }
+    if (test_failed) {
+      fprintf(stdout, "error: lookup in mixed subnet file failed\n");
+    }
+    radix_trie_free(rt);
+    unlink(pathname);
+  }
+  free(subnet);
+  free(addr);
+
+  if (test_failed) {
+    printf("FAILURE; IPv6 radix_trie test failed\n");
+  } else {
+    printf("all IPv6 radix_trie tests passed\n");
+  }
+  return test_failed;
+}
+
 int radix_trie_high_level_unit_test() {
   struct radix_trie rt;
   attr_flags flag_internal, flag_malware, flag;
@@ -723,6 +1937,40 @@ int radix_trie_unit_test() {
     }
   }
 
+  printf("testing covering subnets, added in either order\n");
+  {
+    struct { unsigned int addr, len, flags; } subnet[] = {
+      { 0x0a010000, 16, 0x1 },   /* 10.1.0.0/16 then 10.0.0.0/8 */
+      { 0x0a000000,  8, 0x2 },
+      { 0x14000000,  8, 0x4 },   /* 20.0.0.0/8 then 20.1.0.0/16 */
+      { 0x14010000, 16, 0x8 },
+      { 0x14010200, 24, 0x10 }   /* and 20.1.2.0/24 */
+    };
+    struct { unsigned int addr, flags; } lookup[] = {
+      { 0x0a010203, 0x3 },
+      { 0x0a020304, 0x2 },
+      { 0x14010203, 0x1c },
+      { 0x14010303, 0xc },
+      { 0x14020304, 0x4 },
+      { 0x15010203, 0x0 }
+    };
+
+    for (i=0; i<sizeof(subnet)/sizeof(subnet[0]); i++) {
+      if (radix_trie_add_subnet(&rt, hex2addr(subnet[i].addr), subnet[i].len, subnet[i].flags) != ok) {
+	fprintf(stdout, "error: could not add subnet %x/%u\n", subnet[i].addr, subnet[i].len);
+	test_failed = 1;
+      }
+    }
+    for (i=0; i<sizeof(lookup)/sizeof(lookup[0]); i++) {
+      flag = radix_trie_lookup_addr(&rt, hex2addr(lookup[i].addr));
+      if (flag != lookup[i].flags) {
+	fprintf(stdout, "error: lookup of %x returned %x, expected %x\n", 
+		lookup[i].addr, flag, lookup[i].flags);
+	test_failed = 1;
+      }
+    }
+  }
+
   if (test_failed) {
     printf("FAILURE; at least one test failed\n");
   } else {
@@ -818,6 +2066,14 @@ int radix_trie_unit_test() {
     test_failed = 1;
   }
 
+  if (radix_trie_compact_unit_test() != 0) {
+    test_failed = 1;
+  }
+
+  if (radix_trie_ipv6_unit_test() != 0) {
+    test_failed = 1;
+  }
+
   return test_failed; /* 0 on success, 1 otherwise */
 }
 
@@ -39,9 +39,9 @@
  *
  * interface to radix_trie implementation for fast address lookup
  *
- * This implementation is designed to quickly search over addresses
- * (currently IPv4 only) and determine if an address matches one or
- * more subnets that have been inserted into the trie.  Each subnet is
+ * This implementation is designed to quickly search over IPv4 and
+ * IPv6 addresses and determine if an address matches one or more
+ * subnets that have been inserted into the trie.  Each subnet is
  * associated with a label, and there can be up to MAX_NUM_FLAGS
  * labels (as they are interally represented as bit flags).  
  *
@@ -84,11 +84,20 @@ radix_trie_t radix_trie_alloc();
 enum status radix_trie_init(struct radix_trie *rt);
 
 
+/*
+ * radix_trie_free(rt) frees the radix_trie rt, which must have been
+ * allocated with radix_trie_alloc(), along with all of its nodes and
+ * labels
+ */
+void radix_trie_free(struct radix_trie *rt);
+
+
 /*
  * radix_trie_add_subnets_from_file(rt, f, attr, logfile) reads the
  * file f, parsing each line to find subnet (address/netmask), then
  * adds each subnet to the radix_trie, associating it with the flag
- * attr, and writing errors to logfile
+ * attr, and writing errors to logfile; IPv4 and IPv6 subnets can be
+ * mixed in the file
  */
 enum status radix_trie_add_subnets_from_file(struct radix_trie *rt,
 					     const char *pathname, 
@@ -106,6 +115,24 @@ enum status radix_trie_add_subnet(struct radix_trie *trie,
 				  unsigned int netmasklen, 
 				  attr_flags flags);
 
+/*
+ * radix_trie_add_subnet6(rt, addr, len, flags) is the IPv6
+ * counterpart of radix_trie_add_subnet(), for netmasks of up to 128
+ * bits
+ */
+enum status radix_trie_add_subnet6(struct radix_trie *trie, 
+				   const struct in6_addr *addr, 
+				   unsigned int netmasklen, 
+				   attr_flags flags);
+
+/*
+ * radix_trie_compact(rt) replaces the nodes of the radix_trie rt with
+ * a compact form that gives the same results for
+ * radix_trie_lookup_addr(), but that is faster and uses much less
+ * memory.  No subnets can be added to rt after it has been compacted.
+ */
+enum status radix_trie_compact(struct radix_trie *rt);
+
 /*
  * attr_flags_json_print_labels(rt, f, prefix, file) writes a
  * json-encoded form of the labels associated with the flags in f
@@ -137,6 +164,24 @@ unsigned int get_rt_mem_usage();
 unsigned int radix_trie_lookup_addr(struct radix_trie *trie, struct in_addr addr);
 
 
+/*
+ * radix_trie_lookup_addr6(rt, addr) is the IPv6 counterpart of
+ * radix_trie_lookup_addr()
+ */
+attr_flags radix_trie_lookup_addr6(const struct radix_trie *trie, const struct in6_addr *addr);
+
+
+/*
+ * radix_trie_lookup_addr_batch(rt, addr, flags, n) sets flags[i] to
+ * radix_trie_lookup_addr(rt, addr[i]), for i = 0..n-1; it is faster
+ * than looking up the addresses one at a time, since it prefetches
+ * the memory needed for several lookups at once
+ */
+void radix_trie_lookup_addr_batch(struct radix_trie *trie, 
+				  const struct in_addr *addr, 
+				  attr_flags *flags, 
+				  unsigned int n);
+
 
 /*
  * radix_trie_add_attr(rt, label) adds a labeled flag with the name
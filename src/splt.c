@@ -0,0 +1,250 @@
+/*
+ *	
+ * Copyright (c) 2016 Cisco Systems, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * splt.c
+ *
+ * compact encoding of sequences of packet lengths and times (SPLT)
+ */
+
+#include <stdio.h>     /* for fprintf()  */
+#include <stdlib.h>    /* for rand()     */
+#include "splt.h"
+#include "huffman.h"
+#include "err.h"
+
+#define SPLT_LEN_CLASSES   17       /* bit lengths 0 through 16   */
+#define SPLT_LEN_REPEAT    17       /* same as last in direction  */
+#define SPLT_LEN_SYMBOLS   (2 * 18)
+#define SPLT_IPT_SYMBOLS   33       /* bit lengths 0 through 32   */
+
+/*
+ * codeword lengths, generated with the huffman program from the
+ * symbol histograms of sample.pcap (bidir=1)
+ */
+static const unsigned char splt_len_code_len[SPLT_LEN_SYMBOLS] = {
+  7, 7, 7, 7, 7, 6, 6, 5, 3, 4, 4, 5, 7, 7, 7, 7, 7, 4,   /* out */
+  7, 7, 7, 7, 7, 4, 4, 7, 7, 3, 7, 7, 7, 6, 6, 6, 6, 3    /* in  */
+};
+
+static const unsigned char splt_ipt_code_len[SPLT_IPT_SYMBOLS] = {
+  2, 7, 6, 7, 6, 4, 4, 4, 3, 6, 5, 6, 6, 6, 6, 6, 6, 
+  6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6
+};
+
+static struct huffman_code splt_len_code, splt_ipt_code;
+
+static unsigned int splt_codes_ready = 0;
+
+static void splt_codes_init() {
+
+  if (!splt_codes_ready) {
+    huffman_code_init_from_lengths(&splt_len_code, splt_len_code_len, SPLT_LEN_SYMBOLS);
+    huffman_code_init_from_lengths(&splt_ipt_code, splt_ipt_code_len, SPLT_IPT_SYMBOLS);
+    splt_codes_ready = 1;
+  }
+}
+
+static inline unsigned int bit_length(uint32_t x) {
+  return x ? 32 - __builtin_clz(x) : 0;
+}
+
+/*
+ * a value with bit length k >= 2 is sent as the k-1 bits below its
+ * (implicit) leading one bit
+ */
+static int splt_put_value(struct bit_buffer *b, const struct huffman_code *c, unsigned int symbol_base, uint32_t x) {
+  unsigned int k = bit_length(x);
+
+  if (huffman_encode(b, c, symbol_base + k) != ok) {
+    return failure;
+  }
+  if (k >= 2) {
+    return bit_buffer_put(b, x & ~(1U << (k-1)), k-1);
+  }
+  return ok;
+}
+
+static int splt_get_value(struct bit_buffer *b, unsigned int k, uint32_t *x) {
+  uint32_t bits;
+
+  if (k < 2) {
+    *x = k;
+    return ok;
+  }
+  if (bit_buffer_get(b, k-1, &bits) != ok) {
+    return failure;
+  }
+  *x = (1U << (k-1)) | bits;
+  return ok;
+}
+
+unsigned int splt_encode(unsigned char *buf, unsigned int size, const struct splt_entry *e, unsigned int n) {
+  struct bit_buffer b;
+  int last_len[2] = { -1, -1 };
+  unsigned int i, x;
+
+  splt_codes_init();
+  bit_buffer_init(&b, buf, size);
+
+  /* number of entries, as a varint */
+  x = n;
+  do {
+    if (bit_buffer_put(&b, (x > 0x7f ? 0x80 : 0) | (x & 0x7f), 8) != ok) {
+      return 0;
+    }
+    x >>= 7;
+  } while (x);
+
+  for (i=0; i<n; i++) {
+    unsigned int dir = e[i].dir ? SPLT_DIR_IN : SPLT_DIR_OUT;
+
+    if (last_len[dir] == e[i].len) {
+      if (huffman_encode(&b, &splt_len_code, 18*dir + SPLT_LEN_REPEAT) != ok) {
+	return 0;
+      }
+    } else if (splt_put_value(&b, &splt_len_code, 18*dir, e[i].len) != ok) {
+      return 0;
+    }
+    last_len[dir] = e[i].len;
+    if (splt_put_value(&b, &splt_ipt_code, 0, e[i].ipt) != ok) {
+      return 0;
+    }
+  }
+
+  return bit_buffer_get_num_octets(&b);
+}
+
+int splt_decode(const unsigned char *buf, unsigned int len, struct splt_entry *e, unsigned int max) {
+  struct bit_buffer b;
+  int last_len[2] = { -1, -1 };
+  unsigned int i, n = 0, shift = 0;
+  uint32_t octet, x;
+  int symbol;
+
+  splt_codes_init();
+  bit_buffer_init(&b, (void *)buf, len);
+
+  do {
+    if (shift > 28 || bit_buffer_get(&b, 8, &octet) != ok) {
+      return -1;
+    }
+    n |= (octet & 0x7f) << shift;
+    shift += 7;
+  } while (octet & 0x80);
+
+  if (n > max) {
+    return -1;
+  }
+  for (i=0; i<n; i++) {
+    symbol = huffman_decode(&b, &splt_len_code);
+    if (symbol < 0) {
+      return -1;
+    }
+    e[i].dir = symbol / 18;
+    if (symbol % 18 == SPLT_LEN_REPEAT) {
+      if (last_len[e[i].dir] < 0) {
+	return -1;
+      }
+      e[i].len = last_len[e[i].dir];
+    } else {
+      if (splt_get_value(&b, symbol % 18, &x) != ok) {
+	return -1;
+      }
+      e[i].len = x;
+    }
+    last_len[e[i].dir] = e[i].len;
+
+    symbol = huffman_decode(&b, &splt_ipt_code);
+    if (symbol < 0 || splt_get_value(&b, symbol, &x) != ok) {
+      return -1;
+    }
+    e[i].ipt = x;
+  }
+
+  return n;
+}
+
+int splt_unit_test() {
+  struct splt_entry e[400], d[400];
+  unsigned char buf[SPLT_MAX_ENCODED_LEN(400)];
+  unsigned int i, n, len, trial;
+  int num_fails = 0;
+
+  srand(0xbeef);
+  for (trial=0; trial<100; trial++) {
+    n = trial < 2 ? trial : rand() % 400;
+    for (i=0; i<n; i++) {
+      switch (rand() % 4) {
+      case 0:
+	e[i].len = 1448;  /* repeated lengths are common */
+	break;
+      case 1:
+	e[i].len = rand() % 1500;
+	break;
+      case 2:
+	e[i].len = 65536 - (rand() % 50 + 1);  /* run-length entries */
+	break;
+      default:
+	e[i].len = rand() & 0xffff;
+      }
+      e[i].dir = rand() % 2;
+      e[i].ipt = (rand() % 3) ? rand() % 100 : (uint32_t) rand() * 2 + (rand() & 1);
+    }
+    len = splt_encode(buf, sizeof(buf), e, n);
+    if (len == 0 || splt_decode(buf, len, d, 400) != (int) n) {
+      num_fails++;
+      continue;
+    }
+    for (i=0; i<n; i++) {
+      if (d[i].len != e[i].len || d[i].dir != e[i].dir || d[i].ipt != e[i].ipt) {
+	num_fails++;
+	break;
+      }
+    }
+  }
+
+  /* a truncated encoding is rejected */
+  len = splt_encode(buf, sizeof(buf), e, n);
+  if (n > 0 && splt_decode(buf, len / 2, d, 400) != -1) {
+    num_fails++;
+  }
+
+  if (num_fails) {
+    fprintf(info, "error: %d splt tests failed\n", num_fails);
+  }
+  return num_fails ? failure : ok;
+}
@@ -0,0 +1,95 @@
+/*
+ *	
+ * Copyright (c) 2016 Cisco Systems, Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ * 
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * splt.h
+ *
+ * compact encoding of sequences of packet lengths and times (SPLT)
+ */
+
+#ifndef SPLT_H
+#define SPLT_H
+
+/*
+ * a splt_entry is one element of the "non_norm_stats" array: the
+ * length of a packet (or its 16-bit run-length representation), its
+ * direction, and the time since the previous packet, in milliseconds
+ */
+struct splt_entry {
+  unsigned short len;
+  unsigned char dir;         /* SPLT_DIR_OUT or SPLT_DIR_IN */
+  unsigned int ipt;
+};
+
+#define SPLT_DIR_OUT 0       /* printed as "<" */
+#define SPLT_DIR_IN  1       /* printed as ">" */
+
+/*
+ * The encoding is a bit string, consisting of the number of entries
+ * as a varint (LEB128), then for each entry, a Huffman-coded length
+ * symbol followed by a Huffman-coded inter-packet time symbol.
+ *
+ * The length symbol is 18*dir + k, where k is either the bit length
+ * of the packet length (0 through 16), or 17, which means that the
+ * length is the same as that of the previous packet in the same
+ * direction.  The time symbol is the bit length k of the time (0
+ * through 32).  A symbol with bit length k >= 2 is followed by the
+ * k-1 low-order bits of the value, the top bit being implicit.
+ *
+ * The Huffman codes are static; their codeword lengths were trained
+ * from the histogram of symbols seen in sample.pcap, with each count
+ * incremented by one so that every symbol can be encoded.
+ */
+
+#define SPLT_MAX_ENCODED_LEN(n) (5 + 12 * (n))
+
+/*
+ * splt_encode(buf, size, e, n) writes the encoding of the n entries e
+ * into buf, and returns the number of octets written, or zero if
+ * size is too small
+ */
+unsigned int splt_encode(unsigned char *buf, unsigned int size, const struct splt_entry *e, unsigned int n);
+
+/*
+ * splt_decode(buf, len, e, max) decodes the len octets in buf into
+ * at most max entries e, and returns the number of entries, or -1 if
+ * buf is not a valid encoding
+ */
+int splt_decode(const unsigned char *buf, unsigned int len, struct splt_entry *e, unsigned int max);
+
+int splt_unit_test();
+
+#endif /* SPLT_H */
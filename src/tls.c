@@ -48,6 +48,13 @@
 #include <stdlib.h>
 #include <netinet/in.h>
 #include "tls.h"
+#include "err.h"      /* for ok, failure    */
+#include <openssl/evp.h>  /* for MD5          */
+
+/*
+ * external variables, defined in pcap2flow
+ */
+extern unsigned int report_tls_fp;
 
 /* initialize data associated with TLS */
 void tls_record_init(struct tls_information *r) {
@@ -57,6 +64,17 @@ void tls_record_init(struct tls_information *r) {
   r->tls_sid_len = 0;
   r->tls_v = 0;
   r->tls_client_key_length = 0;
+  r->tls_client_version = 0;
+  r->tls_fp_valid = 0;
+  r->tls_state = tls_state_none;
+  r->tls_skip = 0;
+  r->tls_buf = NULL;
+  r->tls_buf_size = 0;
+  r->tls_buf_len = 0;
+  r->tls_buf_prev = NULL;
+  r->tls_buf_next = NULL;
+  r->tls_seq = 0;
+  r->tls_seq_valid = 0;
 
   memset(r->tls_len, 0, sizeof(r->tls_len));
   memset(r->tls_time, 0, sizeof(r->tls_time));
@@ -67,9 +85,13 @@ void tls_record_init(struct tls_information *r) {
   memset(r->tls_random, 0, sizeof(r->tls_random));
 }
 
+static void tls_buf_release(struct tls_information *r);
+
 /* free data associated with TLS */
 void tls_record_delete(struct tls_information *r) {
   int i;
+
+  tls_buf_release(r);
   for (i=0; i<r->num_tls_extensions; i++) {
     if (r->tls_extensions[i].data) {
       free(r->tls_extensions[i].data);
@@ -77,6 +99,24 @@ void tls_record_delete(struct tls_information *r) {
   }
 }
 
+/* allocate and initialize TLS data; returns NULL if malloc fails */
+struct tls_information *tls_record_alloc() {
+  struct tls_information *r = malloc(sizeof(struct tls_information));
+
+  if (r != NULL) {
+    tls_record_init(r);
+  }
+  return r;
+}
+
+/* free TLS data allocated by tls_record_alloc(), if any */
+void tls_record_free(struct tls_information *r) {
+  if (r != NULL) {
+    tls_record_delete(r);
+    free(r);
+  }
+}
+
 
 unsigned short raw_to_unsigned_short(const void *x) {
   unsigned short int y;
@@ -141,7 +181,8 @@ void TLSClientHello_get_ciphersuites(const void *x, int len,
     return;  
   }
 
-  /* record the 32-byte Random field */
+  /* record the ProtocolVersion and the 32-byte Random field */
+  r->tls_client_version = raw_to_unsigned_short(y);
   memcpy(r->tls_random, y+2, 32); 
 
   y += 34;  /* skip over ProtocolVersion and Random */
@@ -185,11 +226,13 @@ void TLSClientHello_get_extensions(const void *x, int len,
 				     struct tls_information *r) {
   unsigned int session_id_len, compression_method_len;
   const unsigned char *y = x;
+  const unsigned char *end;
   unsigned short int cipher_suites_len, extensions_len;
   unsigned int i = 0;
 
 
   len -= 4; // get handshake message length
+  end = y + len;
   if ((y[0] != 3) || (y[1] > 3)) {
     return;  
   }
@@ -233,7 +276,10 @@ void TLSClientHello_get_extensions(const void *x, int len,
   len -= 2;
 
   i = 0;
-  while (len > 0) {
+  while (len > 0 && i < MAX_EXTENSIONS) {
+    if (y + 4 > end || y + 4 + raw_to_unsigned_short(y+2) > end) {
+      break;   /* error: extension runs past the end of the message */
+    }
     r->tls_extensions[i].type = raw_to_unsigned_short(y);
     r->tls_extensions[i].length = raw_to_unsigned_short(y+2);
     // should check if length is reasonable?
@@ -376,88 +422,773 @@ unsigned int packet_is_sslv2_hello(const void *data) {
   return tls_unknown;
 }
 
-struct tls_information *
-process_tls(const struct pcap_pkthdr *h, const void *start, int len, struct tls_information *r) {
-  const struct tls_header *tls;
-  unsigned int tls_len;
-  unsigned int levels = 0;
+/*
+ * packet_is_tls() returns nonzero if data starts with what looks like
+ * a TLS record header: a content type from change_cipher_spec to
+ * application_data, and a 3.x protocol version
+ */
+unsigned int packet_is_tls(const void *data, unsigned int len) {
+  const unsigned char *d = data;
 
-  /* currently skipping SSLv2 */
+  if (len < 5) {
+    return 0;
+  }
+  return (d[0] >= change_cipher_spec && d[0] <= application_data 
+	  && d[1] == 3 && d[2] <= 3);
+}
 
-  while (len > 0) {
-    tls = start;
-    tls_len = tls_header_get_length(tls);
-    if (tls->ContentType == application_data) {
-      levels++;
+/*
+ * TLS client fingerprints
+ *
+ * The fingerprint of a ClientHello is the MD5 hash of the string
+ * "version,ciphers,extensions,curves,point_formats", in which each
+ * field is a list of decimal numbers separated by '-': the version of
+ * the ClientHello, its ciphersuites and extension types in the order
+ * offered, the groups of its supported_groups (elliptic_curves)
+ * extension, and the formats of its ec_point_formats extension.
+ * GREASE values (RFC 8701) are left out, so that they do not make
+ * every fingerprint unique.  This is the fingerprint known as JA3.
+ */
 
-      /* sanity check version number */
-      if ((tls->ProtocolVersionMajor != 3) || (tls->ProtocolVersionMinor > 3)) {
-	return NULL;
-      }
-      r->tls_v = tls_version(&tls->ProtocolVersionMajor);
+#define TLS_EXT_SUPPORTED_GROUPS  10
+#define TLS_EXT_EC_POINT_FORMATS  11
 
-    } else if (tls->ContentType == handshake) {
-      if (tls->Handshake.HandshakeType == client_hello) {
-	
-	TLSClientHello_get_ciphersuites(&tls->Handshake.body, tls_len, r);
-	TLSClientHello_get_extensions(&tls->Handshake.body, tls_len, r);
+static unsigned int tls_is_grease(unsigned short x) {
+  return (x & 0x0f0f) == 0x0a0a && (x >> 8) == (x & 0xff);
+}
 
-      } else if (tls->Handshake.HandshakeType == server_hello) {
+static const struct tls_extension *tls_find_extension(const struct tls_information *r, unsigned short type) {
+  unsigned int i;
 
-	TLSServerHello_get_ciphersuite(&tls->Handshake.body, tls_len, r);
+  for (i=0; i<r->num_tls_extensions; i++) {
+    if (r->tls_extensions[i].type == type) {
+      return &r->tls_extensions[i];
+    }
+  }
+  return NULL;
+}
 
-      } else if (tls->Handshake.HandshakeType == client_key_exchange) {
+/*
+ * tls_fp_list() appends the numbers of a list to the fingerprint
+ * string at s, separated by '-', and returns the new end of s
+ */
+static char *tls_fp_list(char *s, const unsigned short *x, unsigned int num) {
+  unsigned int i, first = 1;
 
-	//	TLSClientKeyExchange_get_key_length(&tls->Handshake.body, tls_len, tls_version(&tls->ProtocolVersionMajor), r);
-	if (r->tls_client_key_length == 0) {
-	  r->tls_client_key_length = (unsigned int)tls->Handshake.lengthLo*8 + 
-	    (unsigned int)tls->Handshake.lengthMid*8*256 + 
-	    (unsigned int)tls->Handshake.lengthHi*8*256*256;
-	  if (r->tls_client_key_length > 8193) {
-	    r->tls_client_key_length = 0;
-	  }
-	}
+  for (i=0; i<num; i++) {
+    if (!tls_is_grease(x[i])) {
+      s += sprintf(s, first ? "%u" : "-%u", x[i]);
+      first = 0;
+    }
+  }
+  return s;
+}
+
+/*
+ * tls_client_fingerprint_string() returns the fingerprint string of
+ * the ClientHello in r, which the caller must free, or NULL if there
+ * was no ClientHello or malloc failed
+ */
+char *tls_client_fingerprint_string(const struct tls_information *r) {
+  const struct tls_extension *groups, *formats;
+  unsigned short *x;
+  unsigned int i, num_groups = 0, num_formats = 0, num;
+  char *str, *s;
+
+  if (r->tls_client_version == 0) {
+    return NULL;
+  }
+  groups = tls_find_extension(r, TLS_EXT_SUPPORTED_GROUPS);
+  if (groups && groups->length >= 2) {
+    num_groups = raw_to_unsigned_short(groups->data) / 2;
+    if (num_groups > (groups->length - 2) / 2) {
+      num_groups = (groups->length - 2) / 2;
+    }
+  }
+  formats = tls_find_extension(r, TLS_EXT_EC_POINT_FORMATS);
+  if (formats && formats->length >= 1) {
+    num_formats = *(const unsigned char *)formats->data;
+    if (num_formats > formats->length - 1u) {
+      num_formats = formats->length - 1;
+    }
+  }
+
+  /* each number takes at most five digits and a separator */
+  num = r->num_ciphersuites + r->num_tls_extensions + num_groups + num_formats;
+  str = malloc(6 * (num + 1) + 5);
+  x = malloc(sizeof(unsigned short) * (num + 1));
+  if (str == NULL || x == NULL) {
+    free(str);
+    free(x);
+    return NULL;
+  }
+
+  s = str + sprintf(str, "%u,", r->tls_client_version);
+  s = tls_fp_list(s, r->ciphersuites, r->num_ciphersuites);
+  *s++ = ',';
+  for (i=0; i<r->num_tls_extensions; i++) {
+    x[i] = r->tls_extensions[i].type;
+  }
+  s = tls_fp_list(s, x, r->num_tls_extensions);
+  *s++ = ',';
+  for (i=0; i<num_groups; i++) {
+    x[i] = raw_to_unsigned_short((const unsigned char *)groups->data + 2 + 2*i);
+  }
+  s = tls_fp_list(s, x, num_groups);
+  *s++ = ',';
+  for (i=0; i<num_formats; i++) {
+    x[i] = ((const unsigned char *)formats->data)[1 + i];
+  }
+  s = tls_fp_list(s, x, num_formats);
+  *s = 0;
+
+  free(x);
+  return str;
+}
+
+/*
+ * tls_client_fingerprint() sets the fingerprint of the ClientHello
+ * in r, as it is parsed
+ */
+void tls_client_fingerprint(struct tls_information *r) {
+  unsigned int len;
+  char *str = tls_client_fingerprint_string(r);
+
+  if (str != NULL) {
+    if (EVP_Digest(str, strlen(str), r->tls_fp, &len, EVP_md5(), NULL) == 1) {
+      r->tls_fp_valid = 1;
+    }
+    free(str);
+  }
+}
+
+/*
+ * tls_handshake_state() returns the state of the TLS handshake that
+ * is reached when a handshake message of type t is seen, or
+ * tls_state_none if t is not a handshake type that we know
+ */
+static enum tls_state tls_handshake_state(unsigned char t) {
+  switch (t) {
+  case client_hello:
+    return tls_state_client_hello;
+  case server_hello:
+    return tls_state_server_hello;
+  case hello_request:
+  case new_session_ticket:
+  case certificate:
+  case server_key_exchange:
+  case certificate_request:
+  case server_hello_done:
+  case certificate_verify:
+  case client_key_exchange:
+  case finished:
+    return tls_state_certificate;
+  default:
+    ;
+  }
+  return tls_state_none;
+}
+
+/*
+ * tls_process_record() processes the TLS record with the header tls,
+ * of which the first len bytes are available, and which arrived at
+ * time ts; a handshake message is only parsed if all of its record is
+ * available.  It returns failure if the record does not look like
+ * TLS, and ok otherwise.
+ */
+static enum status tls_process_record(const struct timeval *ts, struct tls_information *r,
+				      const struct tls_header *tls, unsigned int len) {
+  unsigned int tls_len;
+  enum tls_state state;
+
+  if (!packet_is_tls(tls, len)) {
+    return failure;
+  }
+  tls_len = tls_header_get_length(tls);
 
-      } if (((tls->Handshake.HandshakeType > 2) & 
-	     (tls->Handshake.HandshakeType < 11)) ||
-	    ((tls->Handshake.HandshakeType > 16) & 
-	     (tls->Handshake.HandshakeType < 20)) ||
-	    (tls->Handshake.HandshakeType > 20)) {
+  if (tls->ContentType == application_data) {
+    r->tls_v = tls_version(&tls->ProtocolVersionMajor);
+    if (r->tls_state < tls_state_application_data) {
+      r->tls_state = tls_state_application_data;
+    }
+
+  } else if (tls->ContentType == change_cipher_spec) {
+    if (r->tls_state < tls_state_change_cipher_spec) {
+      r->tls_state = tls_state_change_cipher_spec;
+    }
+
+  } else if (tls->ContentType == handshake) {
+    if (r->tls_state >= tls_state_change_cipher_spec) {
+
+      /* an encrypted handshake message, which should be a Finished */
+      if (r->tls_op < MAX_NUM_RCD_LEN) {
+	r->tls_type[r->tls_op].handshake = finished;
+      }
+
+    } else if (len > TLS_HDR_LEN) {
+      state = tls_handshake_state(tls->Handshake.HandshakeType);
+      if (state == tls_state_none) {
 	
 	/*
 	 * we encountered an unknown handshaketype, so this packet is
 	 * not actually a TLS handshake, so we bail on decoding it
 	 */
-	return NULL;
+	return failure;
+      }
+      if (r->tls_state < state) {
+	r->tls_state = state;
+      }
+
+      /* parse the message only if all of it is available */
+      if (TLS_HDR_LEN + tls_len <= len) {
+	if (tls->Handshake.HandshakeType == client_hello) {
+	  
+	  TLSClientHello_get_ciphersuites(&tls->Handshake.body, tls_len, r);
+	  TLSClientHello_get_extensions(&tls->Handshake.body, tls_len, r);
+	  if (report_tls_fp) {
+	    tls_client_fingerprint(r);
+	  }
+
+	} else if (tls->Handshake.HandshakeType == server_hello) {
+
+	  TLSServerHello_get_ciphersuite(&tls->Handshake.body, tls_len, r);
+
+	} else if (tls->Handshake.HandshakeType == client_key_exchange) {
+
+	  //	TLSClientKeyExchange_get_key_length(&tls->Handshake.body, tls_len, tls_version(&tls->ProtocolVersionMajor), r);
+	  if (r->tls_client_key_length == 0) {
+	    r->tls_client_key_length = (unsigned int)tls->Handshake.lengthLo*8 + 
+	      (unsigned int)tls->Handshake.lengthMid*8*256 + 
+	      (unsigned int)tls->Handshake.lengthHi*8*256*256;
+	    if (r->tls_client_key_length > 8193) {
+	      r->tls_client_key_length = 0;
+	    }
+	  }
+	}
       }
 
       if (r->tls_op < MAX_NUM_RCD_LEN) {
 	r->tls_type[r->tls_op].handshake = tls->Handshake.HandshakeType;
       }      
-    } else if (tls->ContentType != change_cipher_spec || 
-	       tls->ContentType != alert) {
-      
-      /* 
-       * we encountered an unknown contenttype, so this is not
-       * actually a TLS record, so we bail on decoding it
-       */      
+    }
+  }
+
+  /* record TLS record lengths and arrival times */
+  if (r->tls_op < MAX_NUM_RCD_LEN) {
+    r->tls_type[r->tls_op].content = tls->ContentType;
+    r->tls_len[r->tls_op] = tls_len;
+    r->tls_time[r->tls_op] = *ts;
+  }
+
+  /* increment TLS record count in tls_information */
+  r->tls_op++;
+
+  return ok;
+}
+
+/*
+ * TLS reassembly buffers
+ *
+ * Until the ChangeCipherSpec, a record that continues past the end of
+ * a payload is copied into a reassembly buffer of its direction of the
+ * flow, and it is processed when all of it has arrived, so that
+ * handshake messages split across TCP segments are parsed completely.
+ * The buffers hold at most TLS_REASSEMBLY_MAX bytes in all; when a
+ * new one would not fit, the least recently used ones are evicted,
+ * and the rest of their records is skipped over.  After the handshake,
+ * only a record header that is split across payloads is buffered.  A
+ * buffer is dropped when tls_seq_check() finds a gap in the payloads.
+ */
+
+struct tls_reassembly_stats tls_reassembly_stats = { 0, 0, 0 };
+
+static struct tls_information *tls_buf_lru = NULL;  /* least recently used */
+static struct tls_information *tls_buf_mru = NULL;  /* most recently used  */
+
+static void tls_buf_unlink(struct tls_information *r) {
+  if (r->tls_buf_prev) {
+    r->tls_buf_prev->tls_buf_next = r->tls_buf_next;
+  } else {
+    tls_buf_lru = r->tls_buf_next;
+  }
+  if (r->tls_buf_next) {
+    r->tls_buf_next->tls_buf_prev = r->tls_buf_prev;
+  } else {
+    tls_buf_mru = r->tls_buf_prev;
+  }
+  r->tls_buf_prev = r->tls_buf_next = NULL;
+}
+
+/* free the reassembly buffer of r, if it has one */
+static void tls_buf_release(struct tls_information *r) {
+  if (r->tls_buf) {
+    tls_buf_unlink(r);
+    free(r->tls_buf);
+    tls_reassembly_stats.bytes -= r->tls_buf_size;
+    r->tls_buf = NULL;
+    r->tls_buf_size = 0;
+    r->tls_buf_len = 0;
+  }
+}
+
+/*
+ * tls_buf_evict() gives up on reassembling the record in the buffer
+ * of r: what has arrived of it is processed as a partial record, and
+ * the rest of it is skipped over
+ */
+static void tls_buf_evict(struct tls_information *r) {
+  const struct tls_header *tls = (const struct tls_header *)r->tls_buf;
+
+  if (r->tls_buf_len >= TLS_HDR_LEN 
+      && tls_process_record(&r->tls_buf_time, r, tls, r->tls_buf_len) == ok) {
+    r->tls_skip = TLS_HDR_LEN + tls_header_get_length(tls) - r->tls_buf_len;
+  }
+  tls_buf_release(r);
+  tls_reassembly_stats.evictions++;
+}
+
+/*
+ * tls_buf_reserve() makes the reassembly buffer of r hold size bytes,
+ * evicting other buffers if needed, and makes it the most recently
+ * used one; it returns failure if the buffer cannot be that large
+ */
+static enum status tls_buf_reserve(struct tls_information *r, unsigned int size) {
+  unsigned char *buf;
+
+  if (r->tls_buf) {
+    tls_buf_unlink(r);
+  }
+  while (tls_buf_lru && tls_reassembly_stats.bytes - r->tls_buf_size + size > TLS_REASSEMBLY_MAX) {
+    tls_buf_evict(tls_buf_lru);
+  }
+  if (tls_reassembly_stats.bytes - r->tls_buf_size + size > TLS_REASSEMBLY_MAX) {
+    buf = NULL;
+  } else {
+    buf = realloc(r->tls_buf, size);
+  }
+  if (buf == NULL) {
+    free(r->tls_buf);
+    tls_reassembly_stats.bytes -= r->tls_buf_size;
+    r->tls_buf = NULL;
+    r->tls_buf_size = 0;
+    r->tls_buf_len = 0;
+    return failure;
+  }
+  tls_reassembly_stats.bytes += size - r->tls_buf_size;
+  if (tls_reassembly_stats.bytes > tls_reassembly_stats.max_bytes) {
+    tls_reassembly_stats.max_bytes = tls_reassembly_stats.bytes;
+  }
+  r->tls_buf = buf;
+  r->tls_buf_size = size;
+
+  /* append to the most recently used end of the list */
+  r->tls_buf_prev = tls_buf_mru;
+  if (tls_buf_mru) {
+    tls_buf_mru->tls_buf_next = r;
+  } else {
+    tls_buf_lru = r;
+  }
+  tls_buf_mru = r;
+
+  return ok;
+}
+
+/*
+ * tls_buf_needed() returns the number of bytes that the reassembly
+ * buffer of r should hold: the record header, until it is complete,
+ * and then the whole record
+ */
+static unsigned int tls_buf_needed(const struct tls_information *r) {
+  if (r->tls_buf_len < TLS_HDR_LEN) {
+    return TLS_HDR_LEN;
+  }
+  return TLS_HDR_LEN + tls_header_get_length((const struct tls_header *)r->tls_buf);
+}
+
+/*
+ * tls_seq_check() checks that a TCP payload of len bytes with the
+ * sequence number seq follows on from the previous payload in its
+ * direction of the flow.  It returns failure for a retransmission of
+ * bytes that have already been seen, which must not be passed to
+ * process_tls().  After a gap or a partial overlap, the record
+ * boundaries are lost, so the record in progress is dropped, and the
+ * payload is processed from its start.
+ */
+enum status tls_seq_check(struct tls_information *r, unsigned int seq, unsigned int len) {
+  if (r->tls_seq_valid && seq != r->tls_seq) {
+    if ((int)(seq + len - r->tls_seq) <= 0) {
+      return failure;   /* retransmission */
+    }
+    tls_buf_release(r);
+    r->tls_skip = 0;
+  }
+  r->tls_seq = seq + len;
+  r->tls_seq_valid = 1;
+
+  return ok;
+}
+
+/*
+ * process_tls() processes the TLS records in one TCP payload of one
+ * direction of a flow, in which the first len bytes of start follow
+ * on from the bytes of the previous payload.  A record that continues
+ * past the end of the payload is reassembled from the payloads that
+ * follow during the handshake, and is skipped over using its length
+ * afterwards, without looking at its contents.  The state of the
+ * handshake only moves forward; handshake messages are parsed until
+ * the ChangeCipherSpec, since the ones after it are encrypted.  Once
+ * the handshake is done and max_records record lengths have been
+ * collected, there is nothing more to learn, and later payloads are
+ * ignored.
+ */
+struct tls_information *
+process_tls(const struct pcap_pkthdr *h, const void *start, int len, 
+	    struct tls_information *r, unsigned int max_records) {
+  const struct tls_header *tls;
+  unsigned int tls_len, needed, n;
+
+  if (r->tls_state == tls_state_done) {
+    return NULL;
+  }
+
+  /* skip over the rest of a record that started in an earlier payload */
+  if (r->tls_skip) {
+    if (len <= r->tls_skip) {
+      r->tls_skip -= len;
       return NULL;
     }
+    start += r->tls_skip;
+    len -= r->tls_skip;
+    r->tls_skip = 0;
+  }
+
+  /* add to a record that started in an earlier payload */
+  while (r->tls_buf && len > 0) {
+    needed = tls_buf_needed(r);
+    n = needed - r->tls_buf_len;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(r->tls_buf + r->tls_buf_len, start, n);
+    r->tls_buf_len += n;
+    start += n;
+    len -= n;
+    if (r->tls_buf_len < needed) {
+      return NULL;   /* wait for more of the record */
+    }
+
+    if (needed == TLS_HDR_LEN) {
+      struct tls_header hdr;
+
+      /* the header is complete, so make room for the whole record */
+      if (!packet_is_tls(r->tls_buf, TLS_HDR_LEN)) {
+	tls_buf_release(r);
+	return NULL;
+      }
+      memcpy(&hdr, r->tls_buf, TLS_HDR_LEN);
+      if (r->tls_state >= tls_state_change_cipher_spec || tls_buf_reserve(r, tls_buf_needed(r)) != ok) {
+
+	/* the handshake is over, or there is no room, so skip over the rest of the record */
+	tls_buf_release(r);
+	r->tls_skip = tls_header_get_length(&hdr);
+	tls_process_record(&r->tls_buf_time, r, &hdr, TLS_HDR_LEN);
+	return process_tls(h, start, len, r, max_records);
+      }
+    } else {
+      /* the record is complete */
+      enum status status = tls_process_record(&r->tls_buf_time, r, 
+					      (const struct tls_header *)r->tls_buf, r->tls_buf_len);
+
+      tls_buf_release(r);
+      if (status != ok) {
+	return NULL;
+      }
+    }
+  }
+
+  /* currently skipping SSLv2 */
+
+  while (len > 0) {
+    tls = start;
 
-    /* record TLS record lengths and arrival times */
-    if (r->tls_op < MAX_NUM_RCD_LEN) {
-      r->tls_type[r->tls_op].content = tls->ContentType;
-      r->tls_len[r->tls_op] = tls_len;
-      r->tls_time[r->tls_op] = h->ts;
+    if (len < TLS_HDR_LEN || TLS_HDR_LEN + tls_header_get_length(tls) > len) {
+
+      /*
+       * the record continues into the next payload; its header is
+       * always reassembled, but the rest of it is only reassembled
+       * during the handshake
+       */
+      if (len < TLS_HDR_LEN || (r->tls_state < tls_state_change_cipher_spec && packet_is_tls(tls, len))) {
+	needed = len < TLS_HDR_LEN ? TLS_HDR_LEN : TLS_HDR_LEN + tls_header_get_length(tls);
+	if (tls_buf_reserve(r, needed) == ok) {
+	  memcpy(r->tls_buf, start, len);
+	  r->tls_buf_len = len;
+	  r->tls_buf_time = h->ts;
+	  return NULL;
+	}
+      }
     }
 
-    /* increment TLS record count in tls_information */
-    r->tls_op++;
+    /*
+     * if this is not a TLS record header, we have lost track of the
+     * record boundaries, so we bail on decoding this payload
+     */
+    if (tls_process_record(&h->ts, r, tls, len) != ok) {
+      return NULL;
+    }
 
-    tls_len += 5; /* advance over header */
+    tls_len = TLS_HDR_LEN + tls_header_get_length(tls);
+    if (tls_len > len) {
+      r->tls_skip = tls_len - len;
+      break;
+    }
     start += tls_len;
     len -= tls_len;
   }
 
+  if (r->tls_state == tls_state_application_data && r->tls_op >= max_records) {
+    r->tls_state = tls_state_done;
+  }
+
   return NULL;
 }
+
+/*
+ * tls_test_client_hello() writes a TLS record holding a ClientHello
+ * with num_ext extensions of ext_len bytes each into buf, and returns
+ * its length
+ */
+static unsigned int tls_test_client_hello(unsigned char *buf, unsigned int num_ext, unsigned int ext_len) {
+  unsigned char *p = buf;
+  unsigned int i, j, body_len, exts_len = num_ext * (4 + ext_len);
+
+  body_len = 2 + 32 + 1 + 2 + 2*16 + 2 + 2 + exts_len;
+  *p++ = handshake;
+  *p++ = 3;
+  *p++ = 1;
+  *p++ = (4 + body_len) >> 8;
+  *p++ = (4 + body_len);
+  *p++ = client_hello;
+  *p++ = 0;
+  *p++ = body_len >> 8;
+  *p++ = body_len;
+  *p++ = 3;
+  *p++ = 3;
+  for (i=0; i<32; i++) {
+    *p++ = i;            /* random */
+  }
+  *p++ = 0;              /* session id length */
+  *p++ = 0;
+  *p++ = 2*16;
+  for (i=0; i<16; i++) {
+    *p++ = 0xc0;
+    *p++ = i;            /* ciphersuites */
+  }
+  *p++ = 1;
+  *p++ = 0;              /* null compression */
+  *p++ = exts_len >> 8;
+  *p++ = exts_len;
+  for (i=0; i<num_ext; i++) {
+    *p++ = 0;
+    *p++ = i;
+    *p++ = ext_len >> 8;
+    *p++ = ext_len;
+    for (j=0; j<ext_len; j++) {
+      *p++ = i + j;
+    }
+  }
+  return p - buf;
+}
+
+/* tls_test_record() writes a TLS record header of type t and length len */
+static unsigned int tls_test_record(unsigned char *buf, unsigned char t, unsigned int len) {
+  buf[0] = t;
+  buf[1] = 3;
+  buf[2] = 3;
+  buf[3] = len >> 8;
+  buf[4] = len;
+  memset(buf + TLS_HDR_LEN, 0x5a, len);
+  return TLS_HDR_LEN + len;
+}
+
+/*
+ * tls_test_segment() passes the len bytes at offset i of stream, which
+ * holds stream_len bytes, to process_tls() as a TCP payload, unless
+ * tls_seq_check() finds that it is a retransmission
+ */
+#define TLS_TEST_SEQ 0xfffff000
+
+static void tls_test_segment(const struct pcap_pkthdr *h, const unsigned char *stream, unsigned int stream_len, 
+			     unsigned int i, unsigned int len, struct tls_information *r) {
+  if (len > stream_len - i) {
+    len = stream_len - i;
+  }
+  if (tls_seq_check(r, TLS_TEST_SEQ + i, len) == ok) {
+    process_tls(h, stream + i, len, r, MAX_NUM_RCD_LEN);
+  }
+}
+
+/*
+ * a ClientHello with GREASE values in its ciphersuites, extensions,
+ * and supported groups, and its fingerprint
+ */
+static const unsigned char tls_test_grease_hello[] = {
+  0x16, 0x03, 0x01, 0x00, 0x4d,                     /* record header  */
+  0x01, 0x00, 0x00, 0x49,                           /* ClientHello    */
+  0x03, 0x03,                                       /* version        */
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,   /* random         */
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0x00,                                             /* session id     */
+  0x00, 0x06, 0x0a, 0x0a, 0xc0, 0x2b, 0x00, 0x2f,   /* ciphersuites   */
+  0x01, 0x00,                                       /* compression    */
+  0x00, 0x1a,                                       /* extensions     */
+  0x1a, 0x1a, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00,
+  0x00, 0x0a, 0x00, 0x08, 0x00, 0x06, 0x0a, 0x0a, 0x00, 0x1d, 0x00, 0x17,
+  0x00, 0x0b, 0x00, 0x02, 0x01, 0x00
+};
+
+static const char tls_test_grease_fp_string[] = "771,49195-47,0-10-11,29-23,0";
+
+static const unsigned char tls_test_grease_fp[TLS_FP_LEN] = {
+  0xdd, 0xd6, 0x1e, 0xed, 0xf3, 0x38, 0x3c, 0x30,
+  0x56, 0xf6, 0xef, 0x5b, 0x71, 0x8d, 0xe7, 0xca
+};
+
+/*
+ * tls_unit_test() checks the fingerprint of a ClientHello with GREASE
+ * values, checks that a ClientHello split across payloads in every
+ * way is parsed as if it were in one payload, that records are
+ * followed across payloads, retransmissions, and gaps, and that the reassembly buffers stay under
+ * their cap by evicting the least recently used ones
+ */
+int tls_unit_test() {
+  static unsigned char stream[65536];
+  struct tls_information whole, split, *many;
+  struct pcap_pkthdr h;
+  unsigned int i, len, hello_len, seg, num_fails = 0;
+  unsigned int num_many = TLS_REASSEMBLY_MAX / (TLS_HDR_LEN + 16000) + 10;
+  char *str;
+
+  memset(&h, 0, sizeof(h));
+
+  report_tls_fp = 1;
+  tls_record_init(&whole);
+  process_tls(&h, tls_test_grease_hello, sizeof(tls_test_grease_hello), &whole, MAX_NUM_RCD_LEN);
+  str = tls_client_fingerprint_string(&whole);
+  if (str == NULL || strcmp(str, tls_test_grease_fp_string) != 0
+      || !whole.tls_fp_valid || memcmp(whole.tls_fp, tls_test_grease_fp, TLS_FP_LEN) != 0) {
+    printf("error: TLS client fingerprint string is %s, not %s\n", str ? str : "NULL", tls_test_grease_fp_string);
+    num_fails++;
+  }
+  free(str);
+  tls_record_delete(&whole);
+  report_tls_fp = 0;
+
+  /* a ClientHello of about 3 KB, a ChangeCipherSpec, and application data */
+  hello_len = tls_test_client_hello(stream, 40, 64);
+  len = hello_len;
+  len += tls_test_record(stream + len, change_cipher_spec, 1);
+  len += tls_test_record(stream + len, application_data, 16000);
+  len += tls_test_record(stream + len, application_data, 20);
+
+  tls_record_init(&whole);
+  process_tls(&h, stream, hello_len, &whole, MAX_NUM_RCD_LEN);
+  if (whole.num_ciphersuites != 16 || whole.num_tls_extensions != 40 || whole.tls_len[0] != hello_len - TLS_HDR_LEN) {
+    printf("error: ClientHello not parsed\n");
+    num_fails++;
+  }
+
+  /*
+   * split the records into payloads of every size, and retransmit
+   * each payload after the one that follows it; the sequence numbers
+   * wrap around in the middle of the records
+   */
+  for (seg = 1; seg < 1500; seg += (seg < 16) ? 1 : 97) {
+    tls_record_init(&split);
+    for (i=0; i<len; i += seg) {
+      tls_test_segment(&h, stream, len, i, seg, &split);
+      if (i >= seg) {
+	tls_test_segment(&h, stream, len, i - seg, seg, &split);
+      }
+    }
+    if (split.num_ciphersuites != whole.num_ciphersuites 
+	|| memcmp(split.ciphersuites, whole.ciphersuites, sizeof(split.ciphersuites)) != 0
+	|| split.num_tls_extensions != whole.num_tls_extensions) {
+      printf("error: ClientHello in %u-byte payloads not parsed\n", seg);
+      num_fails++;
+    } else {
+      for (i=0; i<split.num_tls_extensions; i++) {
+	if (split.tls_extensions[i].type != whole.tls_extensions[i].type 
+	    || split.tls_extensions[i].length != whole.tls_extensions[i].length
+	    || memcmp(split.tls_extensions[i].data, whole.tls_extensions[i].data, whole.tls_extensions[i].length) != 0) {
+	  printf("error: extension %u of ClientHello in %u-byte payloads differs\n", i, seg);
+	  num_fails++;
+	  break;
+	}
+      }
+    }
+    if (split.tls_op != 4 || split.tls_len[2] != 16000 || split.tls_len[3] != 20 
+	|| split.tls_state != tls_state_application_data || split.tls_buf != NULL) {
+      printf("error: records in %u-byte payloads not followed (%u records)\n", seg, split.tls_op);
+      num_fails++;
+    }
+    tls_record_delete(&split);
+  }
+  tls_record_delete(&whole);
+
+  /*
+   * lose the end of the ClientHello; the part of it in the reassembly
+   * buffer is dropped, and the records after the gap are followed
+   */
+  tls_record_init(&split);
+  tls_test_segment(&h, stream, len, 0, 500, &split);
+  for (i=hello_len; i<len; i += 1000) {
+    tls_test_segment(&h, stream, len, i, 1000, &split);
+  }
+  if (split.num_ciphersuites != 0 || split.tls_op != 3 || split.tls_len[1] != 16000 || split.tls_len[2] != 20 
+      || split.tls_state != tls_state_application_data || split.tls_buf != NULL) {
+    printf("error: records not followed after a gap (%u records)\n", split.tls_op);
+    num_fails++;
+  }
+  tls_record_delete(&split);
+
+  /*
+   * start more large handshake records than fit under the cap; the
+   * first ones are evicted, and the rest of their records is skipped
+   */
+  many = malloc(num_many * sizeof(struct tls_information));
+  if (many == NULL) {
+    return failure;
+  }
+  len = tls_test_record(stream, handshake, 16000);
+  stream[TLS_HDR_LEN] = certificate;
+  len += tls_test_record(stream + len, change_cipher_spec, 1);
+  for (i=0; i<num_many; i++) {
+    tls_record_init(&many[i]);
+    process_tls(&h, stream, 1000, &many[i], MAX_NUM_RCD_LEN);
+  }
+  if (tls_reassembly_stats.bytes > TLS_REASSEMBLY_MAX || tls_reassembly_stats.evictions < 10) {
+    printf("error: TLS reassembly buffers hold %lu bytes after %lu evictions\n", 
+	   tls_reassembly_stats.bytes, tls_reassembly_stats.evictions);
+    num_fails++;
+  }
+  for (i=0; i<num_many; i++) {
+    process_tls(&h, stream + 1000, len - 1000, &many[i], MAX_NUM_RCD_LEN);
+    if (many[i].tls_op != 2 || many[i].tls_len[0] != 16000 || many[i].tls_state != tls_state_change_cipher_spec) {
+      printf("error: record %u not followed after eviction (%u records)\n", i, many[i].tls_op);
+      num_fails++;
+      break;
+    }
+  }
+  for (i=0; i<num_many; i++) {
+    tls_record_delete(&many[i]);
+  }
+  free(many);
+  if (tls_reassembly_stats.bytes != 0) {
+    printf("error: TLS reassembly buffers hold %lu bytes after they were freed\n", tls_reassembly_stats.bytes);
+    num_fails++;
+  }
+
+  return num_fails ? failure : ok;
+}
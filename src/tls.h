@@ -50,6 +50,9 @@
 #define MAX_EXTENSIONS 256
 #define MAX_SID_LEN 256
 #define MAX_NUM_RCD_LEN 200
+#define TLS_HDR_LEN 5
+#define TLS_FP_LEN 16
+#define TLS_REASSEMBLY_MAX (4 * 1024 * 1024) /* bytes in all reassembly buffers */
 
 /* structure for TLS awareness */
 /*
@@ -118,7 +121,34 @@ struct tls_extension {
   void *data;
 };
 
+/*
+ * the state of the TLS handshake in one direction of a flow, which
+ * only moves forward; after the ChangeCipherSpec, handshake messages
+ * are encrypted, and once the handshake is done and enough record
+ * lengths have been collected, the flow is done
+ */
+enum tls_state {
+  tls_state_none = 0,             /* no handshake message seen yet     */
+  tls_state_client_hello = 1,     /* ClientHello seen                  */
+  tls_state_server_hello = 2,     /* ServerHello seen                  */
+  tls_state_certificate = 3,      /* Certificate or key exchange seen  */
+  tls_state_change_cipher_spec = 4, /* ChangeCipherSpec seen           */
+  tls_state_application_data = 5, /* application data seen            */
+  tls_state_done = 6              /* nothing more to collect           */
+};
+
 struct tls_information {
+  unsigned char  tls_state;                 /* enum tls_state                  */
+  unsigned int   tls_skip;                  /* bytes left in a record that     */
+                                            /* continues into later payloads   */
+  unsigned char *tls_buf;                   /* reassembly buffer, or NULL      */
+  unsigned int   tls_buf_size;              /* bytes allocated for tls_buf     */
+  unsigned int   tls_buf_len;               /* bytes of the record in tls_buf  */
+  struct timeval tls_buf_time;              /* arrival time of the record      */
+  struct tls_information *tls_buf_prev;     /* LRU list of reassembly buffers  */
+  struct tls_information *tls_buf_next;
+  unsigned int   tls_seq;                   /* TCP seq of the next payload     */
+  unsigned char  tls_seq_valid;             /* tls_seq is set                  */
   unsigned int   tls_op;
   unsigned short tls_len[MAX_NUM_RCD_LEN];  /* array of TLS record lengths     */  
   struct timeval tls_time[MAX_NUM_RCD_LEN]; /* array of TLS arrival times      */
@@ -132,6 +162,9 @@ struct tls_information {
   unsigned char tls_sid_len;             /* TLS session ID length              */
   unsigned char tls_sid[MAX_SID_LEN];    /* TLS session ID                     */
   unsigned char tls_random[32];          /* TLS random field from hello        */ 
+  unsigned short tls_client_version;     /* version of ClientHello             */
+  unsigned char tls_fp_valid;            /* tls_fp is set                      */
+  unsigned char tls_fp[TLS_FP_LEN];      /* client fingerprint (MD5)           */
 };
 
 /* structures for parsing TLS content */
@@ -189,6 +222,7 @@ enum HandshakeType {
   hello_request = 0, 
   client_hello = 1, 
   server_hello = 2,
+  new_session_ticket = 4,
   certificate = 11, 
   server_key_exchange  = 12,
   certificate_request = 13, 
@@ -211,6 +245,8 @@ typedef unsigned char CipherSuite[2];
 /* TLS functions */
 void tls_record_init(struct tls_information *r);
 void tls_record_delete(struct tls_information *r);
+struct tls_information *tls_record_alloc();
+void tls_record_free(struct tls_information *r);
 unsigned short raw_to_unsigned_short(const void *x);
 //void TLSClientKeyExchange_get_key_length(const void *x, int len, int version,
 //					 struct tls_information *r);
@@ -225,8 +261,24 @@ unsigned int tls_header_get_length(const struct tls_header *H);
 char *tls_version_get_string(enum tls_version v);
 unsigned char tls_version(const void *x);
 unsigned int packet_is_sslv2_hello(const void *data);
+unsigned int packet_is_tls(const void *data, unsigned int len);
+/* statistics of the TLS reassembly buffers */
+struct tls_reassembly_stats {
+  unsigned long int bytes;      /* bytes in reassembly buffers now   */
+  unsigned long int max_bytes;  /* largest value of bytes            */
+  unsigned long int evictions;  /* buffers evicted to stay under cap */
+};
+
+extern struct tls_reassembly_stats tls_reassembly_stats;
+
+void tls_client_fingerprint(struct tls_information *r);
+char *tls_client_fingerprint_string(const struct tls_information *r);
+
+int tls_unit_test();
+
+enum status tls_seq_check(struct tls_information *r, unsigned int seq, unsigned int len);
 struct tls_information *process_tls(const struct pcap_pkthdr *h, const void *start,
-				int len, struct tls_information *r);
+				int len, struct tls_information *r, unsigned int max_records);
 
 #endif /* TLS_H */
 
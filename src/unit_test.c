@@ -44,6 +44,16 @@
 #include "radix_trie.h"
 #include "wht.h"
 #include "p2f.h"
+#include "encode.h"
+#include "dict.h"
+#include "huffman.h"
+#include "splt.h"
+#include "frag.h"
+#include "byte_dist.h"
+#include "hdr_dsc.h"
+#include "tls.h"
+#include "jfd_reader.h"
+#include "anon.h"
 
 /*
  * use the "info" output stream to represent secondary output - it is
@@ -64,7 +74,84 @@ int main(int argc, char *argv[]) {
     printf("radix_trie tests passed\n");
   }
 
-  wht_unit_test();
+  if (encode_unit_test() != ok) {
+    printf("error: encode test failed\n");
+  } else {
+    printf("encode tests passed\n");
+  }
+
+  if (dict_unit_test() != ok) {
+    printf("error: dict test failed\n");
+  } else {
+    printf("dict tests passed\n");
+  }
+
+  if (huffman_unit_test() != ok) {
+    printf("error: huffman test failed\n");
+  } else {
+    printf("huffman tests passed\n");
+  }
+
+  if (splt_unit_test() != ok) {
+    printf("error: splt test failed\n");
+  } else {
+    printf("splt tests passed\n");
+  }
+
+  if (byte_dist_unit_test() != ok) {
+    printf("error: byte_dist test failed\n");
+  } else {
+    printf("byte_dist tests passed\n");
+  }
+
+  if (frag_unit_test() != ok) {
+    printf("error: frag test failed\n");
+  } else {
+    printf("frag tests passed\n");
+  }
+
+  if (jfd_reader_unit_test() != ok) {
+    printf("error: jfd_reader test failed\n");
+  } else {
+    printf("jfd_reader tests passed\n");
+  }
+
+  if (anon_unit_test() != ok) {
+    printf("error: anon test failed\n");
+  } else {
+    printf("anon tests passed\n");
+  }
+
+  if (flow_key_unit_test() != 0) {
+    printf("error: flow_key test failed\n");
+  } else {
+    printf("flow_key tests passed\n");
+  }
+
+  if (wht_unit_test() != ok) {
+    printf("error: wht test failed\n");
+  } else {
+    printf("wht tests passed\n");
+  }
+
+  if (header_description_unit_test() != ok) {
+    printf("error: header_description test failed\n");
+  } else {
+    printf("header_description tests passed\n");
+  }
+
+  if (tls_unit_test() != ok) {
+    printf("error: tls test failed\n");
+  } else {
+    printf("tls tests passed\n");
+  }
+
+  if (flow_record_tls_fp_unit_test() != 0) {
+    printf("error: tls_fp output test failed\n");
+  } else {
+    printf("tls_fp output tests passed\n");
+  }
+
   flow_record_list_unit_test();
   
   return 0;
@@ -42,9 +42,14 @@
  */
 
 #include <stdint.h>   /* for uint8_t, uint16_t, ... */
+#include <inttypes.h> /* for PRId64                 */
 #include <string.h>   /* for memcpy()               */
 #include <stdio.h>    /* for fprintf()              */
+#include <stdlib.h>   /* for rand()                 */
+#include <sys/time.h> /* for gettimeofday()         */
 #include "wht.h"     
+#include "cpu_isa.h"
+#include "err.h"
 
 inline void wht_init(struct wht *wht) {
   wht->spectrum[0] = 0;
@@ -66,27 +71,124 @@ inline void wht_process_four_bytes(struct wht *wht, const uint8_t *d) {
   wht->spectrum[3] += (x[2] - x[3]);
 }
 
+#ifdef CPU_ISA_X86
+
+/*
+ * the transform is linear, so the sum of the transforms of the
+ * four-byte blocks is the transform of the sums of the bytes in each
+ * position (modulo four) of the blocks.  The vector kernels compute
+ * those sums with psadbw, which adds eight bytes into a 64-bit lane,
+ * after masking: t is the sum of all bytes, e that of positions 0 and
+ * 2, l that of positions 0 and 1, and z that of position 0.  Each
+ * kernel processes two vectors per iteration, and returns the number
+ * of bytes that it processed, which is a multiple of four.
+ */
+static void wht_add_sums(struct wht *wht, int64_t t, int64_t e, int64_t l, int64_t z) {
+  wht->spectrum[0] += t;
+  wht->spectrum[1] += 2*e - t;
+  wht->spectrum[2] += 2*l - t;
+  wht->spectrum[3] += 4*z - 2*e - 2*l + t;
+}
+
+static TARGET_SSE2 unsigned int wht_update_sse2(struct wht *wht, const uint8_t *d, unsigned int len) {
+  const __m128i even = _mm_set1_epi32(0x00ff00ff);
+  const __m128i low = _mm_set1_epi32(0x0000ffff);
+  const __m128i first = _mm_set1_epi32(0x000000ff);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i t = zero, e = zero, l = zero, z = zero;
+  uint64_t s[4][2];
+  unsigned int i;
+
+  for (i=0; i + 32 <= len; i += 32) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(d + i));
+    __m128i y = _mm_loadu_si128((const __m128i *)(d + i + 16));
+
+    t = _mm_add_epi64(t, _mm_add_epi64(_mm_sad_epu8(x, zero), _mm_sad_epu8(y, zero)));
+    e = _mm_add_epi64(e, _mm_add_epi64(_mm_sad_epu8(_mm_and_si128(x, even), zero),
+				       _mm_sad_epu8(_mm_and_si128(y, even), zero)));
+    l = _mm_add_epi64(l, _mm_add_epi64(_mm_sad_epu8(_mm_and_si128(x, low), zero),
+				       _mm_sad_epu8(_mm_and_si128(y, low), zero)));
+    z = _mm_add_epi64(z, _mm_add_epi64(_mm_sad_epu8(_mm_and_si128(x, first), zero),
+				       _mm_sad_epu8(_mm_and_si128(y, first), zero)));
+  }
+  _mm_storeu_si128((__m128i *)s[0], t);
+  _mm_storeu_si128((__m128i *)s[1], e);
+  _mm_storeu_si128((__m128i *)s[2], l);
+  _mm_storeu_si128((__m128i *)s[3], z);
+  wht_add_sums(wht, s[0][0] + s[0][1], s[1][0] + s[1][1], s[2][0] + s[2][1], s[3][0] + s[3][1]);
+
+  return i;
+}
+
+static TARGET_AVX2 unsigned int wht_update_avx2(struct wht *wht, const uint8_t *d, unsigned int len) {
+  const __m256i even = _mm256_set1_epi32(0x00ff00ff);
+  const __m256i low = _mm256_set1_epi32(0x0000ffff);
+  const __m256i first = _mm256_set1_epi32(0x000000ff);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i t = zero, e = zero, l = zero, z = zero;
+  uint64_t s[4][4];
+  unsigned int i;
+
+  for (i=0; i + 64 <= len; i += 64) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(d + i));
+    __m256i y = _mm256_loadu_si256((const __m256i *)(d + i + 32));
+
+    t = _mm256_add_epi64(t, _mm256_add_epi64(_mm256_sad_epu8(x, zero), _mm256_sad_epu8(y, zero)));
+    e = _mm256_add_epi64(e, _mm256_add_epi64(_mm256_sad_epu8(_mm256_and_si256(x, even), zero),
+					     _mm256_sad_epu8(_mm256_and_si256(y, even), zero)));
+    l = _mm256_add_epi64(l, _mm256_add_epi64(_mm256_sad_epu8(_mm256_and_si256(x, low), zero),
+					     _mm256_sad_epu8(_mm256_and_si256(y, low), zero)));
+    z = _mm256_add_epi64(z, _mm256_add_epi64(_mm256_sad_epu8(_mm256_and_si256(x, first), zero),
+					     _mm256_sad_epu8(_mm256_and_si256(y, first), zero)));
+  }
+  _mm256_storeu_si256((__m256i *)s[0], t);
+  _mm256_storeu_si256((__m256i *)s[1], e);
+  _mm256_storeu_si256((__m256i *)s[2], l);
+  _mm256_storeu_si256((__m256i *)s[3], z);
+  wht_add_sums(wht, s[0][0] + s[0][1] + s[0][2] + s[0][3], s[1][0] + s[1][1] + s[1][2] + s[1][3],
+	       s[2][0] + s[2][1] + s[2][2] + s[2][3], s[3][0] + s[3][1] + s[3][2] + s[3][3]);
+
+  return i;
+}
+
+#endif /* CPU_ISA_X86 */
+
+static void wht_update_isa(struct wht *wht, const uint8_t *d, unsigned int len, enum cpu_isa isa) {
+  unsigned int n = 0;
+
+#ifdef CPU_ISA_X86
+  if (isa == cpu_isa_avx2) {
+    n = wht_update_avx2(wht, d, len);
+  } else if (isa == cpu_isa_sse2) {
+    n = wht_update_sse2(wht, d, len);
+  }
+#endif
+  d += n;
+  len -= n;
+
+  while (len >= 4) {
+    wht_process_four_bytes(wht, d);
+    d += 4;
+    len -= 4;
+  }
+  if (len > 0) {
+    uint8_t buffer[4] = { 0, 0, 0, 0 };   /* the last block is padded with zeros */
+      
+    memcpy(buffer, d, len);
+    wht_process_four_bytes(wht, buffer);
+  }
+}
+
 void wht_update(struct wht *wht, const void *data, unsigned int len, unsigned int report_wht) {
-  const uint8_t *d = data;
 
   if (report_wht) {
-    while (len > 4) {
-      wht_process_four_bytes(wht, d);
-      d += 4;
-      len -= 4;
-    }
-    if (len > 0) {
-      uint8_t buffer[4];
-      
-      memcpy(buffer, d, len);
-      wht_process_four_bytes(wht, buffer);
-    }
+    wht_update_isa(wht, data, len, cpu_isa_get());
   }
 }
 
 void wht_printf(const struct wht *wht, FILE *f) {
   
-  fprintf(f, ",\n\t\t\t\"wht\": [ %d, %d, %d, %d ]",
+  fprintf(f, ",\n\t\t\t\"wht\": [ %" PRId64 ", %" PRId64 ", %" PRId64 ", %" PRId64 " ]",
 	  wht->spectrum[0], wht->spectrum[1], wht->spectrum[2], wht->spectrum[3]);
   
 }
@@ -141,7 +243,53 @@ void wht_printf_scaled_bidir(const struct wht *w1, unsigned int b1,
 }
 
 
-void wht_unit_test() {
+#define WHT_TEST_LEN 256
+
+struct wht_kernel {
+  const char *name;
+  enum cpu_isa isa;
+};
+
+static const struct wht_kernel wht_kernels[] = {
+  { "scalar", cpu_isa_scalar },
+#ifdef CPU_ISA_X86
+  { "sse2",   cpu_isa_sse2   },
+  { "avx2",   cpu_isa_avx2   },
+#endif
+};
+
+#define NUM_WHT_KERNELS (sizeof(wht_kernels)/sizeof(struct wht_kernel))
+
+static void wht_benchmark() {
+  uint8_t data[1460];
+  struct wht wht;
+  unsigned int i, k, iters = 20000;
+  struct timeval start;
+  double mb = (double) sizeof(data) * iters / 1000000.0;
+
+  for (i=0; i<sizeof(data); i++) {
+    data[i] = rand();
+  }
+  for (k=0; k<NUM_WHT_KERNELS; k++) {
+    if (wht_kernels[k].isa > cpu_isa_get()) {
+      continue;
+    }
+    wht_init(&wht);
+    gettimeofday(&start, NULL);
+    for (i=0; i<iters; i++) {
+      wht_update_isa(&wht, data, sizeof(data), wht_kernels[k].isa);
+    }
+    printf("wht of 1460-byte buffer, %-6s: %8.1f MB/s\n", wht_kernels[k].name, mb / time_diff(&start));
+  }
+}
+
+/*
+ * wht_unit_test() prints the transforms of a few short buffers, and
+ * checks that each kernel matches wht_process_four_bytes() on buffers
+ * of every length up to WHT_TEST_LEN at several alignments, and on a
+ * buffer long enough to overflow 32-bit sums
+ */
+int wht_unit_test() {
   struct wht wht, wht2;
   uint8_t buffer1[8] = {
     1, 1, 1, 1, 1, 1, 1, 1
@@ -156,6 +304,11 @@ void wht_unit_test() {
   uint8_t buffer4[4] = {
     255, 254, 253, 252
   };
+  uint8_t data[WHT_TEST_LEN + 32];
+  uint8_t *big;
+  unsigned int len, offset, i, k, big_len = 1 << 24;
+  struct wht ref;
+  int num_fails = 0;
 
   wht_init(&wht);
   wht_update(&wht, buffer1, sizeof(buffer1), 1);
@@ -175,5 +328,58 @@ void wht_unit_test() {
   wht_update(&wht, buffer4, 1, 1); /* note: only reading first byte */
   wht_update(&wht, buffer4, 1, 1); /* note: only reading first byte */
   wht_printf_scaled_bidir(&wht, 3, &wht2, 0, stdout);
+  printf("\n");
+
+  for (i=0; i<sizeof(data); i++) {
+    data[i] = rand();
+  }
+  for (len=0; len<=WHT_TEST_LEN; len++) {
+    for (offset=0; offset<32; offset += 5) {
+      wht_init(&ref);
+      for (i=0; i + 4 <= len; i += 4) {
+	wht_process_four_bytes(&ref, data + offset + i);
+      }
+      if (i < len) {
+	uint8_t pad[4] = { 0, 0, 0, 0 };
+	memcpy(pad, data + offset + i, len - i);
+	wht_process_four_bytes(&ref, pad);
+      }
+      for (k=0; k<NUM_WHT_KERNELS; k++) {
+	if (wht_kernels[k].isa > cpu_isa_get()) {
+	  continue;
+	}
+	wht_init(&wht);
+	wht_update_isa(&wht, data + offset, len, wht_kernels[k].isa);
+	if (memcmp(&wht, &ref, sizeof(wht)) != 0) {
+	  printf("error: %s wht of %u bytes does not match\n", wht_kernels[k].name, len);
+	  num_fails++;
+	}
+      }
+    }
+  }
 
-} 
+  big = malloc(big_len);
+  if (big != NULL) {
+    memset(big, 0xff, big_len);
+    for (i=0; i<big_len; i += 4) {
+      big[i] = 0;
+    }
+    for (k=0; k<NUM_WHT_KERNELS; k++) {
+      if (wht_kernels[k].isa > cpu_isa_get()) {
+	continue;
+      }
+      wht_init(&wht);
+      wht_update_isa(&wht, big, big_len, wht_kernels[k].isa);
+      if (wht.spectrum[0] != (int64_t)255 * 3 * (big_len / 4) || wht.spectrum[1] != -wht.spectrum[0] / 3
+	  || wht.spectrum[2] != -wht.spectrum[0] / 3 || wht.spectrum[3] != -wht.spectrum[0] / 3) {
+	printf("error: %s wht of %u bytes overflows\n", wht_kernels[k].name, big_len);
+	num_fails++;
+      }
+    }
+    free(big);
+  }
+
+  wht_benchmark();
+
+  return num_fails ? failure : ok;
+}
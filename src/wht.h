@@ -44,10 +44,15 @@
 #ifndef WHT_H
 #define WHT_H
 
-#include <stdio.h>   /* for FILE* */
+#include <stdio.h>   /* for FILE*    */
+#include <stdint.h>  /* for int64_t  */
 
+/*
+ * the spectrum is accumulated over all of the payloads of a flow, in
+ * 64-bit sums that cannot overflow
+ */
 struct wht {
-  int32_t spectrum[4];
+  int64_t spectrum[4];
 };
 
 inline void wht_init(struct wht *wht);
@@ -63,6 +68,6 @@ void wht_printf_scaled_bidir(const struct wht *w1, unsigned int b1,
 			     FILE *f);
 
 
-void wht_unit_test();
+int wht_unit_test();
   
 #endif /* WHT_H */